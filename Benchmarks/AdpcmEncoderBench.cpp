@@ -0,0 +1,186 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Benchmark comparing the quality (SNR) and throughput of the PSX ADPCM encoder modes.
+//
+// Usage: AdpcmEncoderBench [file1.vag file2.vag ...]
+//
+// If .vag files are given then they are decoded and used as the test material, otherwise a set of synthetic test signals is used.
+// Each sound is encoded with every encoder configuration, decoded again and compared against the original PCM.
+// Build with any C++17 compiler along with 'VagUtils.cpp', 'AdpcmDecoder.cpp', 'FileUtils.cpp' and 'FatalErrors.cpp' from PluginsCommon.
+//
+// Results on the synthetic set, which the 'High' quality beam width limit and default are based on (average SNR, samples/sec):
+//  fast            34.69 dB    4.7M
+//  high, beam 1    39.41 dB    540k
+//  high, beam 2    39.70 dB    406k
+//  high, beam 4    39.82 dB    274k
+//  high, beam 6    39.81 dB    209k    (before the width was limited to 4)
+//  high, beam 8    39.81 dB    144k    (before the width was limited to 4)
+// Every sound improved with each step in width up to 4, but not beyond that.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "VagUtils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace AudioTools;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A sound to encode and an encoder configuration to test with
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct TestSound {
+    std::string             name;
+    std::vector<int16_t>    samples;
+};
+
+struct EncoderConfig {
+    const char*                 name;
+    VagUtils::EncodeOptions     options;
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Makes some synthetic test sounds, each 5 seconds long at 44.1 KHz
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<TestSound> makeSyntheticSounds() noexcept {
+    constexpr uint32_t NUM_SAMPLES = 44100 * 5;
+    constexpr double PI = 3.14159265358979323846;
+
+    std::vector<TestSound> sounds;
+    std::mt19937 rng(12345);
+    std::normal_distribution<double> noise(0.0, 1.0);
+
+    const auto addSound = [&](const char* const name, const auto& getSample) {
+        TestSound& sound = sounds.emplace_back();
+        sound.name = name;
+        sound.samples.resize(NUM_SAMPLES);
+
+        for (uint32_t i = 0; i < NUM_SAMPLES; ++i) {
+            const double t = (double) i / 44100.0;
+            sound.samples[i] = (int16_t) std::clamp(std::round(getSample(t) * 32767.0), -32768.0, 32767.0);
+        }
+    };
+
+    addSound("sine 440 Hz", [&](const double t) { return 0.5 * std::sin(2.0 * PI * 440.0 * t); });
+    addSound("sine sweep", [&](const double t) { return 0.7 * std::sin(2.0 * PI * (50.0 * t + 1000.0 * t * t)); });
+    addSound("chord + vibrato", [&](const double t) {
+        const double vibrato = 1.0 + 0.005 * std::sin(2.0 * PI * 5.0 * t);
+        return 0.25 * (std::sin(2.0 * PI * 261.6 * vibrato * t) + std::sin(2.0 * PI * 329.6 * vibrato * t) + std::sin(2.0 * PI * 392.0 * vibrato * t));
+    });
+    addSound("plucks", [&](const double t) {
+        const double noteT = std::fmod(t, 0.25);
+        const double freq = 110.0 * std::pow(2.0, (double)((int)(t * 4.0) % 12) / 12.0);
+        return 0.8 * std::exp(-noteT * 12.0) * (std::sin(2.0 * PI * freq * t) + 0.3 * std::sin(2.0 * PI * freq * 3.0 * t));
+    });
+    addSound("drums + noise", [&](const double t) {
+        const double beatT = std::fmod(t, 0.5);
+        return 0.9 * std::exp(-beatT * 30.0) * std::sin(2.0 * PI * 60.0 * beatT) + 0.1 * std::exp(-beatT * 8.0) * noise(rng);
+    });
+    addSound("white noise", [&](const double) { return 0.25 * noise(rng); });
+
+    return sounds;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compute the signal to noise ratio in dB of the decoded sound versus the original
+//------------------------------------------------------------------------------------------------------------------------------------------
+static double computeSnr(const std::vector<int16_t>& original, const std::vector<int16_t>& decoded) noexcept {
+    double signalPower = 0.0;
+    double noisePower = 0.0;
+
+    for (size_t i = 0; i < original.size(); ++i) {
+        const double signal = original[i];
+        const double noise = signal - ((i < decoded.size()) ? decoded[i] : 0);
+        signalPower += signal * signal;
+        noisePower += noise * noise;
+    }
+
+    if (noisePower <= 0.0)
+        return INFINITY;
+
+    return 10.0 * std::log10(signalPower / noisePower);
+}
+
+int main(int argc, char* argv[]) {
+    // Get the sounds to test with
+    std::vector<TestSound> sounds;
+
+    for (int argIdx = 1; argIdx < argc; ++argIdx) {
+        std::vector<std::byte> adpcmData;
+        uint32_t sampleRate = 0;
+        std::string errorMsg;
+
+        if (!VagUtils::readVagFile(argv[argIdx], adpcmData, sampleRate, errorMsg)) {
+            std::printf("Failed to read '%s': %s\n", argv[argIdx], errorMsg.c_str());
+            return 1;
+        }
+
+        TestSound& sound = sounds.emplace_back();
+        sound.name = argv[argIdx];
+        uint32_t loopStartSampleIdx = 0;
+        uint32_t loopEndSampleIdx = 0;
+        VagUtils::decodePsxAdpcmSamples(adpcmData.data(), (uint32_t) adpcmData.size(), sound.samples, loopStartSampleIdx, loopEndSampleIdx);
+    }
+
+    if (sounds.empty()) {
+        sounds = makeSyntheticSounds();
+    }
+
+    // The encoder configurations to compare
+    std::vector<EncoderConfig> configs;
+    configs.push_back({ "fast", {} });
+
+    for (const uint32_t beamWidth : { 1u, 2u, 4u }) {
+        VagUtils::EncodeOptions options = {};
+        options.quality = VagUtils::EncodeQuality::High;
+        options.beamWidth = beamWidth;
+        configs.push_back({ (beamWidth == 1) ? "high, beam 1" : (beamWidth == 2) ? "high, beam 2" : "high, beam 4", options });
+    }
+
+    // Run all the tests
+    std::vector<double> totalSnrs(configs.size());
+    std::vector<double> totalSeconds(configs.size());
+    uint64_t totalSamples = 0;
+
+    std::printf("%-24s %-14s %10s %14s\n", "Sound", "Encoder", "SNR (dB)", "Samples/sec");
+
+    for (const TestSound& sound : sounds) {
+        for (size_t configIdx = 0; configIdx < configs.size(); ++configIdx) {
+            const EncoderConfig& config = configs[configIdx];
+            std::vector<std::byte> adpcmData;
+
+            const auto startTime = std::chrono::steady_clock::now();
+            VagUtils::encodePcmSoundToPsxAdpcm(sound.samples.data(), (uint32_t) sound.samples.size(), 0, 0, adpcmData, config.options);
+            const auto endTime = std::chrono::steady_clock::now();
+            const double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+            std::vector<int16_t> decodedSamples;
+            uint32_t loopStartSampleIdx = 0;
+            uint32_t loopEndSampleIdx = 0;
+            VagUtils::decodePsxAdpcmSamples(adpcmData.data(), (uint32_t) adpcmData.size(), decodedSamples, loopStartSampleIdx, loopEndSampleIdx);
+
+            const double snr = computeSnr(sound.samples, decodedSamples);
+            totalSnrs[configIdx] += snr;
+            totalSeconds[configIdx] += seconds;
+            std::printf("%-24s %-14s %10.2f %14.0f\n", sound.name.c_str(), config.name, snr, (double) sound.samples.size() / seconds);
+        }
+
+        totalSamples += sound.samples.size();
+    }
+
+    // Print a summary
+    std::printf("\n%-14s %14s %14s\n", "Encoder", "Avg SNR (dB)", "Samples/sec");
+
+    for (size_t configIdx = 0; configIdx < configs.size(); ++configIdx) {
+        std::printf(
+            "%-14s %14.2f %14.0f\n",
+            configs[configIdx].name,
+            totalSnrs[configIdx] / (double) sounds.size(),
+            (double) totalSamples / totalSeconds[configIdx]
+        );
+    }
+
+    return 0;
+}
@@ -0,0 +1,497 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Offline render benchmark for the SPU core.
+//
+// Usage: SpuRenderBench [-s seconds] [-r reverbMode] [-n numRuns] [-m float|16bit] [-e] [file.vag]
+//
+// Sets up the SPU the same way the PsxSampler instrument does and plays a scripted (but deterministic) sequence of notes, chords and pitch
+// bends through it, rendering the requested number of seconds of audio offline. The sample played is the given .vag file, or a synthetic
+// looped sound if none is given. Reverb is off by default like the sampler, but any of the 10 LIBSPU reverb modes can be enabled with '-r'.
+// With '-e' no notes are played and the SPU is used purely as a reverb effect like the PsxReverb plugin, with noise bursts as the input;
+// this measures the cost of reverb processing by itself.
+//
+// Reports throughput in samples per second and nanoseconds per voice sample, plus a hash of the output so that the results of different
+// builds can be checked against each other. When built with 'SIMPLE_SPU_PROFILE' it also reports how much time was spent in each stage
+// of SPU processing. Use '-m' to choose between the clean floating point (the default) and accurate 16-bit sample modes of the SPU.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "Spu.h"
+#include "VagUtils.h"
+#include "PsxReverb/SpuReverbPresets.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace AudioTools;
+
+static constexpr uint32_t   kSpuRamSize         = 512 * 1024;   // Same as the PsxSampler instrument
+static constexpr uint32_t   kSpuBlockCacheSize  = 2048;         // Same as the PsxSampler instrument
+static constexpr uint32_t   kNumVoices          = 24;           // Hardware voice limit of the PS1
+static constexpr uint32_t   kSampleRate         = 44100;        // Rate that the SPU outputs at
+static constexpr uint32_t   kBaseNote           = 60;           // Note which plays the sample at it's original sample rate
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// An event in the scripted note sequence
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct NoteEvent {
+    enum Type : uint8_t {
+        NoteOn,
+        NoteOff,
+        PitchBend
+    };
+
+    uint32_t    frame;          // Which frame the event happens on
+    Type        type;
+    uint8_t     note;           // Note to turn on or off
+    uint8_t     velocity;       // Velocity for a note on
+    float       bendInNotes;    // Pitch bend amount in semitones
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Results from a single run of the benchmark
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct RunResult {
+    double      seconds;            // Time taken to render
+    uint64_t    numVoiceFrames;     // Number of frames rendered by playing voices (approximate: counted at event boundaries)
+    uint64_t    outputHash;         // Hash of all of the output samples
+#if SIMPLE_SPU_PROFILE
+    Spu::ProfileStats profileStats;
+#endif
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Makes a synthetic 1 second sound to play if no .vag file is given: a decaying sawtooth-like tone with a looped sustain portion.
+// Returns the encoded ADPCM data.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::byte> makeSyntheticSound(uint32_t& sampleRateOut) noexcept {
+    constexpr uint32_t NUM_SAMPLES = 22050;
+    constexpr uint32_t LOOP_START = 11200;
+    constexpr double PI = 3.14159265358979323846;
+
+    std::vector<int16_t> samples(NUM_SAMPLES);
+
+    for (uint32_t i = 0; i < NUM_SAMPLES; ++i) {
+        const double t = (double) i / 22050.0;
+        const double env = (i < LOOP_START) ? 0.4 + 0.6 * std::exp(-t * 6.0) : 0.4 + 0.6 * std::exp(-(double) LOOP_START / 22050.0 * 6.0);
+        double value = 0.0;
+
+        for (int harmonic = 1; harmonic <= 8; ++harmonic) {
+            value += std::sin(2.0 * PI * 220.0 * harmonic * t) / harmonic;
+        }
+
+        samples[i] = (int16_t) std::clamp(std::round(value * env * 0.45 * 32767.0), -32768.0, 32767.0);
+    }
+
+    std::vector<std::byte> adpcmData;
+    VagUtils::encodePcmSoundToPsxAdpcm(samples.data(), NUM_SAMPLES, LOOP_START, NUM_SAMPLES, adpcmData);
+    sampleRateOut = 22050;
+    return adpcmData;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Makes the scripted sequence of notes to play: a mix of chords, fast runs and pitch bends which regularly uses all of the voices
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<NoteEvent> makeNoteSequence(const uint32_t numFrames) noexcept {
+    std::vector<NoteEvent> events;
+    std::mt19937 rng(1234);
+
+    const auto randInt = [&](const int32_t min, const int32_t max) noexcept {
+        return std::uniform_int_distribution<int32_t>(min, max)(rng);
+    };
+
+    const auto addNote = [&](const uint32_t frame, const uint8_t note, const uint32_t length) noexcept {
+        events.push_back({ frame, NoteEvent::NoteOn, note, (uint8_t) randInt(64, 127), 0.0f });
+        events.push_back({ frame + length, NoteEvent::NoteOff, note, 0, 0.0f });
+    };
+
+    for (uint32_t frame = 0; frame < numFrames; frame += kSampleRate / 8) {
+        switch (randInt(0, 3)) {
+            // Chord
+            case 0: {
+                const uint8_t rootNote = (uint8_t) randInt(36, 72);
+                const uint32_t length = (uint32_t) randInt(kSampleRate / 4, kSampleRate * 2);
+
+                for (const uint8_t interval : { 0, 4, 7, 12, 16, 19 }) {
+                    addNote(frame, rootNote + interval, length);
+                }
+            }   break;
+
+            // Fast run of notes
+            case 1: {
+                for (uint32_t i = 0; i < 8; ++i) {
+                    addNote(frame + i * (kSampleRate / 64), (uint8_t) randInt(48, 96), kSampleRate / 2);
+                }
+            }   break;
+
+            // Pitch bend sweep
+            case 2: {
+                for (uint32_t i = 0; i < 32; ++i) {
+                    const float bend = std::sin((float) i / 32.0f * 6.2831853f) * 2.0f;
+                    events.push_back({ frame + i * (kSampleRate / 256), NoteEvent::PitchBend, 0, 0, bend });
+                }
+            }   break;
+
+            // A single long note
+            default: {
+                addNote(frame, (uint8_t) randInt(24, 108), (uint32_t) randInt(kSampleRate / 8, kSampleRate * 4));
+            }   break;
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const NoteEvent& e1, const NoteEvent& e2) noexcept { return e1.frame < e2.frame; });
+    return events;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Input for the effect only mode: short bursts of noise every quarter of a second, with silence in between for the reverb tail
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static std::vector<Spu::BasicStereoSample<Sample>> makeNoiseBurstInput(const uint32_t numFrames) noexcept {
+    std::vector<Spu::BasicStereoSample<Sample>> input(numFrames);
+    uint32_t rngState = 1234;
+
+    const auto nextNoise = [&]() noexcept {
+        rngState = rngState * 1664525u + 1013904223u;
+        return (int16_t)(rngState >> 17) - (int16_t) 0x4000;
+    };
+
+    for (uint32_t frameIdx = 0; frameIdx < numFrames; ++frameIdx) {
+        const uint32_t burstFrameIdx = frameIdx % (kSampleRate / 4);
+
+        if (burstFrameIdx < kSampleRate / 40) {
+            input[frameIdx].left = (int16_t) nextNoise();
+            input[frameIdx].right = (int16_t) nextNoise();
+        }
+    }
+
+    return input;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the SPU pitch for a note, given the sample rate of the sound at the base note
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint16_t getNoteSpuPitch(const float note, const uint32_t soundSampleRate) noexcept {
+    const double sampleRate = (double) soundSampleRate * std::pow(2.0, ((double) note - (double) kBaseNote) / 12.0);
+    return (uint16_t) std::clamp(std::round(sampleRate / 44100.0 * 4096.0), 0.0, 65535.0);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Setup the SPU the same way as the PsxSampler instrument, with the given sound loaded and optionally with reverb
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void setupSpu(
+    Spu::Core& spu,
+    const std::vector<std::byte>& adpcmData,
+    const Spu::SampleMode sampleMode,
+    const int32_t reverbMode,
+    const bool bEffectOnly
+) noexcept {
+    Spu::initCore(spu, kSpuRamSize, kNumVoices, sampleMode);
+    Spu::enableBlockCache(spu, kSpuBlockCacheSize);
+
+    spu.masterVol = { 0x3FFF, 0x3FFF };
+    spu.extInputVol = {};
+    spu.bUnmute = true;
+    spu.bExtEnabled = false;
+    spu.bExtReverbEnable = false;
+    spu.pExtInputCallback = nullptr;
+    spu.pExtInputUserData = nullptr;
+    spu.cycleCount = 0;
+    spu.reverbCurAddr = 0;
+    spu.processedReverb = {};
+
+    if (reverbMode > 0) {
+        static_assert(sizeof(Spu::ReverbRegs) == sizeof(SpuReverbPresets::SpuReverbDef));
+        std::memcpy(&spu.reverbRegs, &SpuReverbPresets::gReverbDefs[reverbMode], sizeof(Spu::ReverbRegs));
+        spu.reverbVol = { 0x2FFF, 0x2FFF };
+        spu.bReverbWriteEnable = true;
+        spu.reverbBaseAddr8 = SpuReverbPresets::gReverbWorkAreaBaseAddrs[reverbMode];
+    } else {
+        spu.reverbRegs = {};
+        spu.reverbVol = {};
+        spu.bReverbWriteEnable = false;
+        spu.reverbBaseAddr8 = (kSpuRamSize / 8) - 1;
+    }
+
+    // In effect only mode all of the input is treated as external input, like the PsxReverb plugin
+    if (bEffectOnly) {
+        spu.extInputVol = { 0x3FFF, 0x3FFF };
+        spu.bExtEnabled = true;
+        spu.bExtReverbEnable = true;
+    }
+
+    // Copy in the sound (which must not overlap the reverb work area) and terminate it with 2 silent looping blocks like the sampler does
+    const uint32_t maxSoundSize = std::min(spu.reverbBaseAddr8 * 8, kSpuRamSize) - Spu::ADPCM_BLOCK_SIZE * 2;
+    const uint32_t soundSize = std::min((uint32_t) adpcmData.size(), maxSoundSize) & ~(Spu::ADPCM_BLOCK_SIZE - 1);
+    std::memcpy(spu.pRam, adpcmData.data(), soundSize);
+    std::memset(spu.pRam + soundSize, 0, Spu::ADPCM_BLOCK_SIZE * 2);
+    spu.pRam[soundSize + 1] = (std::byte) Spu::ADPCM_FLAG_LOOP_START;
+    spu.pRam[soundSize + 17] = (std::byte) Spu::ADPCM_FLAG_LOOP_END;
+    Spu::invalidateBlockCache(spu);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Render the note sequence once and time it
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static RunResult doRun(
+    const std::vector<std::byte>& adpcmData,
+    const uint32_t soundSampleRate,
+    const std::vector<NoteEvent>& events,
+    const uint32_t numFrames,
+    const int32_t reverbMode,
+    const bool bEffectOnly
+) noexcept {
+    typedef Spu::BasicStereoSample<Sample> StereoSample;
+
+    Spu::Core spu = {};
+    setupSpu(spu, adpcmData, Sample::MODE, reverbMode, bEffectOnly);
+    const std::vector<StereoSample> effectInput = (bEffectOnly) ? makeNoiseBurstInput<Sample>(numFrames) : std::vector<StereoSample>();
+
+    // Voice allocation state, like the PsxSampler instrument: use a free voice if there is one, otherwise the oldest
+    uint8_t voiceNotes[kNumVoices] = {};
+    uint8_t voiceVelocities[kNumVoices] = {};
+    uint32_t voiceStartFrames[kNumVoices] = {};
+    float bendInNotes = 0.0f;
+
+    Spu::AdsrEnvelope adsrEnv = {};
+    adsrEnv.attackStep = 3;
+    adsrEnv.attackShift = 10;
+    adsrEnv.decayShift = 6;
+    adsrEnv.sustainLevel = 10;
+    adsrEnv.sustainStep = 3;
+    adsrEnv.sustainShift = 20;
+    adsrEnv.bSustainDec = 1;
+    adsrEnv.bSustainExp = 1;
+    adsrEnv.releaseShift = 12;
+    adsrEnv.bReleaseExp = 1;
+
+    const auto handleEvent = [&](const NoteEvent& event) noexcept {
+        if (event.type == NoteEvent::NoteOn) {
+            uint32_t voiceIdx = 0;
+
+            for (uint32_t i = 0; i < kNumVoices; ++i) {
+                if (spu.pVoices[i].envPhase == Spu::EnvPhase::Off) {
+                    voiceIdx = i;
+                    break;
+                }
+
+                if (voiceStartFrames[i] < voiceStartFrames[voiceIdx]) {
+                    voiceIdx = i;
+                }
+            }
+
+            Spu::Voice& voice = spu.pVoices[voiceIdx];
+            const int16_t volume = (int16_t)(0x3FFF * event.velocity / 127);
+            voice.sampleRate = getNoteSpuPitch((float) event.note + bendInNotes, soundSampleRate);
+            voice.adpcmStartAddr8 = 0;
+            voice.bDisabled = false;
+            voice.bDoReverb = (reverbMode > 0);
+            voice.env = adsrEnv;
+            voice.volume = { volume, (int16_t)(volume - (event.note % 8) * 0x200) };
+            Spu::keyOn(voice);
+
+            voiceNotes[voiceIdx] = event.note;
+            voiceVelocities[voiceIdx] = event.velocity;
+            voiceStartFrames[voiceIdx] = event.frame;
+        }
+        else if (event.type == NoteEvent::NoteOff) {
+            for (uint32_t i = 0; i < kNumVoices; ++i) {
+                Spu::Voice& voice = spu.pVoices[i];
+
+                if ((voiceNotes[i] == event.note) && (voice.envPhase != Spu::EnvPhase::Off) && (voice.envPhase != Spu::EnvPhase::Release)) {
+                    Spu::keyOff(voice);
+                }
+            }
+        }
+        else {
+            bendInNotes = event.bendInNotes;
+
+            for (uint32_t i = 0; i < kNumVoices; ++i) {
+                Spu::Voice& voice = spu.pVoices[i];
+
+                if (voice.envPhase != Spu::EnvPhase::Off) {
+                    voice.sampleRate = getNoteSpuPitch((float) voiceNotes[i] + bendInNotes, soundSampleRate);
+                }
+            }
+        }
+    };
+
+    // Render the sequence in the same way as the sampler does: split at each event and render the spans in between in one go
+    std::vector<StereoSample> output(numFrames);
+    RunResult result = {};
+
+    #if SIMPLE_SPU_PROFILE
+        Spu::getProfileStats() = {};
+    #endif
+
+    const auto startTime = std::chrono::steady_clock::now();
+    size_t eventIdx = 0;
+
+    for (uint32_t frameIdx = 0; frameIdx < numFrames;) {
+        while ((eventIdx < events.size()) && (events[eventIdx].frame <= frameIdx)) {
+            handleEvent(events[eventIdx]);
+            eventIdx++;
+        }
+
+        const uint32_t spanEndFrameIdx = (eventIdx < events.size()) ? std::min(events[eventIdx].frame, numFrames) : numFrames;
+        const uint32_t numSpanFrames = spanEndFrameIdx - frameIdx;
+        uint32_t numActiveVoices = 0;
+
+        for (uint32_t i = 0; i < kNumVoices; ++i) {
+            numActiveVoices += (spu.pVoices[i].envPhase != Spu::EnvPhase::Off) ? 1 : 0;
+        }
+
+        if (bEffectOnly) {
+            Spu::renderReverbEffect(spu, effectInput.data() + frameIdx, output.data() + frameIdx, numSpanFrames);
+        } else {
+            Spu::renderCore(spu, output.data() + frameIdx, numSpanFrames);
+        }
+
+        result.numVoiceFrames += (uint64_t) numActiveVoices * numSpanFrames;
+        frameIdx = spanEndFrameIdx;
+    }
+
+    const auto endTime = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    #if SIMPLE_SPU_PROFILE
+        result.profileStats = Spu::getProfileStats();
+        result.numVoiceFrames = result.profileStats.numVoiceFrames;
+    #endif
+
+    // Hash the output (FNV-1a) so the output of different builds can be compared
+    result.outputHash = 0xCBF29CE484222325ull;
+
+    for (const StereoSample& sample : output) {
+        const auto hashBytes = [&](const auto& value) noexcept {
+            const uint8_t* const pBytes = (const uint8_t*) &value;
+
+            for (size_t i = 0; i < sizeof(value); ++i) {
+                result.outputHash = (result.outputHash ^ pBytes[i]) * 0x100000001B3ull;
+            }
+        };
+
+        hashBytes(sample.left.value);
+        hashBytes(sample.right.value);
+    }
+
+    Spu::destroyCore(spu);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse command line arguments
+    double numSeconds = 60.0;
+    int32_t reverbMode = 0;
+    uint32_t numRuns = 3;
+    Spu::SampleMode sampleMode = Spu::SampleMode::Float;
+    bool bEffectOnly = false;
+    const char* vagFilePath = nullptr;
+
+    for (int argIdx = 1; argIdx < argc; ++argIdx) {
+        const std::string arg = argv[argIdx];
+        const bool bHasValue = (argIdx + 1 < argc);
+
+        if ((arg == "-s") && bHasValue) {
+            numSeconds = std::max(std::atof(argv[++argIdx]), 0.1);
+        } else if ((arg == "-r") && bHasValue) {
+            reverbMode = std::clamp(std::atoi(argv[++argIdx]), 0, (int) SpuReverbPresets::SPU_REV_MODE_MAX - 1);
+        } else if ((arg == "-n") && bHasValue) {
+            numRuns = (uint32_t) std::max(std::atoi(argv[++argIdx]), 1);
+        } else if ((arg == "-m") && bHasValue && (std::string(argv[argIdx + 1]) == "float")) {
+            sampleMode = Spu::SampleMode::Float;
+            argIdx++;
+        } else if ((arg == "-m") && bHasValue && (std::string(argv[argIdx + 1]) == "16bit")) {
+            sampleMode = Spu::SampleMode::Int16;
+            argIdx++;
+        } else if (arg == "-e") {
+            bEffectOnly = true;
+        } else if (arg[0] != '-') {
+            vagFilePath = argv[argIdx];
+        } else {
+            std::printf("Usage: SpuRenderBench [-s seconds] [-r reverbMode 0-9] [-n numRuns] [-m float|16bit] [-e] [file.vag]\n");
+            return 1;
+        }
+    }
+
+    // Get the sound to play
+    std::vector<std::byte> adpcmData;
+    uint32_t soundSampleRate = 0;
+
+    if (vagFilePath) {
+        std::string errorMsg;
+
+        if (!VagUtils::readVagFile(vagFilePath, adpcmData, soundSampleRate, errorMsg)) {
+            std::printf("Failed to read '%s': %s\n", vagFilePath, errorMsg.c_str());
+            return 1;
+        }
+    } else {
+        adpcmData = makeSyntheticSound(soundSampleRate);
+    }
+
+    // Do all of the runs and keep the fastest
+    const uint32_t numFrames = (uint32_t)(numSeconds * kSampleRate);
+    const std::vector<NoteEvent> events = (bEffectOnly) ? std::vector<NoteEvent>() : makeNoteSequence(numFrames);
+    RunResult bestResult = {};
+
+    for (uint32_t runIdx = 0; runIdx < numRuns; ++runIdx) {
+        const RunResult result = (sampleMode == Spu::SampleMode::Float) ?
+            doRun<Spu::FloatSample>(adpcmData, soundSampleRate, events, numFrames, reverbMode, bEffectOnly) :
+            doRun<Spu::Int16Sample>(adpcmData, soundSampleRate, events, numFrames, reverbMode, bEffectOnly);
+
+        if ((runIdx > 0) && (result.outputHash != bestResult.outputHash)) {
+            std::printf("Error: output differs between runs!\n");
+            return 1;
+        }
+
+        if ((runIdx == 0) || (result.seconds < bestResult.seconds)) {
+            bestResult = result;
+        }
+    }
+
+    // Print the results
+    const double samplesPerSec = (double) numFrames / bestResult.seconds;
+    const double nsPerVoiceSample = (bestResult.numVoiceFrames > 0) ? bestResult.seconds * 1e9 / (double) bestResult.numVoiceFrames : 0.0;
+
+    std::printf("SPU:                    %s%s\n", (sampleMode == Spu::SampleMode::Float) ? "float" : "16-bit", (SIMPLE_SPU_PROFILE) ? " (profiling)" : "");
+    std::printf("Sound:                  %s\n", (bEffectOnly) ? "none (effect only)" : ((vagFilePath) ? vagFilePath : "synthetic"));
+    std::printf("Reverb:                 %s\n", SpuReverbPresets::gReverbModeNames[reverbMode]);
+    std::printf("Rendered:               %.1f seconds, %u events, best of %u runs\n", numSeconds, (unsigned) events.size(), numRuns);
+    std::printf("Time:                   %.3f seconds (%.1fx realtime)\n", bestResult.seconds, numSeconds / bestResult.seconds);
+    std::printf("Samples/sec:            %.0f\n", samplesPerSec);
+    std::printf("Avg active voices:      %.2f\n", (double) bestResult.numVoiceFrames / (double) numFrames);
+    std::printf("ns per voice sample:    %.2f\n", nsPerVoiceSample);
+    std::printf("Output hash:            %016llx\n", (unsigned long long) bestResult.outputHash);
+
+    #if SIMPLE_SPU_PROFILE
+    {
+        const Spu::ProfileStats& stats = bestResult.profileStats;
+        const double totalNs = bestResult.seconds * 1e9;
+        const double voiceFrames = (double) std::max<uint64_t>(stats.numVoiceFrames, 1);
+
+        const auto printStage = [&](const char* const name, const uint64_t stageNs) noexcept {
+            std::printf(
+                "  %-20s %10.3f ms %6.1f%% %8.2f ns/voice sample\n",
+                name,
+                (double) stageNs / 1e6,
+                (double) stageNs / totalNs * 100.0,
+                (double) stageNs / voiceFrames
+            );
+        };
+
+        std::printf("\nStage timings (include timer overhead):\n");
+        printStage("Decode", stats.decodeNs);
+        printStage("Envelope", stats.envelopeNs);
+        printStage("Interpolation", stats.interpolationNs);
+        printStage("Reverb + mix", stats.reverbNs);
+        std::printf("  %-20s %10llu\n", "Blocks decoded", (unsigned long long) stats.numBlocksDecoded);
+    }
+    #endif
+
+    return 0;
+}
@@ -4,8 +4,16 @@
 #include "IPlug_include_in_plug_src.h"
 #include "SpuReverbPresets.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 static constexpr int        kNumPresets = 10;           // How many reverb presets there are
 static constexpr uint32_t   kSpuRamSize = 512 * 1024;   // SPU RAM size: this is the size that the PS1 had
+static constexpr uint32_t   kMaxResampleFrames = 256;   // Maximum number of frames to convert to and from the host sample rate at a time
+static constexpr uint32_t   kSampleModeStateTag = 0x444D5053u;  // 'SPMD': marks the SPU sample mode in the saved state, after the parameters
+static constexpr double     kMaxTailSecs = 600.0;       // Longest reverb tail reported to the host: any longer (e.g 'Echo') and the tail is reported as infinite where possible
+static constexpr double     kTailFloor = 1.0 / 65536.0; // Level at which the reverb tail is considered to have died away: the quietest level 16-bit output can hold
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Initializes the reverb plugin
@@ -15,7 +23,13 @@ PsxReverb::PsxReverb(const InstanceInfo& info) noexcept
 #if IPLUG_DSP
     , mSpu()
     , mSpuMutex()
-    , mSpuInputSample()
+    , mInputResampler()
+    , mOutputResampler()
+    , mHostInput()
+    , mSpuInput()
+    , mNumSpuInputFrames(0)
+    , mSpuOutput()
+    , mResampledOutput()
 #endif
 {
     DefinePluginParams();
@@ -35,44 +49,147 @@ PsxReverb::PsxReverb(const InstanceInfo& info) noexcept
 //------------------------------------------------------------------------------------------------------------------------------------------
 PsxReverb::~PsxReverb() noexcept {
     Spu::destroyCore(mSpu);
-    mSpuInputSample = {};
+    Resampler::destroyStream(mInputResampler);
+    Resampler::destroyStream(mOutputResampler);
 }
 
 #if IPLUG_DSP
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Does the work of the reverb effect plugin
+// Tells if the given buffer of samples is entirely silent
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool IsSilent(const float* const pSamples, const uint32_t numSamples) noexcept {
+    return std::all_of(pSamples, pSamples + numSamples, [](const float sample) noexcept { return (sample == 0.0f); });
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Does the work of the reverb effect plugin.
+// The SPU always runs at 44.1 KHz internally so that it behaves exactly as the original hardware did, so the input is converted to that rate
+// and the output converted back to the host rate. If the host is also running at 44.1 KHz then samples are passed through untouched.
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxReverb::ProcessBlock(sample** pInputs, sample** pOutputs, int numFrames) noexcept {
     std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-
-    // Process the requested number of samples
     const int numChannels = NOutChansConnected();
-    
-    for (int frameIdx = 0; frameIdx < numFrames; frameIdx++) {
-        // Setup the SPU input sample
-        if (numChannels >= 2) {
-            mSpuInputSample.left = (float) pInputs[0][frameIdx];
-            mSpuInputSample.right = (float) pInputs[1][frameIdx];
-        } else if (numChannels == 1) {
-            mSpuInputSample.left = (float) pInputs[0][frameIdx];
-            mSpuInputSample.right = (float) pInputs[0][frameIdx];
-        } else {
-            mSpuInputSample = {};
+    const uint32_t numSpuOutputs = (uint32_t) std::clamp(numChannels, 0, 2);
+
+    float* const hostInput[2] = { mHostInput[0].data(), mHostInput[1].data() };
+    float* const spuInput[2] = { mSpuInput[0].data(), mSpuInput[1].data() };
+    float* const spuOutput[2] = { mSpuOutput[0].data(), mSpuOutput[1].data() };
+    float* const resampledOutput[2] = { mResampledOutput[0].data(), mResampledOutput[1].data() };
+
+    for (uint32_t chunkStartIdx = 0; chunkStartIdx < (uint32_t) numFrames;) {
+        const uint32_t chunkSize = std::min((uint32_t) numFrames - chunkStartIdx, kMaxResampleFrames);
+
+        // Convert this chunk of input to 44.1 KHz and queue it up for the SPU: mono input is fed to both channels
+        for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+            if (numChannels > 0) {
+                const sample* const pInput = pInputs[std::min((int) chanIdx, numChannels - 1)] + chunkStartIdx;
+
+                for (uint32_t frameIdx = 0; frameIdx < chunkSize; ++frameIdx) {
+                    hostInput[chanIdx][frameIdx] = (float) pInput[frameIdx];
+                }
+            } else {
+                std::fill_n(hostInput[chanIdx], chunkSize, 0.0f);
+            }
+        }
+
+        // If there is no input and nothing still to come out of the resamplers or the SPU then the output is silent: skip all the work.
+        // Nothing is consumed or produced when skipping, so everything carries on from exactly where it left off once there is input again.
+        const bool bSilent = (
+            IsSilent(hostInput[0], chunkSize) &&
+            IsSilent(hostInput[1], chunkSize) &&
+            Resampler::isSilent(mInputResampler) &&
+            IsSilent(spuInput[0], mNumSpuInputFrames) &&
+            IsSilent(spuInput[1], mNumSpuInputFrames) &&
+            Spu::isReverbSilent(mSpu) &&
+            Resampler::isSilent(mOutputResampler)
+        );
+
+        if (bSilent) {
+            for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+                std::fill_n(pOutputs[chanIdx] + chunkStartIdx, chunkSize, (sample) 0);
+            }
+
+            chunkStartIdx += chunkSize;
+            continue;
         }
 
-        // Run the SPU and grab the output sample and save
-        const Spu::StereoSample soundOut = Spu::stepCore(mSpu);
+        Resampler::pushInput(mInputResampler, hostInput[0], hostInput[1], chunkSize);
+        const uint32_t numNewSpuInputFrames = Resampler::getNumOutputFramesAvailable(mInputResampler);
+        Resampler::pullOutput(mInputResampler, spuInput[0] + mNumSpuInputFrames, spuInput[1] + mNumSpuInputFrames, numNewSpuInputFrames);
+        mNumSpuInputFrames += numNewSpuInputFrames;
+
+        // Run the SPU for however many of it's own frames are needed to produce this chunk of output at the host sample rate.
+        // The input queue starts out with enough silence that it should never run dry, but pad it with more silence just in case.
+        const uint32_t numSpuFrames = Resampler::getNumInputFramesNeeded(mOutputResampler, chunkSize);
 
-        if (numChannels >= 2) {
-            pOutputs[0][frameIdx] = soundOut.left;
-            pOutputs[1][frameIdx] = soundOut.right;
-        } else if (numChannels == 1) {
-            pOutputs[0][frameIdx] = soundOut.left;
+        if (mNumSpuInputFrames < numSpuFrames) {
+            std::fill(spuInput[0] + mNumSpuInputFrames, spuInput[0] + numSpuFrames, 0.0f);
+            std::fill(spuInput[1] + mNumSpuInputFrames, spuInput[1] + numSpuFrames, 0.0f);
+            mNumSpuInputFrames = numSpuFrames;
         }
+
+        Spu::renderReverbEffect(mSpu, spuInput, spuOutput, 2, numSpuFrames);
+
+        // Remove the input consumed by the SPU from the queue
+        mNumSpuInputFrames -= numSpuFrames;
+        std::copy_n(spuInput[0] + numSpuFrames, mNumSpuInputFrames, spuInput[0]);
+        std::copy_n(spuInput[1] + numSpuFrames, mNumSpuInputFrames, spuInput[1]);
+
+        // Convert the output back to the host sample rate
+        Resampler::pushInput(mOutputResampler, spuOutput[0], spuOutput[1], numSpuFrames);
+        Resampler::pullOutput(mOutputResampler, resampledOutput[0], resampledOutput[1], chunkSize);
+
+        for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+            std::copy_n(resampledOutput[chanIdx], chunkSize, pOutputs[chanIdx] + chunkStartIdx);
+        }
+
+        chunkStartIdx += chunkSize;
     }
 }
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Called when the host sample rate or block size changes, or playback is about to start
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxReverb::OnReset() noexcept {
+    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+    SetupResampling();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Serialize the plugin state: the SPU sample mode is saved after the parameters rather than as a parameter, so older states still load
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool PsxReverb::SerializeState(IByteChunk& chunk) const noexcept {
+    if (!SerializeParams(chunk))
+        return false;
+
+    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+    const uint32_t sampleModeTag = kSampleModeStateTag;
+    const uint32_t sampleMode = (uint32_t) mSpu.sampleMode;
+    chunk.Put(&sampleModeTag);
+    chunk.Put(&sampleMode);
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Deserialize the plugin state.
+// States saved before the sample mode could be chosen always used the floating point SPU, so default to that if it's missing.
+//------------------------------------------------------------------------------------------------------------------------------------------
+int PsxReverb::UnserializeState(const IByteChunk& chunk, int startPos) noexcept {
+    startPos = UnserializeParams(chunk, startPos);
+
+    uint32_t sampleModeTag = 0;
+    uint32_t sampleMode = (uint32_t) Spu::SampleMode::Float;
+    const int sampleModeTagEndPos = (startPos >= 0) ? chunk.Get(&sampleModeTag, startPos) : -1;
+
+    if ((sampleModeTagEndPos >= 0) && (sampleModeTag == kSampleModeStateTag)) {
+        startPos = chunk.Get(&sampleMode, sampleModeTagEndPos);
+    }
+
+    SetSampleMode((sampleMode == (uint32_t) Spu::SampleMode::Int16) ? Spu::SampleMode::Int16 : Spu::SampleMode::Float);
+    return startPos;
+}
+
 #endif  // #if IPLUG_DSP
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -233,6 +350,26 @@ void PsxReverb::DoEditorSetup() noexcept {
             )
         );
 
+        // Chooses between the accurate 16-bit and clean floating point sample modes of the SPU
+        IVTabSwitchControl* const pSampleModeSwitch = new IVTabSwitchControl(
+            IRECT(605, 5, 795, 70),
+            [this](IControl* const pCaller) noexcept {
+                const int selectedIdx = static_cast<IVTabSwitchControl*>(pCaller)->GetSelectedIdx();
+                SetSampleMode((selectedIdx == 0) ? Spu::SampleMode::Int16 : Spu::SampleMode::Float);
+            },
+            { "Accurate 16-bit", "Clean float" },
+            "",
+            DEFAULT_STYLE,
+            EVShape::Rectangle,
+            EDirection::Vertical
+        );
+
+        {
+            std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+            pSampleModeSwitch->SetValue((mSpu.sampleMode == Spu::SampleMode::Int16) ? 0.0 : 1.0);
+        }
+
+        pGraphics->AttachControl(pSampleModeSwitch, kCtrlTagSampleMode);
         pGraphics->AttachControl(new ITextControl(IRECT(0, 150, PLUG_WIDTH, 164), "- Advanced Settings -", DEFAULT_TEXT, COLOR_MID_GRAY));
 
         addHSlider(kWABaseAddr, "WA Base Addr",    10, 180, 130, 40);   addTInput(kWABaseAddr,  145, 200, 45, 20);
@@ -278,21 +415,12 @@ void PsxReverb::DoEditorSetup() noexcept {
 
 #if IPLUG_DSP
 
-//------------------------------------------------------------------------------------------------------------------------------------------
-// Called by the SPU emulation to retrieve an input sample.
-// Returns a sample that was passed as input to the reverb effect.
-//------------------------------------------------------------------------------------------------------------------------------------------
-Spu::StereoSample PsxReverb::SpuWantsASampleCallback(void* pUserData) noexcept {
-    PsxReverb& reverbPlugin = *(PsxReverb*) pUserData;
-    return reverbPlugin.mSpuInputSample;
-}
-
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Setup DSP related stuff
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxReverb::DoDspSetup() noexcept {
     // Create the PlayStation SPU core and do it with NO voices, since we are not playing any samples and just using the reverb FX...
-    Spu::initCore(mSpu, kSpuRamSize, 0);
+    Spu::initCore(mSpu, kSpuRamSize, 0, Spu::SampleMode::Float);
 
     // Set default volume levels
     mSpu.masterVol.left = 0x3FFF;
@@ -313,9 +441,41 @@ void PsxReverb::DoDspSetup() noexcept {
     mSpu.processedReverb = {};
     mSpu.reverbRegs = {};
 
-    // This is how we will feed samples into the SPU which were fed to the this plugin
-    mSpu.pExtInputCallback = SpuWantsASampleCallback;
-    mSpu.pExtInputUserData = this;
+    // Input is fed straight to the SPU when rendering the reverb effect, rather than being requested sample by sample
+    mSpu.pExtInputCallback = nullptr;
+    mSpu.pExtInputUserData = nullptr;
+    SetupResampling();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Setup conversion of the input to the SPU's native 44.1 KHz and of the output back to the host sample rate.
+// Also tells the host about the latency that adds, and how long the reverb tail can last after the input stops.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxReverb::SetupResampling() noexcept {
+    const double hostSampleRate = GetSampleRate();
+    const double spuFramesPerHostFrame = (double) Spu::OUTPUT_SAMPLE_RATE / hostSampleRate;
+
+    Resampler::destroyStream(mInputResampler);
+    Resampler::destroyStream(mOutputResampler);
+    Resampler::initStream(mInputResampler, hostSampleRate, Spu::OUTPUT_SAMPLE_RATE, kMaxResampleFrames, 0);
+    Resampler::initStream(mOutputResampler, Spu::OUTPUT_SAMPLE_RATE, hostSampleRate, 0, kMaxResampleFrames);
+
+    // The SPU has to run ahead of the input by however far both resamplers look ahead, so start the input queue off with that much silence.
+    // A couple of extra frames are needed because the SPU frames needed for each chunk of output can vary by a frame or so.
+    const double lookahead = Resampler::getLookahead(mOutputResampler) + Resampler::getLookahead(mInputResampler) * spuFramesPerHostFrame;
+    const uint32_t numPrimingFrames = (lookahead > 0.0) ? (uint32_t) std::ceil(lookahead) + 2 : 0;
+    const uint32_t maxSpuFrames = Resampler::getMaxInputFramesNeeded(mOutputResampler, kMaxResampleFrames);
+
+    for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+        mHostInput[chanIdx].assign(kMaxResampleFrames, 0.0f);
+        mSpuInput[chanIdx].assign(numPrimingFrames + maxSpuFrames * 2, 0.0f);
+        mSpuOutput[chanIdx].assign(maxSpuFrames, 0.0f);
+        mResampledOutput[chanIdx].assign(kMaxResampleFrames, 0.0f);
+    }
+
+    mNumSpuInputFrames = numPrimingFrames;
+    SetLatency((int) std::lround(numPrimingFrames / spuFramesPerHostFrame));
+    UpdateTailSize();
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -341,6 +501,17 @@ void PsxReverb::OnRestoreState() noexcept {
     std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
     UpdateSpuRegistersFromParams();
     ClearReverbWorkArea();
+
+    // Make sure the sample mode switch shows the restored mode, if the UI is open
+    #if IPLUG_EDITOR
+        IGraphics* const pGraphics = GetUI();
+        IControl* const pSampleModeSwitch = (pGraphics) ? pGraphics->GetControlWithTag(kCtrlTagSampleMode) : nullptr;
+
+        if (pSampleModeSwitch) {
+            pSampleModeSwitch->SetValue((mSpu.sampleMode == Spu::SampleMode::Int16) ? 0.0 : 1.0);
+            pSampleModeSwitch->SetDirty(false);
+        }
+    #endif
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -386,12 +557,115 @@ void PsxReverb::UpdateSpuRegistersFromParams() noexcept {
     mSpu.reverbRegs.addrRAPF2     = (uint16_t) GetParam(kAddrRAPF2)->Value();
     mSpu.reverbRegs.volLIn        = (int16_t) GetParam(kVolLIn)->Value();
     mSpu.reverbRegs.volRIn        = (int16_t) GetParam(kVolRIn)->Value();
+    UpdateTailSize();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Returns how many reverb updates ago the value read from one location in the reverb work area was written by another location.
+// Addresses are in the 8-byte units of the reverb registers and wrap around the work area, which is 'workAreaUpdates' 16-bit samples long.
+// Reads happen before writes, so a location reading itself gets the value written a full trip around the work area ago.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static double GetReverbTapDelay(const uint32_t writeAddr8, const uint32_t readAddr8, const uint32_t workAreaUpdates) noexcept {
+    if (workAreaUpdates == 0)
+        return 0.0;
+
+    const uint32_t writeOffset = (writeAddr8 * 4) % workAreaUpdates;
+    const uint32_t readOffset = (readAddr8 * 4) % workAreaUpdates;
+    const uint32_t delay = (writeOffset + workAreaUpdates - readOffset) % workAreaUpdates;
+    return (delay > 0) ? delay : workAreaUpdates;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Returns how many reverb updates it takes a feedback loop with the given gain and round trip delay to die away to the tail floor level.
+// Returns infinity if the loop never dies away.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static double GetFeedbackDecayUpdates(const double loopGain, const double loopDelay) noexcept {
+    if (loopGain <= 0.0)
+        return 0.0;
+
+    if (loopGain >= 1.0)
+        return std::numeric_limits<double>::infinity();
+
+    return loopDelay * std::log(kTailFloor) / std::log(loopGain);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells the host how long the reverb tail lasts after the input stops, working it out from the current reverb registers.
+// The output comes from taps anywhere in the work area, after going around the reflection and all pass filter feedback loops, so the tail
+// is one trip around the work area plus the time for each of those loops to die away. If that is longer than the host should wait for (or
+// the loops never die away) then the tail is reported as infinite for VST3, which supports that, and as the longest tail allowed otherwise.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxReverb::UpdateTailSize() noexcept {
+    const Spu::ReverbRegs& regs = mSpu.reverbRegs;
+    const bool bNoReverbOutput = ((mSpu.reverbVol.left == 0) && (mSpu.reverbVol.right == 0));
+    const bool bNoReverbInput = ((regs.volLIn == 0) && (regs.volRIn == 0));
+
+    if (bNoReverbOutput || bNoReverbInput) {
+        SetTailSize(0);
+        return;
+    }
+
+    const uint32_t workAreaStart = std::min<uint32_t>(mSpu.reverbBaseAddr8 * 8, mSpu.ramSize);
+    const uint32_t workAreaUpdates = (mSpu.ramSize - workAreaStart) / 2;
+
+    // Reflections feed back with the 'wall' volume on each trip, through a low pass IIR filter which passes DC at full volume but lengthens
+    // the trip by roughly (1 - volIIR) / volIIR updates. A negative 'volIIR' makes the filter unstable, and a zero one lets no input in.
+    const double volIIR = regs.volIIR / 32768.0;
+    double reflectionUpdates = 0.0;
+
+    if (volIIR < 0.0) {
+        reflectionUpdates = std::numeric_limits<double>::infinity();
+    } else if (volIIR > 0.0) {
+        const double sameSideDelay = std::max(
+            GetReverbTapDelay(regs.addrLSame1, regs.addrLSame2, workAreaUpdates),
+            GetReverbTapDelay(regs.addrRSame1, regs.addrRSame2, workAreaUpdates)
+        );
+
+        // Different side reflections go left to right and back again, so average the two trips
+        const double diffSideDelay = (
+            GetReverbTapDelay(regs.addrLDiff1, regs.addrRDiff2, workAreaUpdates) +
+            GetReverbTapDelay(regs.addrRDiff1, regs.addrLDiff2, workAreaUpdates)
+        ) * 0.5;
+
+        const double iirDelay = (1.0 - volIIR) / volIIR;
+        reflectionUpdates = GetFeedbackDecayUpdates(std::abs(regs.volWall / 32768.0), std::max(sameSideDelay, diffSideDelay) + iirDelay);
+    }
+
+    // The all pass filters feed back by their displacement, with their own volume
+    const double apf1Updates = GetFeedbackDecayUpdates(std::abs(regs.volAPF1 / 32768.0), GetReverbTapDelay(regs.dispAPF1, 0, workAreaUpdates));
+    const double apf2Updates = GetFeedbackDecayUpdates(std::abs(regs.volAPF2 / 32768.0), GetReverbTapDelay(regs.dispAPF2, 0, workAreaUpdates));
+
+    // Reverb updates once for every 2 SPU output samples
+    const double tailUpdates = workAreaUpdates + reflectionUpdates + apf1Updates + apf2Updates;
+    const double tailSecs = tailUpdates * 2.0 / Spu::OUTPUT_SAMPLE_RATE;
+
+    if (tailSecs <= kMaxTailSecs) {
+        SetTailSize((int) std::lround(tailSecs * GetSampleRate()));
+    } else {
+        #if defined VST3_API || defined VST3P_API
+            SetTailSize(-1);    // Reads as 0xFFFFFFFF through the VST3 interface, which means an infinite tail
+        #else
+            SetTailSize((int) std::lround(kMaxTailSecs * GetSampleRate()));
+        #endif
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Switch the SPU between accurate 16-bit and clean floating point processing.
+// The current reverb carries on in the new mode, since the SPU converts the work area over.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxReverb::SetSampleMode(const Spu::SampleMode sampleMode) noexcept {
+    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+    Spu::setSampleMode(mSpu, sampleMode);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Clears the work area for the current reverb effect, effectively silencing the current reverb
+// Clears the work area for the current reverb effect, effectively silencing the current reverb.
+// Clears the work area for both sample modes: in SPU RAM for 16-bit mode and in reverb RAM for floating point mode.
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxReverb::ClearReverbWorkArea() noexcept {
+    const uint32_t workAreaStart = std::min<uint32_t>(mSpu.reverbBaseAddr8 * 8, mSpu.ramSize);
+    std::memset(mSpu.pRam + workAreaStart, 0, mSpu.ramSize - workAreaStart);
     std::memset(mSpu.pReverbRam, 0, mSpu.numReverbRamSamples * sizeof(float));
 }
 
@@ -2,8 +2,10 @@
 
 #include "IPlug_include_in_plug_hdr.h"
 
+#include "../../PluginsCommon/Resampler.h"
 #include "../../PluginsCommon/Spu.h"
 #include <mutex>
+#include <vector>
 
 using namespace iplug;
 using namespace igraphics;
@@ -55,6 +57,14 @@ enum EParams : uint32_t {
     kNumParams
 };
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// UI control identifiers
+//------------------------------------------------------------------------------------------------------------------------------------------
+enum EControlTags : uint32_t {
+    kCtrlTagSampleMode = 0,
+    kNumCtrlTags
+};
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Logic for the PlayStation 1 reverb plugin
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -65,13 +75,22 @@ public:
 
     #if IPLUG_DSP
         void ProcessBlock(sample** pInputs, sample** pOutputs, int numFrames) noexcept override;
+        void OnReset() noexcept override;
+        bool SerializeState(IByteChunk& chunk) const noexcept override;
+        int UnserializeState(const IByteChunk& chunk, int startPos) noexcept override;
     #endif
 
 private:
     #if IPLUG_DSP
-        Spu::Core               mSpu;
-        std::recursive_mutex    mSpuMutex;
-        Spu::StereoSample       mSpuInputSample;
+        Spu::Core                       mSpu;
+        mutable std::recursive_mutex    mSpuMutex;
+        Resampler::Stream               mInputResampler;        // Converts input from the host sample rate to the SPU's native 44.1 KHz
+        Resampler::Stream               mOutputResampler;       // Converts the SPU output from 44.1 KHz back to the host sample rate
+        std::vector<float>              mHostInput[2];          // Left and right input at the host sample rate, waiting to be converted to 44.1 KHz
+        std::vector<float>              mSpuInput[2];           // Left and right input at 44.1 KHz, queued up to be fed to the SPU reverb effect
+        uint32_t                        mNumSpuInputFrames;     // How many frames of input are queued up for the SPU
+        std::vector<float>              mSpuOutput[2];          // Left and right SPU output waiting to be converted to the host sample rate
+        std::vector<float>              mResampledOutput[2];    // Left and right SPU output after being converted to the host sample rate
     #endif
 
     void DefinePluginParams() noexcept;
@@ -82,11 +101,13 @@ private:
     #endif
 
     #if IPLUG_DSP
-        static Spu::StereoSample SpuWantsASampleCallback(void* pUserData) noexcept;
         void DoDspSetup() noexcept;
+        void SetupResampling() noexcept;
         virtual void InformHostOfParamChange(int idx, double normalizedValue) noexcept override;
         virtual void OnRestoreState() noexcept override;
         void UpdateSpuRegistersFromParams() noexcept;
+        void UpdateTailSize() noexcept;
+        void SetSampleMode(const Spu::SampleMode sampleMode) noexcept;
         void ClearReverbWorkArea() noexcept;
     #endif
 };
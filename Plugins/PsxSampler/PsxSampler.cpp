@@ -3,20 +3,28 @@
 #include "../PluginsCommon/FileUtils.h"
 #include "../PluginsCommon/JsonUtils.h"
 #include "../PluginsCommon/VagUtils.h"
+#include "SamplerState.h"
 #include "IPlug_include_in_plug_src.h"
 
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cassert>
+#include <thread>
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
 
 using namespace AudioTools;
 
-static constexpr uint32_t   kSpuRamSize         = 512 * 1024;   // SPU RAM size: this is the size that the PS1 had
+static constexpr uint32_t   kSpuBlockCacheSize  = 2048;         // How many decoded ADPCM blocks the SPU can cache (besides the sample's shared pre-decoded blocks)
+static constexpr uint32_t   kSpuRamFadeFrames   = 256;          // How many frames to fade out playing voices over before swapping in a new sample
+static constexpr uint32_t   kMaxResampleFrames  = 256;          // Maximum number of frames to convert to the host sample rate at a time
 static constexpr int        kNumPresets         = 1;            // Not doing any actual presets for this instrument
 static constexpr int32_t    PITCH_BEND_CENTER   = 0x2000u;      // Pitch bend center value
 static constexpr int32_t    PITCH_BEND_MAX      = 0x3FFFu;      // Maximum pitch bend value
 
+static_assert(PsxSampler::kMaxZones == SamplerState::MAX_ZONES, "Must be able to save all the zones!");
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // --- COPIED FROM PSYDOOM ---
 // 
@@ -145,17 +153,54 @@ static double GetNoteSampleRate(const double baseNote, const double baseNoteSamp
     return sampleRate;
 }
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Points the given SPU core at the pre-decoded blocks of the sounds in the given SPU RAM image, for the core's sample mode
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void SetSpuPredecodedSounds(Spu::Core& spu, const SharedSampleStore::SharedSample& sample) noexcept {
+    const std::vector<Spu::PredecodedSound>& predecodedSounds = sample.getPredecodedSounds(spu.sampleMode);
+    spu.pPredecodedSounds = predecodedSounds.data();
+    spu.numPredecodedSounds = (uint32_t) predecodedSounds.size();
+}
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Initializes the sampler instrument plugin
 //------------------------------------------------------------------------------------------------------------------------------------------
 PsxSampler::PsxSampler(const InstanceInfo& info) noexcept
     : Plugin(info, MakeConfig(kNumParams, kNumPresets))
-    , mSpu()
-    , mSpuMutex()
+    , mSpuCores()
+    , mNumSpuCores(1)
+    , mSampleMutex()
+    , mSample()
+    , mStagedSample()
+    , mActiveSample()
+    , mSampleMode(Spu::SampleMode::Float)
+    , mSpuHardware(SpuHardware::Ps1)
+    , mStagedSpuHardware(SpuHardware::Ps1)
+    , mZones()
+    , mSelectedZoneIdx(0)
+    , mSpuRamHeap()
+    , mSpuRamSwapState(SpuRamSwapState::Idle)
+    , mSpuRamFadeFramesLeft(0)
+    , mbSpuRamFading(false)
     , mCurMidiPitchBend(PITCH_BEND_CENTER)
+    , mCurPitchBendInNotes(0.0f)
+    , mNotePitchesValid{}
+    , mNotePitches{}
+    , mNotePitchZones{}
+    , mVoiceParams()
+    , mPendingVoiceParams()
+    , mbHostParamsChanged(false)
     , mVoiceInfos{}
+    , mFreeVoicesHead(kNoVoice)
+    , mOldestVoiceIdx(kNoVoice)
+    , mNewestVoiceIdx(kNoVoice)
+    , mNoteVoiceMasks{}
     , mMeterSender()
     , mMidiQueue()
+    , mOutputResampler()
+    , mSpuOutput()
+    , mSpuCoreOutput()
+    , mResampledOutput()
     , mpCaption_SampleRate(nullptr)
     , mpCaption_BaseNote(nullptr)
     , mpKnob_Volume(nullptr)
@@ -177,6 +222,11 @@ PsxSampler::PsxSampler(const InstanceInfo& info) noexcept
     , mpSwitch_SustainIsExp(nullptr)
     , mpSwitch_ReleaseShift(nullptr)
     , mpSwitch_ReleaseIsExp(nullptr)
+    , mpSwitch_SampleMode(nullptr)
+    , mpSwitch_SpuHardware(nullptr)
+    , mpText_Zone(nullptr)
+    , mpEdit_ZoneVelocityMin(nullptr)
+    , mpEdit_ZoneVelocityMax(nullptr)
 {
     DefinePluginParams();
     DoDspSetup();
@@ -187,13 +237,38 @@ PsxSampler::PsxSampler(const InstanceInfo& info) noexcept
 // Shuts down the sampler plugin
 //------------------------------------------------------------------------------------------------------------------------------------------
 PsxSampler::~PsxSampler() noexcept {
-    Spu::destroyCore(mSpu);
+    for (Spu::Core& spuCore : mSpuCores) {
+        Spu::destroyCore(spuCore);
+    }
+
+    mNumSpuCores = 0;
+    Resampler::destroyStream(mOutputResampler);
+    mSample.reset();
+    mStagedSample.reset();
+    mActiveSample.reset();
+    mZones.clear();
+    mSelectedZoneIdx = 0;
+    mSpuRamHeap = {};
+    mSpuRamFadeFramesLeft = 0;
+    mbSpuRamFading = false;
     mCurMidiPitchBend = {};
+    mCurPitchBendInNotes = {};
+    mNotePitchesValid[0] = {};
+    mNotePitchesValid[1] = {};
+    mVoiceParams = {};
 
     for (VoiceInfo& voiceInfo : mVoiceInfos) {
         voiceInfo = {};
     }
 
+    mFreeVoicesHead = kNoVoice;
+    mOldestVoiceIdx = kNoVoice;
+    mNewestVoiceIdx = kNoVoice;
+
+    for (uint64_t& noteVoiceMask : mNoteVoiceMasks) {
+        noteVoiceMask = {};
+    }
+
     mpCaption_SampleRate = nullptr;
     mpCaption_BaseNote = nullptr;
     mpKnob_Volume = nullptr;
@@ -215,6 +290,11 @@ PsxSampler::~PsxSampler() noexcept {
     mpSwitch_SustainIsExp = nullptr;
     mpSwitch_ReleaseShift = nullptr;
     mpSwitch_ReleaseIsExp = nullptr;
+    mpSwitch_SampleMode = nullptr;
+    mpSwitch_SpuHardware = nullptr;
+    mpText_Zone = nullptr;
+    mpEdit_ZoneVelocityMin = nullptr;
+    mpEdit_ZoneVelocityMax = nullptr;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -224,39 +304,34 @@ void PsxSampler::ProcessBlock(sample** pInputs, sample** pOutputs, int numFrames
     // Process the requested number of samples on the SPU
     const int numChannels = NOutChansConnected();
 
-    {
-        std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+    // Pick up any new sample or parameter changes made by the UI thread since the last block
+    ApplyPendingSpuRam();
+    ApplyPendingVoiceParams();
 
-        for (int frameIdx = 0; frameIdx < numFrames; frameIdx++) {
-            // Process any incoming MIDI messages
-            ProcessMidiQueue();
+    // Split the block up at the offsets of incoming MIDI messages, handling the messages at each split point and rendering the SPU
+    // in one go for the spans in between. This keeps MIDI handling sample accurate without having to poll the queue every frame.
+    int frameIdx = 0;
 
-            // Run the SPU and grab the output sample and save
-            const Spu::StereoSample soundOut = Spu::stepCore(mSpu);
+    while (frameIdx < numFrames) {
+        // Pick up any parameter changes made by the host, then process all MIDI messages which are due by this frame
+        ApplyHostParamChanges();
 
-            if (numChannels >= 2) {
-                pOutputs[0][frameIdx] = soundOut.left;
-                pOutputs[1][frameIdx] = soundOut.right;
-            } else if (numChannels == 1) {
-                pOutputs[0][frameIdx] = soundOut.left;
-            }
+        while ((!mMidiQueue.Empty()) && (mMidiQueue.Peek().mOffset <= frameIdx)) {
+            const IMidiMsg msg = mMidiQueue.Peek();
+            mMidiQueue.Remove();
+            ProcessQueuedMidiMsg(msg);
         }
-    }
 
-    // Voice management: update the number of samples certain voices are active for and reset the parameters for other voices.
-    // Could to this for each sample processed, but that is probably overkill...
-    for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        VoiceInfo& voiceInfo = mVoiceInfos[i];
-        
-        if (mSpu.pVoices[i].envPhase != Spu::EnvPhase::Off) {
-            voiceInfo.numSamplesActive += (uint32_t) numFrames;
-        } else {
-            voiceInfo.midiNote = 0xFFFFu;
-            voiceInfo.midiVelocity = 0xFFFFu;
-            voiceInfo.numSamplesActive = 0;
-        }
+        // Render up until the next MIDI message, or the end of the block if there are no more messages for this block
+        const int spanEndFrameIdx = (!mMidiQueue.Empty()) ? std::min(mMidiQueue.Peek().mOffset, numFrames) : numFrames;
+        RenderSpu(pOutputs, numChannels, frameIdx, spanEndFrameIdx - frameIdx);
+        frameIdx = spanEndFrameIdx;
     }
 
+    // Any MIDI messages left are for future blocks: make their offsets relative to the start of the next block.
+    // Note: voices which finished playing were already freed by the SPU voice off callback during rendering.
+    mMidiQueue.Flush(numFrames);
+
     // Send the output to the meter
     mMeterSender.ProcessBlock(pOutputs, numFrames, kCtrlTagMeter);
 }
@@ -268,6 +343,13 @@ void PsxSampler::OnIdle() noexcept {
     mMeterSender.TransmitData(*this);
 }
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Called when the host sample rate or block size changes, or playback is about to start
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::OnReset() noexcept {
+    SetupResampling();
+}
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Serialize the VST state
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -276,37 +358,135 @@ bool PsxSampler::SerializeState(IByteChunk& chunk) const noexcept {
     if (!SerializeParams(chunk))
         return false;
 
-    // Serialize the ADPCM data for the current loaded sound
-    const uint32_t numAdpcmBlocks = (uint32_t) GetParam(kParamLengthInBlocks)->Value();
-    const uint32_t numAdpcmBytes = numAdpcmBlocks * Spu::ADPCM_BLOCK_SIZE;
-
-    if (numAdpcmBytes > 0) {
-        std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-        return (chunk.PutBytes(mSpu.pRam, (int) numAdpcmBytes) >= numAdpcmBytes);
+    // Grab the zones and the SPU RAM image holding their samples. The image is read-only, so the lock isn't needed after this.
+    // Note: this is the sample as seen by the UI, so it's saved even if the audio thread has not swapped it into SPU RAM yet.
+    std::unique_lock<std::mutex> lockSample(mSampleMutex);
+    const SharedSampleStore::SharedSampleRef pSample = mSample;
+    const std::vector<SampleZone> zones = mZones;
+    const uint32_t selectedZoneIdx = mSelectedZoneIdx;
+    lockSample.unlock();
+
+    // Serialize the SPU settings, the sample zones and the samples of all zones, compressed, along with a hash of the samples so instances
+    // loading the same samples can share them. The compressed data is kept with the shared SPU RAM image, so it only has to be made once for
+    // all instances and saves.
+    SamplerState::State state = {};
+    state.sampleMode = (uint32_t) mSampleMode.load();
+    state.spuHardware = (uint32_t) mSpuHardware.load();
+    state.selectedZoneIdx = selectedZoneIdx;
+    state.soundDataHash = pSample->soundDataHash;
+
+    for (uint32_t zoneIdx = 0; zoneIdx < (uint32_t) zones.size(); ++zoneIdx) {
+        const SampleZone& zone = zones[zoneIdx];
+        const uint32_t numZoneAdpcmBytes = (uint32_t) pSample->sounds[zoneIdx].adpcmData.size();
+        state.zones.push_back(SamplerState::Zone{ zone.noteMin, zone.noteMax, zone.velocityMin, zone.velocityMax, zone.baseNote, numZoneAdpcmBytes });
     }
-    
-    return true;
+
+    std::vector<std::byte> stateData;
+    SamplerState::writeState(state, SharedSampleStore::getCompressedSoundData(*pSample), stateData);
+    return (chunk.PutBytes(stateData.data(), (int) stateData.size()) >= (int) stateData.size());
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Deserialize the VST state
 //------------------------------------------------------------------------------------------------------------------------------------------
 int PsxSampler::UnserializeState(const IByteChunk& chunk, int startPos) noexcept {
-    // Make sure all Spu voices are killed and lock the SPU
-    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-    KillAllSpuVoices();
-
-    // De-serialize normal parameters
+    // De-serialize normal parameters.
+    // The rest of the state is read without holding the sample lock, since decompressing large samples takes a moment.
+    std::unique_lock<std::mutex> lockSample(mSampleMutex);
     startPos = UnserializeParams(chunk, startPos);
-
-    // De-serialize the ADPCM data for the previously loaded sound
     const uint32_t numAdpcmBlocks = (uint32_t) GetParam(kParamLengthInBlocks)->Value();
-    const uint32_t numAdpcmBytes = numAdpcmBlocks * Spu::ADPCM_BLOCK_SIZE;
+    lockSample.unlock();
+
+    // De-serialize the sample zones, and their samples and SPU settings.
+    // Versioned states have a tag right after the parameters, where older states have the ADPCM data for their one sample.
+    SavedZones savedZones = {};
+    savedZones.sampleMode = Spu::SampleMode::Float;
+    savedZones.spuHardware = SpuHardware::Ps1;
+    if ((startPos >= 0) && SamplerState::hasStateTag((const std::byte*) chunk.GetData(), (uint32_t) chunk.Size(), startPos)) {
+        startPos = UnserializeZones(chunk, startPos, savedZones);
+    } else {
+        startPos = UnserializeLegacySample(chunk, startPos, numAdpcmBlocks, savedZones);
+    }
 
-    if (numAdpcmBytes > 0) {
-        startPos = chunk.GetBytes(mSpu.pRam, (int) numAdpcmBytes, startPos);
+    if (savedZones.zones.empty()) {
+        savedZones.zones.assign(1, SampleZone{ 0, 127, 0, 127, 0.0, SpuRamAlloc::INVALID_ADDR, 0 });
+        savedZones.zoneSounds.assign(1, SharedSampleStore::SoundPlacement{ SpuRamAlloc::INVALID_ADDR, 0, nullptr, 0 });
+        savedZones.selectedZoneIdx = 0;
     }
 
+    lockSample.lock();
+    mSampleMode = savedZones.sampleMode;
+    mSpuHardware = savedZones.spuHardware;
+    mZones = std::move(savedZones.zones);
+    mSelectedZoneIdx = savedZones.selectedZoneIdx;
+    UpdateSelectedZoneFromParams();
+
+    // Lay out the samples of all the zones in SPU RAM, sharing the image with any other instances which have the same samples for the same
+    // hardware. The image is handed to the audio thread in 'OnRestoreState', which is always called after this.
+    LayoutZonesInSpuRam(savedZones.zoneSounds);
+    AcquireZoneSounds(savedZones.zoneSounds);
+    return startPos;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// De-serialize the sample zones, their samples and the SPU settings from a versioned state, starting at the state tag.
+// If another instance already has exactly the same samples then it's copy of them is shared.
+// Returns the position after the state, or '-1' and no zones if the state is not valid.
+//------------------------------------------------------------------------------------------------------------------------------------------
+int PsxSampler::UnserializeZones(const IByteChunk& chunk, int startPos, SavedZones& savedZones) noexcept {
+    SamplerState::State state = {};
+    startPos = SamplerState::readState((const std::byte*) chunk.GetData(), (uint32_t) chunk.Size(), startPos, state, savedZones.adpcmData);
+
+    if (startPos < 0)
+        return -1;
+
+    savedZones.sampleMode = (state.sampleMode == (uint32_t) Spu::SampleMode::Int16) ? Spu::SampleMode::Int16 : Spu::SampleMode::Float;
+    savedZones.spuHardware = (state.spuHardware == (uint32_t) SpuHardware::Ps2) ? SpuHardware::Ps2 : SpuHardware::Ps1;
+    savedZones.selectedZoneIdx = state.selectedZoneIdx;
+
+    // Make the zones, not yet placed in SPU RAM, and point each zone's sound at it's sample in the decompressed data
+    const uint32_t numZones = (uint32_t) state.zones.size();
+    const std::byte* pZoneAdpcmData = savedZones.adpcmData.data();
+
+    for (const SamplerState::Zone& zone : state.zones) {
+        savedZones.zones.push_back(SampleZone{ zone.noteMin, zone.noteMax, zone.velocityMin, zone.velocityMax, zone.baseNote, SpuRamAlloc::INVALID_ADDR, 0 });
+        savedZones.zoneSounds.push_back(SharedSampleStore::SoundPlacement{ SpuRamAlloc::INVALID_ADDR, 0, pZoneAdpcmData, zone.adpcmSize });
+        pZoneAdpcmData += zone.adpcmSize;
+    }
+
+    // If another instance has exactly the same samples then share them, rather than keeping another copy
+    savedZones.pSharedSample = SharedSampleStore::findSampleWithSoundData(state.soundDataHash, savedZones.zoneSounds.data(), numZones);
+
+    if (savedZones.pSharedSample) {
+        for (uint32_t zoneIdx = 0; zoneIdx < numZones; ++zoneIdx) {
+            savedZones.zoneSounds[zoneIdx].pAdpcmData = savedZones.pSharedSample->sounds[zoneIdx].adpcmData.data();
+        }
+
+        savedZones.adpcmData.clear();
+        savedZones.adpcmData.shrink_to_fit();
+    }
+
+    return startPos;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// De-serialize the sample from a state saved before states were versioned, starting after the parameters.
+// These states just have the given number of blocks of ADPCM data for the one sample there was, which is played for all velocities of the
+// notes in the note range parameters. The SPU settings are left as the caller's defaults: the floating point SPU of the PS1 was all there was.
+// Returns the position after the state, or '-1' if the state is not valid (the sample is still kept, with any missing data zeroed).
+//------------------------------------------------------------------------------------------------------------------------------------------
+int PsxSampler::UnserializeLegacySample(const IByteChunk& chunk, int startPos, const uint32_t numAdpcmBlocks, SavedZones& savedZones) noexcept {
+    // The sample can be no bigger than the SPU RAM of the largest hardware
+    const uint32_t numAdpcmBytes = std::min(numAdpcmBlocks, Spu::PS2_RAM_SIZE / Spu::ADPCM_BLOCK_SIZE) * Spu::ADPCM_BLOCK_SIZE;
+    savedZones.adpcmData.assign(numAdpcmBytes, std::byte(0));
+
+    if ((numAdpcmBytes > 0) && (startPos >= 0)) {
+        startPos = chunk.GetBytes(savedZones.adpcmData.data(), (int) numAdpcmBytes, startPos);
+    }
+
+    savedZones.zones.assign(1, SampleZone{ 0, 127, 0, 127, 0.0, SpuRamAlloc::INVALID_ADDR, 0 });
+    savedZones.zoneSounds.assign(1, SharedSampleStore::SoundPlacement{ SpuRamAlloc::INVALID_ADDR, 0, savedZones.adpcmData.data(), numAdpcmBytes });
+    savedZones.selectedZoneIdx = 0;
     return startPos;
 }
 
@@ -395,14 +575,20 @@ void PsxSampler::DoEditorSetup() noexcept {
         const IRECT bndSamplePanel = bndPadded.GetFromTop(80).GetFromLeft(300);
         const IRECT bndSampleInfoPanel = bndPadded.GetFromTop(80).GetReducedFromLeft(310).GetFromLeft(400);
         const IRECT bndParamsLoadSavePanel = bndPadded.GetFromTop(80).GetReducedFromLeft(720).GetFromLeft(100);
+        const IRECT bndSpuPanel = bndPadded.GetFromTop(80).GetReducedFromLeft(830).GetFromLeft(110);
+        const IRECT bndHardwarePanel = bndPadded.GetReducedFromTop(90).GetFromTop(80).GetReducedFromLeft(830).GetFromLeft(110);
         const IRECT bndTrackPanel = bndPadded.GetReducedFromTop(90).GetFromTop(100).GetFromLeft(820);
         const IRECT bndEnvelopePanel = bndPadded.GetReducedFromTop(200).GetFromTop(230).GetFromLeft(860);
+        const IRECT bndZonesPanel = bndPadded.GetReducedFromTop(200).GetFromTop(230).GetReducedFromLeft(870);
 
         pGraphics->AttachControl(new IVGroupControl(bndSamplePanel, "Sample"));
         pGraphics->AttachControl(new IVGroupControl(bndSampleInfoPanel, "Sample Info"));
         pGraphics->AttachControl(new IVGroupControl(bndParamsLoadSavePanel, "Params"));
+        pGraphics->AttachControl(new IVGroupControl(bndSpuPanel, "SPU"));
+        pGraphics->AttachControl(new IVGroupControl(bndHardwarePanel, "Hardware"));
         pGraphics->AttachControl(new IVGroupControl(bndTrackPanel, "Track"));
         pGraphics->AttachControl(new IVGroupControl(bndEnvelopePanel, "Envelope"));
+        pGraphics->AttachControl(new IVGroupControl(bndZonesPanel, "Zones"));
 
         // Make a read only edit box
         const auto makeReadOnlyEditBox = [=](const IRECT bounds, const int paramIdx) noexcept {
@@ -450,7 +636,7 @@ void PsxSampler::DoEditorSetup() noexcept {
                     bndColLoadSave.GetFromBottom(30.0f),
                     [=](IControl* const pControl) noexcept {
                         SplashClickActionFunc(pControl);
-                        DoLoadVagFilePrompt(*pGraphics);
+                        DoLoadVagFilePrompt(*pGraphics, false);
                     },
                     "Load"
                 )
@@ -510,6 +696,48 @@ void PsxSampler::DoEditorSetup() noexcept {
             );
         }
 
+        // SPU panel: chooses between the accurate 16-bit and clean floating point sample modes
+        {
+            const IRECT bndPanelPadded = bndSpuPanel.GetReducedFromTop(20.0f);
+
+            mpSwitch_SampleMode = new IVTabSwitchControl(
+                bndPanelPadded,
+                [=](IControl* const pControl) noexcept {
+                    const int selectedIdx = static_cast<IVTabSwitchControl*>(pControl)->GetSelectedIdx();
+                    SetSampleMode((selectedIdx == 0) ? Spu::SampleMode::Int16 : Spu::SampleMode::Float);
+                },
+                { "Accurate 16-bit", "Clean float" },
+                "",
+                DEFAULT_STYLE,
+                EVShape::Rectangle,
+                EDirection::Vertical
+            );
+
+            mpSwitch_SampleMode->SetValue((mSampleMode.load() == Spu::SampleMode::Int16) ? 0.0 : 1.0);
+            pGraphics->AttachControl(mpSwitch_SampleMode);
+        }
+
+        // Hardware panel: chooses between emulating the PS1 SPU and the PS2 SPU2, which has twice the voices and 4x the SPU RAM
+        {
+            const IRECT bndPanelPadded = bndHardwarePanel.GetReducedFromTop(20.0f);
+
+            mpSwitch_SpuHardware = new IVTabSwitchControl(
+                bndPanelPadded,
+                [=](IControl* const pControl) noexcept {
+                    const int selectedIdx = static_cast<IVTabSwitchControl*>(pControl)->GetSelectedIdx();
+                    SetSpuHardware((selectedIdx == 0) ? SpuHardware::Ps1 : SpuHardware::Ps2);
+                },
+                { "PS1: 24 voices", "PS2: 48 voices" },
+                "",
+                DEFAULT_STYLE,
+                EVShape::Rectangle,
+                EDirection::Vertical
+            );
+
+            mpSwitch_SpuHardware->SetValue((mSpuHardware.load() == SpuHardware::Ps1) ? 0.0 : 1.0);
+            pGraphics->AttachControl(mpSwitch_SpuHardware);
+        }
+
         // Track Panel
         {
             const IRECT bndPanelPadded = bndTrackPanel.GetReducedFromTop(24.0f).GetReducedFromBottom(4.0f);
@@ -561,6 +789,93 @@ void PsxSampler::DoEditorSetup() noexcept {
             pGraphics->AttachControl(mpSwitch_ReleaseIsExp);
         }
 
+        // Zones panel: picks the sample zone edited by the other panels, adds and removes zones and sets the velocity range of the selected zone
+        {
+            const IRECT bndPanelPadded = bndZonesPanel.GetReducedFromTop(24.0f).GetPadded(-4.0f);
+            const IRECT bndRowZone = bndPanelPadded.GetFromTop(20.0f);
+            const IRECT bndRowPrevNext = bndPanelPadded.GetReducedFromTop(24.0f).GetFromTop(25.0f);
+            const IRECT bndRowAdd = bndPanelPadded.GetReducedFromTop(53.0f).GetFromTop(25.0f);
+            const IRECT bndRowRemove = bndPanelPadded.GetReducedFromTop(82.0f).GetFromTop(25.0f);
+            const IRECT bndRowVelocityMin = bndPanelPadded.GetReducedFromTop(115.0f).GetFromTop(25.0f);
+            const IRECT bndRowVelocityMax = bndPanelPadded.GetReducedFromTop(145.0f).GetFromTop(25.0f);
+
+            mpText_Zone = new ITextControl(bndRowZone, "", editBoxTextStyle.WithFGColor(IColor(255, 255, 255, 255)));
+            pGraphics->AttachControl(mpText_Zone);
+
+            pGraphics->AttachControl(
+                new IVButtonControl(
+                    bndRowPrevNext.GetFromLeft(bndRowPrevNext.W() * 0.5f),
+                    [=](IControl* const pControl) noexcept {
+                        SplashClickActionFunc(pControl);
+                        StepSelectedZone(-1);
+                    },
+                    "<"
+                )
+            );
+
+            pGraphics->AttachControl(
+                new IVButtonControl(
+                    bndRowPrevNext.GetFromRight(bndRowPrevNext.W() * 0.5f),
+                    [=](IControl* const pControl) noexcept {
+                        SplashClickActionFunc(pControl);
+                        StepSelectedZone(+1);
+                    },
+                    ">"
+                )
+            );
+
+            pGraphics->AttachControl(
+                new IVButtonControl(
+                    bndRowAdd,
+                    [=](IControl* const pControl) noexcept {
+                        SplashClickActionFunc(pControl);
+                        DoLoadVagFilePrompt(*pGraphics, true);
+                    },
+                    "Add"
+                )
+            );
+
+            pGraphics->AttachControl(
+                new IVButtonControl(
+                    bndRowRemove,
+                    [=](IControl* const pControl) noexcept {
+                        SplashClickActionFunc(pControl);
+                        RemoveSelectedZone();
+                    },
+                    "Remove"
+                )
+            );
+
+            // Velocity limit edit boxes: the value typed in is clamped to the valid range of MIDI velocities
+            const auto createAndAttachVelocityEditBox = [=](const IRECT bounds, const char* const label, const bool bMaxLimit) noexcept {
+                pGraphics->AttachControl(new IVLabelControl(bounds.GetFromLeft(55.0f), label, labelStyle.WithValueText(labelStyle.valueText.WithSize(14.0f))));
+
+                IEditableTextControl* const pEditBox = new IEditableTextControl(
+                    bounds.GetReducedFromLeft(55.0f).GetPadded(-2.0f),
+                    "",
+                    editBoxTextStyle,
+                    editBoxBgColor
+                );
+
+                pEditBox->SetActionFunction(
+                    [=](IControl* const pControl) noexcept {
+                        const char* const velocityStr = static_cast<IEditableTextControl*>(pControl)->GetStr();
+                        SetSelectedZoneVelocityLimit(bMaxLimit, std::atoi(velocityStr));
+                    }
+                );
+
+                pGraphics->AttachControl(pEditBox);
+                return pEditBox;
+            };
+
+            mpEdit_ZoneVelocityMin = createAndAttachVelocityEditBox(bndRowVelocityMin, "Vel Min", false);
+            mpEdit_ZoneVelocityMax = createAndAttachVelocityEditBox(bndRowVelocityMax, "Vel Max", true);
+
+            // Show the settings of the selected zone
+            std::lock_guard<std::mutex> lockSample(mSampleMutex);
+            UpdateZoneControls();
+        }
+
         // Add the test keyboard and pitch bend wheel
         const IRECT bndKeyboardPanel = bndPadded.GetFromBottom(200);
         const IRECT bndKeyboard = bndKeyboardPanel.GetReducedFromLeft(60.0f);
@@ -589,41 +904,92 @@ void PsxSampler::DoEditorSetup() noexcept {
 // Setup DSP related stuff
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::DoDspSetup() noexcept {
-    // Create the PlayStation SPU core.
+    // Start out with a single zone playing an empty sample, in the SPU RAM image for the chosen hardware
+    mZones.assign(1, SampleZone{ 0, 127, 0, 127, 0.0, SpuRamAlloc::INVALID_ADDR, 0 });
+    mSelectedZoneIdx = 0;
+    UpdateSelectedZoneFromParams();
+
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds(1, SharedSampleStore::SoundPlacement{});
+    LayoutZonesInSpuRam(zoneSounds);
+    AcquireZoneSounds(zoneSounds);
+    mActiveSample = mSample;
+    mNumSpuCores = GetNumSpuCores(mSpuHardware.load());
+
+    // Create the PlayStation SPU cores: all of them are created up front, so the hardware can be switched without any allocations.
     // Note: only allocate a tiny amount of samples for reverb since the sampler doesn't do reverb.
-    Spu::initCore(mSpu, kSpuRamSize, kMaxVoices, 1024);
-
-    // Set default volume levels
-    mSpu.masterVol.left = 0x3FFF;
-    mSpu.masterVol.right = 0x3FFF;
-    mSpu.reverbVol.left = 0;
-    mSpu.reverbVol.right = 0;
-    mSpu.extInputVol.left = 0;
-    mSpu.extInputVol.right = 0;
-
-    // Setup other SPU settings
-    mSpu.bUnmute = true;
-    mSpu.bReverbWriteEnable = false;
-    mSpu.bExtEnabled = false;
-    mSpu.bExtReverbEnable = false;
-    mSpu.pExtInputCallback = nullptr;
-    mSpu.pExtInputUserData = nullptr;
-    mSpu.cycleCount = 0;
-    mSpu.reverbBaseAddr8 = (kSpuRamSize / 8) - 1;   // Allocate no RAM for reverb: this instrument does not use the PSX reverb effects
-    mSpu.reverbCurAddr = 0;
-    mSpu.processedReverb = {};
-    mSpu.reverbRegs = {};
-
-    // Default initialize all the SPU voice infos
-    for (VoiceInfo& voiceInfo : mVoiceInfos) {
-        voiceInfo.midiNote = 0xFFFFu;
-        voiceInfo.midiVelocity = 0xFFFFu;
-        voiceInfo.numSamplesActive = 0;
+    // SPU RAM is not allocated either, since it comes from the shared image for the current sample, which all of the cores share.
+    constexpr Spu::VoiceOffCallback spuVoiceOffCallbacks[kMaxSpuCores] = { OnSpuVoiceOff<0>, OnSpuVoiceOff<1> };
+
+    for (uint32_t coreIdx = 0; coreIdx < kMaxSpuCores; ++coreIdx) {
+        Spu::Core& spu = mSpuCores[coreIdx];
+        Spu::initCore(spu, 0, kVoicesPerSpuCore, mSampleMode.load(), 1024);
+        spu.pRam = mActiveSample->pSpuRam;
+        spu.ramSize = mActiveSample->spuRamSize;
+        SetSpuPredecodedSounds(spu, *mActiveSample);
+
+        // Cache decoded ADPCM blocks: the same sample data gets decoded over and over again by different voices and loops.
+        // Most blocks come from the shared pre-decoded samples, so this only needs to catch loops jumping to unexpected places.
+        Spu::enableBlockCache(spu, kSpuBlockCacheSize);
+
+        // Set default volume levels
+        spu.masterVol.left = 0x3FFF;
+        spu.masterVol.right = 0x3FFF;
+        spu.reverbVol.left = 0;
+        spu.reverbVol.right = 0;
+        spu.extInputVol.left = 0;
+        spu.extInputVol.right = 0;
+
+        // Setup other SPU settings
+        spu.bUnmute = true;
+        spu.bReverbWriteEnable = false;     // Must stay disabled: SPU RAM is shared with other instances and is read-only
+        spu.bExtEnabled = false;
+        spu.bExtReverbEnable = false;
+        spu.pExtInputCallback = nullptr;
+        spu.pExtInputUserData = nullptr;
+        spu.pVoiceOffCallback = spuVoiceOffCallbacks[coreIdx];
+        spu.pVoiceOffUserData = this;
+        spu.cycleCount = 0;
+        spu.reverbBaseAddr8 = (spu.ramSize / 8) - 1;    // Allocate no RAM for reverb: this instrument does not use the PSX reverb effects
+        spu.reverbCurAddr = 0;
+        spu.processedReverb = {};
+        spu.reverbRegs = {};
     }
 
-    // Update SPU voices from the current instrument settings and terminate the current empty sample in SPU RAM
-    UpdateSpuVoicesFromParams();
-    AddSampleTerminator();
+    // All voices start out free
+    ResetVoiceAllocation();
+
+    // Update SPU voices from the current instrument settings.
+    // The audio thread is not running yet so it's safe to apply the parameters here directly.
+    {
+        std::lock_guard<std::mutex> lockSample(mSampleMutex);
+        PublishVoiceParams();
+    }
+
+    ApplyPendingVoiceParams();
+    SetupResampling();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Setup conversion of the SPU output to the current host sample rate and tell the host about the latency that adds.
+// The SPU always runs at 44.1 KHz internally so that it behaves exactly as the original hardware did; if the host is also running at that
+// rate then the output is passed through untouched.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::SetupResampling() noexcept {
+    const double hostSampleRate = GetSampleRate();
+    const double spuFramesPerHostFrame = (double) Spu::OUTPUT_SAMPLE_RATE / hostSampleRate;
+
+    Resampler::destroyStream(mOutputResampler);
+    Resampler::initStream(mOutputResampler, Spu::OUTPUT_SAMPLE_RATE, hostSampleRate, 0, kMaxResampleFrames);
+    const uint32_t maxSpuFrames = Resampler::getMaxInputFramesNeeded(mOutputResampler, kMaxResampleFrames);
+
+    for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+        mSpuOutput[chanIdx].assign(maxSpuFrames, 0.0f);
+        mSpuCoreOutput[chanIdx].assign(maxSpuFrames, 0.0f);
+        mResampledOutput[chanIdx].assign(kMaxResampleFrames, 0.0f);
+    }
+
+    // Notes are heard later by however far the resampler looks ahead, since the SPU must be run that much further ahead of the output
+    SetLatency((int) std::lround(Resampler::getLookahead(mOutputResampler) / spuFramesPerHostFrame));
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -631,20 +997,42 @@ void PsxSampler::DoDspSetup() noexcept {
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::InformHostOfParamChange(int idx, [[maybe_unused]] double normalizedValue) noexcept {
     // These two parameters are linked
-    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-
     if (idx == kParamSampleRate) {
         SetBaseNoteFromSampleRate();
         GetUI()->SetAllControlsDirty();
     } else if (idx == kParamBaseNote) {
         SetSampleRateFromBaseNote();
         GetUI()->SetAllControlsDirty();
-    } else if ((idx == kParamNoteMin) || (idx == kParamNoteMax)) {
-        DoNoteOffForOutOfRangeNotes();
     }
 
-    // Update the SPU voices etc.
-    UpdateSpuVoicesFromParams();
+    // Hand the new parameters to the audio thread: it will update the SPU voices at the start of the next block
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    PublishVoiceParams();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Called when a parameter changes, from any source.
+// Changes made through the UI are handled by 'InformHostOfParamChange', which publishes a new snapshot of the voice parameters. Changes
+// made by the host (automation) can arrive on the audio thread however, where the sample lock can't be taken and where publishing would
+// make a second producer for the snapshots. Instead the audio thread is just told to re-read the parameters itself: it does this at the
+// start of the next block or span between MIDI events (see 'ApplyHostParamChanges'), so the change reaches playing and new voices.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::OnParamChange(int idx, EParamSource source, [[maybe_unused]] int sampleOffset) noexcept {
+    if (source != kHost)
+        return;
+
+    // The sample rate is just another view of the base note, and the sample length and loop points are informational only
+    const bool bAffectsVoices = (
+        (idx != kParamSampleRate) &&
+        (idx != kParamLengthInSamples) &&
+        (idx != kParamLengthInBlocks) &&
+        (idx != kParamLoopStartSample) &&
+        (idx != kParamLoopEndSample)
+    );
+
+    if (bAffectsVoices) {
+        mbHostParamsChanged.store(true, std::memory_order_release);
+    }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -654,55 +1042,571 @@ void PsxSampler::OnRestoreState() noexcept {
     // Base plugin restore functionality
     Plugin::OnRestoreState();
 
-    // Update the SPU from the changes and make sure the current sample is terminated
-    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-    UpdateSpuVoicesFromParams();
-    AddSampleTerminator();
+    // Update the sample mode and hardware switches, if the UI is open
+    if (GetUI() && mpSwitch_SampleMode) {
+        mpSwitch_SampleMode->SetValue((mSampleMode.load() == Spu::SampleMode::Int16) ? 0.0 : 1.0);
+        mpSwitch_SampleMode->SetDirty(false);
+    }
+
+    if (GetUI() && mpSwitch_SpuHardware) {
+        mpSwitch_SpuHardware->SetValue((mSpuHardware.load() == SpuHardware::Ps1) ? 0.0 : 1.0);
+        mpSwitch_SpuHardware->SetDirty(false);
+    }
+
+    // Update the SPU from the changes and hand the restored samples (if any) to the audio thread
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    UpdateZoneControls();
+    PublishVoiceParams();
+    StageSampleInSpuRam();
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Add a terminator for the currently loaded sample consisting of two silent ADPCM blocks which will loop indefinitely.
-// Used to guarantee a sound will stop playing after it reaches the end, since SPU voices technically never stop.
-// The SPU emulation however will kill them to save on CPU time...
+// Stage the currently loaded sample and ask the audio thread to swap it in.
+// If a previously staged sample has not been swapped in yet then it is simply replaced.
+// Note: must only be called from a non-audio thread, with the sample lock held.
 //------------------------------------------------------------------------------------------------------------------------------------------
-void PsxSampler::AddSampleTerminator() noexcept {
-    // Figure out which ADPCM sample block to write the terminators
-    constexpr uint32_t kMaxSampleBlocks = kSpuRamSize / Spu::ADPCM_BLOCK_SIZE;
-    static_assert(kMaxSampleBlocks >= 2);
-    const uint32_t numSampleBlocks = (uint32_t) GetParam(kParamLengthInBlocks)->Value();
-    const uint32_t termAdpcmBlocksStartIdx = std::min(numSampleBlocks, kMaxSampleBlocks - 2);
-    std::byte* const pTermAdpcmBlocks = mSpu.pRam + (size_t) Spu::ADPCM_BLOCK_SIZE * termAdpcmBlocksStartIdx;
+void PsxSampler::StageSampleInSpuRam() noexcept {
+    // Take ownership of the staged sample: if the audio thread is in the middle of swapping it in then wait a moment for it to finish.
+    // Swapping only exchanges a few pointers so this should never be waiting for long.
+    while (true) {
+        SpuRamSwapState swapState = SpuRamSwapState::Pending;
+
+        if (mSpuRamSwapState.compare_exchange_strong(swapState, SpuRamSwapState::Idle, std::memory_order_acq_rel, std::memory_order_acquire))
+            break;
 
-    // Zero the bytes for the two ADPCM sample blocks firstly
-    std::memset(pTermAdpcmBlocks, 0, Spu::ADPCM_BLOCK_SIZE * 2);
+        if (swapState == SpuRamSwapState::Idle)
+            break;
+
+        std::this_thread::yield();
+    }
+
+    // The SPU RAM image for the sample is already built and shared, so staging it is just a matter of handing over a reference.
+    // This also releases the previously active sample if it was the one staged, so it's never freed on the audio thread.
+    mStagedSample = mSample;
+    mStagedSpuHardware = mSpuHardware.load();
 
-    // The 2nd byte of each ADPCM block is the flags byte, and is where we indicate loop start/end.
-    // Make the first block be the loop start, and the second block be loop end:
-    pTermAdpcmBlocks[1]   = (std::byte) Spu::ADPCM_FLAG_LOOP_START;
-    pTermAdpcmBlocks[17]  = (std::byte) Spu::ADPCM_FLAG_LOOP_END;
+    // Let the audio thread know it's ready
+    mSpuRamSwapState.store(SpuRamSwapState::Pending, std::memory_order_release);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Process the MIDI queue - advances time by a single sample
+// Get where the sample of each zone is currently placed in SPU RAM and it's data, in zone order.
+// Note: the data belongs to the current SPU RAM image, so the image must be kept alive while the returned placements are in use.
+// Note: must only be called from a non-audio thread, with the sample lock held.
 //------------------------------------------------------------------------------------------------------------------------------------------
-void PsxSampler::ProcessMidiQueue() noexcept {
-    // Continue processing the queue
-    while (!mMidiQueue.Empty()) {
-        // Is there a delay until the next message?
-        // If so then decrement the time until it and finish up.
-        {
-            IMidiMsg& msg = mMidiQueue.Peek();
+std::vector<SharedSampleStore::SoundPlacement> PsxSampler::GetZoneSounds() const noexcept {
+    assert(mSample->sounds.size() == mZones.size());
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds(mZones.size(), SharedSampleStore::SoundPlacement{});
+
+    for (uint32_t zoneIdx = 0; zoneIdx < mZones.size(); ++zoneIdx) {
+        const SharedSampleStore::SharedSound& sound = mSample->sounds[zoneIdx];
+        SharedSampleStore::SoundPlacement& zoneSound = zoneSounds[zoneIdx];
+        zoneSound.spuRamAddr = sound.spuRamAddr;
+        zoneSound.spuRamSize = sound.spuRamSize;
+        zoneSound.pAdpcmData = sound.adpcmData.data();
+        zoneSound.adpcmSize = (uint32_t) sound.adpcmData.size();
+    }
+
+    return zoneSounds;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Place the sample of each zone where SPU RAM is allocated for the zone and make the SPU RAM image for them the current one.
+// The image is shared with any other instances which have the same samples in the same places, and is not staged for the audio thread.
+// Note: the previous image is only released once the new one is made, so the sample data given can belong to it.
+// Note: must only be called from a non-audio thread, with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::AcquireZoneSounds(std::vector<SharedSampleStore::SoundPlacement>& zoneSounds) noexcept {
+    assert(zoneSounds.size() == mZones.size());
+
+    for (uint32_t zoneIdx = 0; zoneIdx < mZones.size(); ++zoneIdx) {
+        zoneSounds[zoneIdx].spuRamAddr = mZones[zoneIdx].spuRamAddr;
+        zoneSounds[zoneIdx].spuRamSize = mZones[zoneIdx].spuRamSize;
+    }
+
+    mSample = SharedSampleStore::acquireSample(zoneSounds.data(), (uint32_t) zoneSounds.size(), GetSpuRamSize(mSpuHardware.load()));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocate SPU RAM for a zone's sample of the given size and it's terminator. If there is not enough free SPU RAM then as much as possible
+// is allocated, so the sample will be clipped. Enough is always left over for the terminators of the given number of zones still to be
+// allocated. If the free SPU RAM is too fragmented then it is compacted first, which moves the samples of other zones.
+// Returns 'false' if there is not even enough SPU RAM for the terminator.
+// Note: must only be called from a non-audio thread, with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool PsxSampler::AllocZoneSpuRam(SampleZone& zone, const uint32_t adpcmSize, const uint32_t numReservedZones) noexcept {
+    constexpr uint32_t kTerminatorSize = Spu::ADPCM_BLOCK_SIZE * 2;
+
+    zone.spuRamAddr = SpuRamAlloc::INVALID_ADDR;
+    zone.spuRamSize = 0;
+
+    const uint32_t numReservedBytes = numReservedZones * kTerminatorSize;
+    const uint32_t numFreeBytes = SpuRamAlloc::getNumFreeBytes(mSpuRamHeap);
+
+    if (numFreeBytes < numReservedBytes + kTerminatorSize)
+        return false;
+
+    const uint64_t wantedSize = (uint64_t) adpcmSize / Spu::ADPCM_BLOCK_SIZE * Spu::ADPCM_BLOCK_SIZE + kTerminatorSize;
+    const uint32_t allocSize = (uint32_t) std::min<uint64_t>(wantedSize, numFreeBytes - numReservedBytes);
+    uint32_t spuRamAddr = SpuRamAlloc::allocate(mSpuRamHeap, allocSize);
+
+    // If no free range is big enough then compact SPU RAM so all the free space is together: the zones which move are just placed
+    // differently in the next SPU RAM image. Relocations are in address order and only ever move down, so each applies to one zone.
+    if (spuRamAddr == SpuRamAlloc::INVALID_ADDR) {
+        std::vector<SpuRamAlloc::Relocation> relocations;
+        SpuRamAlloc::compact(mSpuRamHeap, relocations);
+
+        for (const SpuRamAlloc::Relocation& relocation : relocations) {
+            for (SampleZone& otherZone : mZones) {
+                if (otherZone.spuRamAddr == relocation.oldAddr) {
+                    otherZone.spuRamAddr = relocation.newAddr;
+                }
+            }
+        }
+
+        spuRamAddr = SpuRamAlloc::allocate(mSpuRamHeap, allocSize);
+        assert(spuRamAddr != SpuRamAlloc::INVALID_ADDR);
+    }
+
+    zone.spuRamAddr = spuRamAddr;
+    zone.spuRamSize = allocSize;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocate SPU RAM for the samples of all zones from scratch, in zone order, for the SPU RAM size of the current hardware.
+// Samples which don't fit are clipped, but every zone always gets at least enough SPU RAM for a terminator.
+// Note: must only be called from a non-audio thread (or before the audio thread has started), with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::LayoutZonesInSpuRam(const std::vector<SharedSampleStore::SoundPlacement>& zoneSounds) noexcept {
+    assert(zoneSounds.size() == mZones.size());
+    SpuRamAlloc::initHeap(mSpuRamHeap, 0, GetSpuRamSize(mSpuHardware.load()));
+
+    for (SampleZone& zone : mZones) {
+        zone.spuRamAddr = SpuRamAlloc::INVALID_ADDR;
+        zone.spuRamSize = 0;
+    }
+
+    const uint32_t numZones = (uint32_t) mZones.size();
+
+    for (uint32_t zoneIdx = 0; zoneIdx < numZones; ++zoneIdx) {
+        [[maybe_unused]] const bool bAllocated = AllocZoneSpuRam(mZones[zoneIdx], zoneSounds[zoneIdx].adpcmSize, numZones - zoneIdx - 1);
+        assert(bAllocated);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Select the zone which is the given number of zones after (or before) the selected zone, wrapping around at the ends.
+// The sample and note range parameters are switched over to those of the newly selected zone.
+// Note: must only be called from the UI thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::StepSelectedZone(const int32_t zoneIdxOffset) noexcept {
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    const int32_t numZones = (int32_t) mZones.size();
+    const int32_t zoneIdx = (((int32_t) mSelectedZoneIdx + zoneIdxOffset) % numZones + numZones) % numZones;
+
+    if ((uint32_t) zoneIdx == mSelectedZoneIdx)
+        return;
+
+    UpdateSelectedZoneFromParams();
+    mSelectedZoneIdx = (uint32_t) zoneIdx;
+    UpdateParamsFromSelectedZone();
+    UpdateZoneControls();
+    PublishVoiceParams();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Save the sample and note range parameters to the selected zone, or load them from it
+// Note: must only be called from a non-audio thread, with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::UpdateSelectedZoneFromParams() noexcept {
+    assert(mSelectedZoneIdx < mZones.size());
+    SampleZone& zone = mZones[mSelectedZoneIdx];
+    zone.noteMin = (uint8_t) GetParam(kParamNoteMin)->Value();
+    zone.noteMax = (uint8_t) GetParam(kParamNoteMax)->Value();
+    zone.baseNote = GetParam(kParamBaseNote)->Value();
+}
+
+void PsxSampler::UpdateParamsFromSelectedZone() noexcept {
+    assert(mSelectedZoneIdx < mZones.size());
+    const SampleZone& zone = mZones[mSelectedZoneIdx];
+    GetParam(kParamNoteMin)->Set((double) zone.noteMin);
+    GetParam(kParamNoteMax)->Set((double) zone.noteMax);
+    GetParam(kParamBaseNote)->Set(zone.baseNote);
+    SetSampleRateFromBaseNote();
+
+    // Decode the zone's sample to figure out it's length and where the loop points are
+    const std::vector<std::byte>& adpcmData = mSample->sounds[mSelectedZoneIdx].adpcmData;
+    std::vector<int16_t> pcmSamples;
+    uint32_t loopStartSample = {};
+    uint32_t loopEndSample = {};
+    VagUtils::decodePsxAdpcmSamples(adpcmData.data(), (uint32_t) adpcmData.size(), pcmSamples, loopStartSample, loopEndSample);
+
+    GetParam(kParamLengthInSamples)->Set((double) pcmSamples.size());
+    GetParam(kParamLengthInBlocks)->Set((double)(adpcmData.size() / Spu::ADPCM_BLOCK_SIZE));
+    GetParam(kParamLoopStartSample)->Set((double) loopStartSample);
+    GetParam(kParamLoopEndSample)->Set((double) loopEndSample);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Update the zone controls and the note range knobs to show the selected zone, if the UI is open
+// Note: must only be called from the UI thread, with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::UpdateZoneControls() noexcept {
+    if ((!GetUI()) || (!mpText_Zone))
+        return;
+
+    const SampleZone& zone = mZones[mSelectedZoneIdx];
+    mpText_Zone->SetStrFmt(32, "Zone %u of %u", mSelectedZoneIdx + 1, (uint32_t) mZones.size());
+    mpEdit_ZoneVelocityMin->SetStrFmt(8, "%u", (uint32_t) zone.velocityMin);
+    mpEdit_ZoneVelocityMax->SetStrFmt(8, "%u", (uint32_t) zone.velocityMax);
+    mpKnob_NoteMin->SetValue(GetParam(kParamNoteMin)->GetNormalized());
+    mpKnob_NoteMax->SetValue(GetParam(kParamNoteMax)->GetNormalized());
+    GetUI()->SetAllControlsDirty();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Remove the selected zone and it's sample, unless it's the only zone, and select the zone after it (or the last zone)
+// Note: must only be called from the UI thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::RemoveSelectedZone() noexcept {
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+
+    if (mZones.size() <= 1)
+        return;
+
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds = GetZoneSounds();
+    SpuRamAlloc::deallocate(mSpuRamHeap, mZones[mSelectedZoneIdx].spuRamAddr);
+    mZones.erase(mZones.begin() + mSelectedZoneIdx);
+    zoneSounds.erase(zoneSounds.begin() + mSelectedZoneIdx);
+    mSelectedZoneIdx = std::min(mSelectedZoneIdx, (uint32_t) mZones.size() - 1);
+
+    AcquireZoneSounds(zoneSounds);
+    UpdateParamsFromSelectedZone();
+    UpdateZoneControls();
+    PublishVoiceParams();
+    StageSampleInSpuRam();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Set the lowest or highest velocity played by the selected zone, clamped to the range of MIDI velocities
+// Note: must only be called from the UI thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::SetSelectedZoneVelocityLimit(const bool bMaxLimit, const int32_t velocity) noexcept {
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    SampleZone& zone = mZones[mSelectedZoneIdx];
+    uint8_t& velocityLimit = (bMaxLimit) ? zone.velocityMax : zone.velocityMin;
+    velocityLimit = (uint8_t) std::clamp(velocity, 0, 127);
+    UpdateZoneControls();
+    PublishVoiceParams();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// If a new sample has been staged then fade out any playing voices and swap the staged sample in once the fade is done.
+// Note: must only be called from the audio thread, at a block boundary.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::ApplyPendingSpuRam() noexcept {
+    // If the UI thread took back the staged sample before it was swapped in then cancel any fade
+    if (mSpuRamSwapState.load(std::memory_order_acquire) != SpuRamSwapState::Pending) {
+        mbSpuRamFading = false;
+        return;
+    }
+
+    // Fade out any playing voices before doing the swap, if not already done
+    if (!mbSpuRamFading) {
+        if (AreAnySpuVoicesActive()) {
+            mbSpuRamFading = true;
+            mSpuRamFadeFramesLeft = kSpuRamFadeFrames;
+            return;
+        }
+    } else if (mSpuRamFadeFramesLeft > 0) {
+        return;
+    }
+
+    // Take the staged sample, unless the UI thread has just taken it back
+    SpuRamSwapState swapState = SpuRamSwapState::Pending;
+
+    if (!mSpuRamSwapState.compare_exchange_strong(swapState, SpuRamSwapState::Applying, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        mbSpuRamFading = false;
+        return;
+    }
+
+    // Swap in the new sample's SPU RAM image and stop all voices: they are silent by now anyway.
+    // All previously decoded ADPCM blocks are now stale too. The image may be for different hardware, so switch to that at the same time.
+    std::swap(mActiveSample, mStagedSample);
+    mNumSpuCores = GetNumSpuCores(mStagedSpuHardware);
+
+    for (Spu::Core& spu : mSpuCores) {
+        spu.pRam = mActiveSample->pSpuRam;
+        spu.ramSize = mActiveSample->spuRamSize;
+        spu.reverbBaseAddr8 = (spu.ramSize / 8) - 1;
+        SetSpuPredecodedSounds(spu, *mActiveSample);
+        Spu::invalidateBlockCache(spu);
+    }
+
+    KillAllSpuVoices();
+    mbSpuRamFading = false;
+
+    // The old sample is now the staged one and belongs to the UI thread again, which will release it when the next sample is staged
+    mSpuRamSwapState.store(SpuRamSwapState::Idle, std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Choose whether the SPU does accurate 16-bit or clean floating point processing: the audio thread switches over at the next block.
+// Note: must only be called from the UI thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::SetSampleMode(const Spu::SampleMode sampleMode) noexcept {
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    mSampleMode = sampleMode;
+    PublishVoiceParams();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Choose which PlayStation's sound hardware to emulate.
+// The zones are laid out again in an SPU RAM image of the right size, and the audio thread switches hardware when it swaps that in.
+// Note: must only be called from the UI thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::SetSpuHardware(const SpuHardware hardware) noexcept {
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+
+    if (mSpuHardware.load() == hardware)
+        return;
+
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds = GetZoneSounds();
+    mSpuHardware = hardware;
+    LayoutZonesInSpuRam(zoneSounds);
+    AcquireZoneSounds(zoneSounds);
+    PublishVoiceParams();
+    StageSampleInSpuRam();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the amount of SPU RAM and the number of SPU cores for the given hardware
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t PsxSampler::GetSpuRamSize(const SpuHardware hardware) noexcept {
+    return (hardware == SpuHardware::Ps2) ? Spu::PS2_RAM_SIZE : Spu::PS1_RAM_SIZE;
+}
 
-            if (msg.mOffset > 0) {
-                msg.mOffset--;
-                break;
+uint32_t PsxSampler::GetNumSpuCores(const SpuHardware hardware) noexcept {
+    return (hardware == SpuHardware::Ps2) ? Spu::PS2_NUM_CORES : 1;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Capture the current instrument parameters and sample zones affecting SPU voices and publish them for the audio thread to pick up.
+// Note: must only be called from the UI thread, or before the audio thread has started, with the sample lock held.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::PublishVoiceParams() noexcept {
+    // The selected zone is edited through the parameters, so pick up any changes to it first
+    UpdateSelectedZoneFromParams();
+
+    // Make the note and velocity lookup tables for the zones, so a note's zone can be found with a couple of lookups when it's played
+    VoiceParams& params = mPendingVoiceParams.writeBuffer();
+    params.zonesSampleHash = mSample->contentHash;
+    params.numZones = (uint32_t) mZones.size();
+    std::fill(std::begin(params.noteZoneMasks), std::end(params.noteZoneMasks), 0);
+    std::fill(std::begin(params.velocityZoneMasks), std::end(params.velocityZoneMasks), 0);
+
+    for (uint32_t zoneIdx = 0; zoneIdx < params.numZones; ++zoneIdx) {
+        const SampleZone& zone = mZones[zoneIdx];
+        const uint64_t zoneBit = (uint64_t) 1 << zoneIdx;
+        params.zones[zoneIdx] = ZoneParams{ (float) zone.baseNote, zone.noteMin, zone.noteMax, zone.velocityMin, zone.velocityMax };
+
+        for (uint32_t note = zone.noteMin; note <= zone.noteMax; ++note) {
+            params.noteZoneMasks[note] |= zoneBit;
+        }
+
+        for (uint32_t velocity = zone.velocityMin; velocity <= zone.velocityMax; ++velocity) {
+            params.velocityZoneMasks[velocity] |= zoneBit;
+        }
+    }
+
+    params.selectedZoneIdx = mSelectedZoneIdx;
+    params.sampleMode = mSampleMode.load();
+    GetVoiceParamsFromParams(params);
+    mPendingVoiceParams.publish();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Fill in the voice parameters which come straight from the plugin parameters (rather than from the sample zones)
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::GetVoiceParamsFromParams(VoiceParams& params) const noexcept {
+    params.volume = (uint32_t) GetParam(kParamVolume)->Value();
+    params.pan = (uint32_t) GetParam(kParamPan)->Value();
+    params.pitchstepUp = (float) GetParam(kParamPitchstepUp)->Value();
+    params.pitchstepDown = (float) GetParam(kParamPitchstepDown)->Value();
+    params.pitchBendUpOffset = (float) GetParam(kParamPitchBendUpOffset)->Value();
+    params.pitchBendDownOffset = (float) GetParam(kParamPitchBendDownOffset)->Value();
+    params.adsrEnv = GetCurrentSpuAdsrEnv();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// If the UI thread has published new voice parameters then start using them and update the SPU voices accordingly.
+// Note: must only be called from the audio thread, or before the audio thread has started.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::ApplyPendingVoiceParams() noexcept {
+    if (!mPendingVoiceParams.acquire())
+        return;
+
+    ApplyVoiceParams(mPendingVoiceParams.readBuffer());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// If the host has changed any parameters affecting voices then re-read them into the voice parameters in use and update the SPU voices.
+// The host's changes to the sample and note range parameters apply to the selected zone, the same as changes made through the UI; the UI
+// thread picks them up into the zones the next time it publishes the voice parameters.
+// Note: must only be called from the audio thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::ApplyHostParamChanges() noexcept {
+    if (!mbHostParamsChanged.exchange(false, std::memory_order_acquire))
+        return;
+
+    VoiceParams newParams = mVoiceParams;
+    GetVoiceParamsFromParams(newParams);
+
+    if (newParams.selectedZoneIdx < newParams.numZones) {
+        const uint32_t zoneIdx = newParams.selectedZoneIdx;
+        const uint64_t zoneBit = (uint64_t) 1 << zoneIdx;
+        ZoneParams& zone = newParams.zones[zoneIdx];
+        zone.baseNote = (float) GetParam(kParamBaseNote)->Value();
+        zone.noteMin = (uint8_t) GetParam(kParamNoteMin)->Value();
+        zone.noteMax = (uint8_t) GetParam(kParamNoteMax)->Value();
+
+        for (uint32_t note = 0; note < 128; ++note) {
+            if ((note >= zone.noteMin) && (note <= zone.noteMax)) {
+                newParams.noteZoneMasks[note] |= zoneBit;
+            } else {
+                newParams.noteZoneMasks[note] &= ~zoneBit;
             }
         }
+    }
+
+    ApplyVoiceParams(newParams);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Start using the given voice parameters and update the SPU voices for whatever has changed
+// Note: must only be called from the audio thread, or before the audio thread has started.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::ApplyVoiceParams(const VoiceParams& newParams) noexcept {
+    // See what has changed, so that only voice properties affected by the change need to be updated.
+    // Any change to the zones might change the pitch of playing notes, or leave them playing with a zone which no longer covers them.
+    const bool bZonesChanged = (
+        (newParams.zonesSampleHash != mVoiceParams.zonesSampleHash) ||
+        (newParams.numZones != mVoiceParams.numZones) ||
+        (std::memcmp(newParams.zones, mVoiceParams.zones, sizeof(ZoneParams) * newParams.numZones) != 0)
+    );
+
+    uint32_t dirtyFlags = 0;
+
+    if (bZonesChanged) {
+        dirtyFlags |= kVoiceDirtyPitch;
+        mNotePitchesValid[0] = 0;
+        mNotePitchesValid[1] = 0;
+    }
 
-        // Remove the message from the queue then process
-        const IMidiMsg msg = mMidiQueue.Peek();
-        mMidiQueue.Remove();
-        ProcessQueuedMidiMsg(msg);
+    if ((newParams.volume != mVoiceParams.volume) || (newParams.pan != mVoiceParams.pan)) {
+        dirtyFlags |= kVoiceDirtyVolume;
+    }
+
+    if (std::memcmp(&newParams.adsrEnv, &mVoiceParams.adsrEnv, sizeof(Spu::AdsrEnvelope)) != 0) {
+        dirtyFlags |= kVoiceDirtyEnvelope;
+    }
+
+    mVoiceParams = newParams;
+
+    // Switch sample mode if that has changed: playing voices carry on, and use the sample's pre-decoded blocks for the new mode
+    for (Spu::Core& spu : mSpuCores) {
+        if (newParams.sampleMode != spu.sampleMode) {
+            Spu::setSampleMode(spu, newParams.sampleMode);
+            SetSpuPredecodedSounds(spu, *mActiveSample);
+        }
+    }
+
+    // The pitch bend range might have changed too
+    if (UpdatePitchBendInNotes()) {
+        dirtyFlags |= kVoiceDirtyPitch;
+    }
+
+    if (bZonesChanged) {
+        DoNoteOffForOutOfRangeNotes();
+    }
+
+    UpdateSpuVoicesFromParams(dirtyFlags);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Run the SPU for the given number of frames and write the output starting at the given frame in the output buffers
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::RenderSpu(sample** const pOutputs, const int numChannels, const int startFrameIdx, const int numFrames) noexcept {
+    const uint32_t numSpuOutputs = (uint32_t) std::clamp(numChannels, 0, 2);
+    sample* spuOutputs[2] = {};
+
+    for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+        spuOutputs[chanIdx] = pOutputs[chanIdx] + startFrameIdx;
+    }
+
+    // If the SPU is silent and everything still to come out of the resampler is too then the output is just silence: skip all the work.
+    // This is the usual case for an instance of the instrument with no notes playing.
+    const uint32_t numSpuCores = mNumSpuCores;
+    bool bSpuSilent = true;
+
+    for (uint32_t coreIdx = 0; coreIdx < numSpuCores; ++coreIdx) {
+        bSpuSilent &= Spu::isCoreSilent(mSpuCores[coreIdx]);
+    }
+
+    if ((!mbSpuRamFading) && bSpuSilent && Resampler::isSilent(mOutputResampler)) {
+        for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+            std::fill_n(spuOutputs[chanIdx], numFrames, (sample) 0);
+        }
+
+        return;
+    }
+
+    // Run the SPU for the entire span, a chunk of output at a time.
+    // For each chunk the SPU is run for however many of it's own frames are needed to produce the chunk at the host sample rate.
+    // When there is more than one SPU core, the output of each core is simply added together.
+    float* const spuOutput[2] = { mSpuOutput[0].data(), mSpuOutput[1].data() };
+    float* const spuCoreOutput[2] = { mSpuCoreOutput[0].data(), mSpuCoreOutput[1].data() };
+    float* const resampledOutput[2] = { mResampledOutput[0].data(), mResampledOutput[1].data() };
+
+    for (uint32_t chunkStartIdx = 0; chunkStartIdx < (uint32_t) numFrames;) {
+        const uint32_t chunkSize = std::min((uint32_t) numFrames - chunkStartIdx, kMaxResampleFrames);
+        const uint32_t numSpuFrames = Resampler::getNumInputFramesNeeded(mOutputResampler, chunkSize);
+        Spu::renderCore(mSpuCores[0], spuOutput, 2, numSpuFrames);
+
+        for (uint32_t coreIdx = 1; coreIdx < numSpuCores; ++coreIdx) {
+            Spu::renderCore(mSpuCores[coreIdx], spuCoreOutput, 2, numSpuFrames);
+
+            for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+                for (uint32_t frameIdx = 0; frameIdx < numSpuFrames; ++frameIdx) {
+                    spuOutput[chanIdx][frameIdx] += spuCoreOutput[chanIdx][frameIdx];
+                }
+            }
+        }
+
+        Resampler::pushInput(mOutputResampler, spuOutput[0], spuOutput[1], numSpuFrames);
+        Resampler::pullOutput(mOutputResampler, resampledOutput[0], resampledOutput[1], chunkSize);
+
+        for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+            std::copy_n(resampledOutput[chanIdx], chunkSize, spuOutputs[chanIdx] + chunkStartIdx);
+        }
+
+        chunkStartIdx += chunkSize;
+    }
+
+    // If a new sample is waiting to be swapped in then fade out the current voices to avoid clicks
+    if (mbSpuRamFading) {
+        for (int frameIdx = 0; frameIdx < numFrames; ++frameIdx) {
+            const sample fadeGain = (sample) mSpuRamFadeFramesLeft / (sample) kSpuRamFadeFrames;
+
+            for (uint32_t chanIdx = 0; chanIdx < numSpuOutputs; ++chanIdx) {
+                spuOutputs[chanIdx][frameIdx] *= fadeGain;
+            }
+
+            if (mSpuRamFadeFramesLeft > 0) {
+                mSpuRamFadeFramesLeft--;
+            }
+        }
     }
 }
 
@@ -746,59 +1650,43 @@ void PsxSampler::ProcessMidiNoteOn(const uint8_t note, const uint8_t velocity) n
     // Release any playing instances of this note that are not already being released
     ProcessMidiNoteOff(note);
 
-    // Only allow the note to be played if it's within the acceptable range
-    const uint32_t minNote = (uint32_t) GetParam(kParamNoteMin)->Value();
-    const uint32_t maxNote = (uint32_t) GetParam(kParamNoteMax)->Value();
+    // Only allow the note to be played if some zone covers the note and velocity.
+    // Notes are also ignored while the zones are for an SPU RAM image that has not been swapped in yet, since the samples might not be there.
+    const uint64_t zoneMask = mVoiceParams.noteZoneMasks[note] & mVoiceParams.velocityZoneMasks[velocity];
 
-    if ((note < minNote) || (note > maxNote))
+    if ((zoneMask == 0) || (mVoiceParams.zonesSampleHash != mActiveSample->contentHash))
         return;
 
-    // Try to find a free SPU voice firstly to service this request
-    uint32_t spuVoiceIdx = UINT32_MAX;
+    // Where zones overlap the most recently added zone plays the note
+    uint8_t zoneIdx = kMaxZones - 1;
 
-    for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        if (mSpu.pVoices[i].envPhase == Spu::EnvPhase::Off) {
-            spuVoiceIdx = i;
-            break;
-        }
+    while ((zoneMask & ((uint64_t) 1 << zoneIdx)) == 0) {
+        --zoneIdx;
     }
 
-    // If that fails try to find the oldest playing voice to use
-    if (spuVoiceIdx == UINT32_MAX) {
-        spuVoiceIdx = 0;
-        uint32_t oldestSamplesActive = mVoiceInfos[0].numSamplesActive;
-
-        for (uint32_t i = 1; i < kMaxVoices; ++i) {
-            if (mVoiceInfos[i].numSamplesActive > oldestSamplesActive) {
-                oldestSamplesActive = mVoiceInfos[i].numSamplesActive;
-                spuVoiceIdx = i;
-            }
-        }
-    }
-
-    // Save the info for this voice
-    VoiceInfo& voiceInfo = mVoiceInfos[spuVoiceIdx];
-    voiceInfo.midiNote = note;
-    voiceInfo.midiVelocity = velocity;
-    voiceInfo.numSamplesActive = 0;
+    // Get a free SPU voice to service this request, or the oldest playing voice if there are none
+    const uint32_t spuVoiceIdx = AllocVoice(note, velocity, zoneIdx);
 
     // Make sure the voice parameters are up to date and sound the voice
     UpdateSpuVoiceFromParams(spuVoiceIdx);
-    Spu::keyOn(mSpu.pVoices[spuVoiceIdx]);
+    Spu::keyOn(GetSpuVoice(spuVoiceIdx));
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Handle a MIDI note off message
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::ProcessMidiNoteOff(const uint8_t note) noexcept {
-    // Find voices playing this note which are not already being released and release them
-    for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        if (mVoiceInfos[i].midiNote == note) {
-            Spu::Voice& voice = mSpu.pVoices[i];
+    // Release the voices playing this note which are not already being released
+    uint32_t voiceIdx = 0;
 
-            if ((voice.envPhase != Spu::EnvPhase::Release) && (voice.envPhase != Spu::EnvPhase::Off)) {
-                Spu::keyOff(voice);
-            }
+    for (uint64_t voicesLeft = mNoteVoiceMasks[note]; voicesLeft != 0; voicesLeft >>= 1, ++voiceIdx) {
+        if ((voicesLeft & 1) == 0)
+            continue;
+
+        Spu::Voice& voice = GetSpuVoice(voiceIdx);
+
+        if ((voice.envPhase != Spu::EnvPhase::Release) && (voice.envPhase != Spu::EnvPhase::Off)) {
+            Spu::keyOff(voice);
         }
     }
 }
@@ -808,7 +1696,10 @@ void PsxSampler::ProcessMidiNoteOff(const uint8_t note) noexcept {
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::ProcessMidiPitchBend(const uint16_t pitchBend) noexcept {
     mCurMidiPitchBend = pitchBend;
-    UpdateSpuVoicesFromParams();
+
+    if (UpdatePitchBendInNotes()) {
+        UpdateSpuVoicesFromParams(kVoiceDirtyPitch);
+    }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -819,60 +1710,90 @@ void PsxSampler::ProcessMidiAllNotesOff() noexcept {
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Update all of the SPU voices from the current parameters.
-// Note: assumes the SPU lock is held.
+// Update the playing SPU voices from the current parameters.
+// Only the voice properties indicated by the given dirty flags are updated; voices which are not playing are updated on key on instead.
+// Note: must only be called from the audio thread.
 //------------------------------------------------------------------------------------------------------------------------------------------
-void PsxSampler::UpdateSpuVoicesFromParams() noexcept {
-    // These parameters affect the pitch and volume of all voices
-    const float baseNote = (float) GetParam(kParamBaseNote)->Value();
-    const uint32_t volume = (uint32_t) GetParam(kParamVolume)->Value();
-    const uint32_t pan = (uint32_t) GetParam(kParamPan)->Value();
+void PsxSampler::UpdateSpuVoicesFromParams(const uint32_t dirtyFlags) noexcept {
+    if (dirtyFlags == 0)
+        return;
 
-    // Get the current pitch bend to apply to all voices (in semitones) and the ADSR envelope to use for all voices
-    Spu::AdsrEnvelope adsrEnv = GetCurrentSpuAdsrEnv();
-    const float pitchBendInNotes = GetCurrentPitchBendInNotes();
+    for (uint32_t voiceIdx = mOldestVoiceIdx; voiceIdx != kNoVoice; voiceIdx = mVoiceInfos[voiceIdx].nextVoiceIdx) {
+        Spu::Voice& voice = GetSpuVoice(voiceIdx);
+        const VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
 
-    // Update all the voices: note that the base note is the note at which the sample rate is 44,100 Hz (4096.0 in SPU units) so the calculation is based on that
-    const uint32_t numVoices = mSpu.numVoices;
-    Spu::Voice* const pVoices = mSpu.pVoices;
+        if (dirtyFlags & kVoiceDirtyPitch) {
+            voice.sampleRate = GetNoteSpuPitch(voiceInfo.midiNote, voiceInfo.zoneIdx);
+        }
 
-    for (uint32_t voiceIdx = 0; voiceIdx < numVoices; ++voiceIdx) {
-        const VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
-        Spu::Voice& voice = pVoices[voiceIdx];
+        if (dirtyFlags & kVoiceDirtyVolume) {
+            voice.volume = CalcSpuVoiceVolume(mVoiceParams.volume, mVoiceParams.pan, voiceInfo.midiVelocity);
+        }
 
-        voice.sampleRate = GetNoteSpuSampleRate(baseNote, (float) voiceInfo.midiNote + pitchBendInNotes);
-        voice.bDisabled = false;
-        voice.bDoReverb = false;
-        voice.env = adsrEnv;
-        voice.volume = CalcSpuVoiceVolume(volume, pan, voiceInfo.midiVelocity);
+        if (dirtyFlags & kVoiceDirtyEnvelope) {
+            voice.env = mVoiceParams.adsrEnv;
+        }
     }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Update a single SPU voice (only) from current parameters.
-// Note: assumes the SPU lock is held.
+// Note: must only be called from the audio thread.
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::UpdateSpuVoiceFromParams(const uint32_t voiceIdx) noexcept {
     assert(voiceIdx < kMaxVoices);
 
-    // This will affect the pitch and volume of the voice
-    const float baseNote = (float) GetParam(kParamBaseNote)->Value();
-    const uint32_t volume = (uint32_t) GetParam(kParamVolume)->Value();
-    const uint32_t pan = (uint32_t) GetParam(kParamPan)->Value();
-
-    // Get the envelope to use and the current pitch bend
-    Spu::AdsrEnvelope adsrEnv = GetCurrentSpuAdsrEnv();
-    const float pitchBendInNotes = GetCurrentPitchBendInNotes();
-
-    // Update the voice: note that the base note is the note at which the sample rate is 44,100 Hz (4096.0 in SPU units) so the calculation is based on that
+    // Update the voice using the current parameters
     const VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
-    Spu::Voice& voice = mSpu.pVoices[voiceIdx];
+    Spu::Voice& voice = GetSpuVoice(voiceIdx);
+
+    // The voice plays the sample of it's zone, which also becomes the loop point until the sample says otherwise
+    assert(voiceInfo.zoneIdx < mActiveSample->sounds.size());
+    const SharedSampleStore::SharedSound& zoneSound = mActiveSample->sounds[voiceInfo.zoneIdx];
+    voice.adpcmStartAddr8 = zoneSound.spuRamAddr / 8;
+    voice.adpcmRepeatAddr8 = zoneSound.spuRamAddr / 8;
 
-    voice.sampleRate = GetNoteSpuSampleRate(baseNote, (float) voiceInfo.midiNote + pitchBendInNotes);
+    voice.sampleRate = GetNoteSpuPitch(voiceInfo.midiNote, voiceInfo.zoneIdx);
     voice.bDisabled = false;
     voice.bDoReverb = false;
-    voice.env = adsrEnv;
-    voice.volume = CalcSpuVoiceVolume(volume, pan, voiceInfo.midiVelocity);
+    voice.env = mVoiceParams.adsrEnv;
+    voice.volume = CalcSpuVoiceVolume(mVoiceParams.volume, mVoiceParams.pan, voiceInfo.midiVelocity);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Recompute the current pitch bend in semitones from the MIDI pitch bend and the bend range parameters.
+// If it has changed then the cached note pitches are invalidated and 'true' is returned.
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool PsxSampler::UpdatePitchBendInNotes() noexcept {
+    const float pitchBendInNotes = GetCurrentPitchBendInNotes();
+
+    if (pitchBendInNotes == mCurPitchBendInNotes)
+        return false;
+
+    mCurPitchBendInNotes = pitchBendInNotes;
+    mNotePitchesValid[0] = 0;
+    mNotePitchesValid[1] = 0;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the SPU sample rate (pitch) to play the given MIDI note at with the given zone, given the zone's base note and the current pitch bend.
+// Pitches are computed on demand and cached until the zones or pitch bend change, or the note is played with a different zone.
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint16_t PsxSampler::GetNoteSpuPitch(const uint32_t note, const uint32_t zoneIdx) noexcept {
+    assert(note < 128);
+    assert(zoneIdx < kMaxZones);
+    uint64_t& validBits = mNotePitchesValid[note / 64];
+    const uint64_t noteBit = (uint64_t) 1 << (note % 64);
+
+    // Note that the base note is the note at which the sample rate is 44,100 Hz (4096.0 in SPU units) so the calculation is based on that
+    if (((validBits & noteBit) == 0) || (mNotePitchZones[note] != zoneIdx)) {
+        mNotePitches[note] = GetNoteSpuSampleRate(mVoiceParams.zones[zoneIdx].baseNote, (float) note + mCurPitchBendInNotes);
+        mNotePitchZones[note] = (uint8_t) zoneIdx;
+        validBits |= noteBit;
+    }
+
+    return mNotePitches[note];
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -930,8 +1851,8 @@ Spu::AdsrEnvelope PsxSampler::GetCurrentSpuAdsrEnv() const noexcept {
 //------------------------------------------------------------------------------------------------------------------------------------------
 float PsxSampler::GetCurrentPitchBendInNotes() const noexcept {
     // Get the range of the pitch bend in semitones
-    const float pitchstepUp = (float) GetParam(kParamPitchstepUp)->Value();
-    const float pitchstepDown = (float) GetParam(kParamPitchstepDown)->Value();
+    const float pitchstepUp = mVoiceParams.pitchstepUp;
+    const float pitchstepDown = mVoiceParams.pitchstepDown;
 
     // Get the clamped MIDI pitch bend
     const uint32_t midiPitchBend = std::min<uint32_t>(mCurMidiPitchBend, PITCH_BEND_MAX);
@@ -945,9 +1866,9 @@ float PsxSampler::GetCurrentPitchBendInNotes() const noexcept {
     float pitchBendOffset = 0.0f;
 
     if (midiPitchBend < PITCH_BEND_CENTER) {
-        pitchBendOffset -= (float) GetParam(kParamPitchBendDownOffset)->Value();
+        pitchBendOffset -= mVoiceParams.pitchBendDownOffset;
     } else if (midiPitchBend > PITCH_BEND_CENTER) {
-        pitchBendOffset += (float) GetParam(kParamPitchBendUpOffset)->Value();
+        pitchBendOffset += mVoiceParams.pitchBendUpOffset;
     }
 
     const float scaledPitchBend = (pitchBendNormalized < 0) ? pitchBendNormalized * pitchstepDown : pitchBendNormalized * pitchstepUp;
@@ -956,9 +1877,10 @@ float PsxSampler::GetCurrentPitchBendInNotes() const noexcept {
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Prompt the user to load a sample in .vag file and load it if a choice is made
+// Prompt the user to load a sample in .vag file and load it if a choice is made.
+// The sample either replaces the sample of the selected zone, or is played by a new zone which covers all notes and velocities.
 //------------------------------------------------------------------------------------------------------------------------------------------
-void PsxSampler::DoLoadVagFilePrompt(IGraphics& graphics) noexcept {
+void PsxSampler::DoLoadVagFilePrompt(IGraphics& graphics, const bool bAddZone) noexcept {
     // Prompt for the file to open and abort if none is chosen
     WDL_String filePath;
     WDL_String fileDir;
@@ -983,26 +1905,79 @@ void PsxSampler::DoLoadVagFilePrompt(IGraphics& graphics) noexcept {
     uint32_t loopEndSample = {};
     VagUtils::decodePsxAdpcmSamples(adpcmData.data(), (uint32_t) adpcmData.size(), pcmSamples, loopStartSample, loopEndSample);
 
-    // Clamp the length of the VAG file to be within the RAM size of the SPU
-    const uint32_t numAdpcmBlocks = std::min((uint32_t) adpcmData.size(), kSpuRamSize) / Spu::ADPCM_BLOCK_SIZE;
+    // Load it into a zone. Any error is shown once the sample is unlocked again, since a modal message box would hold up everything waiting on the lock.
+    const char* const pErrorMsg = LoadZoneSample(adpcmData, sampleRate, (uint32_t) pcmSamples.size(), loopStartSample, loopEndSample, bAddZone);
+
+    if (pErrorMsg) {
+        graphics.ShowMessageBox(pErrorMsg, "Error!", EMsgBoxType::kMB_OK);
+    }
+}
 
-    // Update sample related parameters and lock the SPU at this point
-    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Load the given sample from a VAG file into either the selected zone or a new zone which covers all notes and velocities.
+// Returns an error message if the sample can't be loaded, or null if it is loaded.
+//------------------------------------------------------------------------------------------------------------------------------------------
+const char* PsxSampler::LoadZoneSample(
+    std::vector<std::byte>& adpcmData,
+    const uint32_t sampleRate,
+    const uint32_t numPcmSamples,
+    const uint32_t loopStartSample,
+    const uint32_t loopEndSample,
+    const bool bAddZone
+) noexcept {
+    // Lock the sample at this point: the hardware and zones must not change while the sample is being loaded for them
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
 
+    if (bAddZone && (mZones.size() >= kMaxZones)) {
+        return "Unable to add another sample zone: the instrument has the maximum number of zones already!";
+    }
+
+    // Allocate SPU RAM for the sample, either in a new zone or in place of the selected zone's sample
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds = GetZoneSounds();
+    UpdateSelectedZoneFromParams();
+
+    if (bAddZone) {
+        SampleZone zone = { 0, 127, 0, 127, 0.0, SpuRamAlloc::INVALID_ADDR, 0 };
+
+        if (!AllocZoneSpuRam(zone, (uint32_t) adpcmData.size(), 0)) {
+            return "Unable to add another sample zone: there is no SPU RAM left for it!";
+        }
+
+        mZones.push_back(zone);
+        zoneSounds.push_back(SharedSampleStore::SoundPlacement{});
+        mSelectedZoneIdx = (uint32_t) mZones.size() - 1;
+        GetParam(kParamNoteMin)->Set(0.0);
+        GetParam(kParamNoteMax)->Set(127.0);
+    } else {
+        // Note: this can't fail, since at least as much SPU RAM as the previous sample had is free again
+        SampleZone& zone = mZones[mSelectedZoneIdx];
+        SpuRamAlloc::deallocate(mSpuRamHeap, zone.spuRamAddr);
+        AllocZoneSpuRam(zone, (uint32_t) adpcmData.size(), 0);
+    }
+
+    // Clamp the length of the VAG file to fit in the SPU RAM allocated for it, leaving room for the terminator
+    const SampleZone& zone = mZones[mSelectedZoneIdx];
+    const uint32_t numAdpcmBlocks = std::min((uint32_t) adpcmData.size() / Spu::ADPCM_BLOCK_SIZE, zone.spuRamSize / Spu::ADPCM_BLOCK_SIZE - 2);
+    adpcmData.resize((size_t) numAdpcmBlocks * Spu::ADPCM_BLOCK_SIZE);
+    zoneSounds[mSelectedZoneIdx].pAdpcmData = adpcmData.data();
+    zoneSounds[mSelectedZoneIdx].adpcmSize = (uint32_t) adpcmData.size();
+
+    // Update sample related parameters
     GetParam(kParamSampleRate)->Set((double) sampleRate);
     SetBaseNoteFromSampleRate();
-    GetParam(kParamLengthInSamples)->Set((double) pcmSamples.size());
+    GetParam(kParamLengthInSamples)->Set((double) numPcmSamples);
     GetParam(kParamLengthInBlocks)->Set((double) numAdpcmBlocks);
     GetParam(kParamLoopStartSample)->Set((double) loopStartSample);
     GetParam(kParamLoopEndSample)->Set((double) loopEndSample);
-    GetUI()->SetAllControlsDirty();
 
-    // Transfer the sound data to the SPU and terminate the sample
-    std::memcpy(mSpu.pRam, adpcmData.data(), (size_t) numAdpcmBlocks * Spu::ADPCM_BLOCK_SIZE);
-    AddSampleTerminator();
-
-    // Kill all currently playing SPU voices
-    KillAllSpuVoices();
+    // Stage the sound data for the audio thread to swap into SPU RAM.
+    // Currently playing voices will be faded out and stopped when this happens.
+    // The SPU RAM image is shared with any other instances which have the same samples loaded in the same places.
+    AcquireZoneSounds(zoneSounds);
+    UpdateZoneControls();
+    PublishVoiceParams();
+    StageSampleInSpuRam();
+    return nullptr;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -1017,15 +1992,23 @@ void PsxSampler::DoSaveVagFilePrompt(IGraphics& graphics) noexcept {
     if (filePath.GetLength() <= 0)
         return;
 
-    // Get the size of the currently loaded sound and the sample rate
-    const uint32_t numAdpcmBlocks = (uint32_t) GetParam(kParamLengthInBlocks)->Value();
-    const uint32_t numAdpcmBytes = numAdpcmBlocks * Spu::ADPCM_BLOCK_SIZE;
+    // Get the sound of the selected zone and the sample rate.
+    // Keep a reference to the sample rather than holding the lock: an error message box must not hold up everything waiting on the lock.
+    SharedSampleStore::SharedSampleRef pSample;
+    uint32_t zoneIdx;
+
+    {
+        std::lock_guard<std::mutex> lockSample(mSampleMutex);
+        pSample = mSample;
+        zoneIdx = mSelectedZoneIdx;
+    }
+
+    const std::vector<std::byte>& adpcmData = pSample->sounds[zoneIdx].adpcmData;
+    const uint32_t numAdpcmBytes = (uint32_t) adpcmData.size();
     const uint32_t sampleRate = (uint32_t) GetParam(kParamSampleRate)->Value();
 
     // Save the VAG file
-    std::lock_guard<std::recursive_mutex> lockSpu(mSpuMutex);
-
-    if (!VagUtils::writePsxAdpcmSoundToVagFile(filePath.Get(), mSpu.pRam, numAdpcmBytes, sampleRate)) {
+    if (!VagUtils::writePsxAdpcmSoundToVagFile(filePath.Get(), adpcmData.data(), numAdpcmBytes, sampleRate)) {
         graphics.ShowMessageBox("Unable to save to the specified .VAG file. Do you have write permissions or is the disk full?", "Error!", EMsgBoxType::kMB_OK);
     }
 }
@@ -1138,8 +2121,11 @@ void PsxSampler::DoLoadParamsFilePrompt(IGraphics& graphics) noexcept {
     mpSwitch_ReleaseShift->SetValue(GetParam(kParamReleaseShift)->GetNormalized());
     mpSwitch_ReleaseIsExp->SetValue(GetParam(kParamReleaseIsExp)->GetNormalized());
 
-    // Need to refresh the UI after all this value setting
+    // Need to refresh the UI after all this value setting and let the audio thread know about the new parameters.
+    // The sample and note range parameters loaded apply to the selected zone.
     GetUI()->SetAllControlsDirty();
+    std::lock_guard<std::mutex> lockSample(mSampleMutex);
+    PublishVoiceParams();
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -1242,18 +2228,16 @@ void PsxSampler::SetSampleRateFromBaseNote() noexcept {
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Do 'note off' for any notes that are now out of range according to the note min/max settings
+// Do 'note off' for any notes that are now out of range of the zone they are played with, according to the zone's note and velocity range
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::DoNoteOffForOutOfRangeNotes() noexcept {
-    // Release any notes that are playing, not already releasing and which are now out of range...
-    const uint32_t minNote = (uint32_t) GetParam(kParamNoteMin)->Value();
-    const uint32_t maxNote = (uint32_t) GetParam(kParamNoteMax)->Value();
-
-    for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        const uint16_t note = mVoiceInfos[i].midiNote;
+    // Release any notes that are playing, not already releasing and which are now out of range (or whose zone is gone)...
+    for (uint32_t voiceIdx = mOldestVoiceIdx; voiceIdx != kNoVoice; voiceIdx = mVoiceInfos[voiceIdx].nextVoiceIdx) {
+        const VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
+        const uint64_t zoneMask = mVoiceParams.noteZoneMasks[voiceInfo.midiNote] & mVoiceParams.velocityZoneMasks[voiceInfo.midiVelocity];
 
-        if ((note < minNote) || (note > maxNote)) {
-            Spu::Voice& voice = mSpu.pVoices[i];
+        if ((zoneMask & ((uint64_t) 1 << voiceInfo.zoneIdx)) == 0) {
+            Spu::Voice& voice = GetSpuVoice(voiceIdx);
 
             if ((voice.envPhase != Spu::EnvPhase::Release) && (voice.envPhase != Spu::EnvPhase::Off)) {
                 Spu::keyOff(voice);
@@ -1266,8 +2250,8 @@ void PsxSampler::DoNoteOffForOutOfRangeNotes() noexcept {
 // Keys off all currently playing SPU voices which are not already keying off
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::KeyOffAllSpuVoices() noexcept {
-    for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        Spu::Voice& voice = mSpu.pVoices[i];
+    for (uint32_t voiceIdx = mOldestVoiceIdx; voiceIdx != kNoVoice; voiceIdx = mVoiceInfos[voiceIdx].nextVoiceIdx) {
+        Spu::Voice& voice = GetSpuVoice(voiceIdx);
 
         if ((voice.envPhase != Spu::EnvPhase::Release) && (voice.envPhase != Spu::EnvPhase::Off)) {
             Spu::keyOff(voice);
@@ -1280,8 +2264,143 @@ void PsxSampler::KeyOffAllSpuVoices() noexcept {
 //------------------------------------------------------------------------------------------------------------------------------------------
 void PsxSampler::KillAllSpuVoices() noexcept {
     for (uint32_t i = 0; i < kMaxVoices; ++i) {
-        Spu::Voice& voice = mSpu.pVoices[i];
+        Spu::Voice& voice = GetSpuVoice(i);
         voice.envLevel = 0;
         voice.envPhase = Spu::EnvPhase::Off;
     }
+
+    // The SPU does not send voice off notifications for voices that are killed directly: free them all here instead
+    ResetVoiceAllocation();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if any SPU voices are currently playing
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool PsxSampler::AreAnySpuVoicesActive() const noexcept {
+    return (mOldestVoiceIdx != kNoVoice);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the SPU voice for the given voice index: voices are numbered consecutively across all the SPU cores
+//------------------------------------------------------------------------------------------------------------------------------------------
+Spu::Voice& PsxSampler::GetSpuVoice(const uint32_t voiceIdx) noexcept {
+    assert(voiceIdx < kMaxVoices);
+    return mSpuCores[voiceIdx / kVoicesPerSpuCore].pVoices[voiceIdx % kVoicesPerSpuCore];
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Marks all voices of the SPU cores in use as free, in index order, and forgets which notes they were playing.
+// Voices of SPU cores which are not in use are left out of the free list, so they are never allocated.
+// Note: the SPU voices themselves are expected to be off already.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::ResetVoiceAllocation() noexcept {
+    const uint32_t numVoices = mNumSpuCores * kVoicesPerSpuCore;
+    assert(numVoices <= kMaxVoices);
+
+    for (uint32_t voiceIdx = 0; voiceIdx < kMaxVoices; ++voiceIdx) {
+        VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
+        voiceInfo.midiNote = 0xFFFFu;
+        voiceInfo.midiVelocity = 0xFFFFu;
+        voiceInfo.prevVoiceIdx = kNoVoice;
+        voiceInfo.nextVoiceIdx = (voiceIdx + 1 < numVoices) ? (uint8_t)(voiceIdx + 1) : kNoVoice;
+        voiceInfo.zoneIdx = 0;
+    }
+
+    mFreeVoicesHead = (numVoices > 0) ? 0 : kNoVoice;
+    mOldestVoiceIdx = kNoVoice;
+    mNewestVoiceIdx = kNoVoice;
+
+    for (uint64_t& noteVoiceMask : mNoteVoiceMasks) {
+        noteVoiceMask = 0;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocates a voice to play the given note with the given zone and makes it the newest playing voice, returning the voice index.
+// A free voice is used if there is one, otherwise the oldest playing voice is stolen.
+// Note: must only be called from the audio thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t PsxSampler::AllocVoice(const uint8_t note, const uint8_t velocity, const uint8_t zoneIdx) noexcept {
+    assert(note < 128);
+    assert(zoneIdx < kMaxZones);
+    uint32_t voiceIdx = mFreeVoicesHead;
+
+    if (voiceIdx != kNoVoice) {
+        mFreeVoicesHead = mVoiceInfos[voiceIdx].nextVoiceIdx;
+    } else {
+        // Steal the oldest voice: unlink it from the playing list and stop associating it with it's current note
+        voiceIdx = mOldestVoiceIdx;
+        assert(voiceIdx != kNoVoice);
+        VoiceInfo& oldestVoiceInfo = mVoiceInfos[voiceIdx];
+        mOldestVoiceIdx = oldestVoiceInfo.nextVoiceIdx;
+
+        if (mOldestVoiceIdx != kNoVoice) {
+            mVoiceInfos[mOldestVoiceIdx].prevVoiceIdx = kNoVoice;
+        } else {
+            mNewestVoiceIdx = kNoVoice;
+        }
+
+        mNoteVoiceMasks[oldestVoiceInfo.midiNote] &= ~((uint64_t) 1 << voiceIdx);
+    }
+
+    // Add to the end of the playing list and associate with the new note
+    VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
+    voiceInfo.midiNote = note;
+    voiceInfo.midiVelocity = velocity;
+    voiceInfo.zoneIdx = zoneIdx;
+    voiceInfo.prevVoiceIdx = mNewestVoiceIdx;
+    voiceInfo.nextVoiceIdx = kNoVoice;
+
+    if (mNewestVoiceIdx != kNoVoice) {
+        mVoiceInfos[mNewestVoiceIdx].nextVoiceIdx = (uint8_t) voiceIdx;
+    } else {
+        mOldestVoiceIdx = (uint8_t) voiceIdx;
+    }
+
+    mNewestVoiceIdx = (uint8_t) voiceIdx;
+    mNoteVoiceMasks[note] |= (uint64_t) 1 << voiceIdx;
+    return voiceIdx;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Removes the given voice from the playing list and returns it to the free list.
+// Note: must only be called from the audio thread.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void PsxSampler::FreeVoice(const uint32_t voiceIdx) noexcept {
+    assert(voiceIdx < kMaxVoices);
+    VoiceInfo& voiceInfo = mVoiceInfos[voiceIdx];
+
+    // Ignore the voice if it's already free
+    if (voiceInfo.midiNote >= 128)
+        return;
+
+    // Unlink from the playing list
+    if (voiceInfo.prevVoiceIdx != kNoVoice) {
+        mVoiceInfos[voiceInfo.prevVoiceIdx].nextVoiceIdx = voiceInfo.nextVoiceIdx;
+    } else {
+        mOldestVoiceIdx = voiceInfo.nextVoiceIdx;
+    }
+
+    if (voiceInfo.nextVoiceIdx != kNoVoice) {
+        mVoiceInfos[voiceInfo.nextVoiceIdx].prevVoiceIdx = voiceInfo.prevVoiceIdx;
+    } else {
+        mNewestVoiceIdx = voiceInfo.prevVoiceIdx;
+    }
+
+    // Stop associating it with it's note and push it onto the free list
+    mNoteVoiceMasks[voiceInfo.midiNote] &= ~((uint64_t) 1 << voiceIdx);
+    voiceInfo.midiNote = 0xFFFFu;
+    voiceInfo.midiVelocity = 0xFFFFu;
+    voiceInfo.prevVoiceIdx = kNoVoice;
+    voiceInfo.nextVoiceIdx = mFreeVoicesHead;
+    mFreeVoicesHead = (uint8_t) voiceIdx;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Called by the given SPU core during rendering whenever one of it's voices switches off: the voice is now free to be used for another note
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <uint32_t CoreIdx>
+void PsxSampler::OnSpuVoiceOff(void* const pUserData, const uint32_t coreVoiceIdx) noexcept {
+    static_assert(CoreIdx < kMaxSpuCores);
+    static_cast<PsxSampler*>(pUserData)->FreeVoice(CoreIdx * kVoicesPerSpuCore + coreVoiceIdx);
 }
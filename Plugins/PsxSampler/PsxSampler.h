@@ -3,8 +3,14 @@
 #include "IPlug_include_in_plug_hdr.h"
 
 #include "IControls.h"
+#include "../../PluginsCommon/Resampler.h"
+#include "../../PluginsCommon/SharedSampleStore.h"
 #include "../../PluginsCommon/Spu.h"
+#include "../../PluginsCommon/SpuRamAlloc.h"
+#include "../../PluginsCommon/TripleBuffer.h"
+#include <atomic>
 #include <mutex>
+#include <vector>
 
 using namespace iplug;
 using namespace igraphics;
@@ -13,6 +19,7 @@ using namespace igraphics;
 // All of the parameters used by the instrument.
 // Note that some of these are purely informational, and don't actually affect anything.
 // Sample rate and base note are also two views looking at the same information.
+// The sample parameters and the note range are those of the currently selected sample zone.
 //------------------------------------------------------------------------------------------------------------------------------------------
 enum EParams : uint32_t {
     kParamSampleRate,
@@ -58,8 +65,13 @@ enum EControlTags : uint32_t {
 //------------------------------------------------------------------------------------------------------------------------------------------
 class PsxSampler final : public Plugin {
 public:
-    // Maximum number of active voices: this is the hardware limit of the PS1
-    static constexpr uint32_t kMaxVoices = 24;
+    // Maximum number of active voices: each SPU core has the 24 voices of the PS1, and the PS2 has 2 SPU cores
+    static constexpr uint32_t kVoicesPerSpuCore = Spu::PS1_NUM_VOICES;
+    static constexpr uint32_t kMaxSpuCores = Spu::PS2_NUM_CORES;
+    static constexpr uint32_t kMaxVoices = kVoicesPerSpuCore * kMaxSpuCores;
+
+    // Maximum number of sample zones: the zones covering each note and velocity are tracked by 64-bit masks
+    static constexpr uint32_t kMaxZones = 64;
 
     PsxSampler(const InstanceInfo& info) noexcept;
     virtual ~PsxSampler() noexcept override;
@@ -67,23 +79,138 @@ public:
     virtual void ProcessBlock(sample** pInputs, sample** pOutputs, int numFrames) noexcept override;
     virtual void ProcessMidiMsg(const IMidiMsg& msg) noexcept override;
     virtual void OnIdle() noexcept override;
+    virtual void OnReset() noexcept override;
     virtual bool SerializeState(IByteChunk &chunk) const noexcept override;
     virtual int UnserializeState(const IByteChunk &chunk, int startPos) noexcept override;
 
 private:
-    // Information for a playing voice
+    // Information for a voice and it's place in the voice lists.
+    // Free voices are kept in a singly linked list, and playing voices in a doubly linked list ordered by when they were keyed on.
     struct VoiceInfo {
-        uint16_t midiNote;            // The note played
+        uint16_t midiNote;            // The note played: 0xFFFF if the voice is free
         uint16_t midiVelocity;        // 0-127 velocity
-        uint32_t numSamplesActive;    // Number of samples the voice has been active for
+        uint8_t  prevVoiceIdx;        // The next oldest playing voice, or 'kNoVoice' if none
+        uint8_t  nextVoiceIdx;        // The next newest playing voice or the next free voice, or 'kNoVoice' if none
+        uint8_t  zoneIdx;             // The sample zone the note is played with
+    };
+
+    // Used to terminate the voice lists
+    static constexpr uint8_t kNoVoice = 0xFFu;
+    static_assert(kMaxVoices < kNoVoice);
+    static_assert(kMaxVoices <= 64, "Each note's voices are tracked by a 64-bit mask!");
+
+    // A range of notes and velocities which is played with one sample, and where that sample is in SPU RAM.
+    // The sample data is in the shared SPU RAM image for the instrument, as the sound with the same index as the zone.
+    // The settings of the selected zone are edited through the plugin parameters for the sample and note range.
+    struct SampleZone {
+        uint8_t     noteMin;                // Lowest note the zone plays
+        uint8_t     noteMax;                // Highest note the zone plays
+        uint8_t     velocityMin;            // Lowest velocity the zone plays
+        uint8_t     velocityMax;            // Highest velocity the zone plays
+        double      baseNote;               // Note at which the zone's sample plays at 44,100 Hz
+        uint32_t    spuRamAddr;             // Where SPU RAM is allocated for the sample and it's terminator: 'SpuRamAlloc::INVALID_ADDR' if not allocated
+        uint32_t    spuRamSize;             // How much SPU RAM is allocated for the sample and it's terminator
+    };
+
+    // The settings of a sample zone needed by the audio thread to play notes with it
+    struct ZoneParams {
+        float       baseNote;               // Note at which the zone's sample plays at 44,100 Hz
+        uint8_t     noteMin;                // Lowest note the zone plays
+        uint8_t     noteMax;                // Highest note the zone plays
+        uint8_t     velocityMin;            // Lowest velocity the zone plays
+        uint8_t     velocityMax;            // Highest velocity the zone plays
+    };
+
+    // A snapshot of the instrument parameters which affect how SPU voices are played.
+    // These are captured on the UI thread and handed to the audio thread, so the audio thread only needs to read the plugin parameters when
+    // the host changes them (see 'ApplyHostParamChanges').
+    struct VoiceParams {
+        uint64_t            zonesSampleHash;        // Content hash of the SPU RAM image the zones are laid out in: notes are ignored until it's swapped in
+        uint32_t            numZones;               // How many sample zones there are
+        uint32_t            selectedZoneIdx;        // Which zone the sample and note range parameters are for
+        ZoneParams          zones[kMaxZones];       // Settings for each sample zone
+        uint64_t            noteZoneMasks[128];     // Which zones play each MIDI note: bit 'N' is for zone 'N'
+        uint64_t            velocityZoneMasks[128]; // Which zones play each MIDI velocity: bit 'N' is for zone 'N'
+        uint32_t            volume;                 // 0-127 volume
+        uint32_t            pan;                    // 0-127 pan, 64 = center
+        float               pitchstepUp;            // Pitch bend range (semitones) when bending up
+        float               pitchstepDown;          // Pitch bend range (semitones) when bending down
+        float               pitchBendUpOffset;      // Extra semitones added for any amount of upward pitch bend
+        float               pitchBendDownOffset;    // Extra semitones subtracted for any amount of downward pitch bend
+        Spu::AdsrEnvelope   adsrEnv;                // Envelope used by all voices
+        Spu::SampleMode     sampleMode;             // Whether the SPU does accurate 16-bit or clean floating point processing
     };
 
-    Spu::Core                       mSpu;
-    mutable std::recursive_mutex    mSpuMutex;
+    // Flags for which voice properties need to be updated after a parameter or pitch bend change
+    static constexpr uint32_t kVoiceDirtyPitch      = 0x1;
+    static constexpr uint32_t kVoiceDirtyVolume     = 0x2;
+    static constexpr uint32_t kVoiceDirtyEnvelope   = 0x4;
+
+    // Who owns the staged sample and whether it is waiting to be swapped in.
+    //  Idle:       The UI thread owns the staged sample reference and can replace it.
+    //  Pending:    A new sample has been staged and is waiting for the audio thread to swap it in.
+    //              The UI thread can take the sample back (by switching to 'Idle') if it has not been swapped in yet.
+    //  Applying:   The audio thread is swapping the staged sample in, which only takes a moment.
+    enum class SpuRamSwapState : uint8_t {
+        Idle,
+        Pending,
+        Applying
+    };
+
+    // Which PlayStation's sound hardware is emulated, which determines the number of voices and the amount of SPU RAM.
+    //  Ps1:    A single SPU core with 24 voices and 512 KiB of SPU RAM.
+    //  Ps2:    The 2 cores of the SPU2 with 48 voices in total, sharing 2 MiB of SPU RAM. Each core has it's own output and (unused) reverb.
+    enum class SpuHardware : uint8_t {
+        Ps1,
+        Ps2
+    };
+
+    // The sample zones and SPU settings read from a saved state, before they are applied to the instrument.
+    // The sample data for the zones is either decompressed from the state or shared with another instance which already has the same data.
+    struct SavedZones {
+        Spu::SampleMode                                 sampleMode;         // SPU sample mode saved with the zones
+        SpuHardware                                     spuHardware;        // SPU hardware saved with the zones
+        std::vector<SampleZone>                         zones;              // The zones, not yet placed in SPU RAM
+        uint32_t                                        selectedZoneIdx;    // Which zone was selected
+        std::vector<SharedSampleStore::SoundPlacement>  zoneSounds;         // The sample data for each zone, pointing into 'adpcmData' or the sounds of 'pSharedSample'
+        std::vector<std::byte>                          adpcmData;          // The sample data of all zones in zone order, unless shared with another instance
+        SharedSampleStore::SharedSampleRef              pSharedSample;      // Another instance's SPU RAM image with the same sample data, if found
+    };
+
+    Spu::Core                       mSpuCores[kMaxSpuCores];  // The SPU cores: only the first is used when emulating the PS1
+    uint32_t                        mNumSpuCores;             // How many SPU cores are in use for the active sample: only touched by the audio thread
+    mutable std::mutex              mSampleMutex;             // Guards the sample data and SPU RAM staging against concurrent non-audio threads: never taken by the audio thread
+    SharedSampleStore::SharedSampleRef  mSample;              // The SPU RAM image with the samples of all zones, as seen by the UI (may not be swapped into the SPU yet)
+    SharedSampleStore::SharedSampleRef  mStagedSample;        // Sample waiting to be swapped in by the audio thread, or the previously active sample after a swap
+    SharedSampleStore::SharedSampleRef  mActiveSample;        // Sample whose SPU RAM image the SPU is currently using: only touched by the audio thread
+    std::atomic<Spu::SampleMode>    mSampleMode;              // Sample mode chosen in the UI: saved with the state rather than as a parameter, so older states still load
+    std::atomic<SpuHardware>        mSpuHardware;             // Hardware chosen in the UI, which the current sample's SPU RAM image is made for: saved with the state like the sample mode
+    SpuHardware                     mStagedSpuHardware;       // Hardware the staged sample's SPU RAM image is made for: owned by the same thread as the staged sample
+    std::vector<SampleZone>         mZones;                   // The sample zones, as seen by the UI: guarded by the sample lock
+    uint32_t                        mSelectedZoneIdx;         // Which zone is being edited through the plugin parameters: guarded by the sample lock
+    SpuRamAlloc::Heap               mSpuRamHeap;              // Allocates the SPU RAM used by the sample of each zone: guarded by the sample lock
+    std::atomic<SpuRamSwapState>    mSpuRamSwapState;         // Controls ownership of the staged sample
+    uint32_t                        mSpuRamFadeFramesLeft;    // How many more frames of fade out before the staged sample can be swapped in
+    bool                            mbSpuRamFading;           // True if voices are being faded out so the staged sample can be swapped in
     uint32_t                        mCurMidiPitchBend;        // Current MIDI pitch bend value, a 14-bit value: 0x2000 = center, 0x0000 = lowest, 0x3FFF = highest
+    float                           mCurPitchBendInNotes;     // Pitch bend in semitones for the current MIDI pitch bend and bend range parameters
+    uint64_t                        mNotePitchesValid[2];     // Bit mask of which entries in 'mNotePitches' are up to date
+    uint16_t                        mNotePitches[128];        // Cached SPU sample rate for each MIDI note, given the base note of the zone it was computed for and pitch bend
+    uint8_t                         mNotePitchZones[128];     // Which zone each entry in 'mNotePitches' was computed for
+    VoiceParams                     mVoiceParams;             // Parameters currently in use by the audio thread
+    TripleBuffer<VoiceParams>       mPendingVoiceParams;      // Parameter snapshots published by the UI thread for the audio thread to pick up
+    std::atomic<bool>               mbHostParamsChanged;      // Set when the host changes a parameter affecting voices, for the audio thread to pick up
     VoiceInfo                       mVoiceInfos[kMaxVoices];
+    uint8_t                         mFreeVoicesHead;          // The first voice in the list of free voices
+    uint8_t                         mOldestVoiceIdx;          // The first voice in the list of playing voices: this is the voice stolen if there are no free voices
+    uint8_t                         mNewestVoiceIdx;          // The last voice in the list of playing voices: the most recently keyed on
+    uint64_t                        mNoteVoiceMasks[128];     // Which voices are playing each MIDI note: bit 'N' is for voice 'N'
     IPeakSender<2>                  mMeterSender;
     IMidiQueue                      mMidiQueue;
+    Resampler::Stream               mOutputResampler;         // Converts the SPU output from it's native 44.1 KHz to the host sample rate
+    std::vector<float>              mSpuOutput[2];            // Left and right SPU output waiting to be converted to the host sample rate
+    std::vector<float>              mSpuCoreOutput[2];        // Left and right output of the 2nd SPU core, before it is added to the output of the 1st
+    std::vector<float>              mResampledOutput[2];      // Left and right SPU output after being converted to the host sample rate
     ICaptionControl*                mpCaption_SampleRate;
     ICaptionControl*                mpCaption_BaseNote;
     IVKnobControl*                  mpKnob_Volume;
@@ -105,25 +232,57 @@ private:
     IVSlideSwitchControl*           mpSwitch_SustainIsExp;
     IVKnobControl*                  mpSwitch_ReleaseShift;
     IVSlideSwitchControl*           mpSwitch_ReleaseIsExp;
+    IVTabSwitchControl*             mpSwitch_SampleMode;
+    IVTabSwitchControl*             mpSwitch_SpuHardware;
+    ITextControl*                   mpText_Zone;
+    IEditableTextControl*           mpEdit_ZoneVelocityMin;
+    IEditableTextControl*           mpEdit_ZoneVelocityMax;
 
     void DefinePluginParams() noexcept;
     void DoEditorSetup() noexcept;
     void DoDspSetup() noexcept;
+    void SetupResampling() noexcept;
     virtual void InformHostOfParamChange(int idx, double normalizedValue) noexcept override;
+    virtual void OnParamChange(int idx, EParamSource source, int sampleOffset) noexcept override;
+    static int UnserializeZones(const IByteChunk& chunk, int startPos, SavedZones& savedZones) noexcept;
+    static int UnserializeLegacySample(const IByteChunk& chunk, int startPos, const uint32_t numAdpcmBlocks, SavedZones& savedZones) noexcept;
     virtual void OnRestoreState() noexcept override;
-    void AddSampleTerminator() noexcept;
-    void ProcessMidiQueue() noexcept;
+    void StageSampleInSpuRam() noexcept;
+    std::vector<SharedSampleStore::SoundPlacement> GetZoneSounds() const noexcept;
+    void AcquireZoneSounds(std::vector<SharedSampleStore::SoundPlacement>& zoneSounds) noexcept;
+    bool AllocZoneSpuRam(SampleZone& zone, const uint32_t adpcmSize, const uint32_t numReservedZones) noexcept;
+    void LayoutZonesInSpuRam(const std::vector<SharedSampleStore::SoundPlacement>& zoneSounds) noexcept;
+    void StepSelectedZone(const int32_t zoneIdxOffset) noexcept;
+    void UpdateSelectedZoneFromParams() noexcept;
+    void UpdateParamsFromSelectedZone() noexcept;
+    void UpdateZoneControls() noexcept;
+    void RemoveSelectedZone() noexcept;
+    void SetSelectedZoneVelocityLimit(const bool bMaxLimit, const int32_t velocity) noexcept;
+    void ApplyPendingSpuRam() noexcept;
+    void SetSampleMode(const Spu::SampleMode sampleMode) noexcept;
+    void SetSpuHardware(const SpuHardware hardware) noexcept;
+    static uint32_t GetSpuRamSize(const SpuHardware hardware) noexcept;
+    static uint32_t GetNumSpuCores(const SpuHardware hardware) noexcept;
+    void PublishVoiceParams() noexcept;
+    void GetVoiceParamsFromParams(VoiceParams& params) const noexcept;
+    void ApplyPendingVoiceParams() noexcept;
+    void ApplyHostParamChanges() noexcept;
+    void ApplyVoiceParams(const VoiceParams& newParams) noexcept;
+    void RenderSpu(sample** const pOutputs, const int numChannels, const int startFrameIdx, const int numFrames) noexcept;
     void ProcessQueuedMidiMsg(const IMidiMsg& msg) noexcept;
     void ProcessMidiNoteOn(const uint8_t note, const uint8_t velocity) noexcept;
     void ProcessMidiNoteOff(const uint8_t note) noexcept;
     void ProcessMidiPitchBend(const uint16_t pitchBend) noexcept;
     void ProcessMidiAllNotesOff() noexcept;
-    void UpdateSpuVoicesFromParams() noexcept;
+    void UpdateSpuVoicesFromParams(const uint32_t dirtyFlags) noexcept;
     void UpdateSpuVoiceFromParams(const uint32_t voiceIdx) noexcept;
+    bool UpdatePitchBendInNotes() noexcept;
+    uint16_t GetNoteSpuPitch(const uint32_t note, const uint32_t zoneIdx) noexcept;
     static Spu::Volume CalcSpuVoiceVolume(const uint32_t volume, const uint32_t pan, const uint32_t velocity) noexcept;
     Spu::AdsrEnvelope GetCurrentSpuAdsrEnv() const noexcept;
     float GetCurrentPitchBendInNotes() const noexcept;
-    void DoLoadVagFilePrompt(IGraphics& graphics) noexcept;
+    void DoLoadVagFilePrompt(IGraphics& graphics, const bool bAddZone) noexcept;
+    const char* LoadZoneSample(std::vector<std::byte>& adpcmData, const uint32_t sampleRate, const uint32_t numPcmSamples, const uint32_t loopStartSample, const uint32_t loopEndSample, const bool bAddZone) noexcept;
     void DoSaveVagFilePrompt(IGraphics& graphics) noexcept;
     void DoLoadParamsFilePrompt(IGraphics& graphics) noexcept;
     void DoSaveParamsFilePrompt(IGraphics& graphics) noexcept;
@@ -132,4 +291,12 @@ private:
     void DoNoteOffForOutOfRangeNotes() noexcept;
     void KeyOffAllSpuVoices() noexcept;
     void KillAllSpuVoices() noexcept;
+    bool AreAnySpuVoicesActive() const noexcept;
+    Spu::Voice& GetSpuVoice(const uint32_t voiceIdx) noexcept;
+    void ResetVoiceAllocation() noexcept;
+    uint32_t AllocVoice(const uint8_t note, const uint8_t velocity, const uint8_t zoneIdx) noexcept;
+    void FreeVoice(const uint32_t voiceIdx) noexcept;
+
+    template <uint32_t CoreIdx>
+    static void OnSpuVoiceOff(void* const pUserData, const uint32_t coreVoiceIdx) noexcept;
 };
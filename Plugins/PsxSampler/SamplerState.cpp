@@ -0,0 +1,169 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The versioned part of the PsxSampler plugin state
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "SamplerState.h"
+
+#include "../PluginsCommon/LzCodec.h"
+#include "../PluginsCommon/SharedSampleStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+BEGIN_NAMESPACE(SamplerState)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Append a value to the state being written
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class T>
+static void putValue(std::vector<std::byte>& out, const T value) noexcept {
+    const size_t pos = out.size();
+    out.resize(pos + sizeof(T));
+    std::memcpy(out.data() + pos, &value, sizeof(T));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Read a value from the state at the given position and move past it.
+// Once a read runs past the end of the data the position is '-1', and all following reads fail too.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class T>
+static void getValue(const std::byte* const pData, const uint32_t dataSize, int& pos, T& value) noexcept {
+    if ((pos < 0) || ((uint64_t) pos + sizeof(T) > dataSize)) {
+        pos = -1;
+        return;
+    }
+
+    std::memcpy(&value, pData + pos, sizeof(T));
+    pos += (int) sizeof(T);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Append the state to the given bytes, with the samples of all zones already compressed
+//------------------------------------------------------------------------------------------------------------------------------------------
+void writeState(const State& state, const std::vector<std::byte>& compressedSamples, std::vector<std::byte>& out) noexcept {
+    // Write the state version and SPU settings
+    putValue(out, STATE_TAG);
+    putValue(out, STATE_VERSION);
+    putValue(out, state.sampleMode);
+    putValue(out, state.spuHardware);
+    putValue(out, (uint32_t) state.zones.size());
+    putValue(out, state.selectedZoneIdx);
+
+    // Write the sample zones, along with the size of each zone's sample
+    for (const Zone& zone : state.zones) {
+        putValue(out, (uint32_t) zone.noteMin);
+        putValue(out, (uint32_t) zone.noteMax);
+        putValue(out, (uint32_t) zone.velocityMin);
+        putValue(out, (uint32_t) zone.velocityMax);
+        putValue(out, zone.baseNote);
+        putValue(out, zone.adpcmSize);
+    }
+
+    // Write the hash of the samples and the compressed samples
+    putValue(out, state.soundDataHash);
+    putValue(out, (uint32_t) compressedSamples.size());
+    out.insert(out.end(), compressedSamples.begin(), compressedSamples.end());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if a versioned state starts at the given position
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool hasStateTag(const std::byte* const pData, const uint32_t dataSize, const int startPos) noexcept {
+    uint32_t stateTag = 0;
+    int pos = startPos;
+    getValue(pData, dataSize, pos, stateTag);
+    return ((pos >= 0) && (stateTag == STATE_TAG));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Read the state at the given position, starting with the state tag, and decompress the samples of all zones into 'adpcmData'.
+// The samples are checked against the hash saved with them after decompressing, since the compressed data has no checks of it's own.
+// Returns the position after the state, or '-1' if the state is not valid: states saved by newer versions of the plugin can't be read.
+//------------------------------------------------------------------------------------------------------------------------------------------
+int readState(const std::byte* const pData, const uint32_t dataSize, int startPos, State& state, std::vector<std::byte>& adpcmData) noexcept {
+    const auto fail = [&]() noexcept {
+        state.zones.clear();
+        adpcmData.clear();
+        return -1;
+    };
+
+    // Read the state version and SPU settings
+    uint32_t stateTag = 0;
+    uint32_t stateVersion = 0;
+    uint32_t numZones = 0;
+
+    getValue(pData, dataSize, startPos, stateTag);
+    getValue(pData, dataSize, startPos, stateVersion);
+    getValue(pData, dataSize, startPos, state.sampleMode);
+    getValue(pData, dataSize, startPos, state.spuHardware);
+    getValue(pData, dataSize, startPos, numZones);
+    getValue(pData, dataSize, startPos, state.selectedZoneIdx);
+
+    if ((startPos < 0) || (stateTag != STATE_TAG) || (stateVersion != STATE_VERSION) || (numZones > MAX_ZONES) || (state.selectedZoneIdx >= numZones))
+        return fail();
+
+    // Read the sample zones and the size of each zone's sample.
+    // The total is kept in 64-bits so a corrupt zone table can't wrap it around and get past the size check.
+    state.zones.clear();
+    uint64_t numAdpcmBytes = 0;
+
+    for (uint32_t zoneIdx = 0; zoneIdx < numZones; ++zoneIdx) {
+        uint32_t noteMin = 0;
+        uint32_t noteMax = 0;
+        uint32_t velocityMin = 0;
+        uint32_t velocityMax = 0;
+        double baseNote = 0.0;
+        uint32_t adpcmSize = 0;
+
+        getValue(pData, dataSize, startPos, noteMin);
+        getValue(pData, dataSize, startPos, noteMax);
+        getValue(pData, dataSize, startPos, velocityMin);
+        getValue(pData, dataSize, startPos, velocityMax);
+        getValue(pData, dataSize, startPos, baseNote);
+        getValue(pData, dataSize, startPos, adpcmSize);
+        numAdpcmBytes += adpcmSize;
+
+        if ((startPos < 0) || (numAdpcmBytes > MAX_SAMPLES_SIZE))
+            return fail();
+
+        Zone& zone = state.zones.emplace_back();
+        zone.noteMin = (uint8_t) std::min(noteMin, 127u);
+        zone.noteMax = (uint8_t) std::min(noteMax, 127u);
+        zone.velocityMin = (uint8_t) std::min(velocityMin, 127u);
+        zone.velocityMax = (uint8_t) std::min(velocityMax, 127u);
+        zone.baseNote = baseNote;
+        zone.adpcmSize = adpcmSize;
+    }
+
+    // Read the hash and size of the compressed samples, and make sure the compressed samples are all there
+    uint32_t compressedSize = 0;
+    getValue(pData, dataSize, startPos, state.soundDataHash);
+    getValue(pData, dataSize, startPos, compressedSize);
+
+    if ((startPos < 0) || ((uint64_t) startPos + compressedSize > dataSize))
+        return fail();
+
+    const std::byte* const pCompressedData = pData + startPos;
+    startPos += (int) compressedSize;
+
+    // Decompress the samples and make sure they are intact
+    adpcmData.resize((size_t) numAdpcmBytes);
+
+    if (!LzCodec::decompress(pCompressedData, compressedSize, adpcmData.data(), (uint32_t) numAdpcmBytes))
+        return fail();
+
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds;
+    zoneSounds.reserve(numZones);
+    const std::byte* pZoneAdpcmData = adpcmData.data();
+
+    for (const Zone& zone : state.zones) {
+        zoneSounds.push_back(SharedSampleStore::SoundPlacement{ 0, 0, pZoneAdpcmData, zone.adpcmSize });
+        pZoneAdpcmData += zone.adpcmSize;
+    }
+
+    if (SharedSampleStore::hashSoundData(zoneSounds.data(), numZones) != state.soundDataHash)
+        return fail();
+
+    return startPos;
+}
+
+END_NAMESPACE(SamplerState)
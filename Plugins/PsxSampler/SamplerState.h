@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../PluginsCommon/Macros.h"
+#include "../PluginsCommon/Spu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The versioned part of the PsxSampler plugin state, which comes after the plugin parameters: the SPU settings, the sample zones and the
+// samples of all zones. Kept apart from the plugin so the format can be checked without a plugin host.
+//
+// The state is laid out as follows, with all values in native byte order:
+//  (1) The state tag and version, the SPU sample mode and hardware, the number of zones and which zone is selected.
+//  (2) For each zone: the note and velocity ranges, the base note and the size of the zone's sample.
+//  (3) A hash of the samples of all zones (see 'SharedSampleStore::hashSoundData'), then their size compressed and the compressed data.
+//------------------------------------------------------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE(SamplerState)
+
+static constexpr uint32_t STATE_TAG         = 0x54535053u;          // 'SPST': marks a versioned state. Can't be mistaken for the ADPCM data older states have there, since it would use filter 5.
+static constexpr uint32_t STATE_VERSION     = 1;                    // Version of the state saved: bump when the state changes
+static constexpr uint32_t MAX_ZONES         = 64;                   // Most sample zones a state can have
+static constexpr uint32_t MAX_SAMPLES_SIZE  = Spu::PS2_RAM_SIZE;    // Most sample data a state can have for all zones: no more than fits in the SPU RAM of the largest hardware
+
+// A sample zone as saved in the state
+struct Zone {
+    uint8_t     noteMin;        // Lowest note the zone plays
+    uint8_t     noteMax;        // Highest note the zone plays
+    uint8_t     velocityMin;    // Lowest velocity the zone plays
+    uint8_t     velocityMax;    // Highest velocity the zone plays
+    double      baseNote;       // Note at which the zone's sample plays at 44,100 Hz
+    uint32_t    adpcmSize;      // Size of the zone's sample
+};
+
+// Everything in the state besides the sample data itself
+struct State {
+    uint32_t            sampleMode;         // The 'Spu::SampleMode' used
+    uint32_t            spuHardware;        // The SPU hardware emulated: as defined by the plugin
+    uint32_t            selectedZoneIdx;    // Which zone is selected
+    std::vector<Zone>   zones;              // The sample zones, in the order their samples are saved
+    uint64_t            soundDataHash;      // Hash of the samples of all zones
+};
+
+void writeState(const State& state, const std::vector<std::byte>& compressedSamples, std::vector<std::byte>& out) noexcept;
+bool hasStateTag(const std::byte* const pData, const uint32_t dataSize, const int startPos) noexcept;
+int readState(const std::byte* const pData, const uint32_t dataSize, int startPos, State& state, std::vector<std::byte>& adpcmData) noexcept;
+
+END_NAMESPACE(SamplerState)
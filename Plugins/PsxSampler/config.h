@@ -23,7 +23,7 @@
 #define PLUG_DOES_MPE 0
 #define PLUG_DOES_STATE_CHUNKS 0
 #define PLUG_HAS_UI 1
-#define PLUG_WIDTH 880
+#define PLUG_WIDTH 990
 #define PLUG_HEIGHT 670
 #define PLUG_FPS 60
 #define PLUG_SHARED_RESOURCES 0
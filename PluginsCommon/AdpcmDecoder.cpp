@@ -0,0 +1,109 @@
+#include "AdpcmDecoder.h"
+
+#include "Simd.h"
+
+#include <algorithm>
+
+BEGIN_NAMESPACE(AdpcmDecoder)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unpack the 4-bit samples in an ADPCM block to 16-bit: each sample is sign extended and then scaled by the block's shift.
+// Uses SSE2 or NEON if available, otherwise falls back to plain C++.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void unpackBlockSamples(const std::byte adpcmBlock[BLOCK_SIZE], int16_t samplesOut[BLOCK_NUM_SAMPLES]) noexcept {
+    #if SIMD_SSE2
+        // Get the 14 bytes of sample data at the start of a vector, then put each nibble in the top 4 bits of it's own byte.
+        // Low nibbles are the even samples and high nibbles are the odd samples.
+        const __m128i data = _mm_srli_si128(_mm_loadu_si128((const __m128i*) adpcmBlock), 2);
+        const __m128i nibbleMask = _mm_set1_epi8((char) 0xF0);
+        const __m128i evenNibbles = _mm_and_si128(_mm_slli_epi16(data, 4), nibbleMask);
+        const __m128i oddNibbles = _mm_and_si128(data, nibbleMask);
+
+        // Interleave the nibbles to put the samples in order, then move each byte to the top of a 16-bit lane.
+        // This does the sign extension to 16-bit, and an arithmetic right shift then does the scaling.
+        const __m128i samples0to15 = _mm_unpacklo_epi8(evenNibbles, oddNibbles);
+        const __m128i samples16to31 = _mm_unpackhi_epi8(evenNibbles, oddNibbles);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i shift = _mm_cvtsi32_si128((int) getBlockShift(adpcmBlock));
+
+        const __m128i samples0to7 = _mm_sra_epi16(_mm_unpacklo_epi8(zero, samples0to15), shift);
+        const __m128i samples8to15 = _mm_sra_epi16(_mm_unpackhi_epi8(zero, samples0to15), shift);
+        const __m128i samples16to23 = _mm_sra_epi16(_mm_unpacklo_epi8(zero, samples16to31), shift);
+        const __m128i samples24to27 = _mm_sra_epi16(_mm_unpackhi_epi8(zero, samples16to31), shift);
+
+        _mm_storeu_si128((__m128i*)(samplesOut + 0), samples0to7);
+        _mm_storeu_si128((__m128i*)(samplesOut + 8), samples8to15);
+        _mm_storeu_si128((__m128i*)(samplesOut + 16), samples16to23);
+        _mm_storel_epi64((__m128i*)(samplesOut + 24), samples24to27);
+    #elif SIMD_NEON
+        // Same approach as the SSE2 version above
+        const uint8x16_t data = vextq_u8(vld1q_u8((const uint8_t*) adpcmBlock), vdupq_n_u8(0), 2);
+        const uint8x16_t evenNibbles = vshlq_n_u8(data, 4);
+        const uint8x16_t oddNibbles = vandq_u8(data, vdupq_n_u8(0xF0));
+        const uint8x16x2_t samples = vzipq_u8(evenNibbles, oddNibbles);
+        const int16x8_t shift = vdupq_n_s16(-(int16_t) getBlockShift(adpcmBlock));
+
+        const int16x8_t samples0to7 = vshlq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(samples.val[0]), 8)), shift);
+        const int16x8_t samples8to15 = vshlq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(samples.val[0]), 8)), shift);
+        const int16x8_t samples16to23 = vshlq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(samples.val[1]), 8)), shift);
+        const int16x8_t samples24to27 = vshlq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(samples.val[1]), 8)), shift);
+
+        vst1q_s16(samplesOut + 0, samples0to7);
+        vst1q_s16(samplesOut + 8, samples8to15);
+        vst1q_s16(samplesOut + 16, samples16to23);
+        vst1_s16(samplesOut + 24, vget_low_s16(samples24to27));
+    #else
+        unpackBlockSamplesScalar(adpcmBlock, samplesOut);
+    #endif
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Plain C++ version of 'unpackBlockSamples'.
+// Used when SIMD is not available, and also handy as a reference implementation.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void unpackBlockSamplesScalar(const std::byte adpcmBlock[BLOCK_SIZE], int16_t samplesOut[BLOCK_NUM_SAMPLES]) noexcept {
+    const uint32_t sampleShift = getBlockShift(adpcmBlock);
+
+    for (uint32_t byteIdx = 0; byteIdx < BLOCK_NUM_SAMPLES / 2; ++byteIdx) {
+        // N.B: the arithmetic right shift here is important!
+        const uint16_t sampleBits = (uint16_t) adpcmBlock[2 + byteIdx];
+        samplesOut[byteIdx * 2 + 0] = (int16_t)(sampleBits << 12) >> sampleShift;
+        samplesOut[byteIdx * 2 + 1] = (int16_t)((sampleBits & 0xF0) << 8) >> sampleShift;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Decode an ADPCM block to 16-bit samples.
+// The previous 2 samples decoded (1 being the newest) are required for the adaptive filtering and get updated after decoding.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void decodeBlock(
+    const std::byte adpcmBlock[BLOCK_SIZE],
+    int16_t& prevSample1,
+    int16_t& prevSample2,
+    int16_t samplesOut[BLOCK_NUM_SAMPLES]
+) noexcept {
+    unpackBlockSamples(adpcmBlock, samplesOut);
+
+    const uint32_t filter = getBlockFilter(adpcmBlock);
+    const int32_t filterCoefPos = FILTER_COEF_POS[filter];
+    const int32_t filterCoefNeg = FILTER_COEF_NEG[filter];
+    int32_t prev1 = prevSample1;
+    int32_t prev2 = prevSample2;
+
+    for (uint32_t sampleIdx = 0; sampleIdx < BLOCK_NUM_SAMPLES; ++sampleIdx) {
+        // Mix in previous samples using the filter coefficients chosen and scale the result; also clamp to a 16-bit range
+        int32_t sample = samplesOut[sampleIdx];
+        sample += (prev1 * filterCoefPos + prev2 * filterCoefNeg + 32) / 64;
+        sample = std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX);
+        samplesOut[sampleIdx] = (int16_t) sample;
+
+        // Move previous samples forward
+        prev2 = prev1;
+        prev1 = sample;
+    }
+
+    prevSample1 = (int16_t) prev1;
+    prevSample2 = (int16_t) prev2;
+}
+
+END_NAMESPACE(AdpcmDecoder)
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Macros.h"
+
+#include <cstddef>
+#include <cstdint>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Decoding for blocks of PlayStation format ADPCM sound data.
+// Shared by the SPU emulation and the VAG file utilities so that there is a single (fast) implementation of the decoder.
+//
+// Decoding happens in two stages:
+//  (1) Unpacking: each 4-bit nibble is sign extended to 16-bits and scaled by the block's shift.
+//      This is independent for each sample and is done using SIMD where available.
+//  (2) Filtering: the adaptive 2-tap filter is applied to the unpacked samples.
+//      This stage is serial since each sample depends on the previous 2 decoded samples.
+//------------------------------------------------------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE(AdpcmDecoder)
+
+static constexpr uint32_t BLOCK_SIZE        = 16;   // The size in bytes of a PSX format ADPCM block
+static constexpr uint32_t BLOCK_NUM_SAMPLES = 28;   // The number of samples in a PSX format ADPCM block
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// PlayStation ADPCM compression linear predictor co-efficients, both positive and negative.
+// The result of the prediction is divided by '64' after applying these.
+// For more details on this see: https://problemkaputt.de/psx-spx.htm#cdromxaaudioadpcmcompression
+//------------------------------------------------------------------------------------------------------------------------------------------
+static constexpr int32_t FILTER_COEF_POS[5] = { 0, 60, 115,  98, 122 };
+static constexpr int32_t FILTER_COEF_NEG[5] = { 0,  0, -52, -55, -60 };
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the filter (0-4) to use for the given ADPCM block.
+// Note that the filter must be from 0-4 so if it goes beyond that then filter mode '0' (no filter) is used.
+//------------------------------------------------------------------------------------------------------------------------------------------
+inline uint32_t getBlockFilter(const std::byte adpcmBlock[BLOCK_SIZE]) noexcept {
+    const uint32_t filter = ((uint32_t) adpcmBlock[0] & 0x70) >> 4;
+    return (filter <= 4) ? filter : 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the sample shift (0-12) to use for the given ADPCM block.
+// According to NO$PSX: "For both 4bit and 8bit ADPCM, reserved shift values 13..15 will act same as shift = 9"
+//------------------------------------------------------------------------------------------------------------------------------------------
+inline uint32_t getBlockShift(const std::byte adpcmBlock[BLOCK_SIZE]) noexcept {
+    const uint32_t shift = (uint32_t) adpcmBlock[0] & 0x0F;
+    return (shift <= 12) ? shift : 9;
+}
+
+void unpackBlockSamples(const std::byte adpcmBlock[BLOCK_SIZE], int16_t samplesOut[BLOCK_NUM_SAMPLES]) noexcept;
+void unpackBlockSamplesScalar(const std::byte adpcmBlock[BLOCK_SIZE], int16_t samplesOut[BLOCK_NUM_SAMPLES]) noexcept;
+
+void decodeBlock(
+    const std::byte adpcmBlock[BLOCK_SIZE],
+    int16_t& prevSample1,
+    int16_t& prevSample2,
+    int16_t samplesOut[BLOCK_NUM_SAMPLES]
+) noexcept;
+
+END_NAMESPACE(AdpcmDecoder)
@@ -0,0 +1,217 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A small and fast LZ77 codec, using the block format of LZ4
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "LzCodec.h"
+
+#include "Asserts.h"
+
+#include <algorithm>
+#include <cstring>
+
+BEGIN_NAMESPACE(LzCodec)
+
+static constexpr uint32_t   HASH_BITS       = 14;           // Size of the table of previous positions used to find matches, in bits
+static constexpr uint32_t   NO_POSITION     = UINT32_MAX;   // Marks an unused entry in the table of previous positions
+static constexpr uint32_t   MAX_NIBBLE_LEN  = 15;           // Lengths this long or longer in a token's nibble continue in extra bytes
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Read the 4 bytes at the given position and hash them for the table of previous positions.
+// Note: only ever compared to other bytes read the same way, so the endianness doesn't matter.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint32_t read32(const std::byte* const pBytes) noexcept {
+    uint32_t value;
+    std::memcpy(&value, pBytes, sizeof(value));
+    return value;
+}
+
+static uint32_t hashSequence(const uint32_t sequence) noexcept {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Write the extra bytes for a length which didn't fit in it's nibble, given how much of the length is left after the nibble
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void writeExtraLength(std::vector<std::byte>& out, uint32_t lengthLeft) noexcept {
+    for (; lengthLeft >= 255; lengthLeft -= 255) {
+        out.push_back(std::byte(255));
+    }
+
+    out.push_back((std::byte) lengthLeft);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Write a sequence of literals followed by a match: if the match length is '0' then the sequence has literals only and is the last one
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void writeSequence(
+    std::vector<std::byte>& out,
+    const std::byte* const pLiterals,
+    const uint32_t numLiterals,
+    const uint32_t matchOffset,
+    const uint32_t matchLength
+) noexcept {
+    ASSERT((matchLength == 0) || (matchLength >= MIN_MATCH_LENGTH));
+    ASSERT((matchLength == 0) || ((matchOffset > 0) && (matchOffset <= MAX_MATCH_OFFSET)));
+
+    const uint32_t literalsNibble = std::min(numLiterals, MAX_NIBBLE_LEN);
+    const uint32_t matchNibble = (matchLength > 0) ? std::min(matchLength - MIN_MATCH_LENGTH, MAX_NIBBLE_LEN) : 0;
+    out.push_back((std::byte)((literalsNibble << 4) | matchNibble));
+
+    if (literalsNibble == MAX_NIBBLE_LEN) {
+        writeExtraLength(out, numLiterals - MAX_NIBBLE_LEN);
+    }
+
+    out.insert(out.end(), pLiterals, pLiterals + numLiterals);
+
+    if (matchLength > 0) {
+        out.push_back((std::byte)(matchOffset & 0xFF));
+        out.push_back((std::byte)(matchOffset >> 8));
+
+        if (matchNibble == MAX_NIBBLE_LEN) {
+            writeExtraLength(out, matchLength - MIN_MATCH_LENGTH - MAX_NIBBLE_LEN);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the most bytes that compressing the given number of bytes can produce, which happens when nothing in the data matches
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getMaxCompressedSize(const uint32_t size) noexcept {
+    return size + size / 255 + 16;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compress the given data, replacing the contents of the output vector.
+// Matches are found greedily using a table of the last position each 4 byte sequence (or rather it's hash) was seen at.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void compress(const std::byte* const pData, const uint32_t size, std::vector<std::byte>& compressedData) noexcept {
+    ASSERT(pData || (size == 0));
+
+    compressedData.clear();
+    compressedData.reserve(getMaxCompressedSize(size));
+
+    std::vector<uint32_t> prevPositions(1u << HASH_BITS, NO_POSITION);
+    uint32_t literalsStart = 0;
+    uint32_t pos = 0;
+
+    while ((uint64_t) pos + MIN_MATCH_LENGTH <= size) {
+        const uint32_t sequence = read32(pData + pos);
+        uint32_t& prevPosition = prevPositions[hashSequence(sequence)];
+        const uint32_t matchPos = prevPosition;
+        prevPosition = pos;
+
+        const bool bMatch = (
+            (matchPos != NO_POSITION) &&
+            (pos - matchPos <= MAX_MATCH_OFFSET) &&
+            (read32(pData + matchPos) == sequence)
+        );
+
+        if (!bMatch) {
+            ++pos;
+            continue;
+        }
+
+        // Extend the match as far as it goes and emit it along with the literals before it
+        uint32_t matchLength = MIN_MATCH_LENGTH;
+
+        while ((pos + matchLength < size) && (pData[matchPos + matchLength] == pData[pos + matchLength])) {
+            ++matchLength;
+        }
+
+        writeSequence(compressedData, pData + literalsStart, pos - literalsStart, pos - matchPos, matchLength);
+        pos += matchLength;
+        literalsStart = pos;
+    }
+
+    // Whatever is left over goes in the last sequence as literals
+    writeSequence(compressedData, pData + literalsStart, size - literalsStart, 0, 0);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Decompress the given data, which must decompress to exactly the given number of bytes.
+// Returns 'false' if the compressed data is corrupt or doesn't decompress to the expected size. Never reads or writes out of bounds.
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool decompress(
+    const std::byte* const pCompressedData,
+    const uint32_t compressedSize,
+    std::byte* const pData,
+    const uint32_t size
+) noexcept {
+    ASSERT(pCompressedData || (compressedSize == 0));
+    ASSERT(pData || (size == 0));
+
+    const std::byte* pIn = pCompressedData;
+    const std::byte* const pInEnd = pCompressedData + compressedSize;
+    std::byte* pOut = pData;
+    std::byte* const pOutEnd = pData + size;
+
+    // Adds the extra bytes of a length which didn't fit in it's nibble: fails if the length is more than could ever be valid
+    const auto readExtraLength = [&](uint32_t& length) noexcept {
+        uint32_t lengthByte = 255;
+
+        while (lengthByte == 255) {
+            if ((pIn >= pInEnd) || (length > size))
+                return false;
+
+            lengthByte = (uint32_t) *pIn++;
+            length += lengthByte;
+        }
+
+        return true;
+    };
+
+    while (pIn < pInEnd) {
+        // Copy the literals
+        const uint32_t token = (uint32_t) *pIn++;
+        uint32_t numLiterals = token >> 4;
+
+        if ((numLiterals == MAX_NIBBLE_LEN) && (!readExtraLength(numLiterals)))
+            return false;
+
+        if ((numLiterals > (size_t)(pInEnd - pIn)) || (numLiterals > (size_t)(pOutEnd - pOut)))
+            return false;
+
+        std::memcpy(pOut, pIn, numLiterals);
+        pIn += numLiterals;
+        pOut += numLiterals;
+
+        // The last sequence has literals only
+        if (pIn == pInEnd)
+            return (pOut == pOutEnd);
+
+        // Copy the match: it can overlap the bytes being written, which is how runs are encoded
+        if (pInEnd - pIn < 2)
+            return false;
+
+        const uint32_t matchOffset = (uint32_t) pIn[0] | ((uint32_t) pIn[1] << 8);
+        pIn += 2;
+        uint32_t matchLength = token & 0x0F;
+
+        if ((matchOffset == 0) || (matchOffset > (size_t)(pOut - pData)))
+            return false;
+
+        if ((matchLength == MAX_NIBBLE_LEN) && (!readExtraLength(matchLength)))
+            return false;
+
+        matchLength += MIN_MATCH_LENGTH;
+
+        if (matchLength > (size_t)(pOutEnd - pOut))
+            return false;
+
+        const std::byte* const pMatch = pOut - matchOffset;
+
+        if (matchOffset >= matchLength) {
+            std::memcpy(pOut, pMatch, matchLength);
+        } else {
+            for (uint32_t i = 0; i < matchLength; ++i) {
+                pOut[i] = pMatch[i];
+            }
+        }
+
+        pOut += matchLength;
+    }
+
+    // Ran out of data before the last sequence
+    return false;
+}
+
+END_NAMESPACE(LzCodec)
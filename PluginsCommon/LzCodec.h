@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Macros.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A small and fast LZ77 codec, using the block format of LZ4.
+// Used to shrink sample data saved in plugin state: encoding is a single greedy pass and decoding is little more than a series of copies.
+//
+// The compressed data is a series of sequences, each of which is made up of:
+//  (1) A token byte: the high nibble is the number of literal bytes and the low nibble is the length of the match, minus 4.
+//      A nibble value of '15' means the length continues in following bytes, each of which is added on until one isn't '255'.
+//  (2) The literal bytes, which are copied to the output as-is.
+//  (3) A 16-bit little endian offset back into the output for the match, followed by any extra match length bytes.
+// The last sequence has literals only and ends the data.
+//------------------------------------------------------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE(LzCodec)
+
+static constexpr uint32_t MIN_MATCH_LENGTH  = 4;        // Shortest match that can be encoded
+static constexpr uint32_t MAX_MATCH_OFFSET  = 65535;    // Furthest back a match can be from the bytes it encodes
+
+uint32_t getMaxCompressedSize(const uint32_t size) noexcept;
+void compress(const std::byte* const pData, const uint32_t size, std::vector<std::byte>& compressedData) noexcept;
+
+bool decompress(
+    const std::byte* const pCompressedData,
+    const uint32_t compressedSize,
+    std::byte* const pData,
+    const uint32_t size
+) noexcept;
+
+END_NAMESPACE(LzCodec)
@@ -0,0 +1,301 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Streaming stereo sample rate conversion, using a polyphase windowed-sinc filter
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "Resampler.h"
+
+#include "Asserts.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+BEGIN_NAMESPACE(Resampler)
+
+static constexpr uint32_t   PHASE_BITS          = 8;                    // Number of fractional position bits used to pick the filter phase
+static constexpr uint32_t   NUM_PHASES          = 1u << PHASE_BITS;     // Number of filter phases between each input frame
+static constexpr uint32_t   NUM_ZERO_CROSSINGS  = 16;                   // Zero crossings of the sinc on either side of the filter center, at the lower of the 2 rates
+static constexpr double     CUTOFF              = 0.9;                  // Filter cutoff, as a fraction of the Nyquist frequency for the lower of the 2 rates
+static constexpr double     KAISER_BETA         = 8.0;                  // Shape of the Kaiser window applied to the sinc: trades transition width for stopband attenuation
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+//------------------------------------------------------------------------------------------------------------------------------------------
+static double besselI0(const double x) noexcept {
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int32_t k = 1; k < 32; ++k) {
+        const double halfXOverK = x / (2.0 * k);
+        term *= halfXOverK * halfXOverK;
+        sum += term;
+    }
+
+    return sum;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compute the filter coefficients for every phase.
+// Each phase is normalized so it has unity gain at DC, otherwise the slight differences between phases would add noise to constant signals.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void makeFilterCoefs(float* const pCoefs, const uint32_t numTaps, const double cutoff) noexcept {
+    const double PI = 3.14159265358979323846;
+    const double halfLength = numTaps / 2.0;
+    const double windowScale = 1.0 / besselI0(KAISER_BETA);
+
+    for (uint32_t phaseIdx = 0; phaseIdx <= NUM_PHASES; ++phaseIdx) {
+        float* const pPhaseCoefs = pCoefs + (size_t) phaseIdx * numTaps;
+        const double phase = (double) phaseIdx / NUM_PHASES;
+        double sum = 0.0;
+
+        for (uint32_t tapIdx = 0; tapIdx < numTaps; ++tapIdx) {
+            // Distance from the filter center in input frames: the center lies between taps 'numTaps / 2 - 1' and 'numTaps / 2'
+            const double x = (double) tapIdx - (halfLength - 1.0) - phase;
+            const double windowPos = x / halfLength;
+            double coef = 0.0;
+
+            if (std::abs(windowPos) < 1.0) {
+                const double sincArg = PI * cutoff * x;
+                const double sinc = (x != 0.0) ? std::sin(sincArg) / sincArg : 1.0;
+                const double window = besselI0(KAISER_BETA * std::sqrt(1.0 - windowPos * windowPos)) * windowScale;
+                coef = cutoff * sinc * window;
+            }
+
+            pPhaseCoefs[tapIdx] = (float) coef;
+            sum += coef;
+        }
+
+        for (uint32_t tapIdx = 0; tapIdx < numTaps; ++tapIdx) {
+            pPhaseCoefs[tapIdx] = (float)(pPhaseCoefs[tapIdx] / sum);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Setup a stream for converting from the given input rate to the given output rate.
+// The stream can hold enough input for pulling up to the given number of output frames at a time, or for pushing up to the given number
+// of input frames in between pulls, whichever needs more.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void initStream(
+    Stream& stream,
+    const double inputRate,
+    const double outputRate,
+    const uint32_t maxInputFramesPerPush,
+    const uint32_t maxOutputFramesPerPull
+) noexcept {
+    ASSERT((inputRate > 0) && (outputRate > 0));
+
+    stream = {};
+    stream.bPassthrough = (inputRate == outputRate);
+
+    if (!stream.bPassthrough) {
+        // When going to a lower rate the filter must cut off at the output's Nyquist frequency, so it gets proportionally longer
+        const double rateScale = std::min(outputRate / inputRate, 1.0);
+        const uint32_t numTaps = (uint32_t) std::ceil(2.0 * NUM_ZERO_CROSSINGS / rateScale);
+
+        stream.numTaps = (numTaps + 3) & ~3u;
+        stream.numPhases = NUM_PHASES;
+        stream.pCoefs = new float[(size_t)(NUM_PHASES + 1) * stream.numTaps];
+        stream.step = (uint64_t) std::llround(inputRate / outputRate * 4294967296.0);
+        makeFilterCoefs(stream.pCoefs, stream.numTaps, CUTOFF * rateScale);
+    }
+
+    stream.historyCapacity = std::max(maxInputFramesPerPush, getMaxInputFramesNeeded(stream, maxOutputFramesPerPull)) + stream.numTaps;
+    stream.pHistory[0] = new float[stream.historyCapacity];
+    stream.pHistory[1] = new float[stream.historyCapacity];
+    resetStream(stream);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Free up the resources used by the given stream
+//------------------------------------------------------------------------------------------------------------------------------------------
+void destroyStream(Stream& stream) noexcept {
+    delete[] stream.pCoefs;
+    delete[] stream.pHistory[0];
+    delete[] stream.pHistory[1];
+    stream = {};
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Discard all input given to the stream so far.
+// The history is primed with enough silence so that the first output frame is centered on the first input frame.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void resetStream(Stream& stream) noexcept {
+    stream.inputPos = 0;
+    stream.numHistoryFrames = (stream.bPassthrough) ? 0 : stream.numTaps / 2 - 1;
+
+    if (stream.historyCapacity > 0) {
+        std::memset(stream.pHistory[0], 0, stream.historyCapacity * sizeof(float));
+        std::memset(stream.pHistory[1], 0, stream.historyCapacity * sizeof(float));
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get how far ahead of an output frame's position (in input frames) the filter reads input.
+// Output frames are not delayed relative to the input, but this much extra input must be available before they can be produced.
+//------------------------------------------------------------------------------------------------------------------------------------------
+double getLookahead(const Stream& stream) noexcept {
+    return (stream.bPassthrough) ? 0.0 : stream.numTaps / 2.0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get how many more input frames must be pushed before the given number of output frames can be pulled
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getNumInputFramesNeeded(const Stream& stream, const uint32_t numOutputFrames) noexcept {
+    if (numOutputFrames == 0)
+        return 0;
+
+    const uint64_t numFramesRequired = (stream.bPassthrough) ?
+        numOutputFrames :
+        ((stream.inputPos + (uint64_t)(numOutputFrames - 1) * stream.step) >> 32) + stream.numTaps;
+
+    return (numFramesRequired > stream.numHistoryFrames) ? (uint32_t)(numFramesRequired - stream.numHistoryFrames) : 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the most input frames that could ever be needed to produce the given number of output frames, for sizing buffers
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getMaxInputFramesNeeded(const Stream& stream, const uint32_t numOutputFrames) noexcept {
+    if (stream.bPassthrough)
+        return numOutputFrames;
+
+    return (uint32_t)(((uint64_t) numOutputFrames * stream.step) >> 32) + stream.numTaps + 1;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get how many output frames can be pulled with the input pushed so far
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getNumOutputFramesAvailable(const Stream& stream) noexcept {
+    if (stream.bPassthrough)
+        return stream.numHistoryFrames;
+
+    // Need the position of the last output frame's filter window to be below this
+    if (stream.numHistoryFrames < stream.numTaps)
+        return 0;
+
+    const uint64_t posLimit = (uint64_t)(stream.numHistoryFrames - stream.numTaps + 1) << 32;
+    return (stream.inputPos < posLimit) ? (uint32_t)((posLimit - 1 - stream.inputPos) / stream.step + 1) : 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if all of the input held by the stream is silent, in which case it will only output silence until more (non-silent) input is pushed
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool isSilent(const Stream& stream) noexcept {
+    for (uint32_t frameIdx = 0; frameIdx < stream.numHistoryFrames; ++frameIdx) {
+        if ((stream.pHistory[0][frameIdx] != 0.0f) || (stream.pHistory[1][frameIdx] != 0.0f))
+            return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Add the given input frames to the stream
+//------------------------------------------------------------------------------------------------------------------------------------------
+void pushInput(Stream& stream, const float* const pInputL, const float* const pInputR, const uint32_t numFrames) noexcept {
+    ASSERT(pInputL && pInputR);
+    ASSERT(stream.numHistoryFrames + numFrames <= stream.historyCapacity);
+
+    std::memcpy(stream.pHistory[0] + stream.numHistoryFrames, pInputL, numFrames * sizeof(float));
+    std::memcpy(stream.pHistory[1] + stream.numHistoryFrames, pInputR, numFrames * sizeof(float));
+    stream.numHistoryFrames += numFrames;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Apply the given filter phase and the one after it to a window of input history for both channels.
+// The results for the 2 phases are returned separately, to be blended by the caller.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static inline void applyFilterPhases(
+    const float* const pHistoryL,
+    const float* const pHistoryR,
+    const float* const pCoefs1,
+    const float* const pCoefs2,
+    const uint32_t numTaps,
+    float (&sums)[4]
+) noexcept {
+    #if SIMD_SSE2
+        __m128 sumL1 = _mm_setzero_ps();
+        __m128 sumL2 = _mm_setzero_ps();
+        __m128 sumR1 = _mm_setzero_ps();
+        __m128 sumR2 = _mm_setzero_ps();
+
+        for (uint32_t tapIdx = 0; tapIdx < numTaps; tapIdx += 4) {
+            const __m128 historyL = _mm_loadu_ps(pHistoryL + tapIdx);
+            const __m128 historyR = _mm_loadu_ps(pHistoryR + tapIdx);
+            const __m128 coefs1 = _mm_loadu_ps(pCoefs1 + tapIdx);
+            const __m128 coefs2 = _mm_loadu_ps(pCoefs2 + tapIdx);
+            sumL1 = _mm_add_ps(sumL1, _mm_mul_ps(historyL, coefs1));
+            sumL2 = _mm_add_ps(sumL2, _mm_mul_ps(historyL, coefs2));
+            sumR1 = _mm_add_ps(sumR1, _mm_mul_ps(historyR, coefs1));
+            sumR2 = _mm_add_ps(sumR2, _mm_mul_ps(historyR, coefs2));
+        }
+
+        // Transpose so that each vector holds one lane from each of the 4 sums, then add them all up
+        _MM_TRANSPOSE4_PS(sumL1, sumL2, sumR1, sumR2);
+        _mm_storeu_ps(sums, _mm_add_ps(_mm_add_ps(sumL1, sumL2), _mm_add_ps(sumR1, sumR2)));
+    #else
+        float sumL1 = 0.0f;
+        float sumL2 = 0.0f;
+        float sumR1 = 0.0f;
+        float sumR2 = 0.0f;
+
+        for (uint32_t tapIdx = 0; tapIdx < numTaps; ++tapIdx) {
+            sumL1 += pHistoryL[tapIdx] * pCoefs1[tapIdx];
+            sumL2 += pHistoryL[tapIdx] * pCoefs2[tapIdx];
+            sumR1 += pHistoryR[tapIdx] * pCoefs1[tapIdx];
+            sumR2 += pHistoryR[tapIdx] * pCoefs2[tapIdx];
+        }
+
+        sums[0] = sumL1;
+        sums[1] = sumL2;
+        sums[2] = sumR1;
+        sums[3] = sumR2;
+    #endif
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Take the given number of output frames from the stream: there must be enough input to produce them
+//------------------------------------------------------------------------------------------------------------------------------------------
+void pullOutput(Stream& stream, float* const pOutputL, float* const pOutputR, const uint32_t numFrames) noexcept {
+    ASSERT(pOutputL && pOutputR);
+    ASSERT(getNumOutputFramesAvailable(stream) >= numFrames);
+
+    float* const pHistoryL = stream.pHistory[0];
+    float* const pHistoryR = stream.pHistory[1];
+    uint32_t numFramesConsumed = numFrames;
+
+    if (stream.bPassthrough) {
+        std::memcpy(pOutputL, pHistoryL, numFrames * sizeof(float));
+        std::memcpy(pOutputR, pHistoryR, numFrames * sizeof(float));
+    } else {
+        const uint32_t numTaps = stream.numTaps;
+        uint64_t inputPos = stream.inputPos;
+
+        for (uint32_t frameIdx = 0; frameIdx < numFrames; ++frameIdx) {
+            // Use the 2 phases either side of the fractional position and linearly interpolate between them
+            const uint32_t historyIdx = (uint32_t)(inputPos >> 32);
+            const uint32_t fracPos = (uint32_t) inputPos;
+            const uint32_t phaseIdx = fracPos >> (32 - PHASE_BITS);
+            const float phaseFrac = (float)(fracPos & ((1u << (32 - PHASE_BITS)) - 1)) * (1.0f / (float)(1u << (32 - PHASE_BITS)));
+            const float* const pCoefs = stream.pCoefs + (size_t) phaseIdx * numTaps;
+
+            float sums[4];
+            applyFilterPhases(pHistoryL + historyIdx, pHistoryR + historyIdx, pCoefs, pCoefs + numTaps, numTaps, sums);
+            pOutputL[frameIdx] = sums[0] + (sums[1] - sums[0]) * phaseFrac;
+            pOutputR[frameIdx] = sums[2] + (sums[3] - sums[2]) * phaseFrac;
+            inputPos += stream.step;
+        }
+
+        // Discard the history which is now entirely behind the filter window
+        numFramesConsumed = (uint32_t)(inputPos >> 32);
+        ASSERT(numFramesConsumed <= stream.numHistoryFrames);
+        stream.inputPos = inputPos - ((uint64_t) numFramesConsumed << 32);
+    }
+
+    const uint32_t numFramesLeft = stream.numHistoryFrames - numFramesConsumed;
+    std::memmove(pHistoryL, pHistoryL + numFramesConsumed, numFramesLeft * sizeof(float));
+    std::memmove(pHistoryR, pHistoryR + numFramesConsumed, numFramesLeft * sizeof(float));
+    stream.numHistoryFrames = numFramesLeft;
+}
+
+END_NAMESPACE(Resampler)
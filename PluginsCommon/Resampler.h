@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Macros.h"
+
+#include <cstdint>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Streaming stereo sample rate conversion, using a polyphase windowed-sinc filter.
+//
+//  Used to run the SPU at it's native 44.1 KHz rate inside hosts running at other sample rates. Input is pushed into a stream and the
+//  converted output is pulled back out, in whatever amounts suit the caller; 'getNumInputFramesNeeded' and 'getNumOutputFramesAvailable'
+//  tell how much of either is required or ready. If the input and output rates are the same then the stream passes samples through
+//  unchanged and adds no latency.
+//------------------------------------------------------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE(Resampler)
+
+struct Stream {
+    bool        bPassthrough;           // If 'true' then the input and output rates are the same and samples are copied straight through
+    uint32_t    numTaps;                // Length of the filter in input frames: always a multiple of '4'
+    uint32_t    numPhases;              // How many fractional positions between input frames the filter has coefficients for
+    float*      pCoefs;                 // Filter coefficients: 'numTaps' for each phase, plus an extra phase which is the first one shifted by 1 frame
+    uint64_t    step;                   // How far the input position advances for each output frame (32.32 fixed point, in input frames)
+    uint64_t    inputPos;               // Position in the history of the next output frame's filter window (32.32 fixed point, in input frames)
+    uint32_t    historyCapacity;        // Maximum number of input frames the history can hold
+    uint32_t    numHistoryFrames;       // Number of input frames currently held in the history
+    float*      pHistory[2];            // History of input frames for the left and right channels
+};
+
+void initStream(
+    Stream& stream,
+    const double inputRate,
+    const double outputRate,
+    const uint32_t maxInputFramesPerPush,
+    const uint32_t maxOutputFramesPerPull
+) noexcept;
+
+void destroyStream(Stream& stream) noexcept;
+void resetStream(Stream& stream) noexcept;
+double getLookahead(const Stream& stream) noexcept;
+uint32_t getNumInputFramesNeeded(const Stream& stream, const uint32_t numOutputFrames) noexcept;
+uint32_t getMaxInputFramesNeeded(const Stream& stream, const uint32_t numOutputFrames) noexcept;
+uint32_t getNumOutputFramesAvailable(const Stream& stream) noexcept;
+bool isSilent(const Stream& stream) noexcept;
+void pushInput(Stream& stream, const float* const pInputL, const float* const pInputR, const uint32_t numFrames) noexcept;
+void pullOutput(Stream& stream, float* const pOutputL, float* const pOutputR, const uint32_t numFrames) noexcept;
+
+END_NAMESPACE(Resampler)
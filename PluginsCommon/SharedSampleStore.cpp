@@ -0,0 +1,376 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A process-wide store of samples loaded into SPU RAM images, shared between plugin instances
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "SharedSampleStore.h"
+
+#include "Asserts.h"
+#include "LzCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+BEGIN_NAMESPACE(SharedSampleStore)
+
+static constexpr uint64_t   FNV_OFFSET_BASIS    = 0xCBF29CE484222325ull;    // Hash of no data, for 64-bit FNV-1a
+static constexpr uint64_t   FNV_PRIME           = 0x100000001B3ull;         // Multiplier for each byte hashed, for 64-bit FNV-1a
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// All of the samples currently alive, keyed by content hash and by sound data hash; more than one sample can have the same hash, in the
+// unlikely event of a hash collision or (for the sound data hash) when the same sounds are placed differently or in a different size of
+// SPU RAM. The store only holds weak references, so samples are freed as soon as the last plugin instance using them lets go.
+//------------------------------------------------------------------------------------------------------------------------------------------
+typedef std::unordered_map<uint64_t, std::vector<std::weak_ptr<const SharedSample>>> SampleMap;
+
+struct Store {
+    std::mutex  mutex;
+    SampleMap   samples;
+    SampleMap   samplesBySoundData;
+};
+
+static Store& getStore() noexcept {
+    static Store gStore;
+    return gStore;
+}
+
+SharedSample::SharedSample() noexcept
+    : contentHash(0)
+    , soundDataHash(0)
+    , sounds()
+    , spuRamSize(0)
+    , pSpuRam(nullptr)
+    , predecodedSounds()
+    , compressOnce()
+    , compressedSoundData()
+{
+}
+
+SharedSample::~SharedSample() noexcept {
+    for (std::vector<Spu::PredecodedSound>& modePredecodedSounds : predecodedSounds) {
+        for (Spu::PredecodedSound& predecodedSound : modePredecodedSounds) {
+            Spu::destroyPredecodedSound(predecodedSound);
+        }
+    }
+
+    delete[] pSpuRam;
+    pSpuRam = nullptr;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Add the given bytes to a hash (64-bit FNV-1a)
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint64_t addToHash(uint64_t hash, const void* const pData, const uint32_t size) noexcept {
+    ASSERT(pData || (size == 0));
+    const uint8_t* const pBytes = (const uint8_t*) pData;
+
+    for (uint32_t i = 0; i < size; ++i) {
+        hash = (hash ^ pBytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Hash the given ADPCM data (64-bit FNV-1a)
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint64_t hashAdpcmData(const std::byte* const pData, const uint32_t size) noexcept {
+    return addToHash(FNV_OFFSET_BASIS, pData, size);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Hash the placement and ADPCM data of all of the given sounds
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint64_t hashSounds(const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (uint32_t i = 0; i < numSounds; ++i) {
+        const SoundPlacement& sound = pSounds[i];
+        hash = addToHash(hash, &sound.spuRamAddr, sizeof(sound.spuRamAddr));
+        hash = addToHash(hash, &sound.spuRamSize, sizeof(sound.spuRamSize));
+        hash = addToHash(hash, &sound.adpcmSize, sizeof(sound.adpcmSize));
+        hash = addToHash(hash, sound.pAdpcmData, sound.adpcmSize);
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Hash just the ADPCM data of all of the given sounds, ignoring where they are placed in SPU RAM.
+// Lets the same sounds be found in an existing sample before they are laid out in SPU RAM, or even decompressed.
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint64_t hashSoundData(const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (uint32_t i = 0; i < numSounds; ++i) {
+        const SoundPlacement& sound = pSounds[i];
+        hash = addToHash(hash, &sound.adpcmSize, sizeof(sound.adpcmSize));
+        hash = addToHash(hash, sound.pAdpcmData, sound.adpcmSize);
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the live samples with the given hash in the given map, forgetting about any which have since been freed.
+// Returns null if there are none, and removes the hash from the map if all of it's samples have been freed, so the map doesn't keep growing.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static const std::vector<std::weak_ptr<const SharedSample>>* getLiveSamples(SampleMap& samples, const uint64_t hash) noexcept {
+    const SampleMap::iterator hashSamplesIter = samples.find(hash);
+
+    if (hashSamplesIter == samples.end())
+        return nullptr;
+
+    std::vector<std::weak_ptr<const SharedSample>>& hashSamples = hashSamplesIter->second;
+
+    hashSamples.erase(
+        std::remove_if(hashSamples.begin(), hashSamples.end(), [](const std::weak_ptr<const SharedSample>& pSample) noexcept {
+            return pSample.expired();
+        }),
+        hashSamples.end()
+    );
+
+    if (hashSamples.empty()) {
+        samples.erase(hashSamplesIter);
+        return nullptr;
+    }
+
+    return &hashSamples;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Forget about all of the samples in the given map which have been freed, including the hashes of samples which are never looked up again
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void pruneSamples(SampleMap& samples) noexcept {
+    for (SampleMap::iterator hashSamplesIter = samples.begin(); hashSamplesIter != samples.end();) {
+        const uint64_t hash = hashSamplesIter->first;
+        ++hashSamplesIter;
+        getLiveSamples(samples, hash);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if the given shared sample's sounds have exactly the same ADPCM data as the given sounds, wherever they are placed in SPU RAM
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool isSampleOfSoundData(const SharedSample& sample, const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept {
+    if (sample.sounds.size() != numSounds)
+        return false;
+
+    for (uint32_t i = 0; i < numSounds; ++i) {
+        const SharedSound& sharedSound = sample.sounds[i];
+        const SoundPlacement& sound = pSounds[i];
+
+        const bool bSameData = (
+            (sharedSound.adpcmData.size() == sound.adpcmSize) &&
+            ((sound.adpcmSize == 0) || (std::memcmp(sharedSound.adpcmData.data(), sound.pAdpcmData, sound.adpcmSize) == 0))
+        );
+
+        if (!bSameData)
+            return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if the given shared sample was made from exactly the given sounds
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool isSampleOfSounds(const SharedSample& sample, const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept {
+    if (!isSampleOfSoundData(sample, pSounds, numSounds))
+        return false;
+
+    for (uint32_t i = 0; i < numSounds; ++i) {
+        const SharedSound& sharedSound = sample.sounds[i];
+        const SoundPlacement& sound = pSounds[i];
+
+        if ((sharedSound.spuRamAddr != sound.spuRamAddr) || (sharedSound.spuRamSize != sound.spuRamSize))
+            return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Make a new shared sample: creates the SPU RAM image for it's sounds and pre-decodes them
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::shared_ptr<SharedSample> makeSample(
+    const uint64_t contentHash,
+    const uint64_t soundDataHash,
+    const SoundPlacement* const pSounds,
+    const uint32_t numSounds,
+    const uint32_t spuRamSize
+) noexcept {
+    ASSERT(spuRamSize % Spu::ADPCM_BLOCK_SIZE == 0);
+
+    std::shared_ptr<SharedSample> sample = std::make_shared<SharedSample>();
+    sample->contentHash = contentHash;
+    sample->soundDataHash = soundDataHash;
+    sample->sounds.resize(numSounds);
+    sample->spuRamSize = spuRamSize;
+    sample->pSpuRam = new std::byte[spuRamSize];
+    std::memset(sample->pSpuRam, 0, spuRamSize);
+
+    for (std::vector<Spu::PredecodedSound>& modePredecodedSounds : sample->predecodedSounds) {
+        modePredecodedSounds.resize(numSounds);
+    }
+
+    for (uint32_t soundIdx = 0; soundIdx < numSounds; ++soundIdx) {
+        // Need room for the terminator blocks at least
+        const SoundPlacement& sound = pSounds[soundIdx];
+        ASSERT(sound.pAdpcmData || (sound.adpcmSize == 0));
+        ASSERT(sound.spuRamAddr % Spu::ADPCM_BLOCK_SIZE == 0);
+        ASSERT(sound.spuRamSize % Spu::ADPCM_BLOCK_SIZE == 0);
+        ASSERT(sound.spuRamSize >= Spu::ADPCM_BLOCK_SIZE * 2);
+        ASSERT((uint64_t) sound.spuRamAddr + sound.spuRamSize <= spuRamSize);
+
+        SharedSound& sharedSound = sample->sounds[soundIdx];
+        sharedSound.spuRamAddr = sound.spuRamAddr;
+        sharedSound.spuRamSize = sound.spuRamSize;
+        sharedSound.adpcmData.assign(sound.pAdpcmData, sound.pAdpcmData + sound.adpcmSize);
+
+        // Copy in the sound: it gets clipped if there is not enough room for it and the terminator
+        std::byte* const pSoundRam = sample->pSpuRam + sound.spuRamAddr;
+        const uint32_t maxSoundBlocks = sound.spuRamSize / Spu::ADPCM_BLOCK_SIZE;
+        const uint32_t numSoundBlocks = std::min(sound.adpcmSize / Spu::ADPCM_BLOCK_SIZE, maxSoundBlocks - 2);
+        const uint32_t numSoundBytes = numSoundBlocks * Spu::ADPCM_BLOCK_SIZE;
+
+        if (numSoundBytes > 0) {
+            std::memcpy(pSoundRam, sound.pAdpcmData, numSoundBytes);
+        }
+
+        // Add the terminator.
+        // The 2nd byte of each ADPCM block is the flags byte, and is where we indicate loop start/end.
+        // Make the first block be the loop start, and the second block be loop end:
+        std::byte* const pTermBlocks = pSoundRam + numSoundBytes;
+        pTermBlocks[1]  = (std::byte) Spu::ADPCM_FLAG_LOOP_START;
+        pTermBlocks[17] = (std::byte) Spu::ADPCM_FLAG_LOOP_END;
+
+        // Decode the sound (and terminator) ahead of time, for each sample mode
+        const uint32_t startAddr8 = sound.spuRamAddr / 8;
+        Spu::initPredecodedSound(sample->predecodedSounds[0][soundIdx], sample->pSpuRam, spuRamSize, startAddr8, numSoundBlocks + 2, Spu::SampleMode::Int16);
+        Spu::initPredecodedSound(sample->predecodedSounds[1][soundIdx], sample->pSpuRam, spuRamSize, startAddr8, numSoundBlocks + 2, Spu::SampleMode::Float);
+    }
+
+    // SPU cores need the pre-decoded sounds in address order
+    for (std::vector<Spu::PredecodedSound>& modePredecodedSounds : sample->predecodedSounds) {
+        std::sort(
+            modePredecodedSounds.begin(),
+            modePredecodedSounds.end(),
+            [](const Spu::PredecodedSound& sound1, const Spu::PredecodedSound& sound2) noexcept {
+                return (sound1.startAddr8 < sound2.startAddr8);
+            }
+        );
+    }
+
+    return sample;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Find a live sample in the store for the given sounds and SPU RAM size, with the given content hash.
+// The store must be locked by the caller. Returns null if there is no such sample.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static SharedSampleRef findSampleOfSounds(
+    Store& store,
+    const uint64_t contentHash,
+    const SoundPlacement* const pSounds,
+    const uint32_t numSounds,
+    const uint32_t spuRamSize
+) noexcept {
+    const std::vector<std::weak_ptr<const SharedSample>>* const pHashSamples = getLiveSamples(store.samples, contentHash);
+
+    if (!pHashSamples)
+        return {};
+
+    for (const std::weak_ptr<const SharedSample>& pWeakSample : *pHashSamples) {
+        SharedSampleRef pSample = pWeakSample.lock();
+
+        if (pSample && (pSample->spuRamSize == spuRamSize) && isSampleOfSounds(*pSample, pSounds, numSounds))
+            return pSample;
+    }
+
+    return {};
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the shared sample for the given sounds and SPU RAM size, creating it if there is not one already.
+// The sounds must not overlap in SPU RAM.
+//------------------------------------------------------------------------------------------------------------------------------------------
+SharedSampleRef acquireSample(const SoundPlacement* const pSounds, const uint32_t numSounds, const uint32_t spuRamSize) noexcept {
+    ASSERT(pSounds || (numSounds == 0));
+    const uint64_t contentHash = hashSounds(pSounds, numSounds);
+    Store& store = getStore();
+
+    // Use an existing sample if there is one with exactly the same data
+    {
+        std::lock_guard<std::mutex> lockStore(store.mutex);
+
+        if (SharedSampleRef pSample = findSampleOfSounds(store, contentHash, pSounds, numSounds, spuRamSize))
+            return pSample;
+    }
+
+    // Otherwise make a new one. This is done without the store locked, since it takes a while and other instances may be acquiring
+    // samples at the same time (e.g when a host restores many instances in parallel).
+    const uint64_t soundDataHash = hashSoundData(pSounds, numSounds);
+    SharedSampleRef pNewSample = makeSample(contentHash, soundDataHash, pSounds, numSounds, spuRamSize);
+
+    // Another instance may have made the same sample in the meantime, in which case use that one so there is only ever one copy.
+    // Note: the lock is released before the unused new sample is freed, since it's declared after it.
+    std::lock_guard<std::mutex> lockStore(store.mutex);
+
+    if (SharedSampleRef pSample = findSampleOfSounds(store, contentHash, pSounds, numSounds, spuRamSize))
+        return pSample;
+
+    // This is a good time to forget about all the samples which have been freed, since making a sample costs far more than checking them
+    pruneSamples(store.samples);
+    pruneSamples(store.samplesBySoundData);
+
+    store.samples[contentHash].push_back(pNewSample);
+    store.samplesBySoundData[soundDataHash].push_back(pNewSample);
+    return pNewSample;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Find a live sample whose sounds have exactly the same ADPCM data as the given sounds, wherever they are placed in SPU RAM.
+// Lets a plugin instance share the ADPCM data already held by another instance rather than keeping it's own copy of the same data.
+// The hash given must be the sound data hash of the given sounds (see 'hashSoundData'): it's only used to find the samples to check, and the
+// data of each is compared in full, so a hash collision can never give the wrong sounds. Returns null if there is no such sample.
+//------------------------------------------------------------------------------------------------------------------------------------------
+SharedSampleRef findSampleWithSoundData(const uint64_t soundDataHash, const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept {
+    ASSERT(pSounds || (numSounds == 0));
+    ASSERT(soundDataHash == hashSoundData(pSounds, numSounds));
+
+    Store& store = getStore();
+    std::lock_guard<std::mutex> lockStore(store.mutex);
+    const std::vector<std::weak_ptr<const SharedSample>>* const pHashSamples = getLiveSamples(store.samplesBySoundData, soundDataHash);
+
+    if (!pHashSamples)
+        return {};
+
+    for (const std::weak_ptr<const SharedSample>& pWeakSample : *pHashSamples) {
+        SharedSampleRef pSample = pWeakSample.lock();
+
+        if (pSample && isSampleOfSoundData(*pSample, pSounds, numSounds))
+            return pSample;
+    }
+
+    return {};
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the ADPCM data of all of the sample's sounds joined together in order and compressed with 'LzCodec', for saving.
+// The data is only compressed the first time it's asked for, so plugin instances sharing the sample don't each compress it every save.
+//------------------------------------------------------------------------------------------------------------------------------------------
+const std::vector<std::byte>& getCompressedSoundData(const SharedSample& sample) noexcept {
+    std::call_once(sample.compressOnce, [&]() noexcept {
+        std::vector<std::byte> soundData;
+
+        for (const SharedSound& sound : sample.sounds) {
+            soundData.insert(soundData.end(), sound.adpcmData.begin(), sound.adpcmData.end());
+        }
+
+        LzCodec::compress(soundData.data(), (uint32_t) soundData.size(), sample.compressedSoundData);
+    });
+
+    return sample.compressedSoundData;
+}
+
+END_NAMESPACE(SharedSampleStore)
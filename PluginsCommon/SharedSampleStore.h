@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Macros.h"
+#include "Spu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+BEGIN_NAMESPACE(SharedSampleStore)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Where to put a sound in an SPU RAM image and the ADPCM data for it.
+// The range of SPU RAM given to the sound must have room for two extra ADPCM blocks at the end, for the terminator (see 'SharedSample').
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct SoundPlacement {
+    uint32_t            spuRamAddr;     // Start address of the SPU RAM for the sound: must be a multiple of the ADPCM block size
+    uint32_t            spuRamSize;     // How much SPU RAM the sound can use, including the terminator: the sound is clipped to fit if required
+    const std::byte*    pAdpcmData;     // The sound's ADPCM data
+    uint32_t            adpcmSize;      // Size of the sound's ADPCM data in bytes
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A sound in a shared SPU RAM image, along with the ADPCM data it was made from
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct SharedSound {
+    uint32_t                spuRamAddr;     // Start address of the SPU RAM for the sound
+    uint32_t                spuRamSize;     // How much SPU RAM the sound can use, including the terminator
+    std::vector<std::byte>  adpcmData;      // The sound's ADPCM data, exactly as given
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A set of sounds loaded into an image of SPU RAM, along with their pre-decoded ADPCM blocks.
+// These are shared read-only between all plugin instances in the process which load the same ADPCM data, so memory use and load time
+// scale with the number of unique samples rather than the number of instances.
+//
+// Each sound in the SPU RAM image is followed by two silent ADPCM blocks which loop indefinitely. The terminator guarantees that the sound
+// will stop playing after it reaches the end, since SPU voices technically never stop (the SPU emulation will kill them however to save on
+// CPU time). Cores using the image must never write to it, so they must not have reverb writes enabled in 16-bit mode.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct SharedSample {
+    SharedSample() noexcept;
+    SharedSample(const SharedSample& other) = delete;
+    SharedSample& operator = (const SharedSample& other) = delete;
+    ~SharedSample() noexcept;
+
+    uint64_t                            contentHash;            // Hash of the ADPCM data and placement of all of the sounds
+    uint64_t                            soundDataHash;          // Hash of just the ADPCM data of all of the sounds: see 'hashSoundData'
+    std::vector<SharedSound>            sounds;                 // The sounds in the SPU RAM image, in the order they were given
+    uint32_t                            spuRamSize;             // Size of the SPU RAM image
+    std::byte*                          pSpuRam;                // SPU RAM image holding the sounds (clipped to fit if required) plus their terminators
+    std::vector<Spu::PredecodedSound>   predecodedSounds[2];    // Pre-decoded blocks for the sounds in address order, for SPU cores using the image: see 'getPredecodedSounds'
+    mutable std::once_flag              compressOnce;           // Guards making 'compressedSoundData' the first time it's needed
+    mutable std::vector<std::byte>      compressedSoundData;    // The ADPCM data of all of the sounds, compressed on demand: see 'getCompressedSoundData'
+
+    // Get the pre-decoded blocks for the sounds for cores in the given sample mode
+    inline const std::vector<Spu::PredecodedSound>& getPredecodedSounds(const Spu::SampleMode sampleMode) const noexcept {
+        return predecodedSounds[(sampleMode == Spu::SampleMode::Float) ? 1 : 0];
+    }
+};
+
+typedef std::shared_ptr<const SharedSample> SharedSampleRef;
+
+uint64_t hashAdpcmData(const std::byte* const pData, const uint32_t size) noexcept;
+uint64_t hashSoundData(const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept;
+
+SharedSampleRef acquireSample(const SoundPlacement* const pSounds, const uint32_t numSounds, const uint32_t spuRamSize) noexcept;
+SharedSampleRef findSampleWithSoundData(const uint64_t soundDataHash, const SoundPlacement* const pSounds, const uint32_t numSounds) noexcept;
+const std::vector<std::byte>& getCompressedSoundData(const SharedSample& sample) noexcept;
+
+END_NAMESPACE(SharedSampleStore)
@@ -0,0 +1,23 @@
+#pragma once
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Detects which SIMD instruction sets can be used by the current build and includes the intrinsics headers for them.
+//
+//  SIMD_SSE2:  Set to '1' if SSE2 intrinsics can be used. Always the case for x64 builds.
+//  SIMD_NEON:  Set to '1' if ARM NEON intrinsics can be used. Always the case for ARM64 builds.
+//
+// Code using these should always provide a plain C++ fallback for when neither instruction set is available.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #define SIMD_SSE2 1
+    #include <emmintrin.h>
+#else
+    #define SIMD_SSE2 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+    #define SIMD_NEON 1
+    #include <arm_neon.h>
+#else
+    #define SIMD_NEON 0
+#endif
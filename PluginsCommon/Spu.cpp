@@ -1,10 +1,61 @@
 #include "Spu.h"
 
+#include "AdpcmDecoder.h"
 #include "Asserts.h"
+#include "Simd.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#if SIMPLE_SPU_PROFILE
+    #include <chrono>
+    #include <optional>
+#endif
+
 using namespace Spu;
 
+#if SIMPLE_SPU_PROFILE
+    static thread_local ProfileStats gProfileStats = {};
+
+    // Adds the time spent in the scope it is declared in to the given profile stat
+    class ProfileScope {
+    public:
+        inline ProfileScope(uint64_t& statNs) noexcept
+            : mStatNs(statNs)
+            , mStartTime(std::chrono::steady_clock::now())
+        {
+        }
+
+        inline ~ProfileScope() noexcept {
+            const auto elapsed = std::chrono::steady_clock::now() - mStartTime;
+            mStatNs += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+
+    private:
+        uint64_t&                                   mStatNs;
+        std::chrono::steady_clock::time_point       mStartTime;
+    };
+
+    #define SPU_PROFILE_SCOPE(statName) ProfileScope _profileScope_##statName(gProfileStats.statName)
+    #define SPU_PROFILE_COUNT(statName, amount) gProfileStats.statName += (amount)
+#else
+    #define SPU_PROFILE_SCOPE(statName)
+    #define SPU_PROFILE_COUNT(statName, amount)
+#endif
+
+// How many frames of output each voice renders at a time when rendering a block of SPU output.
+// Voices are processed one at a time over each batch of frames rather than all voices for every frame.
+static constexpr uint32_t RENDER_BATCH_SIZE = 64;
+
 // A series of co-efficients used by the SPU's gaussian sample interpolation.
 // For more details on this see: https://problemkaputt.de/psx-spx.htm#cdromxaaudioadpcmcompression
 static constexpr int32_t INTERP_GAUSS_TABLE[512] = {
@@ -42,6 +93,38 @@ static constexpr int32_t INTERP_GAUSS_TABLE[512] = {
     0x593A, 0x5949, 0x5958, 0x5965, 0x5971, 0x597C, 0x5986, 0x598F, 0x5997, 0x599E, 0x59A4, 0x59A9, 0x59AD, 0x59B0, 0x59B2, 0x59B3,
 };
 
+// The gauss interpolation table rearranged so that for each of the 256 gauss indexes, the 4 co-efficients used to interpolate a sample are
+// stored together in the order that they apply to the 4 samples (oldest first). This way they can be fetched with a single aligned load.
+// The float version holds the co-efficients exactly as 'Sample * int16_t' would convert them, so interpolation is identical either way.
+template <class T>
+struct alignas(16) InterpGaussCoefs {
+    T coefs[256][4];
+};
+
+template <class T>
+static constexpr InterpGaussCoefs<T> makeInterpGaussCoefs() noexcept {
+    InterpGaussCoefs<T> table = {};
+
+    for (int32_t gaussIdx = 0; gaussIdx < 256; ++gaussIdx) {
+        const int32_t tableIdxs[4] = { 255 - gaussIdx, 511 - gaussIdx, 256 + gaussIdx, gaussIdx };
+
+        for (int32_t tapIdx = 0; tapIdx < 4; ++tapIdx) {
+            const int16_t coef = (int16_t) INTERP_GAUSS_TABLE[tableIdxs[tapIdx]];
+
+            if constexpr (std::is_same_v<T, float>) {
+                table.coefs[gaussIdx][tapIdx] = toFloatSample(coef);
+            } else {
+                table.coefs[gaussIdx][tapIdx] = coef;
+            }
+        }
+    }
+
+    return table;
+}
+
+static constexpr InterpGaussCoefs<int16_t>  INTERP_GAUSS_COEFS_I16 = makeInterpGaussCoefs<int16_t>();
+static constexpr InterpGaussCoefs<float>    INTERP_GAUSS_COEFS_F32 = makeInterpGaussCoefs<float>();
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Read from sound memory with bounds checking.
 // Any portion read beyond the end of sound memory will be zeroed.
@@ -64,88 +147,232 @@ static void sramRead(
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Decode an ADPCM block for the given voice
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void decodeAdpcmBlock(Voice& voice, std::byte adpcmBlock[ADPCM_BLOCK_SIZE]) noexcept {
-    // Hold the last 2 ADPCM samples we decoded here with the newest first.
-    // They are required for the adaptive decoding throughout and carry across ADPCM blocks.
-    Sample prevSamples[2] = {
-        voice.samples[Voice::SAMPLE_BUFFER_SIZE - 1],
-        voice.samples[Voice::SAMPLE_BUFFER_SIZE - 2],
-    };
+template <class Sample>
+static void decodeAdpcmBlock(Voice& voice, const std::byte adpcmBlock[ADPCM_BLOCK_SIZE]) noexcept {
+    static_assert(ADPCM_BLOCK_SIZE == AdpcmDecoder::BLOCK_SIZE);
+    static_assert(ADPCM_BLOCK_NUM_SAMPLES == AdpcmDecoder::BLOCK_NUM_SAMPLES);
 
     // Save the last 3 samples of the previous ADPCM block in the part of the samples buffer reserved for that.
     // We'll need them later for interpolation.
     static_assert(Voice::NUM_PREV_SAMPLES == 3);
-    voice.samples[0] = voice.samples[Voice::SAMPLE_BUFFER_SIZE - 3];
-    voice.samples[1] = voice.samples[Voice::SAMPLE_BUFFER_SIZE - 2];
-    voice.samples[2] = voice.samples[Voice::SAMPLE_BUFFER_SIZE - 1];
-
-    // Get the shift and filter to use from the first ADPCM header byte.
-    // Note that the filter must be from 0-4 so if it goes beyond that then use filter mode '0' (no filter).
-    // Also according to NO$PSX: "For both 4bit and 8bit ADPCM, reserved shift values 13..15 will act same as shift = 9"
-    uint32_t sampleShift = (uint32_t) adpcmBlock[0] & 0x0F;
-    uint32_t adpcmFilter = ((uint32_t) adpcmBlock[0] & 0x70) >> 4;
-
-    if (adpcmFilter > 4) {
-        adpcmFilter = 0;
-    }
-
-    if (sampleShift > 12) {
-        sampleShift = 9;
-    }
-
-    // Get the ADPCM filter co-efficients, both positive and negative.
-    // For more details on this see: https://problemkaputt.de/psx-spx.htm#cdromxaaudioadpcmcompression
-    #if SIMPLE_SPU_FLOAT_SPU
+    Sample* const pSamples = voice.samples.get<Sample>();
+    pSamples[0] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 3];
+    pSamples[1] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 2];
+    pSamples[2] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 1];
+
+    if constexpr (Sample::IS_FLOAT) {
+        // Unpack the 4-bit samples to 16-bit and scale by the sample shift
+        int16_t unpackedSamples[ADPCM_BLOCK_NUM_SAMPLES];
+        AdpcmDecoder::unpackBlockSamples(adpcmBlock, unpackedSamples);
+
+        // Get the ADPCM filter co-efficients, both positive and negative.
+        // For more details on this see: https://problemkaputt.de/psx-spx.htm#cdromxaaudioadpcmcompression
         constexpr float FILTER_COEF_POS[5] = { 0, 60.0f / 64.0f, 115.0f / 64.0f,  98.0f / 64.0f, 122.0f / 64.0f };
         constexpr float FILTER_COEF_NEG[5] = { 0,             0, -52.0f / 64.0f, -55.0f / 64.0f, -60.0f / 64.0f };
 
+        const uint32_t adpcmFilter = AdpcmDecoder::getBlockFilter(adpcmBlock);
         const float filterCoefPos = FILTER_COEF_POS[adpcmFilter];
         const float filterCoefNeg = FILTER_COEF_NEG[adpcmFilter];
-    #else
-        constexpr int32_t FILTER_COEF_POS[5] = { 0, 60, 115,  98, 122 };
-        constexpr int32_t FILTER_COEF_NEG[5] = { 0,  0, -52, -55, -60 };
-
-        const int32_t filterCoefPos = FILTER_COEF_POS[adpcmFilter];
-        const int32_t filterCoefNeg = FILTER_COEF_NEG[adpcmFilter];
-    #endif
-
-    // Decode all of the samples
-    for (int32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; sampleIdx++) {
-        // Read this samples 4-bit data
-        const uint16_t nibble = (sampleIdx % 2 == 0) ?
-            ((uint16_t) adpcmBlock[2 + sampleIdx / 2] & 0x0F) >> 0:
-            ((uint16_t) adpcmBlock[2 + sampleIdx / 2] & 0xF0) >> 4;
 
-        #if SIMPLE_SPU_FLOAT_SPU
-            // The 4-bit sample gets extended to 16-bit by shifting and is sign extended to 32-bit.
-            // After that we scale by the sample shift.
-            const int16_t sampleI16 = ((int16_t)(nibble << 12)) >> sampleShift;
-            Sample sample(sampleI16);
+        // Hold the last 2 ADPCM samples we decoded here with the newest first.
+        // They are required for the adaptive decoding throughout and carry across ADPCM blocks.
+        float prevSamples[2] = {
+            pSamples[Voice::SAMPLE_BUFFER_SIZE - 1].value,
+            pSamples[Voice::SAMPLE_BUFFER_SIZE - 2].value,
+        };
 
-            // Mix in previous samples using the filter coefficients chosen and scale the result
-            sample += prevSamples[0].value * filterCoefPos + prevSamples[1].value * filterCoefNeg;
-            sample = std::clamp(sample.value, -1.0f, 1.0f);
-            voice.samples[Voice::NUM_PREV_SAMPLES + sampleIdx] = sample;
+        // Apply the filter to all of the samples
+        for (uint32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; sampleIdx++) {
+            // Mix in previous samples using the filter coefficients chosen and clamp the result
+            float sample = toFloatSample(unpackedSamples[sampleIdx]);
+            sample += prevSamples[0] * filterCoefPos + prevSamples[1] * filterCoefNeg;
+            sample = std::clamp(sample, -1.0f, 1.0f);
+            pSamples[Voice::NUM_PREV_SAMPLES + sampleIdx] = sample;
 
             // Move previous samples forward
             prevSamples[1] = prevSamples[0];
             prevSamples[0] = sample;
-        #else
-            // The 4-bit sample gets extended to 16-bit by shifting and is sign extended to 32-bit.
-            // After that we scale by the sample shift.
-            int32_t sample = (int32_t)(int16_t)(nibble << 12);
-            sample >>= sampleShift;
+        }
+    } else {
+        // Decode all of the samples, using the last 2 ADPCM samples decoded for the adaptive filtering
+        int16_t prevSample1 = pSamples[Voice::SAMPLE_BUFFER_SIZE - 1].value;
+        int16_t prevSample2 = pSamples[Voice::SAMPLE_BUFFER_SIZE - 2].value;
+        int16_t decodedSamples[ADPCM_BLOCK_NUM_SAMPLES];
+        AdpcmDecoder::decodeBlock(adpcmBlock, prevSample1, prevSample2, decodedSamples);
+
+        for (uint32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; sampleIdx++) {
+            pSamples[Voice::NUM_PREV_SAMPLES + sampleIdx] = decodedSamples[sampleIdx];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get which set in the decoded block cache an ADPCM block address maps to
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint32_t getBlockCacheSetIdx(const DecodedBlockCache& cache, const uint32_t adpcmAddr8) noexcept {
+    // Fibonacci hashing: spreads consecutive block addresses across all sets
+    return (adpcmAddr8 * 0x9E3779B1u) >> cache.setIdxShift;
+}
 
-            // Mix in previous samples using the filter coefficients chosen and scale the result; also clamp to a 16-bit range
-            sample += (prevSamples[0].value * filterCoefPos + prevSamples[1].value * filterCoefNeg + 32) / 64;
-            sample = std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX);
-            voice.samples[Voice::NUM_PREV_SAMPLES + sampleIdx] = (int16_t) sample;
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Load an already decoded ADPCM block into the given voice: does exactly what decoding the block would do
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void loadDecodedBlock(Voice& voice, const DecodedBlock& block) noexcept {
+    // Save the last 3 samples of the previous ADPCM block and then fill in the new samples
+    static_assert(Voice::NUM_PREV_SAMPLES == 3);
+    Sample* const pSamples = voice.samples.get<Sample>();
+    pSamples[0] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 3];
+    pSamples[1] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 2];
+    pSamples[2] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 1];
+    std::memcpy(pSamples + Voice::NUM_PREV_SAMPLES, block.samples.get<Sample>(), sizeof(Sample) * ADPCM_BLOCK_NUM_SAMPLES);
+}
 
-            // Move previous samples forward
-            prevSamples[1] = prevSamples[0];
-            prevSamples[0] = (int16_t) sample;
-        #endif
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tell if the given decoded block is for the ADPCM block at the given address, decoded using the given previous 2 samples
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static bool isMatchingDecodedBlock(const DecodedBlock& block, const uint32_t adpcmAddr8, const Sample prevSamples[2]) noexcept {
+    return ((block.adpcmAddr8 == adpcmAddr8) && (std::memcmp(block.prevSamples.get<Sample>(), prevSamples, sizeof(Sample) * 2) == 0));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Find the pre-decoded version of the ADPCM block at the given address which was decoded using the given previous 2 samples, if any.
+// The pre-decoded sounds must be sorted by start address and must not overlap.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static const DecodedBlock* findPredecodedBlock(
+    const PredecodedSound* const pSounds,
+    const uint32_t numSounds,
+    const uint32_t adpcmAddr8,
+    const Sample prevSamples[2]
+) noexcept {
+    // Find the last sound starting at or before the block: it's the only one which might contain the block
+    const PredecodedSound* const pNextSound = std::upper_bound(
+        pSounds,
+        pSounds + numSounds,
+        adpcmAddr8,
+        [](const uint32_t addr8, const PredecodedSound& sound) noexcept { return (addr8 < sound.startAddr8); }
+    );
+
+    if (pNextSound == pSounds)
+        return nullptr;
+
+    const PredecodedSound& sound = pNextSound[-1];
+    const uint32_t blockIdx = (adpcmAddr8 - sound.startAddr8) / 2;
+
+    if (blockIdx >= sound.numBlocks)
+        return nullptr;
+
+    const DecodedBlock& block = sound.pBlocks[blockIdx];
+
+    if (isMatchingDecodedBlock(block, adpcmAddr8, prevSamples))
+        return &block;
+
+    // Try the version of the block decoded on the first repeat of the loop, if it's part of the loop
+    const uint32_t loopBlockIdx = blockIdx - sound.loopStartBlockIdx;
+
+    if (loopBlockIdx >= sound.numLoopBlocks)
+        return nullptr;
+
+    const DecodedBlock& loopBlock = sound.pLoopBlocks[loopBlockIdx];
+
+    if (isMatchingDecodedBlock(loopBlock, adpcmAddr8, prevSamples))
+        return &loopBlock;
+
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Read and decode the ADPCM block at the current address for the given voice and return the flags for the block.
+// Uses the pre-decoded sounds and the decoded block cache (if provided) when the block lies entirely before the given cache end address.
+// The pre-decoded sounds (if any) must have been decoded for the sample mode being used.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint8_t loadAdpcmBlock(
+    Voice& voice,
+    const std::byte* const pRam,
+    const uint32_t ramSize,
+    DecodedBlockCache& cache,
+    const PredecodedSound* const pPredecodedSounds,
+    const uint32_t numPredecodedSounds,
+    const uint32_t cacheEndAddr
+) noexcept {
+    const uint32_t samplesAddr = voice.adpcmCurAddr8 * 8;
+    std::byte adpcmBlock[ADPCM_BLOCK_SIZE];
+
+    // If not using already decoded blocks for this block then just read and decode normally
+    const bool bUseDecodedBlocks = (
+        (cache.pBlocks || (numPredecodedSounds > 0)) &&
+        ((uint64_t) samplesAddr + ADPCM_BLOCK_SIZE <= cacheEndAddr)
+    );
+
+    if (!bUseDecodedBlocks) {
+        sramRead(pRam, ramSize, samplesAddr, ADPCM_BLOCK_SIZE, adpcmBlock);
+        decodeAdpcmBlock<Sample>(voice, adpcmBlock);
+        return (uint8_t) adpcmBlock[1];
+    }
+
+    // Otherwise see if the block was already decoded using the same previous 2 samples: try the pre-decoded sounds first
+    Sample* const pSamples = voice.samples.get<Sample>();
+    const Sample prevSamples[2] = {
+        pSamples[Voice::SAMPLE_BUFFER_SIZE - 1],
+        pSamples[Voice::SAMPLE_BUFFER_SIZE - 2],
+    };
+
+    if (numPredecodedSounds > 0) {
+        const DecodedBlock* const pBlock = findPredecodedBlock(pPredecodedSounds, numPredecodedSounds, voice.adpcmCurAddr8, prevSamples);
+
+        if (pBlock) {
+            loadDecodedBlock<Sample>(voice, *pBlock);
+            return pBlock->adpcmFlags;
+        }
+    }
+
+    if (!cache.pBlocks) {
+        sramRead(pRam, ramSize, samplesAddr, ADPCM_BLOCK_SIZE, adpcmBlock);
+        decodeAdpcmBlock<Sample>(voice, adpcmBlock);
+        return (uint8_t) adpcmBlock[1];
     }
+
+    static_assert(DecodedBlockCache::NUM_WAYS == 2);
+    const uint32_t setIdx = getBlockCacheSetIdx(cache, voice.adpcmCurAddr8);
+    DecodedBlock* const pSetBlocks = cache.pBlocks + (size_t) setIdx * DecodedBlockCache::NUM_WAYS;
+
+    for (uint8_t wayIdx = 0; wayIdx < DecodedBlockCache::NUM_WAYS; ++wayIdx) {
+        DecodedBlock& block = pSetBlocks[wayIdx];
+
+        if (isMatchingDecodedBlock(block, voice.adpcmCurAddr8, prevSamples)) {
+            loadDecodedBlock<Sample>(voice, block);
+            cache.pMruWays[setIdx] = wayIdx;
+            return block.adpcmFlags;
+        }
+    }
+
+    // Cache miss: decode the block and replace the least recently used block in the set with it
+    sramRead(pRam, ramSize, samplesAddr, ADPCM_BLOCK_SIZE, adpcmBlock);
+    decodeAdpcmBlock<Sample>(voice, adpcmBlock);
+
+    const uint8_t wayIdx = cache.pMruWays[setIdx] ^ 1;
+    DecodedBlock& block = pSetBlocks[wayIdx];
+    block.adpcmAddr8 = voice.adpcmCurAddr8;
+    block.adpcmFlags = (uint8_t) adpcmBlock[1];
+    block.prevSamples.get<Sample>()[0] = prevSamples[0];
+    block.prevSamples.get<Sample>()[1] = prevSamples[1];
+    std::memcpy(block.samples.get<Sample>(), pSamples + Voice::NUM_PREV_SAMPLES, sizeof(Sample) * ADPCM_BLOCK_NUM_SAMPLES);
+
+    cache.pMruWays[setIdx] = wayIdx;
+    return block.adpcmFlags;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get how many pre-decoded sounds the given core has which can be used in the given sample mode: '0' if they were decoded for another mode
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint32_t getNumUsablePredecodedSounds(const Core& core) noexcept {
+    ASSERT(core.pPredecodedSounds || (core.numPredecodedSounds == 0));
+    const bool bUsable = ((core.numPredecodedSounds > 0) && (core.pPredecodedSounds[0].sampleMode == Sample::MODE));
+    return (bUsable) ? core.numPredecodedSounds : 0;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -164,12 +391,10 @@ static EnvPhase getNextEnvPhase(const EnvPhase phase) noexcept {
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Get the phase parameters for the given envelope, phase and current envelope level
+// Get the phase parameters for the given envelope and phase.
+// Adjustments for exponential mode which depend on the current envelope level are made when stepping the envelope: see 'getEnvStep'.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static EnvPhaseParams getEnvPhaseParams(const AdsrEnvelope env, const EnvPhase phase, const int16_t envLevel) noexcept {
-    // Envelope level shouldn't be negative, but just in case...
-    const int32_t absEnvLevel = std::abs((int32_t) envLevel);
-
+static EnvPhaseParams getEnvPhaseParams(const AdsrEnvelope env, const EnvPhase phase) noexcept {
     // Gather basic info for the envelope phase
     int32_t     targetLevel;
     int32_t     stepUnscaled;
@@ -219,23 +444,44 @@ static EnvPhaseParams getEnvPhaseParams(const AdsrEnvelope env, const EnvPhase p
     params.targetLevel = targetLevel;
     params.stepCycles = 1 << std::max<int32_t>(0, stepScale - 11);
     params.step = stepUnscaled * stepScaleMultiplier;
+    params.bExpIncrease = (bExponential && (stepUnscaled > 0));
+    params.bExpDecrease = (bExponential && (stepUnscaled < 0));
+    return params;
+}
 
-    if (bExponential) {
-        // Adjustments based on the current envelope level when the envelope mode is 'exponential'.
-        // Slower fade-outs as the envelope level decreases & 4x slower fade-ins when envelope level surpasses '0x6000'.
-        if ((stepUnscaled > 0) && (absEnvLevel > 0x6000)) {
-            params.stepCycles *= 4;
-        }
-        else if (stepUnscaled < 0) {
-            params.step = (int32_t)(((int64_t) params.step * absEnvLevel) >> 15);
-        }
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Recompute the cached envelope phase parameters for the voice if it's envelope settings or phase have changed since they were computed
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void updateEnvPhaseParams(Voice& voice) noexcept {
+    if ((voice.envParamsEnvBits != voice.envBits) || (voice.envParamsPhase != voice.envPhase)) {
+        voice.envParams = getEnvPhaseParams(voice.env, voice.envPhase);
+        voice.envParamsEnvBits = voice.envBits;
+        voice.envParamsPhase = voice.envPhase;
     }
+}
 
-    return params;
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the actual envelope step and how many cycles it takes for the given envelope phase params and current envelope level.
+// Adjustments based on the current envelope level when the envelope mode is 'exponential':
+// slower fade-outs as the envelope level decreases & 4x slower fade-ins when envelope level surpasses '0x6000'.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void getEnvStep(const EnvPhaseParams& params, const int16_t envLevel, int32_t& step, int32_t& stepCycles) noexcept {
+    // Envelope level shouldn't be negative, but just in case...
+    const int32_t absEnvLevel = std::abs((int32_t) envLevel);
+    step = params.step;
+    stepCycles = params.stepCycles;
+
+    if (params.bExpIncrease && (absEnvLevel > 0x6000)) {
+        stepCycles *= 4;
+    }
+    else if (params.bExpDecrease) {
+        step = (step * absEnvLevel) >> 15;     // Note: can't overflow since the step is at most 8 * 2048 in magnitude
+    }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Step the ADSR envelope for the given voice
+// Step the ADSR envelope for the given voice.
+// The cached envelope phase params for the voice must be up to date.
 //------------------------------------------------------------------------------------------------------------------------------------------
 static void stepVoiceEnvelope(Voice& voice) noexcept {
     // Don't process the envelope if we must wait a few more cycles
@@ -247,16 +493,19 @@ static void stepVoiceEnvelope(Voice& voice) noexcept {
     }
 
     // Step the envelope in it's current phase and compute the new envelope level
-    const EnvPhaseParams envParams = getEnvPhaseParams(voice.env, voice.envPhase, voice.envLevel);
-    int32_t newEnvLevel = std::clamp<int32_t>(voice.envLevel + envParams.step, MIN_ENV_LEVEL, MAX_ENV_LEVEL);
+    const EnvPhaseParams& envParams = voice.envParams;
+    int32_t step;
+    int32_t stepCycles;
+    getEnvStep(envParams, voice.envLevel, step, stepCycles);
+    int32_t newEnvLevel = std::clamp<int32_t>(voice.envLevel + step, MIN_ENV_LEVEL, MAX_ENV_LEVEL);
 
     // Do state transitions when ramping up or down, unless we're in the 'sustain' phase (targetLevel < 0)
     bool bReachedTargetLevel = false;
 
     if (envParams.targetLevel >= 0) {
-        if (envParams.step > 0) {
+        if (step > 0) {
             bReachedTargetLevel = (newEnvLevel >= envParams.targetLevel);
-        } else if (envParams.step < 0) {
+        } else if (step < 0) {
             bReachedTargetLevel = (newEnvLevel <= envParams.targetLevel);
         }
     }
@@ -265,423 +514,1637 @@ static void stepVoiceEnvelope(Voice& voice) noexcept {
         newEnvLevel = envParams.targetLevel;
         voice.envPhase = getNextEnvPhase(voice.envPhase);
         voice.envWaitCycles = 0;
+        updateEnvPhaseParams(voice);
     } else {
-        voice.envWaitCycles = envParams.stepCycles;
+        voice.envWaitCycles = stepCycles;
     }
 
     voice.envLevel = (int16_t) newEnvLevel;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Get a requested sample from the voice's sample buffer.
-// Returns a zeroed sample if the sample buffer has not been filled or if the index is out of range.
+// Get how many of the next calls to 'stepVoiceEnvelope' for the voice are guaranteed to leave the envelope level and phase unchanged.
+// This is the case while waiting for the next envelope step, and forever if the envelope is stuck at it's limit in the sustain phase.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint32_t getNumEnvHoldCycles(const Voice& voice) noexcept {
+    if (voice.envWaitCycles > 1)
+        return (uint32_t) voice.envWaitCycles - 1;
+
+    const EnvPhaseParams& envParams = voice.envParams;
+
+    if (envParams.targetLevel < 0) {
+        const bool bAtMax = ((envParams.step > 0) && (voice.envLevel == MAX_ENV_LEVEL));
+        const bool bAtMin = ((envParams.step < 0) && (voice.envLevel == MIN_ENV_LEVEL));
+
+        if (bAtMax || bAtMin)
+            return UINT32_MAX;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Advance the ADSR envelope for the given voice by a number of cycles in one go, which must be no more than 'getNumEnvHoldCycles' allows.
+// Leaves the voice in exactly the same state as calling 'stepVoiceEnvelope' that many times would.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void holdVoiceEnvelope(Voice& voice, const uint32_t numCycles) noexcept {
+    ASSERT(numCycles <= getNumEnvHoldCycles(voice));
+
+    if ((uint32_t) voice.envWaitCycles > numCycles) {
+        voice.envWaitCycles -= (int32_t) numCycles;
+        return;
+    }
+
+    // The envelope is stuck at it's limit in the sustain phase: envelope steps still happen but change nothing, so just keep their timing
+    int32_t step;
+    int32_t stepCycles;
+    getEnvStep(voice.envParams, voice.envLevel, step, stepCycles);
+
+    const uint32_t firstStepCycle = (uint32_t) std::max<int32_t>(voice.envWaitCycles, 1);
+    voice.envWaitCycles = stepCycles - (int32_t)((numCycles - firstStepCycle) % (uint32_t) stepCycles);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Step the ADSR envelope for the given voice for up to the given number of frames and save the envelope level for each frame.
+// Stops before stepping a frame if the voice has switched off, and returns the number of frames stepped.
+// Wherever the envelope is known to not change for a while the frames are done in bulk, instead of stepping the envelope for each frame.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static Sample getVoiceSample(const Voice& voice, const uint32_t index) noexcept {
-    if (voice.bSamplesLoaded) {
-        if (index < Voice::SAMPLE_BUFFER_SIZE)
-            return voice.samples[index];
+static uint32_t stepVoiceEnvelopeFrames(Voice& voice, int16_t* const pEnvLevels, const uint32_t maxFrames) noexcept {
+    uint32_t numFrames = 0;
+
+    while ((numFrames < maxFrames) && (voice.envPhase != EnvPhase::Off)) {
+        const uint32_t numHoldFrames = std::min(getNumEnvHoldCycles(voice), maxFrames - numFrames);
+
+        if (numHoldFrames > 0) {
+            holdVoiceEnvelope(voice, numHoldFrames);
+            std::fill_n(pEnvLevels + numFrames, numHoldFrames, voice.envLevel);
+            numFrames += numHoldFrames;
+        } else {
+            stepVoiceEnvelope(voice);
+            pEnvLevels[numFrames] = voice.envLevel;
+            numFrames++;
+        }
     }
 
-    return {};
+    return numFrames;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Get the current (interpolated) sample for the given voice
+// Get the interpolated sample for a voice from it's sample buffer, given the position within the current ADPCM block
 //------------------------------------------------------------------------------------------------------------------------------------------
-static Sample getInterpolatedVoiceSample(const Voice& voice) noexcept {
+template <class Sample>
+static Sample getInterpolatedVoiceSample(const Sample* const pSamples, const AdpcmBlockPos blockPos) noexcept {
     // What sample and interpolation index should we use?
-    const int32_t curSampleIdx  = (int32_t) voice.adpcmBlockPos.fields.sampleIdx;
-    const int32_t gaussTableIdx = (int32_t)(uint8_t) voice.adpcmBlockPos.fields.gaussIdx;
+    const uint32_t curSampleIdx = blockPos.fields.sampleIdx;
+    const uint32_t gaussIdx = blockPos.fields.gaussIdx;
 
-    // Get the most recent sample and previous 3 samples
-    const Sample samp1 = getVoiceSample(voice, Voice::NUM_PREV_SAMPLES + curSampleIdx - 3);
-    const Sample samp2 = getVoiceSample(voice, Voice::NUM_PREV_SAMPLES + curSampleIdx - 2);
-    const Sample samp3 = getVoiceSample(voice, Voice::NUM_PREV_SAMPLES + curSampleIdx - 1);
-    const Sample samp4 = getVoiceSample(voice, Voice::NUM_PREV_SAMPLES + curSampleIdx    );
+    // Get the most recent sample and previous 3 samples: the oldest is at the current sample index, since there are 'NUM_PREV_SAMPLES' (3)
+    // previous samples at the start of the sample buffer. The sample index is always less than the number of samples in an ADPCM block when
+    // we get here, so all 4 samples are always within the buffer and no bounds checks are needed.
+    static_assert(Voice::NUM_PREV_SAMPLES == 3);
+    ASSERT(curSampleIdx < ADPCM_BLOCK_NUM_SAMPLES);
+    const Sample* const pTapSamples = pSamples + curSampleIdx;
 
     // Sanity check...
     static_assert(-1 >> 1 == -1, "Right shift on signed types must be an arithmetic shift!");
 
-    // Note: MSVC: for some reason bad code is sometimes generated in release builds for the gauss factors - prevent this by use of 'volatile'.
-    // I'm not sure why this is occuring, it doesn't seem like there is any UB here...
-    const int32_t gaussIdx1 = (255 - gaussTableIdx) & 0x1FF;
-    const int32_t gaussIdx2 = (511 - gaussTableIdx) & 0x1FF;
-    const int32_t gaussIdx3 = (256 + gaussTableIdx) & 0x1FF;
-    const int32_t gaussIdx4 = (      gaussTableIdx) & 0x1FF;
-    const volatile int32_t gaussFactor1 = INTERP_GAUSS_TABLE[gaussIdx1];
-    const volatile int32_t gaussFactor2 = INTERP_GAUSS_TABLE[gaussIdx2];
-    const volatile int32_t gaussFactor3 = INTERP_GAUSS_TABLE[gaussIdx3];
-    const volatile int32_t gaussFactor4 = INTERP_GAUSS_TABLE[gaussIdx4];
-
     // According to No$PSX it shouldn't be possible for this table to cause an overflow past 16-bits.
     // Hence I'm not bothering to clamp here...
-    #if SIMPLE_SPU_FLOAT_SPU
-        const Sample sampMix1 = samp1 * int16_t(gaussFactor1);
-        const Sample sampMix2 = samp2 * int16_t(gaussFactor2);
-        const Sample sampMix3 = samp3 * int16_t(gaussFactor3);
-        const Sample sampMix4 = samp4 * int16_t(gaussFactor4);
+    if constexpr (Sample::IS_FLOAT) {
+        const float* const pCoefs = INTERP_GAUSS_COEFS_F32.coefs[gaussIdx];
+        const float sampMix1 = pTapSamples[0].value * pCoefs[0];
+        const float sampMix2 = pTapSamples[1].value * pCoefs[1];
+        const float sampMix3 = pTapSamples[2].value * pCoefs[2];
+        const float sampMix4 = pTapSamples[3].value * pCoefs[3];
         return sampMix1 + sampMix2 + sampMix3 + sampMix4;
-    #else
-        const int32_t sampMix1 = (gaussFactor1 * samp1.value) >> 15;
-        const int32_t sampMix2 = (gaussFactor2 * samp2.value) >> 15;
-        const int32_t sampMix3 = (gaussFactor3 * samp3.value) >> 15;
-        const int32_t sampMix4 = (gaussFactor4 * samp4.value) >> 15;
+    } else {
+        const int16_t* const pCoefs = INTERP_GAUSS_COEFS_I16.coefs[gaussIdx];
+        const int32_t sampMix1 = ((int32_t) pCoefs[0] * pTapSamples[0].value) >> 15;
+        const int32_t sampMix2 = ((int32_t) pCoefs[1] * pTapSamples[1].value) >> 15;
+        const int32_t sampMix3 = ((int32_t) pCoefs[2] * pTapSamples[2].value) >> 15;
+        const int32_t sampMix4 = ((int32_t) pCoefs[3] * pTapSamples[3].value) >> 15;
 
         return (int16_t)(sampMix1 + sampMix2 + sampMix3 + sampMix4);
-    #endif
+    }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Process/update a single voice and return it's output and output to be reverberated
+// Mixes a run of frames for a voice into the given (planar) output buffers.
+// All of the frames must read from the voice's currently decoded ADPCM block, and for each frame the position within that block and the
+// envelope level to use are given. The output for reverb is optional and may be null.
+//
+// The SIMD versions of this process several consecutive frames of the voice at once rather than several voices at once. This way the output
+// for each frame still receives the contribution from each voice in the same order, which keeps the output bit-exact with the scalar code.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void stepVoice(
-    Voice& voice,
-    const std::byte* pRam,
-    const uint32_t ramSize,
-    StereoSample& output,
-    StereoSample& outputToReverb
+template <class Sample>
+static void mixVoiceFramesScalar(
+    const Sample* const pSamples,
+    const AdpcmBlockPos* const pBlockPositions,
+    const int16_t* const pEnvLevels,
+    const int16_t volL,
+    const int16_t volR,
+    Sample* const pOutL,
+    Sample* const pOutR,
+    Sample* const pRevL,
+    Sample* const pRevR,
+    const uint32_t numFrames
 ) noexcept {
-    // Nothing to do if the voice is switched off
-    if (voice.envPhase == EnvPhase::Off)
-        return;
+    for (uint32_t frameIdx = 0; frameIdx < numFrames; ++frameIdx) {
+        const Sample rawSample = getInterpolatedVoiceSample(pSamples, pBlockPositions[frameIdx]);
+        const Sample sampleEnvScaled = rawSample * pEnvLevels[frameIdx];
+        const Sample sampleL = sampleEnvScaled * volL;
+        const Sample sampleR = sampleEnvScaled * volR;
+
+        pOutL[frameIdx] += sampleL;
+        pOutR[frameIdx] += sampleR;
+
+        if (pRevL) {
+            pRevL[frameIdx] += sampleL;
+            pRevR[frameIdx] += sampleR;
+        }
+    }
+}
 
-    // Read and decode the next ADPCM block if it is time.
-    // Note that if we read in a new block then we'll have to handle the ADPCM flags at the end.
-    std::byte adpcmBlock[ADPCM_BLOCK_SIZE];
-    bool bHandleAdpcmFlags = false;
+#if SIMD_SSE2
+
+static void mixVoiceFramesSimd(
+    const FloatSample* const pSamples,
+    const AdpcmBlockPos* const pBlockPositions,
+    const int16_t* const pEnvLevels,
+    const int16_t volL,
+    const int16_t volR,
+    FloatSample* const pOutL,
+    FloatSample* const pOutR,
+    FloatSample* const pRevL,
+    FloatSample* const pRevR,
+    const uint32_t numFrames
+) noexcept {
+    static_assert(sizeof(FloatSample) == sizeof(float));
+    const float* const pSampleVals = &pSamples[0].value;
 
-    if (!voice.bSamplesLoaded) {
-        const uint32_t samplesAddr = voice.adpcmCurAddr8 * 8;
-        sramRead(pRam, ramSize, samplesAddr, ADPCM_BLOCK_SIZE, adpcmBlock);
-        decodeAdpcmBlock(voice, adpcmBlock);
-        voice.bSamplesLoaded = true;
-        bHandleAdpcmFlags = true;
-    }
+    const __m128 volLVec = _mm_set1_ps(toFloatSample(volL));
+    const __m128 volRVec = _mm_set1_ps(toFloatSample(volR));
+    const __m128 envScaleVec = _mm_set1_ps(1.0f / 32768.0f);
 
-    // Process the ADSR envelope for the voice
-    stepVoiceEnvelope(voice);
+    uint32_t frameIdx = 0;
 
-    // Get the interpolated sample for the voice, attenuate by the volume envelope and voice volume, and add to the output.
-    // Only bother doing this however if the voice is actually turned on.
-    if (!voice.bDisabled) {
-        const Sample rawSample = getInterpolatedVoiceSample(voice);
-        const Sample sampleEnvScaled = rawSample * voice.envLevel;
-        const int16_t realVoiceVolL = (int16_t) std::clamp((int32_t) voice.volume.left * 2, INT16_MIN, +INT16_MAX);     // N.B: voice volume was divided by 2
-        const int16_t realVoiceVolR = (int16_t) std::clamp((int32_t) voice.volume.right * 2, INT16_MIN, +INT16_MAX);
+    for (; frameIdx + 4 <= numFrames; frameIdx += 4) {
+        // Multiply the 4 samples for each frame by their gauss co-efficients: the samples are consecutive in the sample buffer, starting
+        // at the current sample index (see 'getInterpolatedVoiceSample'), and the co-efficients are together in the interleaved table.
+        __m128 products[4];
 
-        const StereoSample sampleVolScaled = {
-            sampleEnvScaled * realVoiceVolL,
-            sampleEnvScaled * realVoiceVolR
-        };
+        for (uint32_t i = 0; i < 4; ++i) {
+            const AdpcmBlockPos blockPos = pBlockPositions[frameIdx + i];
+            const uint32_t sampleIdx = blockPos.fields.sampleIdx;
+            ASSERT(sampleIdx < ADPCM_BLOCK_NUM_SAMPLES);
 
-        output += sampleVolScaled;
+            const __m128 samples = _mm_loadu_ps(pSampleVals + sampleIdx);
+            const __m128 coefs = _mm_load_ps(INTERP_GAUSS_COEFS_F32.coefs[blockPos.fields.gaussIdx]);
+            products[i] = _mm_mul_ps(samples, coefs);
+        }
 
-        // Only include in the output to reverberate if reverb is enabled for the voice
-        if (voice.bDoReverb) {
-            outputToReverb += sampleVolScaled;
+        // Transpose so that each vector holds the products for one tap across all 4 frames, then sum in the same order as the scalar code
+        _MM_TRANSPOSE4_PS(products[0], products[1], products[2], products[3]);
+        __m128 rawSample = _mm_add_ps(products[0], products[1]);
+        rawSample = _mm_add_ps(rawSample, products[2]);
+        rawSample = _mm_add_ps(rawSample, products[3]);
+
+        // Scale by the envelope level and voice volume
+        const __m128i envLevels16 = _mm_loadl_epi64((const __m128i*)(pEnvLevels + frameIdx));
+        const __m128i envLevels32 = _mm_srai_epi32(_mm_unpacklo_epi16(envLevels16, envLevels16), 16);
+        const __m128 envLevels = _mm_mul_ps(_mm_cvtepi32_ps(envLevels32), envScaleVec);
+        const __m128 sampleEnvScaled = _mm_mul_ps(rawSample, envLevels);
+        const __m128 sampleL = _mm_mul_ps(sampleEnvScaled, volLVec);
+        const __m128 sampleR = _mm_mul_ps(sampleEnvScaled, volRVec);
+
+        // Mix into the output
+        float* const pOutLVals = &pOutL[frameIdx].value;
+        float* const pOutRVals = &pOutR[frameIdx].value;
+        _mm_storeu_ps(pOutLVals, _mm_add_ps(_mm_loadu_ps(pOutLVals), sampleL));
+        _mm_storeu_ps(pOutRVals, _mm_add_ps(_mm_loadu_ps(pOutRVals), sampleR));
+
+        if (pRevL) {
+            float* const pRevLVals = &pRevL[frameIdx].value;
+            float* const pRevRVals = &pRevR[frameIdx].value;
+            _mm_storeu_ps(pRevLVals, _mm_add_ps(_mm_loadu_ps(pRevLVals), sampleL));
+            _mm_storeu_ps(pRevRVals, _mm_add_ps(_mm_loadu_ps(pRevRVals), sampleR));
         }
     }
 
-    // Advance the position of the voice within the current sample block.
-    // Note that the original PSX SPU wouldn't allow frequencies of more than 176,400 Hz (0x4000), hence we clamp the frequency here.
-    // Certain pieces of music in Doom need this clamping to be done in order to sound correct.
-    voice.adpcmBlockPos.counter += std::min<uint16_t>(voice.sampleRate, MAX_SAMPLE_RATE);
+    // Mix any leftover frames
+    mixVoiceFramesScalar(
+        pSamples,
+        pBlockPositions + frameIdx,
+        pEnvLevels + frameIdx,
+        volL,
+        volR,
+        pOutL + frameIdx,
+        pOutR + frameIdx,
+        (pRevL) ? pRevL + frameIdx : nullptr,
+        (pRevR) ? pRevR + frameIdx : nullptr,
+        numFrames - frameIdx
+    );
+}
 
-    // Is it time to read another ADPCM block because we have consumed the current one?
-    if (voice.adpcmBlockPos.fields.sampleIdx >= ADPCM_BLOCK_NUM_SAMPLES) {
-        voice.adpcmBlockPos.fields.sampleIdx -= ADPCM_BLOCK_NUM_SAMPLES;
-        voice.adpcmCurAddr8 += ADPCM_BLOCK_SIZE / 8;
-        voice.bSamplesLoaded = false;
+//------------------------------------------------------------------------------------------------------------------------------------------
+// SSE2 helpers for 16-bit mode: these mirror 'sampleAttenuate' and the gauss interpolation math exactly
+//------------------------------------------------------------------------------------------------------------------------------------------
 
-        // Time to go to the loop address?
-        if (voice.bRepeat) {
-            voice.bRepeat = false;
-            voice.adpcmCurAddr8 = voice.adpcmRepeatAddr8;
-        }
-    }
+// Multiply 8 pairs of 16-bit values to give 32-bit products, for the lower and upper 4 lanes respectively
+static inline void mulI16ToI32(const __m128i a, const __m128i b, __m128i& productsLo, __m128i& productsHi) noexcept {
+    const __m128i lo = _mm_mullo_epi16(a, b);
+    const __m128i hi = _mm_mulhi_epi16(a, b);
+    productsLo = _mm_unpacklo_epi16(lo, hi);
+    productsHi = _mm_unpackhi_epi16(lo, hi);
+}
 
-    // Handle processing flags for the current ADPCM block we just read (if we read one)
-    if (bHandleAdpcmFlags) {
-        // The ADPCM flags are in the 2nd byte of the ADPCM block
-        const uint8_t adpcmFlags = (uint8_t) adpcmBlock[1];
+// Truncate 8 32-bit values to 16-bits (wrapping, like a C cast) and pack them
+static inline __m128i truncI32ToI16(const __m128i lo, const __m128i hi) noexcept {
+    const __m128i loSignExt = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    const __m128i hiSignExt = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(loSignExt, hiSignExt);
+}
 
-        // Is this where we jump to restart a loop?
-        if (adpcmFlags & ADPCM_FLAG_LOOP_START) {
-            voice.adpcmRepeatAddr8 = voice.adpcmCurAddr8;
-        }
+// Same as 'sampleAttenuate' for 8 samples
+static inline __m128i attenuateI16(const __m128i samples, const __m128i volumes) noexcept {
+    __m128i productsLo, productsHi;
+    mulI16ToI32(samples, volumes, productsLo, productsHi);
+    return truncI32ToI16(_mm_srai_epi32(productsLo, 15), _mm_srai_epi32(productsHi, 15));
+}
 
-        // Jump to the repeat address after this sample block is done?
-        if (adpcmFlags & ADPCM_FLAG_LOOP_END) {
-            voice.bReachedLoopEnd = true;
-            voice.bRepeat = true;
+// Get the gauss interpolation sums for 4 frames at the given block positions as 32-bit values, before truncation to 16-bits
+static inline __m128i interpolateI16Frames(const int16_t* const pSampleVals, const AdpcmBlockPos* const pBlockPositions) noexcept {
+    // Multiply the 4 samples for each pair of frames by their co-efficients, each product shifted down: gives 4 products for each frame
+    __m128i products[4];
 
-            // If the repeat flag is not set then the voice will be silenced upon 'repeating'
-            if ((adpcmFlags & ADPCM_FLAG_REPEAT) == 0) {
-                voice.envLevel = 0;
-                keyOff(voice);
-            }
+    for (uint32_t i = 0; i < 4; i += 2) {
+        const AdpcmBlockPos blockPos1 = pBlockPositions[i];
+        const AdpcmBlockPos blockPos2 = pBlockPositions[i + 1];
+        ASSERT(blockPos1.fields.sampleIdx < ADPCM_BLOCK_NUM_SAMPLES);
+        ASSERT(blockPos2.fields.sampleIdx < ADPCM_BLOCK_NUM_SAMPLES);
+
+        const __m128i samples = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*)(pSampleVals + blockPos1.fields.sampleIdx)),
+            _mm_loadl_epi64((const __m128i*)(pSampleVals + blockPos2.fields.sampleIdx))
+        );
+
+        const __m128i coefs = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*) INTERP_GAUSS_COEFS_I16.coefs[blockPos1.fields.gaussIdx]),
+            _mm_loadl_epi64((const __m128i*) INTERP_GAUSS_COEFS_I16.coefs[blockPos2.fields.gaussIdx])
+        );
+
+        __m128i productsLo, productsHi;
+        mulI16ToI32(samples, coefs, productsLo, productsHi);
+        products[i] = _mm_srai_epi32(productsLo, 15);
+        products[i + 1] = _mm_srai_epi32(productsHi, 15);
+    }
+
+    // Transpose so that each vector holds the products for one tap across all 4 frames and sum them (the order does not matter for integers)
+    const __m128i t0 = _mm_unpacklo_epi32(products[0], products[1]);
+    const __m128i t1 = _mm_unpacklo_epi32(products[2], products[3]);
+    const __m128i t2 = _mm_unpackhi_epi32(products[0], products[1]);
+    const __m128i t3 = _mm_unpackhi_epi32(products[2], products[3]);
+    const __m128i tap0 = _mm_unpacklo_epi64(t0, t1);
+    const __m128i tap1 = _mm_unpackhi_epi64(t0, t1);
+    const __m128i tap2 = _mm_unpacklo_epi64(t2, t3);
+    const __m128i tap3 = _mm_unpackhi_epi64(t2, t3);
+    return _mm_add_epi32(_mm_add_epi32(tap0, tap1), _mm_add_epi32(tap2, tap3));
+}
+
+static void mixVoiceFramesSimd(
+    const Int16Sample* const pSamples,
+    const AdpcmBlockPos* const pBlockPositions,
+    const int16_t* const pEnvLevels,
+    const int16_t volL,
+    const int16_t volR,
+    Int16Sample* const pOutL,
+    Int16Sample* const pOutR,
+    Int16Sample* const pRevL,
+    Int16Sample* const pRevR,
+    const uint32_t numFrames
+) noexcept {
+    static_assert(sizeof(Int16Sample) == sizeof(int16_t));
+    const int16_t* const pSampleVals = &pSamples[0].value;
+    const __m128i volLVec = _mm_set1_epi16(volL);
+    const __m128i volRVec = _mm_set1_epi16(volR);
+
+    uint32_t frameIdx = 0;
+
+    for (; frameIdx + 8 <= numFrames; frameIdx += 8) {
+        // Interpolate: each product is shifted down before summing and the sum is truncated to 16-bits, same as the scalar code.
+        // The 4 samples for each frame are consecutive in the sample buffer, starting at the current sample index (see
+        // 'getInterpolatedVoiceSample'), and the co-efficients are together in the interleaved table. Frames are done 4 at a time.
+        const __m128i rawSampleLo = interpolateI16Frames(pSampleVals, pBlockPositions + frameIdx);
+        const __m128i rawSampleHi = interpolateI16Frames(pSampleVals, pBlockPositions + frameIdx + 4);
+        const __m128i rawSample = truncI32ToI16(rawSampleLo, rawSampleHi);
+
+        // Scale by the envelope level and voice volume
+        const __m128i envLevels = _mm_loadu_si128((const __m128i*)(pEnvLevels + frameIdx));
+        const __m128i sampleEnvScaled = attenuateI16(rawSample, envLevels);
+        const __m128i sampleL = attenuateI16(sampleEnvScaled, volLVec);
+        const __m128i sampleR = attenuateI16(sampleEnvScaled, volRVec);
+
+        // Mix into the output with saturation
+        int16_t* const pOutLVals = &pOutL[frameIdx].value;
+        int16_t* const pOutRVals = &pOutR[frameIdx].value;
+        _mm_storeu_si128((__m128i*) pOutLVals, _mm_adds_epi16(_mm_loadu_si128((const __m128i*) pOutLVals), sampleL));
+        _mm_storeu_si128((__m128i*) pOutRVals, _mm_adds_epi16(_mm_loadu_si128((const __m128i*) pOutRVals), sampleR));
+
+        if (pRevL) {
+            int16_t* const pRevLVals = &pRevL[frameIdx].value;
+            int16_t* const pRevRVals = &pRevR[frameIdx].value;
+            _mm_storeu_si128((__m128i*) pRevLVals, _mm_adds_epi16(_mm_loadu_si128((const __m128i*) pRevLVals), sampleL));
+            _mm_storeu_si128((__m128i*) pRevRVals, _mm_adds_epi16(_mm_loadu_si128((const __m128i*) pRevRVals), sampleR));
         }
     }
+
+    // Mix any leftover frames
+    mixVoiceFramesScalar(
+        pSamples,
+        pBlockPositions + frameIdx,
+        pEnvLevels + frameIdx,
+        volL,
+        volR,
+        pOutL + frameIdx,
+        pOutR + frameIdx,
+        (pRevL) ? pRevL + frameIdx : nullptr,
+        (pRevR) ? pRevR + frameIdx : nullptr,
+        numFrames - frameIdx
+    );
+}
+
+#endif  // #if SIMD_SSE2
+
+template <class Sample>
+static void mixVoiceFrames(
+    const Sample* const pSamples,
+    const AdpcmBlockPos* const pBlockPositions,
+    const int16_t* const pEnvLevels,
+    const int16_t volL,
+    const int16_t volR,
+    Sample* const pOutL,
+    Sample* const pOutR,
+    Sample* const pRevL,
+    Sample* const pRevR,
+    const uint32_t numFrames
+) noexcept {
+    #if SIMD_SSE2
+        mixVoiceFramesSimd(pSamples, pBlockPositions, pEnvLevels, volL, volR, pOutL, pOutR, pRevL, pRevR, numFrames);
+    #else
+        mixVoiceFramesScalar(pSamples, pBlockPositions, pEnvLevels, volL, volR, pOutL, pOutR, pRevL, pRevR, numFrames);
+    #endif
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Process/update all voices and get 1 sample of output from them
+// Apply the flags for an ADPCM block which was just read by the given voice
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void stepVoices(
-    Voice* const pVoices,
-    const int32_t numVoices,
-    const std::byte* pRam,
-    const uint32_t ramSize,
-    StereoSample& output,
-    StereoSample& outputToReverb
-) noexcept {
-    ASSERT(pVoices || (numVoices == 0));
+static void handleAdpcmFlags(Voice& voice, const uint8_t adpcmFlags) noexcept {
+    // Is this where we jump to restart a loop?
+    if (adpcmFlags & ADPCM_FLAG_LOOP_START) {
+        voice.adpcmRepeatAddr8 = voice.adpcmCurAddr8;
+    }
+
+    // Jump to the repeat address after this sample block is done?
+    if (adpcmFlags & ADPCM_FLAG_LOOP_END) {
+        voice.bReachedLoopEnd = true;
+        voice.bRepeat = true;
 
-    for (int32_t voiceIdx = 0; voiceIdx < numVoices; ++voiceIdx) {
-        stepVoice(pVoices[voiceIdx], pRam, ramSize, output, outputToReverb);
+        // If the repeat flag is not set then the voice will be silenced upon 'repeating'
+        if ((adpcmFlags & ADPCM_FLAG_REPEAT) == 0) {
+            voice.envLevel = 0;
+            keyOff(voice);
+        }
     }
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Mixes sound from an external input; does nothing if there is no current external input
+// Get how many frames a voice at the given position and sample rate can play before it consumes the current ADPCM block.
+// The block is consumed on the last of these frames; returns 'UINT32_MAX' if the voice is not advancing at all.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void mixExternalInput(
-    const ExtInputCallback pExtCallback,
-    void* const pExtCallbackUserData,
-    const Volume extVolume,
-    const bool bExtReverbEnabled,
-    StereoSample& output,
-    StereoSample& outputToReverb
-) noexcept {
-    if (!pExtCallback)
-        return;
+static uint32_t getNumFramesToConsumeBlock(const AdpcmBlockPos blockPos, const uint16_t sampleRate) noexcept {
+    constexpr uint32_t BLOCK_END_COUNTER = (uint32_t) ADPCM_BLOCK_NUM_SAMPLES << 12;
+    ASSERT(blockPos.counter < BLOCK_END_COUNTER);
 
-    const StereoSample extSample = pExtCallback(pExtCallbackUserData);
-    const StereoSample extSampleScaled = extSample * extVolume;
-    output += extSampleScaled;
+    if (sampleRate == 0)
+        return UINT32_MAX;
 
-    if (bExtReverbEnabled) {
-        outputToReverb += extSampleScaled;
-    }
+    return (BLOCK_END_COUNTER - blockPos.counter + sampleRate - 1) / sampleRate;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Add the given sample to reverb input and return a sample of reverb output
+// Process/update a single voice for a batch of frames and add it's output (and output to be reverberated) to the given buffers.
+//
+// The frames are processed in runs which use the same decoded ADPCM block. For each run the envelope and sample position of the voice are
+// worked out for every frame first (this must match the original per-frame logic exactly, but the envelope is advanced in bulk wherever it
+// is known not to change), and then the samples for the run are interpolated, scaled and mixed together in one go.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void doReverb(
-#if SIMPLE_SPU_FLOAT_SPU
-    float* pReverbRam,
-    const uint32_t numReverbRamSamples,
-#else
-    std::byte* pRam,
-#endif
+template <class Sample>
+static void renderVoice(
+    Voice& voice,
+    const std::byte* pRam,
     const uint32_t ramSize,
-    const uint32_t reverbBaseAddr8,
-    uint32_t& reverbCurAddr,
-    const Volume reverbVol,
-    const bool bReverbWriteEnable,
-    const ReverbRegs& reverbRegs,
-    const StereoSample reverbInput,
-    StereoSample& reverbOutput
+    DecodedBlockCache& blockCache,
+    const PredecodedSound* const pPredecodedSounds,
+    const uint32_t numPredecodedSounds,
+    const uint32_t blockCacheEndAddr,
+    Sample* const pOutL,
+    Sample* const pOutR,
+    Sample* const pRevL,
+    Sample* const pRevR,
+    const uint32_t numFrames
 ) noexcept {
-    // Helper: wrap an address to be within the reverb work area and guarantee that 16-bits (or a single float, for the float SPU) can be read safely.
-    // If there is no reverb work area (which should never be the case) then the address '0' is returned.
-    // Note that for the float SPU reverb addresses are still specified in terms of the main SPU ram, so that we can use the original SPU reverb settings.
-    const uint32_t reverbBaseAddr = reverbBaseAddr8 * 8;
-    const uint32_t reverbBaseAddr2 = reverbBaseAddr / 2;
-
-    #if SIMPLE_SPU_FLOAT_SPU
-        const uint32_t reverbWorkAreaSize2 = std::min((ramSize - reverbBaseAddr) / 2, numReverbRamSamples);
-    #else
-        const uint32_t reverbWorkAreaSize2 = (ramSize - reverbBaseAddr) / 2;
-    #endif
+    ASSERT(numFrames <= RENDER_BATCH_SIZE);
 
-    const auto wrapRevAddr16 = [=](uint32_t addr) noexcept -> uint32_t {
-        if (reverbWorkAreaSize2 > 0) {
-            const uint32_t addr2 = addr / 2;
-            const uint32_t relativeAddr2 = (addr2 - reverbBaseAddr2) % reverbWorkAreaSize2;
+    // The positions within the current ADPCM block and envelope levels for each frame in the current run
+    alignas(16) AdpcmBlockPos blockPositions[RENDER_BATCH_SIZE];
+    alignas(16) int16_t envLevels[RENDER_BATCH_SIZE];
 
-            #if SIMPLE_SPU_FLOAT_SPU
-                // For the float SPU the reverb work area always starts at element '0' in reverb RAM
-                return relativeAddr2 * 2;
-            #else
-                return (reverbBaseAddr2 + relativeAddr2) * 2;
-            #endif
+    // Note that the original PSX SPU wouldn't allow frequencies of more than 176,400 Hz (0x4000), hence we clamp the frequency here.
+    // Certain pieces of music in Doom need this clamping to be done in order to sound correct.
+    const uint16_t sampleRate = std::min<uint16_t>(voice.sampleRate, MAX_SAMPLE_RATE);
+
+    // The voice volume, taking into account that it was divided by 2
+    const int16_t realVoiceVolL = (int16_t) std::clamp((int32_t) voice.volume.left * 2, INT16_MIN, +INT16_MAX);
+    const int16_t realVoiceVolR = (int16_t) std::clamp((int32_t) voice.volume.right * 2, INT16_MIN, +INT16_MAX);
+
+    // The envelope settings or phase may have been changed since the voice was last processed
+    updateEnvPhaseParams(voice);
+    uint32_t runStartFrameIdx = 0;
+
+    while (runStartFrameIdx < numFrames) {
+        // Nothing to do if the voice is switched off
+        if (voice.envPhase == EnvPhase::Off)
+            break;
+
+        // Read and decode the next ADPCM block if it is time.
+        // Note that if we read in a new block then we'll have to handle the ADPCM flags after the first frame.
+        uint8_t adpcmFlags = 0;
+        bool bHandleAdpcmFlags = false;
+
+        if (!voice.bSamplesLoaded) {
+            SPU_PROFILE_SCOPE(decodeNs);
+            SPU_PROFILE_COUNT(numBlocksDecoded, 1);
+            adpcmFlags = loadAdpcmBlock<Sample>(
+                voice,
+                pRam,
+                ramSize,
+                blockCache,
+                pPredecodedSounds,
+                numPredecodedSounds,
+                blockCacheEndAddr
+            );
+            voice.bSamplesLoaded = true;
+            bHandleAdpcmFlags = true;
         }
 
-        return 0;
-    };
-
-    // Helpers: read and write a 16-bit sample relative to the current reverb address.
-    // Wraps the read or write to be within the work area for reverb.
-    const auto revR = [=](uint32_t addrRelative) noexcept -> Sample {
-        const uint32_t addr = wrapRevAddr16(reverbCurAddr + addrRelative);
+        // The run lasts until the current ADPCM block is consumed, the batch ends or the voice switches off
+        const uint32_t maxRunFrames = std::min(numFrames - runStartFrameIdx, getNumFramesToConsumeBlock(voice.adpcmBlockPos, sampleRate));
+        uint32_t numRunFrames = 0;
 
-        #if SIMPLE_SPU_FLOAT_SPU
-            return pReverbRam[addr / 2];
-        #else
-            const uint16_t data = (uint16_t) pRam[addr] | ((uint16_t) pRam[addr + 1] << 8);
-            return (int16_t) data;
+        #if SIMPLE_SPU_PROFILE
+            std::optional<ProfileScope> envelopeProfileScope(gProfileStats.envelopeNs);
         #endif
-    };
 
-    const auto revW = [=](uint32_t addrRelative, const Sample sample) noexcept {
-        if (bReverbWriteEnable) {
-            const uint32_t addr = wrapRevAddr16(reverbCurAddr + addrRelative);
+        // Process the ADSR envelope for the voice for each frame in the run.
+        // The processing flags for a newly read ADPCM block are handled after the first frame using it, so step that frame by itself.
+        if (bHandleAdpcmFlags) {
+            stepVoiceEnvelope(voice);
+            envLevels[0] = voice.envLevel;
+            numRunFrames = 1;
+
+            // If the block is consumed on this frame then the flags are handled after that instead
+            if (maxRunFrames > 1) {
+                handleAdpcmFlags(voice, adpcmFlags);
+                bHandleAdpcmFlags = false;
+            }
+        }
 
-            #if SIMPLE_SPU_FLOAT_SPU
-                pReverbRam[addr / 2] = sample.value;
-            #else
-                const uint16_t data = (uint16_t) sample;
-                pRam[addr] = (std::byte) data;
-                pRam[addr + 1] = (std::byte)(data >> 8);
-            #endif
+        numRunFrames += stepVoiceEnvelopeFrames(voice, envLevels + numRunFrames, maxRunFrames - numRunFrames);
+
+        // Save the position of the voice within the current sample block for each frame and advance it past the run
+        for (uint32_t frameIdx = 0; frameIdx < numRunFrames; ++frameIdx) {
+            blockPositions[frameIdx].counter = voice.adpcmBlockPos.counter + frameIdx * sampleRate;
         }
-    };
 
-    // This is based almost exactly on: https://problemkaputt.de/psx-spx.htm#spureverbformula.
-    // First grab all of the reverb inputs we will be dealing with and the real relative reverb addresses (need to x8 them).
-    const uint32_t addrLSame1   = (uint32_t) reverbRegs.addrLSame1 * 8;
-    const uint32_t addrLSame2   = (uint32_t) reverbRegs.addrLSame2 * 8;
-    const uint32_t addrRSame1   = (uint32_t) reverbRegs.addrRSame1 * 8;
-    const uint32_t addrRSame2   = (uint32_t) reverbRegs.addrRSame2 * 8;
-    const uint32_t addrLDiff1   = (uint32_t) reverbRegs.addrLDiff1 * 8;
-    const uint32_t addrLDiff2   = (uint32_t) reverbRegs.addrLDiff2 * 8;
-    const uint32_t addrRDiff1   = (uint32_t) reverbRegs.addrRDiff1 * 8;
-    const uint32_t addrRDiff2   = (uint32_t) reverbRegs.addrRDiff2 * 8;
-    const uint32_t addrLComb1   = (uint32_t) reverbRegs.addrLComb1 * 8;
-    const uint32_t addrLComb2   = (uint32_t) reverbRegs.addrLComb2 * 8;
-    const uint32_t addrLComb3   = (uint32_t) reverbRegs.addrLComb3 * 8;
-    const uint32_t addrLComb4   = (uint32_t) reverbRegs.addrLComb4 * 8;
-    const uint32_t addrRComb1   = (uint32_t) reverbRegs.addrRComb1 * 8;
-    const uint32_t addrRComb2   = (uint32_t) reverbRegs.addrRComb2 * 8;
-    const uint32_t addrRComb3   = (uint32_t) reverbRegs.addrRComb3 * 8;
-    const uint32_t addrRComb4   = (uint32_t) reverbRegs.addrRComb4 * 8;
-    const uint32_t addrLAPF1    = (uint32_t) reverbRegs.addrLAPF1 * 8;
-    const uint32_t addrLAPF2    = (uint32_t) reverbRegs.addrLAPF2 * 8;
-    const uint32_t addrRAPF1    = (uint32_t) reverbRegs.addrRAPF1 * 8;
-    const uint32_t addrRAPF2    = (uint32_t) reverbRegs.addrRAPF2 * 8;
-    const uint32_t dispAPF1     = (uint32_t) reverbRegs.dispAPF1 * 8;
-    const uint32_t dispAPF2     = (uint32_t) reverbRegs.dispAPF2 * 8;
-
-    const int16_t volWall   = reverbRegs.volWall;
-    const int16_t volIIR    = reverbRegs.volIIR;
-    const int16_t volComb1  = reverbRegs.volComb1;
-    const int16_t volComb2  = reverbRegs.volComb2;
-    const int16_t volComb3  = reverbRegs.volComb3;
-    const int16_t volComb4  = reverbRegs.volComb4;
-    const int16_t volAPF1   = reverbRegs.volAPF1;
-    const int16_t volAPF2   = reverbRegs.volAPF2;
-
-    // Scale the sample which is being fed into the reverb:
-    const Sample inputL = reverbInput.left * reverbRegs.volLIn;
-    const Sample inputR = reverbInput.right * reverbRegs.volRIn;
-
-    // Same side reflection (left-to-left and right-to-right)
-    {
-        const Sample l1 = revR(addrLSame2);
-        const Sample r1 = revR(addrRSame2);
-        const Sample l2 = revR(addrLSame1 - 2);
-        const Sample r2 = revR(addrRSame1 - 2);
-
-        revW(addrLSame1, (inputL + l1 * volWall - l2) * volIIR + l2);   // Left to left
-        revW(addrRSame1, (inputR + r1 * volWall - r2) * volIIR + r2);   // Right to right
-    }
-
-    // Different side reflection (left-to-right and right-to-left)
-    {
-        const Sample l1 = revR(addrLDiff2);
-        const Sample r1 = revR(addrRDiff2);
-        const Sample l2 = revR(addrLDiff1 - 2);
-        const Sample r2 = revR(addrRDiff1 - 2);
-
-        revW(addrLDiff1, (inputL + r1 * volWall - l2) * volIIR + l2);   // Right to left
-        revW(addrRDiff1, (inputR + l1 * volWall - r2) * volIIR + r2);   // Left to right
-    }
-
-    // Early echo (comb filter, with input from buffer)
-    Sample outL;
-    Sample outR;
-
-    outL = (
-        revR(addrLComb1) * volComb1 +
-        revR(addrLComb2) * volComb2 +
-        revR(addrLComb3) * volComb3 +
-        revR(addrLComb4) * volComb4
-    );
+        voice.adpcmBlockPos.counter += numRunFrames * sampleRate;
 
-    outR = (
-        revR(addrRComb1) * volComb1 +
-        revR(addrRComb2) * volComb2 +
-        revR(addrRComb3) * volComb3 +
-        revR(addrRComb4) * volComb4
-    );
+        // Is it time to read another ADPCM block because we have consumed the current one?
+        if (voice.adpcmBlockPos.fields.sampleIdx >= ADPCM_BLOCK_NUM_SAMPLES) {
+            voice.adpcmBlockPos.fields.sampleIdx -= ADPCM_BLOCK_NUM_SAMPLES;
+            voice.adpcmCurAddr8 += ADPCM_BLOCK_SIZE / 8;
+            voice.bSamplesLoaded = false;
+
+            // Time to go to the loop address?
+            if (voice.bRepeat) {
+                voice.bRepeat = false;
+                voice.adpcmCurAddr8 = voice.adpcmRepeatAddr8;
+            }
+        }
 
-    // Late reverb APF1 (all pass filter 1, with input from COMB)
-    outL = outL - revR(addrLAPF1 - dispAPF1) * volAPF1;
-    revW(addrLAPF1, outL);
-    outL = outL * volAPF1 + revR(addrLAPF1 - dispAPF1);
+        if (bHandleAdpcmFlags) {
+            handleAdpcmFlags(voice, adpcmFlags);
+        }
 
-    outR = outR - revR(addrRAPF1 - dispAPF1) * volAPF1;
-    revW(addrRAPF1, outR);
-    outR = outR * volAPF1 + revR(addrRAPF1 - dispAPF1);
+        #if SIMPLE_SPU_PROFILE
+            envelopeProfileScope.reset();
+        #endif
 
-    // Late reverb APF2 (all pass filter 2, with input from APF1)
-    outL = outL - revR(addrLAPF2 - dispAPF2) * volAPF2;
-    revW(addrLAPF2, outL);
-    outL = outL * volAPF2 + revR(addrLAPF2 - dispAPF2);
+        SPU_PROFILE_COUNT(numVoiceFrames, numRunFrames);
+
+        // Get the interpolated samples for the run, attenuate by the volume envelope and voice volume, and add to the output.
+        // Only bother doing this however if the voice is actually turned on, and only include in the output to reverberate if enabled.
+        if (!voice.bDisabled) {
+            SPU_PROFILE_SCOPE(interpolationNs);
+            mixVoiceFrames(
+                voice.samples.get<Sample>(),
+                blockPositions,
+                envLevels,
+                realVoiceVolL,
+                realVoiceVolR,
+                pOutL + runStartFrameIdx,
+                pOutR + runStartFrameIdx,
+                (voice.bDoReverb) ? pRevL + runStartFrameIdx : nullptr,
+                (voice.bDoReverb) ? pRevR + runStartFrameIdx : nullptr,
+                numRunFrames
+            );
+        }
 
-    outR = outR - revR(addrRAPF2 - dispAPF2) * volAPF2;
-    revW(addrRAPF2, outR);
-    outR = outR * volAPF2 + revR(addrRAPF2 - dispAPF2);
+        runStartFrameIdx += numRunFrames;
+    }
+}
 
-    // Move along the reverb address for the next update by 1 16-bit sample
-    #if SIMPLE_SPU_FLOAT_SPU
-        reverbCurAddr = reverbBaseAddr + wrapRevAddr16(reverbCurAddr + 2);  // 'wrapRevAddr16' returns the address starting from '0' for the float SPU, need to fix up
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the index of the lowest bit set in the given mask, which must not be zero
+//------------------------------------------------------------------------------------------------------------------------------------------
+static inline uint32_t getLowestSetBitIdx(const uint64_t mask) noexcept {
+    ASSERT(mask != 0);
+
+    #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long bitIdx;
+        _BitScanForward64(&bitIdx, mask);
+        return (uint32_t) bitIdx;
+    #elif defined(__GNUC__) || defined(__clang__)
+        return (uint32_t) __builtin_ctzll(mask);
     #else
-        reverbCurAddr = wrapRevAddr16(reverbCurAddr + 2);
-    #endif
+        uint32_t bitIdx = 0;
 
-    // Scale and return the reverb output
-    reverbOutput = StereoSample {
-        outL * reverbVol.left,
-        outR * reverbVol.right
-    };
+        while (((mask >> bitIdx) & 1) == 0) {
+            ++bitIdx;
+        }
+
+        return bitIdx;
+    #endif
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Does the final mix and attenuation of dry sound and reverb sound, and scales according to the master volume
+// Get a mask with a bit set for each voice of the core which is playing (not 'Off')
 //------------------------------------------------------------------------------------------------------------------------------------------
-void doMasterMix(
-    const StereoSample dryOutput,
-    const StereoSample reverbOutput,
-    const Volume masterVol,
-    StereoSample& output
-) noexcept {
-    // Note: master volume is expected to be +/- 0x3FFF.
-    // Need to clamp if exceeding this and also scale by 2.
-    const StereoSample wetOutput = dryOutput + reverbOutput;
-    const Volume scaledMasterVol = {
-        (int16_t)(std::clamp(masterVol.left, MIN_MASTER_VOLUME, MAX_MASTER_VOLUME) * 2),
+static uint64_t getActiveVoiceMask(const Core& core) noexcept {
+    uint64_t activeVoiceMask = 0;
+
+    for (uint32_t voiceIdx = 0; voiceIdx < core.numVoices; ++voiceIdx) {
+        if (core.pVoices[voiceIdx].envPhase != EnvPhase::Off) {
+            activeVoiceMask |= (uint64_t) 1 << voiceIdx;
+        }
+    }
+
+    return activeVoiceMask;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Process/update all voices in the given mask of active voices for a batch of frames and add their output to the given (planar) output
+// buffers. Voices which switch off during the batch are removed from the mask, and the voice off callback (if any) is notified about them.
+// Voices which are already off would do nothing, so are skipped.
+// Each voice is run for the entire batch before moving onto the next voice; since every voice still adds into a frame's output in voice
+// order, the result is exactly the same as stepping all of the voices for each frame in turn.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void renderVoices(
+    Voice* const pVoices,
+    uint64_t& activeVoiceMask,
+    const VoiceOffCallback pVoiceOffCallback,
+    void* const pVoiceOffUserData,
+    const std::byte* pRam,
+    const uint32_t ramSize,
+    DecodedBlockCache& blockCache,
+    const PredecodedSound* const pPredecodedSounds,
+    const uint32_t numPredecodedSounds,
+    const uint32_t blockCacheEndAddr,
+    Sample* const pOutL,
+    Sample* const pOutR,
+    Sample* const pRevL,
+    Sample* const pRevR,
+    const uint32_t numFrames
+) noexcept {
+    ASSERT(pVoices || (activeVoiceMask == 0));
+    ASSERT(pOutL && pOutR && pRevL && pRevR);
+
+    // Note: going from the lowest bit upwards keeps the voices in order
+    for (uint64_t voicesLeft = activeVoiceMask; voicesLeft != 0; voicesLeft &= voicesLeft - 1) {
+        const uint32_t voiceIdx = getLowestSetBitIdx(voicesLeft);
+        Voice& voice = pVoices[voiceIdx];
+
+        renderVoice(
+            voice,
+            pRam,
+            ramSize,
+            blockCache,
+            pPredecodedSounds,
+            numPredecodedSounds,
+            blockCacheEndAddr,
+            pOutL,
+            pOutR,
+            pRevL,
+            pRevR,
+            numFrames
+        );
+
+        if (voice.envPhase == EnvPhase::Off) {
+            activeVoiceMask &= ~((uint64_t) 1 << voiceIdx);
+
+            if (pVoiceOffCallback) {
+                pVoiceOffCallback(pVoiceOffUserData, voiceIdx);
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// In 16-bit mode the reverb work area shares SPU RAM with sample data.
+// If reverb is being written and any voice might read ADPCM data from the reverb work area within the given number of frames, then voices
+// must be processed one frame at a time so they observe reverb writes at exactly the same point that 'stepCore' always did.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool canVoicesReadReverbArea(const Core& core, const uint32_t numFrames) noexcept {
+    const uint64_t reverbBaseAddr = (uint64_t) core.reverbBaseAddr8 * 8;
+
+    if ((!core.bReverbWriteEnable) || (reverbBaseAddr >= core.ramSize))
+        return false;
+
+    // The furthest a voice can advance in the given number of frames, rounded up to whole ADPCM blocks
+    const uint64_t maxSamplesAdvanced = ((uint64_t) numFrames * MAX_SAMPLE_RATE) >> 12;
+    const uint64_t maxBytesAdvanced = (maxSamplesAdvanced / ADPCM_BLOCK_NUM_SAMPLES + 2) * ADPCM_BLOCK_SIZE;
+
+    for (uint32_t voiceIdx = 0; voiceIdx < core.numVoices; ++voiceIdx) {
+        const Voice& voice = core.pVoices[voiceIdx];
+
+        if (voice.envPhase == EnvPhase::Off)
+            continue;
+
+        const uint64_t maxBlockAddr = (uint64_t) std::max(voice.adpcmCurAddr8, voice.adpcmRepeatAddr8) * 8;
+
+        if (maxBlockAddr + maxBytesAdvanced > reverbBaseAddr)
+            return true;
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Convert a stereo sample from and to normalized floating point: exact for 16-bit samples
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static BasicStereoSample<Sample> fromFloatStereoSample(const FloatStereoSample sample) noexcept {
+    return BasicStereoSample<Sample>{ Sample::fromFloat(sample.left), Sample::fromFloat(sample.right) };
+}
+
+template <class Sample>
+static FloatStereoSample toFloatStereoSample(const BasicStereoSample<Sample> sample) noexcept {
+    return FloatStereoSample{ sample.left.toFloat(), sample.right.toFloat() };
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Mixes sound from an external input; does nothing if there is no current external input
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void mixExternalInput(
+    const ExtInputCallback pExtCallback,
+    void* const pExtCallbackUserData,
+    const Volume extVolume,
+    const bool bExtReverbEnabled,
+    BasicStereoSample<Sample>& output,
+    BasicStereoSample<Sample>& outputToReverb
+) noexcept {
+    typedef BasicStereoSample<Sample> StereoSample;
+
+    if (!pExtCallback)
+        return;
+
+    const StereoSample extSample = fromFloatStereoSample<Sample>(pExtCallback(pExtCallbackUserData));
+    const StereoSample extSampleScaled = extSample * extVolume;
+    output += extSampleScaled;
+
+    if (bExtReverbEnabled) {
+        outputToReverb += extSampleScaled;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Reverb settings which do not change while a block of SPU output is being rendered.
+// These are gathered once per block so the setup work is not repeated for every reverb update.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ReverbParams {
+    float*          pReverbRam;             // Float mode: reverb RAM, which holds only the reverb work area
+    std::byte*      pRam;                   // 16-bit mode: SPU RAM, which holds the reverb work area
+    uint32_t        reverbBaseAddr;         // Start address of the reverb work area in bytes
+    uint32_t        reverbBaseAddr2;        // Start address of the reverb work area in 16-bit units
+    uint32_t        reverbWorkAreaSize2;    // Size of the reverb work area in 16-bit units
+    Volume          reverbVol;
+    bool            bReverbWriteEnable;
+    const uint32_t* pTapOffsets;            // Reverb tap offsets (relative to the current reverb address) in bytes
+    bool            bTapsWidelySpaced;      // Whether the taps are always far enough apart for several reverb updates to be done at once
+
+    // Reverb volumes
+    int16_t         volWall;
+    int16_t         volIIR;
+    int16_t         volComb1;
+    int16_t         volComb2;
+    int16_t         volComb3;
+    int16_t         volComb4;
+    int16_t         volAPF1;
+    int16_t         volAPF2;
+    int16_t         volLIn;
+    int16_t         volRIn;
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the size of the reverb work area for the given core in 16-bit units
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint32_t getReverbWorkAreaSize2(const Core& core) noexcept {
+    const uint32_t reverbBaseAddr = core.reverbBaseAddr8 * 8;
+
+    if constexpr (Sample::IS_FLOAT) {
+        return std::min((core.ramSize - reverbBaseAddr) / 2, core.numReverbRamSamples);
+    } else {
+        return (core.ramSize - reverbBaseAddr) / 2;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Convert the reverb registers to reverb tap offsets
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void convertReverbTaps(ReverbTaps& taps, const ReverbRegs& regs) noexcept {
+    // This is based almost exactly on: https://problemkaputt.de/psx-spx.htm#spureverbformula.
+    // Grab the real relative reverb addresses (need to x8 them) and apply the adjustments made by the reverb formula.
+    uint32_t* const pOffsets = taps.offsets;
+    const uint32_t dispAPF1 = (uint32_t) regs.dispAPF1 * 8;
+    const uint32_t dispAPF2 = (uint32_t) regs.dispAPF2 * 8;
+
+    pOffsets[ReverbTaps::LSame1]        = (uint32_t) regs.addrLSame1 * 8;
+    pOffsets[ReverbTaps::RSame1]        = (uint32_t) regs.addrRSame1 * 8;
+    pOffsets[ReverbTaps::LSame2]        = (uint32_t) regs.addrLSame2 * 8;
+    pOffsets[ReverbTaps::RSame2]        = (uint32_t) regs.addrRSame2 * 8;
+    pOffsets[ReverbTaps::LSame1Prev]    = pOffsets[ReverbTaps::LSame1] - 2;
+    pOffsets[ReverbTaps::RSame1Prev]    = pOffsets[ReverbTaps::RSame1] - 2;
+    pOffsets[ReverbTaps::LDiff1]        = (uint32_t) regs.addrLDiff1 * 8;
+    pOffsets[ReverbTaps::RDiff1]        = (uint32_t) regs.addrRDiff1 * 8;
+    pOffsets[ReverbTaps::LDiff2]        = (uint32_t) regs.addrLDiff2 * 8;
+    pOffsets[ReverbTaps::RDiff2]        = (uint32_t) regs.addrRDiff2 * 8;
+    pOffsets[ReverbTaps::LDiff1Prev]    = pOffsets[ReverbTaps::LDiff1] - 2;
+    pOffsets[ReverbTaps::RDiff1Prev]    = pOffsets[ReverbTaps::RDiff1] - 2;
+    pOffsets[ReverbTaps::LComb1]        = (uint32_t) regs.addrLComb1 * 8;
+    pOffsets[ReverbTaps::RComb1]        = (uint32_t) regs.addrRComb1 * 8;
+    pOffsets[ReverbTaps::LComb2]        = (uint32_t) regs.addrLComb2 * 8;
+    pOffsets[ReverbTaps::RComb2]        = (uint32_t) regs.addrRComb2 * 8;
+    pOffsets[ReverbTaps::LComb3]        = (uint32_t) regs.addrLComb3 * 8;
+    pOffsets[ReverbTaps::RComb3]        = (uint32_t) regs.addrRComb3 * 8;
+    pOffsets[ReverbTaps::LComb4]        = (uint32_t) regs.addrLComb4 * 8;
+    pOffsets[ReverbTaps::RComb4]        = (uint32_t) regs.addrRComb4 * 8;
+    pOffsets[ReverbTaps::LAPF1]         = (uint32_t) regs.addrLAPF1 * 8;
+    pOffsets[ReverbTaps::RAPF1]         = (uint32_t) regs.addrRAPF1 * 8;
+    pOffsets[ReverbTaps::LAPF1Src]      = pOffsets[ReverbTaps::LAPF1] - dispAPF1;
+    pOffsets[ReverbTaps::RAPF1Src]      = pOffsets[ReverbTaps::RAPF1] - dispAPF1;
+    pOffsets[ReverbTaps::LAPF2]         = (uint32_t) regs.addrLAPF2 * 8;
+    pOffsets[ReverbTaps::RAPF2]         = (uint32_t) regs.addrRAPF2 * 8;
+    pOffsets[ReverbTaps::LAPF2Src]      = pOffsets[ReverbTaps::LAPF2] - dispAPF2;
+    pOffsets[ReverbTaps::RAPF2Src]      = pOffsets[ReverbTaps::RAPF2] - dispAPF2;
+
+    taps.regs = regs;
+    taps.bValid = true;
+    taps.spacingWorkAreaSize2 = 0;
+    taps.bWidelySpaced = false;
+}
+
+#if SIMD_SSE2
+
+// How many consecutive reverb updates the SIMD version of reverb processes at a time.
+// In float mode that is one update per vector lane; in 16-bit mode the left and right channels share a vector instead, since with
+// any more updates the taps for most reverb presets would be too close together.
+static constexpr uint32_t REVERB_SIMD_WINDOW = 4;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The SIMD version of reverb processes a window of consecutive reverb updates at a time, with each update in it's own vector lane.
+// Only the same and different side reflections depend on the result of the previous update, and that is always through the location
+// written by the previous update, so the reflections are carried over in registers instead. All other reverb RAM reads and writes in the
+// window are done in bulk, which only gives the same result if none of them touch the same locations within a window.
+//
+// Checks that every tap written is at least a window away from every other tap, for the given work area size. While the taps wrap around
+// the work area with a true modulo their distances from each other are fixed (modulo the size), so this only needs checking when the
+// registers or the work area change.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool areReverbTapsWidelySpaced(const uint32_t (&tapOffsets)[ReverbTaps::NUM_TAPS], const uint32_t workAreaSize2) noexcept {
+    if (workAreaSize2 < REVERB_SIMD_WINDOW * 2)
+        return false;
+
+    constexpr uint32_t WRITE_TAPS[] = {
+        ReverbTaps::LSame1, ReverbTaps::RSame1, ReverbTaps::LDiff1, ReverbTaps::RDiff1,
+        ReverbTaps::LAPF1, ReverbTaps::RAPF1, ReverbTaps::LAPF2, ReverbTaps::RAPF2
+    };
+
+    constexpr uint32_t BULK_READ_TAPS[] = {
+        ReverbTaps::LSame2, ReverbTaps::RSame2, ReverbTaps::LDiff2, ReverbTaps::RDiff2,
+        ReverbTaps::LComb1, ReverbTaps::RComb1, ReverbTaps::LComb2, ReverbTaps::RComb2,
+        ReverbTaps::LComb3, ReverbTaps::RComb3, ReverbTaps::LComb4, ReverbTaps::RComb4,
+        ReverbTaps::LAPF1Src, ReverbTaps::RAPF1Src, ReverbTaps::LAPF2Src, ReverbTaps::RAPF2Src
+    };
+
+    const auto bTooClose = [&](const uint32_t tap1, const uint32_t tap2) noexcept {
+        const int64_t offset1 = (int32_t) tapOffsets[tap1] / 2;
+        const int64_t offset2 = (int32_t) tapOffsets[tap2] / 2;
+        int64_t distance = (offset1 - offset2) % workAreaSize2;
+        distance = (distance < 0) ? distance + workAreaSize2 : distance;
+        return (distance < REVERB_SIMD_WINDOW) || (workAreaSize2 - distance < REVERB_SIMD_WINDOW);
+    };
+
+    for (uint32_t writeIdx = 0; writeIdx < std::size(WRITE_TAPS); ++writeIdx) {
+        for (const uint32_t readTap : BULK_READ_TAPS) {
+            if (bTooClose(WRITE_TAPS[writeIdx], readTap))
+                return false;
+        }
+
+        for (uint32_t otherWriteIdx = 0; otherWriteIdx < writeIdx; ++otherWriteIdx) {
+            if (bTooClose(WRITE_TAPS[writeIdx], WRITE_TAPS[otherWriteIdx]))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+#endif  // #if SIMD_SSE2
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Update the reverb tap offsets if the reverb registers have changed since they were last converted, and check how far apart the taps are
+// for the given work area size if that has not been done already.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void updateReverbTaps(ReverbTaps& taps, const ReverbRegs& regs, const uint32_t workAreaSize2) noexcept {
+    if ((!taps.bValid) || (std::memcmp(&taps.regs, &regs, sizeof(ReverbRegs)) != 0)) {
+        convertReverbTaps(taps, regs);
+    }
+
+    if (taps.spacingWorkAreaSize2 != workAreaSize2) {
+        #if SIMD_SSE2
+            taps.bWidelySpaced = areReverbTapsWidelySpaced(taps.offsets, workAreaSize2);
+        #else
+            taps.bWidelySpaced = false;
+        #endif
+
+        taps.spacingWorkAreaSize2 = workAreaSize2;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Gather the reverb settings for the given core
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static ReverbParams getReverbParams(const Core& core) noexcept {
+    ReverbParams params;
+    params.pReverbRam = core.pReverbRam;
+    params.pRam = core.pRam;
+
+    // Note that in float mode reverb addresses are still specified in terms of the main SPU ram, so that we can use the original SPU reverb settings.
+    params.reverbBaseAddr = core.reverbBaseAddr8 * 8;
+    params.reverbBaseAddr2 = params.reverbBaseAddr / 2;
+
+    params.reverbWorkAreaSize2 = getReverbWorkAreaSize2<Sample>(core);
+    params.reverbVol = core.reverbVol;
+    params.bReverbWriteEnable = core.bReverbWriteEnable;
+    params.pTapOffsets = core.reverbTaps.offsets;
+    params.bTapsWidelySpaced = core.reverbTaps.bWidelySpaced;
+
+    const ReverbRegs& reverbRegs = core.reverbRegs;
+    params.volWall      = reverbRegs.volWall;
+    params.volIIR       = reverbRegs.volIIR;
+    params.volComb1     = reverbRegs.volComb1;
+    params.volComb2     = reverbRegs.volComb2;
+    params.volComb3     = reverbRegs.volComb3;
+    params.volComb4     = reverbRegs.volComb4;
+    params.volAPF1      = reverbRegs.volAPF1;
+    params.volAPF2      = reverbRegs.volAPF2;
+    params.volLIn       = reverbRegs.volLIn;
+    params.volRIn       = reverbRegs.volRIn;
+    return params;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Wrap an address to be within the reverb work area and guarantee that 16-bits (or a single float, in float mode) can be read safely.
+// In float mode the returned address is relative to the start of the work area, since that is where reverb RAM starts.
+// If there is no reverb work area (which should never be the case) then the address '0' is returned.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint32_t wrapReverbAddr(const ReverbParams& params, const uint32_t addr) noexcept {
+    if (params.reverbWorkAreaSize2 > 0) {
+        const uint32_t addr2 = addr / 2;
+        const uint32_t relativeAddr2 = (addr2 - params.reverbBaseAddr2) % params.reverbWorkAreaSize2;
+
+        if constexpr (Sample::IS_FLOAT) {
+            return relativeAddr2 * 2;
+        } else {
+            return (params.reverbBaseAddr2 + relativeAddr2) * 2;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Move along the current reverb address by 1 16-bit sample for each of the given number of reverb updates
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint32_t advanceReverbAddr(const ReverbParams& params, const uint32_t reverbCurAddr, const uint32_t numUpdates) noexcept {
+    if constexpr (Sample::IS_FLOAT) {
+        return params.reverbBaseAddr + wrapReverbAddr<Sample>(params, reverbCurAddr + numUpdates * 2);    // 'wrapReverbAddr' returns the address starting from '0' in float mode, need to fix up
+    } else {
+        return wrapReverbAddr<Sample>(params, reverbCurAddr + numUpdates * 2);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Reverb helpers: read and write a sample at a reverb tap, the given number of updates after the tap was located.
+// In float mode taps point to floats in reverb RAM, and in 16-bit mode they point to little endian 16-bit samples in SPU RAM.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+using ReverbTapPtr = std::conditional_t<Sample::IS_FLOAT, float*, std::byte*>;
+
+static inline FloatSample reverbRead(const float* const pTap, const uint32_t updateIdx) noexcept {
+    return pTap[updateIdx];
+}
+
+static inline void reverbWrite(float* const pTap, const uint32_t updateIdx, const FloatSample sample) noexcept {
+    pTap[updateIdx] = sample.value;
+}
+
+static inline Int16Sample reverbRead(const std::byte* const pTap, const uint32_t updateIdx) noexcept {
+    const uint16_t data = (uint16_t) pTap[updateIdx * 2] | ((uint16_t) pTap[updateIdx * 2 + 1] << 8);
+    return (int16_t) data;
+}
+
+static inline void reverbWrite(std::byte* const pTap, const uint32_t updateIdx, const Int16Sample sample) noexcept {
+    const uint16_t data = (uint16_t) sample;
+    pTap[updateIdx * 2] = (std::byte) data;
+    pTap[updateIdx * 2 + 1] = (std::byte)(data >> 8);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Locate all of the reverb taps in reverb RAM for the given reverb address, and figure out how many reverb updates (up to the given maximum)
+// can be done before the current address or any of the taps wrap around within the work area. For that many updates every tap simply
+// advances by 16-bits each update. Returns the number of updates.
+//
+// Note: this mirrors exactly what 'wrapReverbAddr' does, including for taps behind the start of the work area. Those are wrapped using
+// unsigned 32-bit arithmetic, which does not give the same result as a true modulo unless the size of the work area is a power of two.
+// If any taps were wrapped like that then 'bTrueModulo' is set to 'false'.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static uint32_t locateReverbTaps(
+    const ReverbParams& params,
+    const uint32_t reverbCurAddr,
+    const uint32_t maxUpdates,
+    ReverbTapPtr<Sample> (&taps)[ReverbTaps::NUM_TAPS],
+    bool& bTrueModulo
+) noexcept {
+    // Gets the pointer to a location in the work area, given the address returned by 'wrapReverbAddr'
+    const auto getTapPtr = [&](const uint32_t wrappedAddr) noexcept -> ReverbTapPtr<Sample> {
+        if constexpr (Sample::IS_FLOAT) {
+            return params.pReverbRam + wrappedAddr / 2;
+        } else {
+            return params.pRam + wrappedAddr;
+        }
+    };
+
+    // If the current address is not somewhere inside the work area then it will be after the first update: just do the one update
+    const uint32_t workAreaSize2 = params.reverbWorkAreaSize2;
+    const uint32_t curAddr2 = reverbCurAddr / 2;
+
+    if ((workAreaSize2 == 0) || (reverbCurAddr & 1) || (curAddr2 < params.reverbBaseAddr2) || (curAddr2 - params.reverbBaseAddr2 >= workAreaSize2)) {
+        for (uint32_t tapIdx = 0; tapIdx < ReverbTaps::NUM_TAPS; ++tapIdx) {
+            taps[tapIdx] = getTapPtr(wrapReverbAddr<Sample>(params, reverbCurAddr + params.pTapOffsets[tapIdx]));
+        }
+
+        bTrueModulo = false;
+        return 1;
+    }
+
+    const int64_t curRelAddr2 = (int64_t) curAddr2 - params.reverbBaseAddr2;
+    int64_t numUpdates = std::min<int64_t>(maxUpdates, workAreaSize2 - curRelAddr2);
+    bTrueModulo = true;
+
+    for (uint32_t tapIdx = 0; tapIdx < ReverbTaps::NUM_TAPS; ++tapIdx) {
+        // Tap offsets are always within +/- 512 KiB, so a 'negative' offset is a tap behind the current address.
+        // For taps inside or past the work area a true modulo is used, which usually just needs a subtract:
+        const uint32_t tapOffset = params.pTapOffsets[tapIdx];
+        const int64_t tapRelAddr2 = curRelAddr2 + (int32_t) tapOffset / 2;
+        uint32_t tapWrappedAddr2;
+
+        if (tapRelAddr2 >= 0) {
+            if (tapRelAddr2 < workAreaSize2) {
+                tapWrappedAddr2 = (uint32_t) tapRelAddr2;
+            } else if (tapRelAddr2 < 2 * (int64_t) workAreaSize2) {
+                tapWrappedAddr2 = (uint32_t)(tapRelAddr2 - workAreaSize2);
+            } else {
+                tapWrappedAddr2 = (uint32_t)(tapRelAddr2 % workAreaSize2);
+            }
+        } else {
+            // Behind the start of all RAM or the work area: wrapping jumps when the tap reaches either start
+            tapWrappedAddr2 = (((reverbCurAddr + tapOffset) / 2) - params.reverbBaseAddr2) % workAreaSize2;
+            bTrueModulo = false;
+            numUpdates = std::min(numUpdates, -tapRelAddr2);
+            const int64_t tapAddr2 = tapRelAddr2 + params.reverbBaseAddr2;
+
+            if (tapAddr2 < 0) {
+                numUpdates = std::min(numUpdates, -tapAddr2);
+            }
+        }
+
+        numUpdates = std::min<int64_t>(numUpdates, workAreaSize2 - tapWrappedAddr2);
+
+        if constexpr (Sample::IS_FLOAT) {
+            taps[tapIdx] = getTapPtr(tapWrappedAddr2 * 2);
+        } else {
+            taps[tapIdx] = getTapPtr((params.reverbBaseAddr2 + tapWrappedAddr2) * 2);
+        }
+    }
+
+    return (uint32_t) numUpdates;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Do the given number of reverb updates for a run of updates where none of the reverb taps wrap around the work area
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void doReverbRunScalar(
+    const ReverbParams& params,
+    const ReverbTapPtr<Sample>* const taps,
+    const Sample* const pInputL,
+    const Sample* const pInputR,
+    Sample* const pOutputL,
+    Sample* const pOutputR,
+    const uint32_t numUpdates
+) noexcept {
+    const bool bReverbWriteEnable = params.bReverbWriteEnable;
+
+    for (uint32_t i = 0; i < numUpdates; ++i) {
+        // This is based almost exactly on: https://problemkaputt.de/psx-spx.htm#spureverbformula.
+        // Scale the sample which is being fed into the reverb:
+        const Sample inputL = pInputL[i] * params.volLIn;
+        const Sample inputR = pInputR[i] * params.volRIn;
+
+        // Same side reflection (left-to-left and right-to-right)
+        {
+            const Sample l1 = reverbRead(taps[ReverbTaps::LSame2], i);
+            const Sample r1 = reverbRead(taps[ReverbTaps::RSame2], i);
+            const Sample l2 = reverbRead(taps[ReverbTaps::LSame1Prev], i);
+            const Sample r2 = reverbRead(taps[ReverbTaps::RSame1Prev], i);
+
+            if (bReverbWriteEnable) {
+                reverbWrite(taps[ReverbTaps::LSame1], i, (inputL + l1 * params.volWall - l2) * params.volIIR + l2);  // Left to left
+                reverbWrite(taps[ReverbTaps::RSame1], i, (inputR + r1 * params.volWall - r2) * params.volIIR + r2);  // Right to right
+            }
+        }
+
+        // Different side reflection (left-to-right and right-to-left)
+        {
+            const Sample l1 = reverbRead(taps[ReverbTaps::LDiff2], i);
+            const Sample r1 = reverbRead(taps[ReverbTaps::RDiff2], i);
+            const Sample l2 = reverbRead(taps[ReverbTaps::LDiff1Prev], i);
+            const Sample r2 = reverbRead(taps[ReverbTaps::RDiff1Prev], i);
+
+            if (bReverbWriteEnable) {
+                reverbWrite(taps[ReverbTaps::LDiff1], i, (inputL + r1 * params.volWall - l2) * params.volIIR + l2);  // Right to left
+                reverbWrite(taps[ReverbTaps::RDiff1], i, (inputR + l1 * params.volWall - r2) * params.volIIR + r2);  // Left to right
+            }
+        }
+
+        // Early echo (comb filter, with input from buffer)
+        Sample outL;
+        Sample outR;
+
+        outL = (
+            reverbRead(taps[ReverbTaps::LComb1], i) * params.volComb1 +
+            reverbRead(taps[ReverbTaps::LComb2], i) * params.volComb2 +
+            reverbRead(taps[ReverbTaps::LComb3], i) * params.volComb3 +
+            reverbRead(taps[ReverbTaps::LComb4], i) * params.volComb4
+        );
+
+        outR = (
+            reverbRead(taps[ReverbTaps::RComb1], i) * params.volComb1 +
+            reverbRead(taps[ReverbTaps::RComb2], i) * params.volComb2 +
+            reverbRead(taps[ReverbTaps::RComb3], i) * params.volComb3 +
+            reverbRead(taps[ReverbTaps::RComb4], i) * params.volComb4
+        );
+
+        // Late reverb APF1 (all pass filter 1, with input from COMB)
+        outL = outL - reverbRead(taps[ReverbTaps::LAPF1Src], i) * params.volAPF1;
+
+        if (bReverbWriteEnable) {
+            reverbWrite(taps[ReverbTaps::LAPF1], i, outL);
+        }
+
+        outL = outL * params.volAPF1 + reverbRead(taps[ReverbTaps::LAPF1Src], i);
+        outR = outR - reverbRead(taps[ReverbTaps::RAPF1Src], i) * params.volAPF1;
+
+        if (bReverbWriteEnable) {
+            reverbWrite(taps[ReverbTaps::RAPF1], i, outR);
+        }
+
+        outR = outR * params.volAPF1 + reverbRead(taps[ReverbTaps::RAPF1Src], i);
+
+        // Late reverb APF2 (all pass filter 2, with input from APF1)
+        outL = outL - reverbRead(taps[ReverbTaps::LAPF2Src], i) * params.volAPF2;
+
+        if (bReverbWriteEnable) {
+            reverbWrite(taps[ReverbTaps::LAPF2], i, outL);
+        }
+
+        outL = outL * params.volAPF2 + reverbRead(taps[ReverbTaps::LAPF2Src], i);
+        outR = outR - reverbRead(taps[ReverbTaps::RAPF2Src], i) * params.volAPF2;
+
+        if (bReverbWriteEnable) {
+            reverbWrite(taps[ReverbTaps::RAPF2], i, outR);
+        }
+
+        outR = outR * params.volAPF2 + reverbRead(taps[ReverbTaps::RAPF2Src], i);
+
+        // Scale and output the reverb
+        pOutputL[i] = outL * params.reverbVol.left;
+        pOutputR[i] = outR * params.reverbVol.right;
+    }
+}
+
+#if SIMD_SSE2
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Carry the same and different side reflections through a window of reverb updates.
+// The given inputs are the reflection inputs plus wall reflections for each update, and are replaced with the reflections written.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void carryReverbReflections(
+    const ReverbParams& params,
+    Sample (&reflections)[4][REVERB_SIMD_WINDOW],
+    Sample (&prevReflections)[4]
+) noexcept {
+    for (uint32_t i = 0; i < REVERB_SIMD_WINDOW; ++i) {
+        for (uint32_t channel = 0; channel < 4; ++channel) {
+            const Sample reflection = (reflections[channel][i] - prevReflections[channel]) * params.volIIR + prevReflections[channel];
+            reflections[channel][i] = reflection;
+            prevReflections[channel] = reflection;
+        }
+    }
+}
+
+static void doReverbRunSimd(
+    const ReverbParams& params,
+    float* const* const taps,
+    const FloatSample* const pInputL,
+    const FloatSample* const pInputR,
+    FloatSample* const pOutputL,
+    FloatSample* const pOutputR,
+    const uint32_t numUpdates
+) noexcept {
+    static_assert(sizeof(FloatSample) == sizeof(float));
+    const bool bReverbWriteEnable = params.bReverbWriteEnable;
+
+    const __m128 volLIn = _mm_set1_ps(toFloatSample(params.volLIn));
+    const __m128 volRIn = _mm_set1_ps(toFloatSample(params.volRIn));
+    const __m128 volWall = _mm_set1_ps(toFloatSample(params.volWall));
+    const __m128 volComb1 = _mm_set1_ps(toFloatSample(params.volComb1));
+    const __m128 volComb2 = _mm_set1_ps(toFloatSample(params.volComb2));
+    const __m128 volComb3 = _mm_set1_ps(toFloatSample(params.volComb3));
+    const __m128 volComb4 = _mm_set1_ps(toFloatSample(params.volComb4));
+    const __m128 volAPF1 = _mm_set1_ps(toFloatSample(params.volAPF1));
+    const __m128 volAPF2 = _mm_set1_ps(toFloatSample(params.volAPF2));
+    const __m128 reverbVolL = _mm_set1_ps(toFloatSample(params.reverbVol.left));
+    const __m128 reverbVolR = _mm_set1_ps(toFloatSample(params.reverbVol.right));
+
+    const auto load = [=](const uint32_t tap, const uint32_t i) noexcept { return _mm_loadu_ps(taps[tap] + i); };
+    const auto store = [=](const uint32_t tap, const uint32_t i, const __m128 samples) noexcept { _mm_storeu_ps(taps[tap] + i, samples); };
+
+    // The reflections written by the previous update, in the order: left same side, right same side, left different side, right different side
+    FloatSample prevReflections[4] = {
+        reverbRead(taps[ReverbTaps::LSame1Prev], 0),
+        reverbRead(taps[ReverbTaps::RSame1Prev], 0),
+        reverbRead(taps[ReverbTaps::LDiff1Prev], 0),
+        reverbRead(taps[ReverbTaps::RDiff1Prev], 0),
+    };
+
+    uint32_t i = 0;
+
+    for (; i + REVERB_SIMD_WINDOW <= numUpdates; i += REVERB_SIMD_WINDOW) {
+        // Scale the samples which are being fed into the reverb
+        const __m128 inputL = _mm_mul_ps(_mm_loadu_ps(&pInputL[i].value), volLIn);
+        const __m128 inputR = _mm_mul_ps(_mm_loadu_ps(&pInputR[i].value), volRIn);
+
+        // Same side reflection (left-to-left and right-to-right) and different side reflection (left-to-right and right-to-left)
+        if (bReverbWriteEnable) {
+            alignas(16) FloatSample reflections[4][REVERB_SIMD_WINDOW];
+            _mm_store_ps(&reflections[0][0].value, _mm_add_ps(inputL, _mm_mul_ps(load(ReverbTaps::LSame2, i), volWall)));
+            _mm_store_ps(&reflections[1][0].value, _mm_add_ps(inputR, _mm_mul_ps(load(ReverbTaps::RSame2, i), volWall)));
+            _mm_store_ps(&reflections[2][0].value, _mm_add_ps(inputL, _mm_mul_ps(load(ReverbTaps::RDiff2, i), volWall)));
+            _mm_store_ps(&reflections[3][0].value, _mm_add_ps(inputR, _mm_mul_ps(load(ReverbTaps::LDiff2, i), volWall)));
+            carryReverbReflections(params, reflections, prevReflections);
+            store(ReverbTaps::LSame1, i, _mm_load_ps(&reflections[0][0].value));
+            store(ReverbTaps::RSame1, i, _mm_load_ps(&reflections[1][0].value));
+            store(ReverbTaps::LDiff1, i, _mm_load_ps(&reflections[2][0].value));
+            store(ReverbTaps::RDiff1, i, _mm_load_ps(&reflections[3][0].value));
+        }
+
+        // Early echo (comb filter, with input from buffer)
+        __m128 outL = _mm_mul_ps(load(ReverbTaps::LComb1, i), volComb1);
+        outL = _mm_add_ps(outL, _mm_mul_ps(load(ReverbTaps::LComb2, i), volComb2));
+        outL = _mm_add_ps(outL, _mm_mul_ps(load(ReverbTaps::LComb3, i), volComb3));
+        outL = _mm_add_ps(outL, _mm_mul_ps(load(ReverbTaps::LComb4, i), volComb4));
+
+        __m128 outR = _mm_mul_ps(load(ReverbTaps::RComb1, i), volComb1);
+        outR = _mm_add_ps(outR, _mm_mul_ps(load(ReverbTaps::RComb2, i), volComb2));
+        outR = _mm_add_ps(outR, _mm_mul_ps(load(ReverbTaps::RComb3, i), volComb3));
+        outR = _mm_add_ps(outR, _mm_mul_ps(load(ReverbTaps::RComb4, i), volComb4));
+
+        // Late reverb APF1 (all pass filter 1, with input from COMB)
+        const __m128 apf1L = load(ReverbTaps::LAPF1Src, i);
+        const __m128 apf1R = load(ReverbTaps::RAPF1Src, i);
+        outL = _mm_sub_ps(outL, _mm_mul_ps(apf1L, volAPF1));
+        outR = _mm_sub_ps(outR, _mm_mul_ps(apf1R, volAPF1));
+
+        if (bReverbWriteEnable) {
+            store(ReverbTaps::LAPF1, i, outL);
+            store(ReverbTaps::RAPF1, i, outR);
+        }
+
+        outL = _mm_add_ps(_mm_mul_ps(outL, volAPF1), apf1L);
+        outR = _mm_add_ps(_mm_mul_ps(outR, volAPF1), apf1R);
+
+        // Late reverb APF2 (all pass filter 2, with input from APF1)
+        const __m128 apf2L = load(ReverbTaps::LAPF2Src, i);
+        const __m128 apf2R = load(ReverbTaps::RAPF2Src, i);
+        outL = _mm_sub_ps(outL, _mm_mul_ps(apf2L, volAPF2));
+        outR = _mm_sub_ps(outR, _mm_mul_ps(apf2R, volAPF2));
+
+        if (bReverbWriteEnable) {
+            store(ReverbTaps::LAPF2, i, outL);
+            store(ReverbTaps::RAPF2, i, outR);
+        }
+
+        outL = _mm_add_ps(_mm_mul_ps(outL, volAPF2), apf2L);
+        outR = _mm_add_ps(_mm_mul_ps(outR, volAPF2), apf2R);
+
+        // Scale and output the reverb
+        _mm_storeu_ps(&pOutputL[i].value, _mm_mul_ps(outL, reverbVolL));
+        _mm_storeu_ps(&pOutputR[i].value, _mm_mul_ps(outR, reverbVolR));
+    }
+
+    // Do any leftover updates
+    if (i < numUpdates) {
+        float* leftoverTaps[ReverbTaps::NUM_TAPS];
+
+        for (uint32_t tapIdx = 0; tapIdx < ReverbTaps::NUM_TAPS; ++tapIdx) {
+            leftoverTaps[tapIdx] = taps[tapIdx] + i;
+        }
+
+        doReverbRunScalar(params, leftoverTaps, pInputL + i, pInputR + i, pOutputL + i, pOutputR + i, numUpdates - i);
+    }
+}
+
+static void doReverbRunSimd(
+    const ReverbParams& params,
+    std::byte* const* const taps,
+    const Int16Sample* const pInputL,
+    const Int16Sample* const pInputR,
+    Int16Sample* const pOutputL,
+    Int16Sample* const pOutputR,
+    const uint32_t numUpdates
+) noexcept {
+    // Additions and subtractions saturate and multiplies are done with 'attenuateI16', which is exactly the same as the 'Int16Sample' operators.
+    // Each vector holds a window of left channel samples in the low half and right channel samples in the high half.
+    // Note: SSE2 is only available on little endian machines, so the 16-bit samples in reverb RAM can be accessed directly.
+    static_assert(sizeof(Int16Sample) == sizeof(int16_t));
+    static_assert(REVERB_SIMD_WINDOW == 4);
+    const bool bReverbWriteEnable = params.bReverbWriteEnable;
+
+    const auto setLR = [](const int16_t left, const int16_t right) noexcept { return _mm_setr_epi16(left, left, left, left, right, right, right, right); };
+    const __m128i volIn = setLR(params.volLIn, params.volRIn);
+    const __m128i volWall = _mm_set1_epi16(params.volWall);
+    const __m128i volComb1 = _mm_set1_epi16(params.volComb1);
+    const __m128i volComb2 = _mm_set1_epi16(params.volComb2);
+    const __m128i volComb3 = _mm_set1_epi16(params.volComb3);
+    const __m128i volComb4 = _mm_set1_epi16(params.volComb4);
+    const __m128i volAPF1 = _mm_set1_epi16(params.volAPF1);
+    const __m128i volAPF2 = _mm_set1_epi16(params.volAPF2);
+    const __m128i reverbVol = setLR(params.reverbVol.left, params.reverbVol.right);
+
+    const auto load = [=](const uint32_t tapL, const uint32_t tapR, const uint32_t i) noexcept {
+        return _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*)(taps[tapL] + i * 2)),
+            _mm_loadl_epi64((const __m128i*)(taps[tapR] + i * 2))
+        );
+    };
+
+    const auto store = [=](const uint32_t tapL, const uint32_t tapR, const uint32_t i, const __m128i samples) noexcept {
+        _mm_storel_epi64((__m128i*)(taps[tapL] + i * 2), samples);
+        _mm_storel_epi64((__m128i*)(taps[tapR] + i * 2), _mm_unpackhi_epi64(samples, samples));
+    };
+
+    // The reflections written by the previous update, in the order: left same side, right same side, left different side, right different side
+    Int16Sample prevReflections[4] = {
+        reverbRead(taps[ReverbTaps::LSame1Prev], 0),
+        reverbRead(taps[ReverbTaps::RSame1Prev], 0),
+        reverbRead(taps[ReverbTaps::LDiff1Prev], 0),
+        reverbRead(taps[ReverbTaps::RDiff1Prev], 0),
+    };
+
+    uint32_t i = 0;
+
+    for (; i + REVERB_SIMD_WINDOW <= numUpdates; i += REVERB_SIMD_WINDOW) {
+        // Scale the samples which are being fed into the reverb
+        const __m128i input = attenuateI16(
+            _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) &pInputL[i].value), _mm_loadl_epi64((const __m128i*) &pInputR[i].value)),
+            volIn
+        );
+
+        // Same side reflection (left-to-left and right-to-right) and different side reflection (left-to-right and right-to-left)
+        if (bReverbWriteEnable) {
+            alignas(16) Int16Sample reflections[4][REVERB_SIMD_WINDOW];
+            _mm_store_si128((__m128i*) reflections[0], _mm_adds_epi16(input, attenuateI16(load(ReverbTaps::LSame2, ReverbTaps::RSame2, i), volWall)));
+            _mm_store_si128((__m128i*) reflections[2], _mm_adds_epi16(input, attenuateI16(load(ReverbTaps::RDiff2, ReverbTaps::LDiff2, i), volWall)));
+            carryReverbReflections(params, reflections, prevReflections);
+            store(ReverbTaps::LSame1, ReverbTaps::RSame1, i, _mm_load_si128((const __m128i*) reflections[0]));
+            store(ReverbTaps::LDiff1, ReverbTaps::RDiff1, i, _mm_load_si128((const __m128i*) reflections[2]));
+        }
+
+        // Early echo (comb filter, with input from buffer): sum the 4 combs in order since saturating adds are not associative
+        __m128i out = attenuateI16(load(ReverbTaps::LComb1, ReverbTaps::RComb1, i), volComb1);
+        out = _mm_adds_epi16(out, attenuateI16(load(ReverbTaps::LComb2, ReverbTaps::RComb2, i), volComb2));
+        out = _mm_adds_epi16(out, attenuateI16(load(ReverbTaps::LComb3, ReverbTaps::RComb3, i), volComb3));
+        out = _mm_adds_epi16(out, attenuateI16(load(ReverbTaps::LComb4, ReverbTaps::RComb4, i), volComb4));
+
+        // Late reverb APF1 (all pass filter 1, with input from COMB)
+        const __m128i apf1 = load(ReverbTaps::LAPF1Src, ReverbTaps::RAPF1Src, i);
+        out = _mm_subs_epi16(out, attenuateI16(apf1, volAPF1));
+
+        if (bReverbWriteEnable) {
+            store(ReverbTaps::LAPF1, ReverbTaps::RAPF1, i, out);
+        }
+
+        out = _mm_adds_epi16(attenuateI16(out, volAPF1), apf1);
+
+        // Late reverb APF2 (all pass filter 2, with input from APF1)
+        const __m128i apf2 = load(ReverbTaps::LAPF2Src, ReverbTaps::RAPF2Src, i);
+        out = _mm_subs_epi16(out, attenuateI16(apf2, volAPF2));
+
+        if (bReverbWriteEnable) {
+            store(ReverbTaps::LAPF2, ReverbTaps::RAPF2, i, out);
+        }
+
+        out = _mm_adds_epi16(attenuateI16(out, volAPF2), apf2);
+
+        // Scale and output the reverb
+        out = attenuateI16(out, reverbVol);
+        _mm_storel_epi64((__m128i*) &pOutputL[i].value, out);
+        _mm_storel_epi64((__m128i*) &pOutputR[i].value, _mm_unpackhi_epi64(out, out));
+    }
+
+    // Do any leftover updates
+    if (i < numUpdates) {
+        std::byte* leftoverTaps[ReverbTaps::NUM_TAPS];
+
+        for (uint32_t tapIdx = 0; tapIdx < ReverbTaps::NUM_TAPS; ++tapIdx) {
+            leftoverTaps[tapIdx] = taps[tapIdx] + i * 2;
+        }
+
+        doReverbRunScalar(params, leftoverTaps, pInputL + i, pInputR + i, pOutputL + i, pOutputR + i, numUpdates - i);
+    }
+}
+
+#endif  // #if SIMD_SSE2
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Add the given block of samples to reverb input and output a block of reverb samples: one for each reverb update.
+// The reverb taps are located once for each run of updates where none of them wrap around the work area, then walked linearly.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void doReverb(
+    const ReverbParams& reverbParams,
+    uint32_t& reverbCurAddr,
+    const Sample* const pInputL,
+    const Sample* const pInputR,
+    Sample* const pOutputL,
+    Sample* const pOutputR,
+    const uint32_t numUpdates
+) noexcept {
+    // Work with a local copy of the settings: in 16-bit mode, writes to reverb RAM could otherwise alias them and force reloads
+    const ReverbParams params = reverbParams;
+
+    for (uint32_t startUpdateIdx = 0; startUpdateIdx < numUpdates;) {
+        // Locate all of the taps for this run of updates
+        ReverbTapPtr<Sample> taps[ReverbTaps::NUM_TAPS];
+        bool bTrueModulo;
+        const uint32_t runLength = locateReverbTaps<Sample>(params, reverbCurAddr, numUpdates - startUpdateIdx, taps, bTrueModulo);
+
+        // Do the updates
+        const Sample* const pRunInputL = pInputL + startUpdateIdx;
+        const Sample* const pRunInputR = pInputR + startUpdateIdx;
+        Sample* const pRunOutputL = pOutputL + startUpdateIdx;
+        Sample* const pRunOutputR = pOutputR + startUpdateIdx;
+
+        #if SIMD_SSE2
+            // Can only do the updates a window at a time if the taps are far enough apart, or if nothing is written to reverb RAM
+            if ((!params.bReverbWriteEnable) || (params.bTapsWidelySpaced && bTrueModulo)) {
+                doReverbRunSimd(params, taps, pRunInputL, pRunInputR, pRunOutputL, pRunOutputR, runLength);
+            } else {
+                doReverbRunScalar(params, taps, pRunInputL, pRunInputR, pRunOutputL, pRunOutputR, runLength);
+            }
+        #else
+            doReverbRunScalar(params, taps, pRunInputL, pRunInputR, pRunOutputL, pRunOutputR, runLength);
+        #endif
+
+        reverbCurAddr = advanceReverbAddr<Sample>(params, reverbCurAddr, runLength);
+        startUpdateIdx += runLength;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Reverb silence detection.
+// Reverb is judged to have gone silent once it has had no input for long enough that every location in the work area has been rewritten,
+// the output has stayed silent throughout, and a final check shows that the whole work area is silent. From then on reverb can be skipped
+// for as long as it has no input, since it would only produce silence. In 16-bit mode this is exact. Float reverb decays towards zero but
+// may never quite reach it however, so in float mode anything below the resolution of 24-bit audio counts as silence, and the work area is
+// cleared once the tail is judged to have died away so that what remains of it can never be heard.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static constexpr float FLOAT_REVERB_SILENCE_LEVEL = 1.0f / 8388608.0f;
+
+template <class Sample>
+static inline bool isSilentReverbSample(const Sample sample) noexcept {
+    if constexpr (Sample::IS_FLOAT) {
+        return (std::fabs(sample.value) <= FLOAT_REVERB_SILENCE_LEVEL);
+    } else {
+        return (sample.value == 0);
+    }
+}
+
+template <class Sample>
+static bool isSilentReverbBlock(const Sample* const pSamplesL, const Sample* const pSamplesR, const uint32_t numSamples) noexcept {
+    bool bSilent = true;
+
+    for (uint32_t i = 0; i < numSamples; ++i) {
+        bSilent &= (isSilentReverbSample(pSamplesL[i]) && isSilentReverbSample(pSamplesR[i]));
+    }
+
+    return bSilent;
+}
+
+// Note: unlike reverb output, input only counts as silent if it is exactly zero
+template <class Sample>
+static bool isZeroBlock(const Sample* const pSamplesL, const Sample* const pSamplesR, const uint32_t numSamples) noexcept {
+    bool bZero = true;
+
+    for (uint32_t i = 0; i < numSamples; ++i) {
+        bZero &= ((pSamplesL[i].value == 0) && (pSamplesR[i].value == 0));
+    }
+
+    return bZero;
+}
+
+template <class Sample>
+static bool checkReverbWorkAreaSilent(const ReverbParams& params) noexcept {
+    if constexpr (Sample::IS_FLOAT) {
+        for (uint32_t i = 0; i < params.reverbWorkAreaSize2; ++i) {
+            if (!isSilentReverbSample(reverbRead(params.pReverbRam, i)))
+                return false;
+        }
+
+        std::fill_n(params.pReverbRam, params.reverbWorkAreaSize2, 0.0f);
+    } else {
+        for (uint32_t i = 0; i < params.reverbWorkAreaSize2; ++i) {
+            if (!isSilentReverbSample(reverbRead(params.pRam + params.reverbBaseAddr, i)))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if reverb is inert: it has no volume and cannot write to the work area, so it always outputs silence and never changes state
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool isReverbInert(const Core& core) noexcept {
+    return ((!core.bReverbWriteEnable) && (core.reverbVol.left == 0) && (core.reverbVol.right == 0));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Forget that reverb was found to be silent if the work area has since moved, since the new work area has not been checked
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void revalidateReverbSilence(Core& core) noexcept {
+    if (core.bReverbSilent && (core.reverbBaseAddr8 != core.silentReverbBaseAddr8)) {
+        core.bReverbSilent = false;
+        core.numQuietReverbUpdates = 0;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Do a batch of reverb updates for the given core, or skip them if reverb is silent and would only output silence.
+// Skipped updates still move along the reverb address, so that reverb carries on from exactly where it would otherwise have been.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void doCoreReverb(
+    Core& core,
+    const ReverbParams& reverbParams,
+    const Sample* const pInputL,
+    const Sample* const pInputR,
+    Sample* const pOutputL,
+    Sample* const pOutputR,
+    const uint32_t numUpdates
+) noexcept {
+    if (numUpdates == 0)
+        return;
+
+    if (isReverbInert(core) || (core.bReverbSilent && isZeroBlock(pInputL, pInputR, numUpdates))) {
+        std::fill_n(pOutputL, numUpdates, Sample());
+        std::fill_n(pOutputR, numUpdates, Sample());
+        core.reverbCurAddr = advanceReverbAddr<Sample>(reverbParams, core.reverbCurAddr, numUpdates);
+        return;
+    }
+
+    doReverb(reverbParams, core.reverbCurAddr, pInputL, pInputR, pOutputL, pOutputR, numUpdates);
+
+    // Keep track of how long reverb has been quiet for and check if the tail has died away once it has been quiet for long enough
+    core.bReverbSilent = false;
+
+    if (isZeroBlock(pInputL, pInputR, numUpdates) && isSilentReverbBlock(pOutputL, pOutputR, numUpdates)) {
+        core.numQuietReverbUpdates += numUpdates;
+
+        if (core.numQuietReverbUpdates >= reverbParams.reverbWorkAreaSize2) {
+            core.numQuietReverbUpdates = 0;
+            core.bReverbSilent = checkReverbWorkAreaSilent<Sample>(reverbParams);
+            core.silentReverbBaseAddr8 = core.reverbBaseAddr8;
+        }
+    } else {
+        core.numQuietReverbUpdates = 0;
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Skip over the reverb updates for the given number of cycles (frames) while the core is silent, moving along the reverb address
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void skipReverbUpdates(Core& core, const ReverbParams& reverbParams, const uint32_t numFrames) noexcept {
+    const uint32_t firstReverbFrameIdx = core.cycleCount & 1;
+    const uint32_t numReverbUpdates = (numFrames > firstReverbFrameIdx) ? (numFrames + 1 - firstReverbFrameIdx) / 2 : 0;
+
+    if (numReverbUpdates > 0) {
+        core.reverbCurAddr = advanceReverbAddr<Sample>(reverbParams, core.reverbCurAddr, numReverbUpdates);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the master volume to use for the final mix.
+// Note: master volume is expected to be +/- 0x3FFF; need to clamp if exceeding this and also scale by 2.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static Volume getScaledMasterVolume(const Volume masterVol) noexcept {
+    return Volume {
+        (int16_t)(std::clamp(masterVol.left, MIN_MASTER_VOLUME, MAX_MASTER_VOLUME) * 2),
         (int16_t)(std::clamp(masterVol.right, MIN_MASTER_VOLUME, MAX_MASTER_VOLUME) * 2),
     };
+}
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Does the final mix and attenuation of dry sound and reverb sound, and scales according to the (already scaled) master volume
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void doMasterMix(
+    const BasicStereoSample<Sample> dryOutput,
+    const BasicStereoSample<Sample> reverbOutput,
+    const Volume scaledMasterVol,
+    BasicStereoSample<Sample>& output
+) noexcept {
+    const BasicStereoSample<Sample> wetOutput = dryOutput + reverbOutput;
     output = wetOutput * scaledMasterVol;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Core initialization and teardown
 //------------------------------------------------------------------------------------------------------------------------------------------
-#if SIMPLE_SPU_FLOAT_SPU
-    void Spu::initCore(Core& core, const uint32_t ramSize, const uint32_t voiceCount, const uint32_t numReverbRamSamples) noexcept
-#else
-    void Spu::initCore(Core& core, const uint32_t ramSize, const uint32_t voiceCount) noexcept
-#endif
-{
+void Spu::initCore(
+    Core& core,
+    const uint32_t ramSize,
+    const uint32_t voiceCount,
+    const SampleMode sampleMode,
+    const uint32_t numReverbRamSamples
+) noexcept {
     // Zero init everything by default
     core = {};
+    core.sampleMode = sampleMode;
 
     // Zero voices is a valid use-case, if for example you wanted to use this as a PS1 reverb DSP
+    ASSERT(voiceCount <= MAX_VOICES);
+
     if (voiceCount > 0) {
         core.pVoices = new Voice[voiceCount];
         core.numVoices = voiceCount;
@@ -692,83 +2155,774 @@ void doMasterMix(
     }
 
     // Note: pad RAM size to the nearest 16-bytes to ensure the 8-byte addressing mode of the SPU always works.
-    // Some SPU RAM must always be provided also, in order for the SPU to be used.
-    ASSERT(ramSize > 0);
-    const uint32_t roundedRamSize = ((ramSize + 15) / 16) * 16;
-
-    core.pRam = new std::byte[roundedRamSize];
-    core.ramSize = roundedRamSize;
-    std::memset(core.pRam, 0, roundedRamSize);
-
-    // For floating point SPUs allocate reverb RAM too
-    #if SIMPLE_SPU_FLOAT_SPU
-        ASSERT(numReverbRamSamples > 0);
-        core.pReverbRam = new float[numReverbRamSamples];
-        core.numReverbRamSamples = numReverbRamSamples;
-        std::memset(core.pReverbRam, 0, numReverbRamSamples * sizeof(float));
-    #endif
+    // If no RAM is requested then the caller is providing it's own RAM.
+    if (ramSize > 0) {
+        const uint32_t roundedRamSize = ((ramSize + 15) / 16) * 16;
+        core.pRam = new std::byte[roundedRamSize];
+        core.ramSize = roundedRamSize;
+        core.bOwnsRam = true;
+        std::memset(core.pRam, 0, roundedRamSize);
+    }
+
+    // Allocate floating point reverb RAM too, regardless of the sample mode, so that the core can be switched to float mode at any time
+    ASSERT(numReverbRamSamples > 0);
+    core.pReverbRam = new float[numReverbRamSamples];
+    core.numReverbRamSamples = numReverbRamSamples;
+    std::memset(core.pReverbRam, 0, numReverbRamSamples * sizeof(float));
 }
 
 void Spu::destroyCore(Core& core) noexcept {
-    #if SIMPLE_SPU_FLOAT_SPU
-        delete[] core.pReverbRam;
-    #endif
-
+    delete[] core.pReverbRam;
+    enableBlockCache(core, 0);
     delete[] core.pVoices;
-    delete[] core.pRam;
+
+    if (core.bOwnsRam) {
+        delete[] core.pRam;
+    }
+
     core = {};
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Start playing the given voice
+// Convert the samples held in a sample buffer from the given sample mode to the other sample mode
 //------------------------------------------------------------------------------------------------------------------------------------------
-StereoSample Spu::stepCore(Core& core) noexcept {
-    // Process all voices firstly and silence the output if we are not unmuted
-    StereoSample output = {};
-    StereoSample outputToReverb = {};
-    stepVoices(core.pVoices, core.numVoices, core.pRam, core.ramSize, output, outputToReverb);
+template <uint32_t N>
+static void convertSampleBuffer(SampleBuffer<N>& buffer, const SampleMode fromMode) noexcept {
+    // Note: the two sample formats overlap in memory, so convert via a temporary buffer
+    if (fromMode == SampleMode::Float) {
+        Int16Sample samples[N];
+
+        for (uint32_t i = 0; i < N; ++i) {
+            samples[i] = Int16Sample::fromFloat(buffer.f32[i]);
+        }
 
-    if (!core.bUnmute) {
-        output = {};
-        outputToReverb = {};
+        std::copy(samples, samples + N, buffer.i16);
+    } else {
+        FloatSample samples[N];
+
+        for (uint32_t i = 0; i < N; ++i) {
+            samples[i] = buffer.i16[i].toFloat();
+        }
+
+        std::copy(samples, samples + N, buffer.f32);
     }
+}
 
-    // Mix any external input
-    if (core.bExtEnabled) {
-        mixExternalInput(
-            core.pExtInputCallback,
-            core.pExtInputUserData,
-            core.extInputVol,
-            core.bExtReverbEnable,
-            output,
-            outputToReverb
-        );
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Switch the SPU core to a different sample mode.
+// Voices carry on from where they were, using their existing sample history converted to the new mode, and held reverb output is kept.
+// The reverb work area is only converted if reverb writes are enabled: otherwise SPU RAM may be shared with other cores and must not be
+// modified, and since nothing can be written to the work area there is no reverb state of the core's own to carry over.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void Spu::setSampleMode(Core& core, const SampleMode sampleMode) noexcept {
+    if (core.sampleMode == sampleMode)
+        return;
+
+    for (uint32_t voiceIdx = 0; voiceIdx < core.numVoices; ++voiceIdx) {
+        convertSampleBuffer(core.pVoices[voiceIdx].samples, core.sampleMode);
     }
 
-    // Do reverb every 2 cycles: PSX reverb operates at 22,050 Hz and the SPU operates at 44,100 Hz
-    if ((core.cycleCount & 1) == 0) {
-        doReverb(
-        #if SIMPLE_SPU_FLOAT_SPU
-            core.pReverbRam,
-            core.numReverbRamSamples,
-        #else
+    if (core.bReverbWriteEnable) {
+        // The float reverb work area is the same as the 16-bit one, but clipped to the size of reverb RAM
+        const uint32_t workAreaSize2 = getReverbWorkAreaSize2<FloatSample>(core);
+        std::byte* const pWorkArea16 = core.pRam + core.reverbBaseAddr8 * 8;
+
+        if (sampleMode == SampleMode::Float) {
+            for (uint32_t i = 0; i < workAreaSize2; ++i) {
+                reverbWrite(core.pReverbRam, i, reverbRead(pWorkArea16, i).toFloat());
+            }
+        } else {
+            for (uint32_t i = 0; i < workAreaSize2; ++i) {
+                reverbWrite(pWorkArea16, i, Int16Sample::fromFloat(reverbRead(core.pReverbRam, i)));
+            }
+        }
+    }
+
+    // Blocks are decoded differently in each mode, so none of the cached blocks can be used anymore.
+    // The work area is also different in each mode, so it will need to be checked for silence again.
+    invalidateBlockCache(core);
+    core.sampleMode = sampleMode;
+    core.bReverbSilent = false;
+    core.numQuietReverbUpdates = 0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if the core's reverb is silent and will stay that way until it gets some input
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool Spu::isReverbSilent(const Core& core) noexcept {
+    const bool bSilentTail = (core.bReverbSilent && (core.reverbBaseAddr8 == core.silentReverbBaseAddr8));
+    const bool bSilentHeldOutput = ((core.processedReverb.left.value == 0) && (core.processedReverb.right.value == 0));
+    return ((isReverbInert(core) || bSilentTail) && bSilentHeldOutput);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Tells if the core will output only silence until a voice is keyed on or there is external input
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool Spu::isCoreSilent(const Core& core) noexcept {
+    const bool bHasExtInput = (core.bExtEnabled && core.pExtInputCallback);
+    return ((getActiveVoiceMask(core) == 0) && (!bHasExtInput) && isReverbSilent(core));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Step the SPU core by a single cycle and return the output sample
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+BasicStereoSample<Sample> Spu::stepCore(Core& core) noexcept {
+    BasicStereoSample<Sample> output;
+    renderCore(core, &output, 1);
+    return output;
+}
+
+template Int16StereoSample Spu::stepCore<Int16Sample>(Core& core) noexcept;
+template FloatStereoSample Spu::stepCore<FloatSample>(Core& core) noexcept;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Run the SPU core for the given number of cycles and save the output of each cycle to the given buffer
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+void Spu::renderCore(Core& core, BasicStereoSample<Sample>* const pOutput, const uint32_t numFrames) noexcept {
+    typedef BasicStereoSample<Sample> StereoSample;
+    ASSERT(core.sampleMode == Sample::MODE);
+    ASSERT(pOutput || (numFrames == 0));
+
+    // Settings which are constant for the entire block.
+    // The pre-decoded sounds (if any) can only be used if they were decoded for this sample mode.
+    updateReverbTaps(core.reverbTaps, core.reverbRegs, getReverbWorkAreaSize2<Sample>(core));
+    const ReverbParams reverbParams = getReverbParams<Sample>(core);
+    const Volume scaledMasterVol = getScaledMasterVolume(core.masterVol);
+    const bool bMixExtInput = core.bExtEnabled;
+    const bool bHasExtInput = (bMixExtInput && core.pExtInputCallback);
+    const uint32_t numPredecodedSounds = getNumUsablePredecodedSounds<Sample>(core);
+
+    // Only the voices which are playing need to be processed
+    core.activeVoiceMask = getActiveVoiceMask(core);
+    revalidateReverbSilence(core);
+
+    // Decide which ADPCM blocks can be cached (if the cache is enabled) or used from the pre-decoded sounds (if there are any).
+    // In 16-bit mode, RAM in the reverb work area is modified continuously so never use the cache there. If the work area also moves to a
+    // lower address then cached blocks may now be in the work area and will get overwritten, so in that case invalidate everything.
+    uint32_t blockCacheEndAddr = UINT32_MAX;
+
+    if constexpr (!Sample::IS_FLOAT) {
+        blockCacheEndAddr = (reverbParams.reverbWorkAreaSize2 > 0) ? reverbParams.reverbBaseAddr : 0;
+
+        if (core.blockCache.pBlocks && (core.reverbBaseAddr8 < core.blockCache.reverbBaseAddr8)) {
+            invalidateBlockCache(core);
+        }
+
+        core.blockCache.reverbBaseAddr8 = core.reverbBaseAddr8;
+    }
+
+    // Voice output is rendered to these (planar) buffers in batches before the rest of the mixing is done frame by frame
+    alignas(16) Sample outputL[RENDER_BATCH_SIZE];
+    alignas(16) Sample outputR[RENDER_BATCH_SIZE];
+    alignas(16) Sample outputToReverbL[RENDER_BATCH_SIZE];
+    alignas(16) Sample outputToReverbR[RENDER_BATCH_SIZE];
+
+    // Reverb input and output for each reverb update in a batch
+    alignas(16) Sample reverbInputL[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbInputR[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbOutputL[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbOutputR[RENDER_BATCH_SIZE / 2];
+
+    StereoSample processedReverb = fromFloatStereoSample<Sample>(core.processedReverb);
+
+    for (uint32_t batchStartIdx = 0; batchStartIdx < numFrames;) {
+        uint32_t batchSize = std::min(numFrames - batchStartIdx, RENDER_BATCH_SIZE);
+
+        // If nothing is sounding then the output is silent: just move time along by the same amount as rendering would
+        const bool bCoreSilent = (
+            (core.activeVoiceMask == 0) &&
+            (!bHasExtInput) &&
+            (isReverbInert(core) || core.bReverbSilent) &&
+            (processedReverb.left.value == 0) &&
+            (processedReverb.right.value == 0)
+        );
+
+        if (bCoreSilent) {
+            std::fill_n(pOutput + batchStartIdx, batchSize, StereoSample());
+            skipReverbUpdates<Sample>(core, reverbParams, batchSize);
+            core.cycleCount += batchSize;
+            batchStartIdx += batchSize;
+            continue;
+        }
+
+        if constexpr (!Sample::IS_FLOAT) {
+            if (canVoicesReadReverbArea(core, batchSize)) {
+                batchSize = 1;
+            }
+        }
+
+        // Process all voices firstly and silence the output if we are not unmuted
+        std::fill_n(outputL, batchSize, Sample());
+        std::fill_n(outputR, batchSize, Sample());
+        std::fill_n(outputToReverbL, batchSize, Sample());
+        std::fill_n(outputToReverbR, batchSize, Sample());
+
+        renderVoices(
+            core.pVoices,
+            core.activeVoiceMask,
+            core.pVoiceOffCallback,
+            core.pVoiceOffUserData,
             core.pRam,
-        #endif
             core.ramSize,
-            core.reverbBaseAddr8,
-            core.reverbCurAddr,
-            core.reverbVol,
-            core.bReverbWriteEnable,
-            core.reverbRegs,
-            outputToReverb,
-            core.processedReverb
+            core.blockCache,
+            core.pPredecodedSounds,
+            numPredecodedSounds,
+            blockCacheEndAddr,
+            outputL,
+            outputR,
+            outputToReverbL,
+            outputToReverbR,
+            batchSize
         );
+
+        if (!core.bUnmute) {
+            std::fill_n(outputL, batchSize, Sample());
+            std::fill_n(outputR, batchSize, Sample());
+            std::fill_n(outputToReverbL, batchSize, Sample());
+            std::fill_n(outputToReverbR, batchSize, Sample());
+        }
+
+        SPU_PROFILE_SCOPE(reverbNs);
+
+        // Mix any external input
+        if (bMixExtInput) {
+            for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+                StereoSample output = { outputL[frameIdx], outputR[frameIdx] };
+                StereoSample outputToReverb = { outputToReverbL[frameIdx], outputToReverbR[frameIdx] };
+
+                mixExternalInput(
+                    core.pExtInputCallback,
+                    core.pExtInputUserData,
+                    core.extInputVol,
+                    core.bExtReverbEnable,
+                    output,
+                    outputToReverb
+                );
+
+                outputL[frameIdx] = output.left;
+                outputR[frameIdx] = output.right;
+                outputToReverbL[frameIdx] = outputToReverb.left;
+                outputToReverbR[frameIdx] = outputToReverb.right;
+            }
+        }
+
+        // Do reverb every 2 cycles: PSX reverb operates at 22,050 Hz and the SPU operates at 44,100 Hz.
+        // Gather the input for each reverb update in this batch and process them all in one go.
+        const uint32_t firstReverbFrameIdx = core.cycleCount & 1;
+        uint32_t numReverbUpdates = 0;
+
+        for (uint32_t frameIdx = firstReverbFrameIdx; frameIdx < batchSize; frameIdx += 2, ++numReverbUpdates) {
+            reverbInputL[numReverbUpdates] = outputToReverbL[frameIdx];
+            reverbInputR[numReverbUpdates] = outputToReverbR[frameIdx];
+        }
+
+        doCoreReverb(core, reverbParams, reverbInputL, reverbInputR, reverbOutputL, reverbOutputR, numReverbUpdates);
+
+        // Do the final mixing and finish up
+        for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+            if (((core.cycleCount + frameIdx) & 1) == 0) {
+                const uint32_t reverbUpdateIdx = (frameIdx - firstReverbFrameIdx) / 2;
+                processedReverb = StereoSample{ reverbOutputL[reverbUpdateIdx], reverbOutputR[reverbUpdateIdx] };
+            }
+
+            const StereoSample output = { outputL[frameIdx], outputR[frameIdx] };
+            doMasterMix(output, processedReverb, scaledMasterVol, pOutput[batchStartIdx + frameIdx]);
+        }
+
+        core.cycleCount += batchSize;
+        batchStartIdx += batchSize;
     }
 
-    // Do the final mixing and finish up
-    doMasterMix(output, core.processedReverb, core.masterVol, output);
-    core.cycleCount++;
-    return output;
+    core.processedReverb = toFloatStereoSample(processedReverb);
+}
+
+template void Spu::renderCore(Core& core, Int16StereoSample* const pOutput, const uint32_t numFrames) noexcept;
+template void Spu::renderCore(Core& core, FloatStereoSample* const pOutput, const uint32_t numFrames) noexcept;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Run the SPU core for the given number of cycles and save the output to separate left and right channel buffers.
+// If only 1 output channel is given then only the left channel is output, and channels beyond the first 2 are left untouched.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample, class T>
+static void renderCorePlanar(Core& core, T* const* const pOutputs, const uint32_t numOutputs, const uint32_t numFrames) noexcept {
+    ASSERT(pOutputs || (numOutputs == 0));
+    BasicStereoSample<Sample> output[RENDER_BATCH_SIZE];
+
+    for (uint32_t batchStartIdx = 0; batchStartIdx < numFrames; batchStartIdx += RENDER_BATCH_SIZE) {
+        const uint32_t batchSize = std::min(numFrames - batchStartIdx, RENDER_BATCH_SIZE);
+        renderCore(core, output, batchSize);
+
+        for (uint32_t chanIdx = 0; chanIdx < std::min(numOutputs, 2u); ++chanIdx) {
+            T* const pChanOutput = pOutputs[chanIdx] + batchStartIdx;
+
+            for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+                const Sample sample = (chanIdx == 0) ? output[frameIdx].left : output[frameIdx].right;
+                pChanOutput[frameIdx] = (T) sample.toFloat();
+            }
+        }
+    }
+}
+
+void Spu::renderCore(Core& core, float* const* const pOutputs, const uint32_t numOutputs, const uint32_t numFrames) noexcept {
+    if (core.sampleMode == SampleMode::Float) {
+        renderCorePlanar<FloatSample>(core, pOutputs, numOutputs, numFrames);
+    } else {
+        renderCorePlanar<Int16Sample>(core, pOutputs, numOutputs, numFrames);
+    }
+}
+
+void Spu::renderCore(Core& core, double* const* const pOutputs, const uint32_t numOutputs, const uint32_t numFrames) noexcept {
+    if (core.sampleMode == SampleMode::Float) {
+        renderCorePlanar<FloatSample>(core, pOutputs, numOutputs, numFrames);
+    } else {
+        renderCorePlanar<Int16Sample>(core, pOutputs, numOutputs, numFrames);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Renders a batch of output for the reverb effect path: see 'renderReverbEffect' in the header.
+// The input and output are planar and the batch can be no bigger than 'RENDER_BATCH_SIZE'.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void renderReverbEffectBatch(
+    Core& core,
+    const ReverbParams& reverbParams,
+    const Volume scaledMasterVol,
+    const Sample* const pInputL,
+    const Sample* const pInputR,
+    Sample* const pOutputL,
+    Sample* const pOutputR,
+    const uint32_t batchSize
+) noexcept {
+    typedef BasicStereoSample<Sample> StereoSample;
+    ASSERT(batchSize <= RENDER_BATCH_SIZE);
+    SPU_PROFILE_SCOPE(reverbNs);
+
+    // If there is no input and reverb is silent then the output is silent: just move time along by the same amount as rendering would
+    const bool bSilent = (
+        ((!core.bExtEnabled) || isZeroBlock(pInputL, pInputR, batchSize)) &&
+        (isReverbInert(core) || core.bReverbSilent) &&
+        (core.processedReverb.left.value == 0) &&
+        (core.processedReverb.right.value == 0)
+    );
+
+    if (bSilent) {
+        std::fill_n(pOutputL, batchSize, Sample());
+        std::fill_n(pOutputR, batchSize, Sample());
+        skipReverbUpdates<Sample>(core, reverbParams, batchSize);
+        core.cycleCount += batchSize;
+        return;
+    }
+
+    // Scale the input by the external input volume to get the dry signal; this is also what is fed to reverb (if enabled)
+    alignas(16) Sample dryL[RENDER_BATCH_SIZE];
+    alignas(16) Sample dryR[RENDER_BATCH_SIZE];
+
+    if (core.bExtEnabled) {
+        const Volume extInputVol = core.extInputVol;
+
+        for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+            dryL[frameIdx] = pInputL[frameIdx] * extInputVol.left;
+            dryR[frameIdx] = pInputR[frameIdx] * extInputVol.right;
+        }
+    } else {
+        std::fill_n(dryL, batchSize, Sample());
+        std::fill_n(dryR, batchSize, Sample());
+    }
+
+    // Do reverb every 2 cycles, gathering the input for every reverb update in the batch and processing them all in one go
+    alignas(16) Sample reverbInputL[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbInputR[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbOutputL[RENDER_BATCH_SIZE / 2];
+    alignas(16) Sample reverbOutputR[RENDER_BATCH_SIZE / 2];
+
+    const uint32_t firstReverbFrameIdx = core.cycleCount & 1;
+    const uint32_t numReverbUpdates = (batchSize + 1 - firstReverbFrameIdx) / 2;
+
+    if (core.bExtEnabled && core.bExtReverbEnable) {
+        for (uint32_t updateIdx = 0; updateIdx < numReverbUpdates; ++updateIdx) {
+            reverbInputL[updateIdx] = dryL[firstReverbFrameIdx + updateIdx * 2];
+            reverbInputR[updateIdx] = dryR[firstReverbFrameIdx + updateIdx * 2];
+        }
+    } else {
+        std::fill_n(reverbInputL, numReverbUpdates, Sample());
+        std::fill_n(reverbInputR, numReverbUpdates, Sample());
+    }
+
+    doCoreReverb(core, reverbParams, reverbInputL, reverbInputR, reverbOutputL, reverbOutputR, numReverbUpdates);
+
+    // Do the final mixing. Each reverb output is held for 2 cycles, so mix the frames in pairs with the same reverb output.
+    // If the batch starts on an odd cycle then the first frame uses the reverb output held over from the previous batch.
+    const auto mixFrame = [&](const uint32_t frameIdx, const StereoSample wet) noexcept {
+        StereoSample output;
+        doMasterMix(StereoSample{ dryL[frameIdx], dryR[frameIdx] }, wet, scaledMasterVol, output);
+        pOutputL[frameIdx] = output.left;
+        pOutputR[frameIdx] = output.right;
+    };
+
+    StereoSample processedReverb = fromFloatStereoSample<Sample>(core.processedReverb);
+    uint32_t frameIdx = 0;
+
+    if (firstReverbFrameIdx > 0) {
+        mixFrame(frameIdx++, processedReverb);
+    }
+
+    for (uint32_t updateIdx = 0; updateIdx < numReverbUpdates; ++updateIdx, frameIdx += 2) {
+        processedReverb = StereoSample{ reverbOutputL[updateIdx], reverbOutputR[updateIdx] };
+        mixFrame(frameIdx, processedReverb);
+
+        if (frameIdx + 1 < batchSize) {
+            mixFrame(frameIdx + 1, processedReverb);
+        }
+    }
+
+    core.processedReverb = toFloatStereoSample(processedReverb);
+    core.cycleCount += batchSize;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Run the SPU core purely as a reverb effect on the given interleaved input
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+void Spu::renderReverbEffect(
+    Core& core,
+    const BasicStereoSample<Sample>* const pInput,
+    BasicStereoSample<Sample>* const pOutput,
+    const uint32_t numFrames
+) noexcept {
+    ASSERT(core.sampleMode == Sample::MODE);
+    ASSERT((pInput && pOutput) || (numFrames == 0));
+
+    // Settings which are constant for the entire block
+    updateReverbTaps(core.reverbTaps, core.reverbRegs, getReverbWorkAreaSize2<Sample>(core));
+    const ReverbParams reverbParams = getReverbParams<Sample>(core);
+    const Volume scaledMasterVol = getScaledMasterVolume(core.masterVol);
+    revalidateReverbSilence(core);
+
+    alignas(16) Sample inputL[RENDER_BATCH_SIZE];
+    alignas(16) Sample inputR[RENDER_BATCH_SIZE];
+    alignas(16) Sample outputL[RENDER_BATCH_SIZE];
+    alignas(16) Sample outputR[RENDER_BATCH_SIZE];
+
+    for (uint32_t batchStartIdx = 0; batchStartIdx < numFrames; batchStartIdx += RENDER_BATCH_SIZE) {
+        const uint32_t batchSize = std::min(numFrames - batchStartIdx, RENDER_BATCH_SIZE);
+
+        for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+            inputL[frameIdx] = pInput[batchStartIdx + frameIdx].left;
+            inputR[frameIdx] = pInput[batchStartIdx + frameIdx].right;
+        }
+
+        renderReverbEffectBatch(core, reverbParams, scaledMasterVol, inputL, inputR, outputL, outputR, batchSize);
+
+        for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+            pOutput[batchStartIdx + frameIdx] = BasicStereoSample<Sample>{ outputL[frameIdx], outputR[frameIdx] };
+        }
+    }
+}
+
+template void Spu::renderReverbEffect(Core&, const Int16StereoSample* const, Int16StereoSample* const, const uint32_t) noexcept;
+template void Spu::renderReverbEffect(Core&, const FloatStereoSample* const, FloatStereoSample* const, const uint32_t) noexcept;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Run the SPU core purely as a reverb effect on the given left and right channel input, writing to separate channel buffers.
+// If only 1 output channel is given then only the left channel is output, and channels beyond the first 2 are left untouched.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample, class T>
+static void renderReverbEffectPlanar(
+    Core& core,
+    const T* const* const pInputs,
+    T* const* const pOutputs,
+    const uint32_t numOutputs,
+    const uint32_t numFrames
+) noexcept {
+    ASSERT(pInputs || (numFrames == 0));
+    ASSERT(pOutputs || (numOutputs == 0));
+
+    // Settings which are constant for the entire block
+    updateReverbTaps(core.reverbTaps, core.reverbRegs, getReverbWorkAreaSize2<Sample>(core));
+    const ReverbParams reverbParams = getReverbParams<Sample>(core);
+    const Volume scaledMasterVol = getScaledMasterVolume(core.masterVol);
+    revalidateReverbSilence(core);
+
+    alignas(16) Sample input[2][RENDER_BATCH_SIZE];
+    alignas(16) Sample output[2][RENDER_BATCH_SIZE];
+
+    for (uint32_t batchStartIdx = 0; batchStartIdx < numFrames; batchStartIdx += RENDER_BATCH_SIZE) {
+        const uint32_t batchSize = std::min(numFrames - batchStartIdx, RENDER_BATCH_SIZE);
+
+        for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+            const T* const pChanInput = pInputs[chanIdx] + batchStartIdx;
+
+            for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+                input[chanIdx][frameIdx] = Sample::fromFloat((float) pChanInput[frameIdx]);
+            }
+        }
+
+        renderReverbEffectBatch(core, reverbParams, scaledMasterVol, input[0], input[1], output[0], output[1], batchSize);
+
+        for (uint32_t chanIdx = 0; chanIdx < std::min(numOutputs, 2u); ++chanIdx) {
+            T* const pChanOutput = pOutputs[chanIdx] + batchStartIdx;
+
+            for (uint32_t frameIdx = 0; frameIdx < batchSize; ++frameIdx) {
+                pChanOutput[frameIdx] = (T) output[chanIdx][frameIdx].toFloat();
+            }
+        }
+    }
+}
+
+void Spu::renderReverbEffect(
+    Core& core,
+    const float* const* const pInputs,
+    float* const* const pOutputs,
+    const uint32_t numOutputs,
+    const uint32_t numFrames
+) noexcept {
+    if (core.sampleMode == SampleMode::Float) {
+        renderReverbEffectPlanar<FloatSample>(core, pInputs, pOutputs, numOutputs, numFrames);
+    } else {
+        renderReverbEffectPlanar<Int16Sample>(core, pInputs, pOutputs, numOutputs, numFrames);
+    }
+}
+
+void Spu::renderReverbEffect(
+    Core& core,
+    const double* const* const pInputs,
+    double* const* const pOutputs,
+    const uint32_t numOutputs,
+    const uint32_t numFrames
+) noexcept {
+    if (core.sampleMode == SampleMode::Float) {
+        renderReverbEffectPlanar<FloatSample>(core, pInputs, pOutputs, numOutputs, numFrames);
+    } else {
+        renderReverbEffectPlanar<Int16Sample>(core, pInputs, pOutputs, numOutputs, numFrames);
+    }
+}
+
+#if SIMPLE_SPU_PROFILE
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the profiling stats for SPU processing done on the calling thread; reset by assigning '{}'
+//------------------------------------------------------------------------------------------------------------------------------------------
+ProfileStats& Spu::getProfileStats() noexcept {
+    return gProfileStats;
+}
+#endif  // #if SIMPLE_SPU_PROFILE
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Enable or disable the decoded ADPCM block cache and set it's size
+//------------------------------------------------------------------------------------------------------------------------------------------
+void Spu::enableBlockCache(Core& core, const uint32_t numBlocks) noexcept {
+    // Free any existing cache firstly
+    DecodedBlockCache& cache = core.blockCache;
+    delete[] cache.pBlocks;
+    delete[] cache.pMruWays;
+    cache = {};
+
+    if (numBlocks == 0)
+        return;
+
+    // Round up the number of sets to a power of two, with at least 2 sets
+    uint32_t numSets = 2;
+    uint32_t setIdxShift = 31;
+
+    while ((numSets < 0x80000000u) && (numSets * DecodedBlockCache::NUM_WAYS < numBlocks)) {
+        numSets *= 2;
+        setIdxShift--;
+    }
+
+    cache.pBlocks = new DecodedBlock[(size_t) numSets * DecodedBlockCache::NUM_WAYS];
+    cache.pMruWays = new uint8_t[numSets];
+    cache.numSets = numSets;
+    cache.setIdxShift = setIdxShift;
+    cache.reverbBaseAddr8 = core.reverbBaseAddr8;
+    invalidateBlockCache(core);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Invalidate the entire decoded ADPCM block cache
+//------------------------------------------------------------------------------------------------------------------------------------------
+void Spu::invalidateBlockCache(Core& core) noexcept {
+    DecodedBlockCache& cache = core.blockCache;
+
+    if (!cache.pBlocks)
+        return;
+
+    const uint32_t numBlocks = cache.numSets * DecodedBlockCache::NUM_WAYS;
+
+    for (uint32_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx) {
+        cache.pBlocks[blockIdx].adpcmAddr8 = DecodedBlockCache::INVALID_ADDR8;
+    }
+
+    std::memset(cache.pMruWays, 0, cache.numSets);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Invalidate any decoded ADPCM blocks which overlap the given range of SPU RAM
+//------------------------------------------------------------------------------------------------------------------------------------------
+void Spu::invalidateBlockCache(Core& core, const uint32_t ramAddr, const uint32_t numBytes) noexcept {
+    DecodedBlockCache& cache = core.blockCache;
+
+    if ((!cache.pBlocks) || (numBytes == 0))
+        return;
+
+    const uint64_t rangeStart = ramAddr;
+    const uint64_t rangeEnd = rangeStart + numBytes;
+    const uint32_t numBlocks = cache.numSets * DecodedBlockCache::NUM_WAYS;
+
+    for (uint32_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx) {
+        DecodedBlock& block = cache.pBlocks[blockIdx];
+
+        if (block.adpcmAddr8 == DecodedBlockCache::INVALID_ADDR8)
+            continue;
+
+        const uint64_t blockStart = (uint64_t) block.adpcmAddr8 * 8;
+        const uint64_t blockEnd = blockStart + ADPCM_BLOCK_SIZE;
+
+        if ((blockStart < rangeEnd) && (blockEnd > rangeStart)) {
+            block.adpcmAddr8 = DecodedBlockCache::INVALID_ADDR8;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Decode a sound in SPU RAM ahead of time so it can be shared by several cores.
+// Simulates a voice playing the sound from the start to find which blocks get decoded and with what decoding history: firstly on the first
+// play through of the sound, and then on the first repeat of it's loop (if it loops). Stops when the sound ends or goes out of range.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void predecodeSound(
+    PredecodedSound& sound,
+    const std::byte* const pRam,
+    const uint32_t ramSize,
+    const uint32_t startAddr8,
+    const uint32_t maxNumBlocks
+) noexcept {
+    sound = {};
+    sound.sampleMode = Sample::MODE;
+    sound.startAddr8 = startAddr8;
+
+    if (maxNumBlocks == 0)
+        return;
+
+    sound.pBlocks = new DecodedBlock[maxNumBlocks];
+
+    for (uint32_t blockIdx = 0; blockIdx < maxNumBlocks; ++blockIdx) {
+        sound.pBlocks[blockIdx].adpcmAddr8 = DecodedBlockCache::INVALID_ADDR8;
+    }
+
+    // Decoded blocks for the loop repeat, which are only known once we actually hit the loop end
+    std::vector<DecodedBlock> loopBlocks;
+
+    // Play the sound with a voice which has just been keyed on
+    Voice voice = {};
+    voice.adpcmStartAddr8 = startAddr8;
+    keyOn(voice);
+
+    bool bHaveRepeatAddr = false;
+    bool bRepeatingLoop = false;
+    uint32_t numBlocks = 0;
+
+    while (true) {
+        // Stop if we go outside of the range of blocks allowed, or reach a block with a different alignment
+        const uint32_t blockOffset8 = voice.adpcmCurAddr8 - startAddr8;
+        const uint32_t blockIdx = blockOffset8 / 2;
+
+        if ((blockIdx >= maxNumBlocks) || (blockOffset8 & 1))
+            break;
+
+        // When repeating the loop, the blocks must be contiguous and we stop after reaching the end of the loop again
+        if (bRepeatingLoop && (blockIdx != sound.loopStartBlockIdx + (uint32_t) loopBlocks.size()))
+            break;
+
+        // Stop if this block was already decoded on this pass (should only happen with strange loop flags)
+        if ((!bRepeatingLoop) && (sound.pBlocks[blockIdx].adpcmAddr8 != DecodedBlockCache::INVALID_ADDR8))
+            break;
+
+        // Decode the block and save it
+        DecodedBlock block;
+        block.adpcmAddr8 = voice.adpcmCurAddr8;
+        Sample* const pSamples = voice.samples.get<Sample>();
+        block.prevSamples.get<Sample>()[0] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 1];
+        block.prevSamples.get<Sample>()[1] = pSamples[Voice::SAMPLE_BUFFER_SIZE - 2];
+
+        std::byte adpcmBlock[ADPCM_BLOCK_SIZE];
+        sramRead(pRam, ramSize, voice.adpcmCurAddr8 * 8, ADPCM_BLOCK_SIZE, adpcmBlock);
+        decodeAdpcmBlock<Sample>(voice, adpcmBlock);
+        block.adpcmFlags = (uint8_t) adpcmBlock[1];
+        std::memcpy(block.samples.get<Sample>(), pSamples + Voice::NUM_PREV_SAMPLES, sizeof(Sample) * ADPCM_BLOCK_NUM_SAMPLES);
+
+        if (bRepeatingLoop) {
+            loopBlocks.push_back(block);
+        } else {
+            sound.pBlocks[blockIdx] = block;
+            numBlocks = std::max(numBlocks, blockIdx + 1);
+        }
+
+        // Follow the loop flags in the same way as a voice would, stopping if the voice would be silenced
+        if (block.adpcmFlags & ADPCM_FLAG_LOOP_START) {
+            voice.adpcmRepeatAddr8 = voice.adpcmCurAddr8;
+            bHaveRepeatAddr = true;
+        }
+
+        if (block.adpcmFlags & ADPCM_FLAG_LOOP_END) {
+            if (bRepeatingLoop || (!bHaveRepeatAddr) || ((block.adpcmFlags & ADPCM_FLAG_REPEAT) == 0))
+                break;
+
+            const uint32_t loopOffset8 = voice.adpcmRepeatAddr8 - startAddr8;
+
+            if ((loopOffset8 / 2 >= maxNumBlocks) || (loopOffset8 & 1))
+                break;
+
+            bRepeatingLoop = true;
+            sound.loopStartBlockIdx = loopOffset8 / 2;
+            voice.adpcmCurAddr8 = voice.adpcmRepeatAddr8;
+        } else {
+            voice.adpcmCurAddr8 += ADPCM_BLOCK_SIZE / 8;
+        }
+    }
+
+    sound.numBlocks = numBlocks;
+
+    if (!loopBlocks.empty()) {
+        sound.numLoopBlocks = (uint32_t) loopBlocks.size();
+        sound.pLoopBlocks = new DecodedBlock[loopBlocks.size()];
+        std::copy(loopBlocks.begin(), loopBlocks.end(), sound.pLoopBlocks);
+    }
+}
+
+void Spu::initPredecodedSound(
+    PredecodedSound& sound,
+    const std::byte* const pRam,
+    const uint32_t ramSize,
+    const uint32_t startAddr8,
+    const uint32_t maxNumBlocks,
+    const SampleMode sampleMode
+) noexcept {
+    if (sampleMode == SampleMode::Float) {
+        predecodeSound<FloatSample>(sound, pRam, ramSize, startAddr8, maxNumBlocks);
+    } else {
+        predecodeSound<Int16Sample>(sound, pRam, ramSize, startAddr8, maxNumBlocks);
+    }
+}
+
+void Spu::destroyPredecodedSound(PredecodedSound& sound) noexcept {
+    delete[] sound.pBlocks;
+    delete[] sound.pLoopBlocks;
+    sound = {};
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Zero the samples at the start and end of a voice sample buffer which are used as the decoding and interpolation history on key on
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static void zeroPrevSamples(Sample (&samples)[Voice::SAMPLE_BUFFER_SIZE]) noexcept {
+    static_assert(Voice::NUM_PREV_SAMPLES == 3);
+    samples[0] = {};
+    samples[1] = {};
+    samples[2] = {};
+    samples[Voice::SAMPLE_BUFFER_SIZE - 2] = {};
+    samples[Voice::SAMPLE_BUFFER_SIZE - 1] = {};
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -784,18 +2938,17 @@ void Spu::keyOn(Voice& voice) noexcept {
     voice.envPhase = EnvPhase::Attack;
     voice.envLevel = 0;
     voice.envWaitCycles = 0;
+    updateEnvPhaseParams(voice);
 
     // Initialize flags
     voice.bReachedLoopEnd = false;
     voice.bRepeat = false;
 
-    // Zero the 3 previous samples used for interpolation and previous 2 samples used for ADPCM decoding
-    static_assert(Voice::NUM_PREV_SAMPLES == 3);
-    voice.samples[0] = {};
-    voice.samples[1] = {};
-    voice.samples[2] = {};
-    voice.samples[Voice::SAMPLE_BUFFER_SIZE - 2] = {};
-    voice.samples[Voice::SAMPLE_BUFFER_SIZE - 1] = {};
+    // Zero the 3 previous samples used for interpolation and previous 2 samples used for ADPCM decoding.
+    // The voice does not know the sample mode of it's core, so do this for both modes: any other samples overwritten by doing this are
+    // always replaced before they are used, since the next ADPCM block is decoded before anything else.
+    zeroPrevSamples(voice.samples.i16);
+    zeroPrevSamples(voice.samples.f32);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -804,4 +2957,5 @@ void Spu::keyOn(Voice& voice) noexcept {
 void Spu::keyOff(Voice& voice) noexcept {
     voice.envPhase = EnvPhase::Release;
     voice.envWaitCycles = 0;
+    updateEnvPhaseParams(voice);
 }
@@ -10,6 +10,9 @@
 // PlayStation SPU emulation: simplified.
 //
 //  A stripped down emulation of a PlayStation 1 SPU, and potentially most of the PS2 SPU if the voice and RAM limits are increased.
+//  The PS2 SPU2 is essentially two PS1 style SPU cores sharing 2 MiB of sound RAM, each with it's own 24 voices and reverb. It can be
+//  emulated with one 'Core' for each of the SPU2 cores, which read from the same sound RAM (see 'initCore') and have their output summed.
+//  In 16-bit mode with reverb writes enabled, each core needs it's own separate reverb work area in that RAM.
 //  Implements the most commonly used functionality of the SPU, and specifically all the functionality required by PlayStation Doom.
 //  It is completely self isolated (apart from supplied external inputs) and can safely run in a separate thread.
 //  Largely based on the SPU implementation of the Avocado PlayStation emulator, and follows it's approach in various places.
@@ -25,10 +28,16 @@ BEGIN_NAMESPACE(Spu)
 static constexpr int32_t    ADPCM_BLOCK_SIZE        = 16;           // The size in bytes of a PSX format ADPCM block
 static constexpr int32_t    ADPCM_BLOCK_NUM_SAMPLES = 28;           // The number of samples in a PSX format ADPCM block
 static constexpr uint16_t   MAX_SAMPLE_RATE         = 0x4000;       // The PSX cannot do sample rates over 176,400 Hz
+static constexpr uint32_t   OUTPUT_SAMPLE_RATE      = 44100;        // The rate at which the SPU outputs samples: one for each cycle
 static constexpr int16_t    MIN_MASTER_VOLUME       = -0x3FFF;      // Minimum master volume level (divided by 2)
 static constexpr int16_t    MAX_MASTER_VOLUME       = +0x3FFF;      // Maximum master volume level (divided by 2)
 static constexpr int16_t    MIN_ENV_LEVEL           = 0;            // Minimum allowed envelope level
 static constexpr int16_t    MAX_ENV_LEVEL           = 0x7FFF;       // Maximum allowed envelope level
+static constexpr uint32_t   MAX_VOICES              = 64;           // Maximum number of voices a core can have: one for each bit of 'Core::activeVoiceMask'
+static constexpr uint32_t   PS1_NUM_VOICES          = 24;           // How many voices the PS1 SPU has, and also how many each of the PS2 SPU2 cores has
+static constexpr uint32_t   PS1_RAM_SIZE            = 512 * 1024;   // The size of the PS1's sound RAM
+static constexpr uint32_t   PS2_NUM_CORES           = 2;            // How many SPU cores the PS2 SPU2 has
+static constexpr uint32_t   PS2_RAM_SIZE            = 2048 * 1024;  // The size of the PS2's sound RAM, which is shared by both SPU2 cores
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Flags read from the 2nd byte of a PSX ADPCM block.
@@ -114,12 +123,15 @@ struct AdsrEnvelope {
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Settings/params for a particular phase of the envelope. Note that due to the way PSX envelopes work in exponential mode,
-// these parameters can sometimes change midway through the envelope phase depending on the current envelope level.
+// the actual step and step cycles can change midway through the envelope phase depending on the current envelope level.
+// The 'bExpIncrease' and 'bExpDecrease' flags say which of those adjustments must be made when stepping the envelope.
 //------------------------------------------------------------------------------------------------------------------------------------------
 struct EnvPhaseParams {
     int32_t targetLevel;    // What level the current envelope phase is trying to reach: -1 if not applicable
-    int32_t step;           // The size of the envelope step
-    int32_t stepCycles;     // How many cycles must be waited before doing an envelope step
+    int32_t step;           // The size of the envelope step, before any exponential adjustment
+    int32_t stepCycles;     // How many cycles must be waited before doing an envelope step, before any exponential adjustment
+    bool    bExpIncrease;   // Exponential increase: step cycles are 4x longer when the envelope level is above '0x6000'
+    bool    bExpDecrease;   // Exponential decrease: the step is scaled by the current envelope level
 };
 
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -153,8 +165,6 @@ inline constexpr int16_t toInt16Sample(const float sample) noexcept {
     return (int16_t) std::clamp(sample * 32768.0f, float(INT16_MIN), float(INT16_MAX));
 }
 
-#if !SIMPLE_SPU_FLOAT_SPU
-
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Do a saturated/clamped addition and subtraction of 16-bit sample values
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -178,101 +188,123 @@ inline int16_t sampleAttenuate(const int16_t sample, const int16_t volume) noexc
     return (int16_t)(frac32 >> 15);
 }
 
-#endif  // #if !SIMPLE_SPU_FLOAT_SPU
+//------------------------------------------------------------------------------------------------------------------------------------------
+// What kind of samples an SPU core processes.
+//
+//  Int16:  Accurate 16-bit mode. Samples are 16-bit with saturating arithmetic and reverb uses the work area in SPU RAM, like the PSX.
+//  Float:  Clean floating point mode. Samples are floats which never clip inside the SPU, and reverb uses separate floating point RAM.
+//------------------------------------------------------------------------------------------------------------------------------------------
+enum class SampleMode : uint8_t {
+    Int16,
+    Float
+};
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Convenience container for a 16-bit sample which supports sample add, subtract & attenuate operations
+// The sample types for each sample mode, which support sample add, subtract & attenuate operations.
+// These also act as the sample policy that the SPU's processing is specialized on at compile time, via 'IS_FLOAT' and 'MODE'.
+// Conversion to and from normalized floating point is exact for all 16-bit samples.
 //------------------------------------------------------------------------------------------------------------------------------------------
-#if SIMPLE_SPU_FLOAT_SPU
-    struct Sample {
-        float value;
+struct Int16Sample {
+    static constexpr SampleMode MODE = SampleMode::Int16;
+    static constexpr bool IS_FLOAT = false;
 
-        inline Sample() noexcept : value(0) {}
-        inline Sample(const float value) noexcept : value(value) {}
-        inline Sample(const int16_t value) noexcept: value(toFloatSample(value)) {}     // Convenience auto-conversion from 16-bit
+    int16_t value;
 
-        Sample(const Sample& other) noexcept = default;
-        Sample& operator = (const Sample& other) noexcept = default;
+    inline Int16Sample() noexcept : value(0) {}
+    inline Int16Sample(const int16_t value) noexcept : value(value) {}
 
-        // Convenience overloads for attenuating by a 16-bit volume level
-        inline Sample operator * (const int16_t other) const noexcept {
-            return value * toFloatSample(other);
-        }
+    Int16Sample(const Int16Sample& other) noexcept = default;
+    Int16Sample& operator = (const Int16Sample& other) noexcept = default;
 
-        inline void operator *= (const int16_t other) noexcept {
-            value *= toFloatSample(other);
-        }
+    static inline Int16Sample fromFloat(const float sample) noexcept { return toInt16Sample(sample); }
+    inline float toFloat() const noexcept { return toFloatSample(value); }
+
+    // Convenience overloads for attenuating by a float volume level
+    inline Int16Sample operator * (const float other) const noexcept {
+        return toInt16Sample(toFloatSample(value) * other);
+    }
 
-        inline Sample operator *  (const float other) const noexcept   { return value * other; }
-        inline void   operator *= (const float other) noexcept         { value *= other;       }
-        inline Sample operator +  (const float other) const noexcept   { return value + other; }
-        inline void   operator += (const float other) noexcept         { value += other;       }
-        inline Sample operator -  (const float other) const noexcept   { return value - other; }
-        inline void   operator -= (const float other) noexcept         { value -= other;       }
+    inline void operator *= (const float other) noexcept {
+        value = (*this) * other;
+    }
 
-        operator float() const noexcept { return value; }
-    };
-#else
-    struct Sample {
-        int16_t value;
+    inline Int16Sample operator *  (const int16_t other) const noexcept  { return sampleAttenuate(value, other);     }
+    inline void        operator *= (const int16_t other) noexcept        { value = sampleAttenuate(value, other);    }
+    inline Int16Sample operator +  (const int16_t other) const noexcept  { return sampleAdd(value, other);           }
+    inline void        operator += (const int16_t other) noexcept        { value = sampleAdd(value, other);          }
+    inline Int16Sample operator -  (const int16_t other) const noexcept  { return sampleSub(value, other);           }
+    inline void        operator -= (const int16_t other) noexcept        { value = sampleSub(value, other);          }
 
-        inline Sample() noexcept : value(0) {}
-        inline Sample(const int16_t value) noexcept : value(value) {}
+    operator int16_t() const noexcept { return value; }
+};
 
-        Sample(const Sample& other) noexcept = default;
-        Sample& operator = (const Sample& other) noexcept = default;
+struct FloatSample {
+    static constexpr SampleMode MODE = SampleMode::Float;
+    static constexpr bool IS_FLOAT = true;
 
-        // Convenience overloads for attenuating by a float volume level
-        inline Sample operator * (const float other) const noexcept {
-            return toInt16Sample(toFloatSample(value) * other);
-        }
+    float value;
 
-        inline void operator *= (const float other) noexcept {
-            value = (*this) * other;
-        }
+    inline FloatSample() noexcept : value(0) {}
+    inline FloatSample(const float value) noexcept : value(value) {}
+    inline FloatSample(const int16_t value) noexcept: value(toFloatSample(value)) {}    // Convenience auto-conversion from 16-bit
 
-        inline Sample operator *  (const int16_t other) const noexcept { return sampleAttenuate(value, other);     }
-        inline void   operator *= (const int16_t other) noexcept       { value = sampleAttenuate(value, other);    }
-        inline Sample operator +  (const int16_t other) const noexcept { return sampleAdd(value, other);           }
-        inline void   operator += (const int16_t other) noexcept       { value = sampleAdd(value, other);          }
-        inline Sample operator -  (const int16_t other) const noexcept { return sampleSub(value, other);           }
-        inline void   operator -= (const int16_t other) noexcept       { value = sampleSub(value, other);          }
+    FloatSample(const FloatSample& other) noexcept = default;
+    FloatSample& operator = (const FloatSample& other) noexcept = default;
 
-        operator int16_t() const noexcept { return value; }
-    };
-#endif
+    static inline FloatSample fromFloat(const float sample) noexcept { return sample; }
+    inline float toFloat() const noexcept { return value; }
+
+    // Convenience overloads for attenuating by a 16-bit volume level
+    inline FloatSample operator * (const int16_t other) const noexcept {
+        return value * toFloatSample(other);
+    }
+
+    inline void operator *= (const int16_t other) noexcept {
+        value *= toFloatSample(other);
+    }
+
+    inline FloatSample operator *  (const float other) const noexcept  { return value * other; }
+    inline void        operator *= (const float other) noexcept        { value *= other;       }
+    inline FloatSample operator +  (const float other) const noexcept  { return value + other; }
+    inline void        operator += (const float other) noexcept        { value += other;       }
+    inline FloatSample operator -  (const float other) const noexcept  { return value - other; }
+    inline void        operator -= (const float other) noexcept        { value -= other;       }
+
+    operator float() const noexcept { return value; }
+};
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Holds a stereo sample and allows add/subtract/attenuate operations on that stereo sample
 //------------------------------------------------------------------------------------------------------------------------------------------
-struct StereoSample {
-    Sample left;
-    Sample right;
+template <class S>
+struct BasicStereoSample {
+    S left;
+    S right;
 
-    StereoSample operator + (const StereoSample other) const noexcept {
-        return StereoSample{ left + other.left, right + other.right };
+    BasicStereoSample operator + (const BasicStereoSample other) const noexcept {
+        return BasicStereoSample{ left + other.left, right + other.right };
     }
 
-    void operator += (const StereoSample other) noexcept {
+    void operator += (const BasicStereoSample other) noexcept {
         left += other.left;
         right += other.right;
     }
 
-    StereoSample operator - (const StereoSample other) const noexcept {
-        return StereoSample{ left - other.left, right - other.right };
+    BasicStereoSample operator - (const BasicStereoSample other) const noexcept {
+        return BasicStereoSample{ left - other.left, right - other.right };
     }
 
-    void operator -= (const StereoSample other) noexcept {
+    void operator -= (const BasicStereoSample other) noexcept {
         left -= other.left;
         right -= other.right;
     }
 
-    StereoSample operator * (const Volume volume) const noexcept {
-        return StereoSample{ left * volume.left, right * volume.right };
+    BasicStereoSample operator * (const Volume volume) const noexcept {
+        return BasicStereoSample{ left * volume.left, right * volume.right };
     }
 
-    StereoSample operator * (const float scale) const noexcept {
-        return StereoSample{ left * scale, right * scale };
+    BasicStereoSample operator * (const float scale) const noexcept {
+        return BasicStereoSample{ left * scale, right * scale };
     }
 
     void operator *= (const Volume volume) noexcept {
@@ -286,6 +318,35 @@ struct StereoSample {
     }
 };
 
+typedef BasicStereoSample<Int16Sample> Int16StereoSample;
+typedef BasicStereoSample<FloatSample> FloatStereoSample;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Storage for a fixed number of samples in either sample mode.
+// Only the samples for the sample mode of the core using the buffer are valid: see 'setSampleMode' for switching between them.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <uint32_t N>
+union SampleBuffer {
+    Int16Sample     i16[N];
+    FloatSample     f32[N];
+
+    inline SampleBuffer() noexcept : f32{} {}
+
+    template <class S>
+    inline S* get() noexcept {
+        if constexpr (S::IS_FLOAT) {
+            return f32;
+        } else {
+            return i16;
+        }
+    }
+
+    template <class S>
+    inline const S* get() const noexcept {
+        return const_cast<SampleBuffer*>(this)->template get<S>();
+    }
+};
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Reverb registers: determine how reverb is processed.
 // These are from the NO$PSX spec and in the same memory arrangement as the PSX.
@@ -330,6 +391,28 @@ struct ReverbRegs {
     int16_t     volRIn;         // Reverb Input Volume: Right
 };
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The offsets of every location in the reverb work area that reverb reads or writes, relative to the current reverb address and in bytes.
+// These are converted from the reverb registers (including the adjustments made by the reverb formula, such as reading the previous sample)
+// only when the registers change, instead of on every reverb update. The SPU maintains these itself: they should not be modified.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ReverbTaps {
+    enum : uint32_t {
+        LSame1, RSame1, LSame2, RSame2, LSame1Prev, RSame1Prev,
+        LDiff1, RDiff1, LDiff2, RDiff2, LDiff1Prev, RDiff1Prev,
+        LComb1, RComb1, LComb2, RComb2, LComb3, RComb3, LComb4, RComb4,
+        LAPF1, RAPF1, LAPF1Src, RAPF1Src,
+        LAPF2, RAPF2, LAPF2Src, RAPF2Src,
+        NUM_TAPS
+    };
+
+    ReverbRegs  regs;                   // The reverb registers that the offsets were converted from
+    bool        bValid;                 // If 'false' then the offsets have not been converted yet
+    uint32_t    offsets[NUM_TAPS];      // Offset of each tap relative to the current reverb address, in bytes (may wrap around)
+    uint32_t    spacingWorkAreaSize2;   // The work area size (in 16-bit units) that 'bWidelySpaced' was determined for, or '0' if not determined
+    bool        bWidelySpaced;          // Whether the taps are always far enough apart in the work area for several reverb updates to be done at once
+};
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Holds all of the state for a hardware SPU voice
 //------------------------------------------------------------------------------------------------------------------------------------------
@@ -382,6 +465,12 @@ struct Voice {
     // This is generally always '1' but can be larger for really slow envelopes.
     int32_t envWaitCycles;
 
+    // Parameters for the current envelope phase, which were computed for the given envelope settings and phase.
+    // These are recomputed whenever the envelope settings or phase no longer match, so that they are not worked out every envelope step.
+    EnvPhaseParams  envParams;
+    uint32_t        envParamsEnvBits;
+    EnvPhase        envParamsPhase;
+
     // Left and right volume levels, divided by 2.
     // Note: I am not supporting the 'sweep volume' mode that original PSX SPU used, when the highest bit of these volume level fields was set.
     // These values are just purely fixed volume levels instead.
@@ -393,15 +482,77 @@ struct Voice {
     // Previously decoded samples from the last ADPCM block (3 previous samples) and the currently decoded ADPCM block.
     // At the beginning of the buffer there is 'NUM_PREV_SAMPLES' samples from the last ADPCM block, with the most recent sample last.
     // Those previous samples are used for gaussian interpolation.
-    Sample samples[SAMPLE_BUFFER_SIZE];
+    SampleBuffer<SAMPLE_BUFFER_SIZE> samples;
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// An ADPCM block which has been decoded to samples and saved in the decoded block cache.
+// Since ADPCM decoding depends on the previous 2 samples decoded, the same block can decode differently depending on how it was reached
+// (e.g when it is first played versus when it is jumped to again by a loop) - hence those samples are part of the cache key too.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct DecodedBlock {
+    uint32_t    adpcmAddr8;                             // Address of the ADPCM block in SPU RAM (in 8 byte units), or 'INVALID_ADDR8' if the entry is unused
+    uint8_t     adpcmFlags;                             // The flags byte of the ADPCM block
+    SampleBuffer<2>                         prevSamples;    // The previous 2 samples used to decode the block, with the newest first
+    SampleBuffer<ADPCM_BLOCK_NUM_SAMPLES>   samples;        // The decoded samples for the block
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// An optional cache of decoded ADPCM blocks, used to skip reading and decoding ADPCM data when voices repeatedly play the same sounds.
+// This is a 2-way set associative cache keyed by the address of each ADPCM block, where one way per set is usually enough to hold the
+// first-play version of a block and the other can hold the loop re-entry version.
+//
+// Notes:
+//  (1) The cache must be invalidated whenever SPU RAM holding ADPCM data is modified outside of the SPU.
+//  (2) In 16-bit mode, blocks in the reverb work area are never cached since reverb modifies that RAM continuously.
+//  (3) The cache is invalidated when the sample mode of the core changes, since blocks are decoded differently in each mode.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct DecodedBlockCache {
+    static constexpr uint32_t INVALID_ADDR8 = UINT32_MAX;
+    static constexpr uint32_t NUM_WAYS = 2;
+
+    DecodedBlock*   pBlocks;                // The cached blocks for each set and way: null if the cache is disabled
+    uint8_t*        pMruWays;               // Which way in each set was most recently used
+    uint32_t        numSets;                // Number of sets in the cache: always a power of two
+    uint32_t        setIdxShift;            // Shift applied to hashed ADPCM block addresses to get a set index
+    uint32_t        reverbBaseAddr8;        // 16-bit mode only: the reverb work area base address that the cache contents are valid for
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A read-only set of decoded ADPCM blocks for a sound in SPU RAM, which can be shared between any number of SPU cores that have exactly the
+// same sound data at the same address in RAM. Covers the blocks reached on the first play through of the sound and on the first repeat of
+// it's loop, which is how blocks are normally reached. Blocks reached with any other decoding history fall back to the core's block cache
+// (if enabled) or are decoded as normal, so output is always the same as without the pre-decoded blocks.
+//
+// Notes:
+//  (1) The sound data in SPU RAM must not be modified while a core is using the pre-decoded blocks for it.
+//  (2) In 16-bit mode, blocks in the reverb work area are never used since reverb modifies that RAM continuously.
+//  (3) The blocks are decoded for one sample mode and are ignored by cores which are not in that mode.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct PredecodedSound {
+    SampleMode      sampleMode;             // The sample mode that the blocks were decoded for
+    uint32_t        startAddr8;             // Address of the first ADPCM block of the sound in SPU RAM, in 8 byte units
+    uint32_t        numBlocks;              // How many ADPCM blocks there are in the sound (and in 'pBlocks')
+    uint32_t        loopStartBlockIdx;      // Index of the ADPCM block that the sound loops back to, if it loops
+    uint32_t        numLoopBlocks;          // How many ADPCM blocks are in 'pLoopBlocks': '0' if the sound does not loop
+    DecodedBlock*   pBlocks;                // Blocks as decoded on the first play through of the sound: unused blocks have an invalid address
+    DecodedBlock*   pLoopBlocks;            // Blocks as decoded on the first repeat of the sound's loop, starting at 'loopStartBlockIdx'
 };
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // A callback which is invoked by the SPU to provide external input.
 // Can be used to mix in CD audio or anything else and run it through the reverb processing of the SPU.
-// The callback takes a single piece of user data and must return 1 sound sample.
+// The callback takes a single piece of user data and must return 1 sound sample, as normalized floating point in every sample mode.
+// When external input is enabled it is invoked exactly once per SPU cycle, in order, including when rendering blocks of output.
 //------------------------------------------------------------------------------------------------------------------------------------------
-typedef StereoSample (*ExtInputCallback)(void* pUserData) noexcept;
+typedef FloatStereoSample (*ExtInputCallback)(void* pUserData) noexcept;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A callback which is invoked by the SPU when a voice switches off during rendering, because it's envelope finished or the sound ended.
+// Receives the user data and the index of the voice. Lets the owner of the core track which voices are free without polling all of them.
+// The callback is invoked in the middle of rendering, so it must not key on or modify any voices or the core itself.
+//------------------------------------------------------------------------------------------------------------------------------------------
+typedef void (*VoiceOffCallback)(void* pUserData, const uint32_t voiceIdx) noexcept;
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // The SPU core/device itself
@@ -409,12 +560,12 @@ typedef StereoSample (*ExtInputCallback)(void* pUserData) noexcept;
 struct Core {
     std::byte*          pRam;                   // Sound RAM used by the SPU core
     uint32_t            ramSize;                // How big the RAM size for the SPU core
-#if SIMPLE_SPU_FLOAT_SPU
-    float*              pReverbRam;             // Holds floating point reverb samples for the extended floating point SPU
+    bool                bOwnsRam;               // If 'true' then sound RAM was allocated by 'initCore' and is freed by 'destroyCore'
+    SampleMode          sampleMode;             // What kind of samples the core processes: change with 'setSampleMode'
+    float*              pReverbRam;             // Holds floating point reverb samples, used instead of the reverb work area in SPU RAM in float mode
     uint32_t            numReverbRamSamples;    // The number of floating point samples in reverb RAM
-#endif
     Voice*              pVoices;                // Each of the hardware voices for the SPU
-    uint32_t            numVoices;              // How many voices the core provides
+    uint32_t            numVoices;              // How many voices the core provides: no more than 'MAX_VOICES'
     Volume              masterVol;              // Master volume. Note: expected to be from -0x3FFF to +0x3FFF.
     Volume              reverbVol;              // Reverb volume level
     Volume              extInputVol;            // External input volume (I'm using this for CD audio mixing)
@@ -424,37 +575,139 @@ struct Core {
     bool                bExtReverbEnable;       // Whether to apply reverb on the input from the external source
     ExtInputCallback    pExtInputCallback;      // Callback used to source external input: if null no external input is mixed with SPU voices
     void*               pExtInputUserData;      // User data passed to the external input callback
+    VoiceOffCallback    pVoiceOffCallback;      // Optional callback invoked whenever a voice switches off during rendering: if null then no notifications are sent
+    void*               pVoiceOffUserData;      // User data passed to the voice off callback
     uint32_t            cycleCount;             // How many cycles has the SPU done (44,100 == 1 second of audio): each cycle is generating a 16-bit left & right audio sample
     uint32_t            reverbBaseAddr8;        // Start address of the reverb work area in 8 byte units; anything past this address in SPU RAM is for reverb
     uint32_t            reverbCurAddr;          // Used for relative reads and writes to the reverb work area; continously incremented and wrapped as reverb is processed
-    StereoSample        processedReverb;        // The processed reverb that is to be added into the final mix: only updated at 22,050 Hz instead of 44,100 Hz (every 2 SPU steps)
+    FloatStereoSample   processedReverb;        // The processed reverb to be added into the final mix: only updated at 22,050 Hz instead of 44,100 Hz (every 2 SPU steps). Normalized in all modes.
+    uint64_t            activeVoiceMask;        // Which voices were playing (not 'Off') at the end of the last render: bit 'N' is for voice 'N'
+    uint32_t            numQuietReverbUpdates;  // How many reverb updates in a row have had no input and (near) silent output: once this covers the work area it is checked for silence
+    uint32_t            silentReverbBaseAddr8;  // The reverb work area base address that 'bReverbSilent' was determined for
+    bool                bReverbSilent;          // Set once the reverb tail has died away: the work area is silent and reverb is skipped until it has input again. Clear if the work area is modified externally.
     ReverbRegs          reverbRegs;             // Registers with settings determining how reverb is processed: determines the type of reverb
+    ReverbTaps          reverbTaps;             // Reverb tap offsets converted from 'reverbRegs': updated automatically when the registers change
+    DecodedBlockCache   blockCache;             // Optional cache of decoded ADPCM blocks: disabled by default
+    const PredecodedSound*  pPredecodedSounds;  // Optional pre-decoded blocks for sounds in RAM, which may be shared with other cores: sorted by start address and non-overlapping
+    uint32_t            numPredecodedSounds;    // How many pre-decoded sounds there are: all must be decoded for the same sample mode
 };
 
+#if SIMPLE_SPU_PROFILE
+//------------------------------------------------------------------------------------------------------------------------------------------
+// How much time the SPU spent in each stage of processing, for benchmarking and profiling.
+// Only available when 'SIMPLE_SPU_PROFILE' is defined since timing each stage adds some overhead of it's own.
+// Stats are kept per thread and accumulate across all calls to 'stepCore' and 'renderCore' until reset.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ProfileStats {
+    uint64_t    decodeNs;               // Reading and decoding ADPCM blocks, including decoded block cache lookups
+    uint64_t    envelopeNs;             // Stepping voice envelopes and sample positions
+    uint64_t    interpolationNs;        // Gaussian interpolation of voice samples and mixing them into the output
+    uint64_t    reverbNs;               // Reverb processing, external input and final mixing
+    uint64_t    numBlocksDecoded;       // How many ADPCM blocks were loaded by voices
+    uint64_t    numVoiceFrames;         // How many frames were rendered by voices that were playing
+};
+
+ProfileStats& getProfileStats() noexcept;
+#endif  // #if SIMPLE_SPU_PROFILE
+
 //------------------------------------------------------------------------------------------------------------------------------------------
 // SPU and voice manipulation
 //------------------------------------------------------------------------------------------------------------------------------------------
 
-// Initialize and destroy an SPU core
-#if SIMPLE_SPU_FLOAT_SPU
-    void initCore(
-        Core& core,
-        const uint32_t ramSize,
-        const uint32_t voiceCount,
-        const uint32_t numReverbRamSamples = 128 * 1024     // More than big enough for any of the reverb modes in LIBSPU
-    ) noexcept;
-#else
-    void initCore(
-        Core& core,
-        const uint32_t ramSize,
-        const uint32_t voiceCount
-    ) noexcept;
-#endif
+// Initialize and destroy an SPU core.
+// If the RAM size is '0' then no sound RAM is allocated, and 'pRam' and 'ramSize' must be set to RAM owned by the caller before the core is
+// used. Such RAM can be shared by several cores for reading ADPCM data, provided none of them write reverb to it in 16-bit mode.
+// Reverb RAM for float mode is always allocated, so that the sample mode can be changed at any time.
+void initCore(
+    Core& core,
+    const uint32_t ramSize,
+    const uint32_t voiceCount,
+    const SampleMode sampleMode,
+    const uint32_t numReverbRamSamples = 128 * 1024     // More than big enough for any of the reverb modes in LIBSPU
+) noexcept;
 
 void destroyCore(Core& core) noexcept;
 
-// Step the given SPU core
-StereoSample stepCore(Core& core) noexcept;
+// Switch the given SPU core to a different sample mode, carrying over all state as closely as possible: including the sample history of
+// voices, held reverb output and (if reverb writes are enabled) the contents of the reverb work area. Does nothing if already in that mode.
+void setSampleMode(Core& core, const SampleMode sampleMode) noexcept;
+
+// Step the given SPU core.
+// The sample type must be the one for the core's current sample mode.
+template <class S>
+BasicStereoSample<S> stepCore(Core& core) noexcept;
+
+// Run the given SPU core for a number of cycles (frames) and output the result of each cycle.
+// This produces exactly the same output as calling 'stepCore' the same number of times, but is much more efficient.
+// The interleaved version outputs the samples of the core's current sample mode, and the sample type must be the one for that mode.
+// The planar versions write left and right output to separate channel buffers (left only if there is 1 channel) as normalized floating
+// point samples in any sample mode. Output channels beyond the first 2 are not touched.
+template <class S>
+void renderCore(Core& core, BasicStereoSample<S>* const pOutput, const uint32_t numFrames) noexcept;
+
+void renderCore(Core& core, float* const* const pOutputs, const uint32_t numOutputs, const uint32_t numFrames) noexcept;
+void renderCore(Core& core, double* const* const pOutputs, const uint32_t numOutputs, const uint32_t numFrames) noexcept;
+
+// Run the given SPU core purely as a reverb effect on the given input, for a number of cycles (frames), and output the result of each cycle.
+// The input is used in place of the external input callback (scaled by 'extInputVol' and sent to reverb as per 'bExtEnabled' and
+// 'bExtReverbEnable') and voices are not processed at all. For a core with no voices this produces exactly the same output as 'renderCore'
+// would with a callback supplying the same input, but without any of the per-sample overhead.
+// The interleaved version reads and writes the samples of the core's current sample mode, like the interleaved version of 'renderCore'.
+// The planar versions read 2 input channels and output in the same way as the planar versions of 'renderCore'.
+template <class S>
+void renderReverbEffect(
+    Core& core,
+    const BasicStereoSample<S>* const pInput,
+    BasicStereoSample<S>* const pOutput,
+    const uint32_t numFrames
+) noexcept;
+
+void renderReverbEffect(
+    Core& core,
+    const float* const* const pInputs,
+    float* const* const pOutputs,
+    const uint32_t numOutputs,
+    const uint32_t numFrames
+) noexcept;
+
+void renderReverbEffect(
+    Core& core,
+    const double* const* const pInputs,
+    double* const* const pOutputs,
+    const uint32_t numOutputs,
+    const uint32_t numFrames
+) noexcept;
+
+// Tells if the reverb for the given SPU core is silent and will stay that way until it gets some input: either the reverb tail has fully
+// died away, or reverb has no volume and cannot write to the work area. Reverb processing is skipped while this is the case.
+bool isReverbSilent(const Core& core) noexcept;
+
+// Tells if the given SPU core will output nothing but silence until a voice is keyed on or there is external input: no voices are playing,
+// there is no external input callback and reverb is silent. 'renderCore' skips all voice and reverb processing for such a core.
+bool isCoreSilent(const Core& core) noexcept;
+
+// Enable the decoded ADPCM block cache for the given SPU core and make it hold at least the given number of blocks.
+// If the number of blocks is '0' then the cache is disabled and freed.
+void enableBlockCache(Core& core, const uint32_t numBlocks) noexcept;
+
+// Invalidate all of the decoded ADPCM block cache, or just the blocks overlapping the given range of SPU RAM (specified in bytes).
+// Must be called whenever ADPCM data in SPU RAM is modified.
+void invalidateBlockCache(Core& core) noexcept;
+void invalidateBlockCache(Core& core, const uint32_t ramAddr, const uint32_t numBytes) noexcept;
+
+// Decode the sound starting at the given address in SPU RAM ahead of time, following it's loop flags (up to the given number of blocks).
+// The pre-decoded sound can then be used by any core in the given sample mode with the same sound data at the same address, by pointing
+// 'pPredecodedSounds' at it (or at an array of such sounds for different parts of RAM, sorted by address).
+void initPredecodedSound(
+    PredecodedSound& sound,
+    const std::byte* const pRam,
+    const uint32_t ramSize,
+    const uint32_t startAddr8,
+    const uint32_t maxNumBlocks,
+    const SampleMode sampleMode
+) noexcept;
+
+void destroyPredecodedSound(PredecodedSound& sound) noexcept;
 
 // Key on or off the given SPU voice
 void keyOn(Voice& voice) noexcept;
@@ -0,0 +1,128 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A first-fit allocator for SPU RAM, with compaction
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "SpuRamAlloc.h"
+
+#include "Asserts.h"
+#include "Spu.h"
+
+#include <algorithm>
+
+BEGIN_NAMESPACE(SpuRamAlloc)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Round the given size in bytes up to a whole number of ADPCM blocks
+//------------------------------------------------------------------------------------------------------------------------------------------
+static uint64_t roundUpToBlockSize(const uint32_t size) noexcept {
+    return ((uint64_t) size + Spu::ADPCM_BLOCK_SIZE - 1) / Spu::ADPCM_BLOCK_SIZE * Spu::ADPCM_BLOCK_SIZE;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Make the given heap manage the given range of SPU RAM, with all of it free
+//------------------------------------------------------------------------------------------------------------------------------------------
+void initHeap(Heap& heap, const uint32_t baseAddr, const uint32_t size) noexcept {
+    ASSERT(baseAddr % Spu::ADPCM_BLOCK_SIZE == 0);
+    ASSERT((uint64_t) baseAddr + size <= UINT32_MAX);
+
+    heap.baseAddr = baseAddr;
+    heap.size = size / Spu::ADPCM_BLOCK_SIZE * Spu::ADPCM_BLOCK_SIZE;
+    heap.allocations.clear();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocate a range of at least the given number of bytes from the lowest free range which is big enough, and return it's address.
+// Returns 'INVALID_ADDR' if the size is zero or there is no free range big enough; compacting the heap may help in the latter case.
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t allocate(Heap& heap, const uint32_t size) noexcept {
+    const uint64_t allocSize = roundUpToBlockSize(size);
+
+    if ((allocSize == 0) || (allocSize > heap.size))
+        return INVALID_ADDR;
+
+    // Look for the first gap big enough, including the one at the end of the heap
+    uint32_t freeRangeAddr = heap.baseAddr;
+    auto nextAllocIter = heap.allocations.begin();
+
+    for (; nextAllocIter != heap.allocations.end(); ++nextAllocIter) {
+        if (nextAllocIter->addr - freeRangeAddr >= allocSize)
+            break;
+
+        freeRangeAddr = nextAllocIter->addr + nextAllocIter->size;
+    }
+
+    const uint32_t heapEndAddr = heap.baseAddr + heap.size;
+
+    if ((nextAllocIter == heap.allocations.end()) && (heapEndAddr - freeRangeAddr < allocSize))
+        return INVALID_ADDR;
+
+    // Insert before the allocation following the gap, to keep allocations in address order
+    heap.allocations.insert(nextAllocIter, Allocation{ freeRangeAddr, (uint32_t) allocSize });
+    return freeRangeAddr;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Free the allocation starting at the given address. Returns 'false' if there is no such allocation.
+//------------------------------------------------------------------------------------------------------------------------------------------
+bool deallocate(Heap& heap, const uint32_t addr) noexcept {
+    const auto allocIter = std::lower_bound(
+        heap.allocations.begin(),
+        heap.allocations.end(),
+        addr,
+        [](const Allocation& alloc, const uint32_t addr) noexcept { return (alloc.addr < addr); }
+    );
+
+    if ((allocIter == heap.allocations.end()) || (allocIter->addr != addr))
+        return false;
+
+    heap.allocations.erase(allocIter);
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the total amount of free space in the heap, which is the largest allocation possible after compacting it
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getNumFreeBytes(const Heap& heap) noexcept {
+    uint32_t numUsedBytes = 0;
+
+    for (const Allocation& alloc : heap.allocations) {
+        numUsedBytes += alloc.size;
+    }
+
+    ASSERT(numUsedBytes <= heap.size);
+    return heap.size - numUsedBytes;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the size of the largest free range in the heap, which is the largest allocation possible without compacting it
+//------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t getLargestFreeRangeSize(const Heap& heap) noexcept {
+    uint32_t freeRangeAddr = heap.baseAddr;
+    uint32_t largestSize = 0;
+
+    for (const Allocation& alloc : heap.allocations) {
+        largestSize = std::max(largestSize, alloc.addr - freeRangeAddr);
+        freeRangeAddr = alloc.addr + alloc.size;
+    }
+
+    return std::max(largestSize, heap.baseAddr + heap.size - freeRangeAddr);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Slide all allocations down to the start of the heap, keeping their order, so that all of the free space is in one range at the end.
+// The given list is filled with the old and new address of each allocation which moved, in address order.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void compact(Heap& heap, std::vector<Relocation>& relocations) noexcept {
+    relocations.clear();
+    uint32_t nextAddr = heap.baseAddr;
+
+    for (Allocation& alloc : heap.allocations) {
+        if (alloc.addr != nextAddr) {
+            relocations.push_back(Relocation{ alloc.addr, nextAddr });
+            alloc.addr = nextAddr;
+        }
+
+        nextAddr += alloc.size;
+    }
+}
+
+END_NAMESPACE(SpuRamAlloc)
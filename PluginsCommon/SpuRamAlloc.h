@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Macros.h"
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A first-fit allocator for SPU RAM, in the spirit of the 'SpuMalloc' and 'SpuFree' functions of LIBSPU.
+//
+//  Hands out ranges of SPU RAM in whole ADPCM blocks, always taking the lowest free range which is big enough. Unlike LIBSPU the heap can
+//  also be compacted when it gets fragmented: ranges in use are slid down to the start of the heap (keeping their order) so that all of the
+//  free space ends up in one range at the end. The heap only keeps track of addresses and never touches SPU RAM itself, so after compacting
+//  it's up to the caller to move the data in each relocated range and update anything referring to it.
+//------------------------------------------------------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE(SpuRamAlloc)
+
+// Returned when an allocation fails
+static constexpr uint32_t INVALID_ADDR = UINT32_MAX;
+
+// A range of SPU RAM which is in use
+struct Allocation {
+    uint32_t    addr;       // Start address of the range, in bytes
+    uint32_t    size;       // Size of the range in bytes: always a whole number of ADPCM blocks
+};
+
+// Where an allocation was moved to when the heap was compacted
+struct Relocation {
+    uint32_t    oldAddr;
+    uint32_t    newAddr;
+};
+
+struct Heap {
+    uint32_t                    baseAddr;       // Start address of the SPU RAM managed by the heap
+    uint32_t                    size;           // How many bytes of SPU RAM are managed by the heap: a whole number of ADPCM blocks
+    std::vector<Allocation>     allocations;    // All of the ranges currently in use, sorted by address
+};
+
+void initHeap(Heap& heap, const uint32_t baseAddr, const uint32_t size) noexcept;
+uint32_t allocate(Heap& heap, const uint32_t size) noexcept;
+bool deallocate(Heap& heap, const uint32_t addr) noexcept;
+uint32_t getNumFreeBytes(const Heap& heap) noexcept;
+uint32_t getLargestFreeRangeSize(const Heap& heap) noexcept;
+void compact(Heap& heap, std::vector<Relocation>& relocations) noexcept;
+
+END_NAMESPACE(SpuRamAlloc)
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Wait-free 'latest value' handoff between a single producer thread and a single consumer thread.
+// Used to publish snapshots of plugin parameters from the UI thread to the audio thread, without either side ever blocking.
+//
+// There are 3 buffers: one owned by the producer (being written), one owned by the consumer (being read) and a 'middle' buffer which holds
+// the most recently published value. Publishing and acquiring both atomically swap their own buffer with the middle one.
+// If the producer publishes several times before the consumer acquires then only the latest value is seen, which is what we want.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class T>
+class TripleBuffer {
+public:
+    inline TripleBuffer() noexcept
+        : mBuffers{}
+        , mMiddleIdx(1)
+        , mWriteIdx(0)
+        , mReadIdx(2)
+    {
+    }
+
+    TripleBuffer(const TripleBuffer& other) = delete;
+    TripleBuffer& operator = (const TripleBuffer& other) = delete;
+
+    // Producer only: get the buffer to fill in before calling 'publish'
+    inline T& writeBuffer() noexcept {
+        return mBuffers[mWriteIdx];
+    }
+
+    // Producer only: make the contents of the write buffer available to the consumer
+    inline void publish() noexcept {
+        const uint8_t prevMiddle = mMiddleIdx.exchange(mWriteIdx | NEW_DATA_BIT, std::memory_order_acq_rel);
+        mWriteIdx = prevMiddle & INDEX_MASK;
+    }
+
+    // Consumer only: take ownership of the most recently published value, if there is one.
+    // Returns 'true' if a new value was acquired, in which case 'readBuffer' refers to it.
+    inline bool acquire() noexcept {
+        if ((mMiddleIdx.load(std::memory_order_relaxed) & NEW_DATA_BIT) == 0)
+            return false;
+
+        const uint8_t prevMiddle = mMiddleIdx.exchange(mReadIdx, std::memory_order_acq_rel);
+        mReadIdx = prevMiddle & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer only: get the value that was last acquired
+    inline const T& readBuffer() const noexcept {
+        return mBuffers[mReadIdx];
+    }
+
+private:
+    static constexpr uint8_t INDEX_MASK     = 0x03;     // Mask for the buffer index in the 'middle' slot
+    static constexpr uint8_t NEW_DATA_BIT   = 0x04;     // Set in the 'middle' slot when it holds a value not yet seen by the consumer
+
+    T                       mBuffers[3];
+    std::atomic<uint8_t>    mMiddleIdx;     // Index of the middle buffer plus the 'new data' flag
+    uint8_t                 mWriteIdx;      // Index of the buffer owned by the producer
+    uint8_t                 mReadIdx;       // Index of the buffer owned by the consumer
+};
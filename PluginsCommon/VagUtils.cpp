@@ -1,22 +1,28 @@
 #include "VagUtils.h"
 
+#include "AdpcmDecoder.h"
 #include "Asserts.h"
 #include "Endian.h"
 #include "FileInputStream.h"
 #include "FileOutputStream.h"
 #include "FileUtils.h"
+#include "Simd.h"
 
 #include <algorithm>
+#include <cstring>
+#include <thread>
 
 BEGIN_NAMESPACE(AudioTools)
 BEGIN_NAMESPACE(VagUtils)
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// PlayStation ADPCM compression linear predictor co-efficients, both positive and negative.
-// For more details on this see: https://problemkaputt.de/psx-spx.htm#cdromxaaudioadpcmcompression
+// PlayStation ADPCM compression linear predictor co-efficients, both positive and negative
 //------------------------------------------------------------------------------------------------------------------------------------------
-static constexpr int32_t ADPCM_PREDICT_COEF_POS[5] = { 0, 60, 115,  98, 122 };
-static constexpr int32_t ADPCM_PREDICT_COEF_NEG[5] = { 0,  0, -52, -55, -60 };
+static constexpr const int32_t (&ADPCM_PREDICT_COEF_POS)[5] = AdpcmDecoder::FILTER_COEF_POS;
+static constexpr const int32_t (&ADPCM_PREDICT_COEF_NEG)[5] = AdpcmDecoder::FILTER_COEF_NEG;
+
+static_assert(ADPCM_BLOCK_SIZE == AdpcmDecoder::BLOCK_SIZE);
+static_assert(ADPCM_BLOCK_NUM_SAMPLES == AdpcmDecoder::BLOCK_NUM_SAMPLES);
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // How much each nibble + shift combination contributes to the overall sound.
@@ -207,7 +213,7 @@ void decodePsxAdpcmSamples(
 
     // Setup the output buffer and set there to be no loop points initially
     samplesOut.clear();
-    samplesOut.reserve((size_t) numSampleBlocks * ADPCM_BLOCK_NUM_SAMPLES);
+    samplesOut.resize((size_t) numSampleBlocks * ADPCM_BLOCK_NUM_SAMPLES);
 
     loopStartSampleIdx = 0;
     loopEndSampleIdx = 0;
@@ -221,25 +227,11 @@ void decodePsxAdpcmSamples(
 
     for (uint32_t sampleBlockIdx = 0; sampleBlockIdx < numSampleBlocks; ++sampleBlockIdx) {
         // Grab the data for this sample block
-        uint8_t adpcmBlock[ADPCM_BLOCK_SIZE];
-        std::memcpy(adpcmBlock, pData + sampleBlockIdx * ADPCM_BLOCK_SIZE, ADPCM_BLOCK_SIZE);
-
-        // Get the shift and filter to use from the first ADPCM header byte.
-        // Note that the filter must be from 0-4 so if it goes beyond that then use filter mode '0' (no filter).
-        // Also according to NO$PSX: "For both 4bit and 8bit ADPCM, reserved shift values 13..15 will act same as shift = 9"
-        uint32_t sampleShift = (uint32_t) adpcmBlock[0] & 0x0F;
-        uint32_t adpcmFilter = ((uint32_t) adpcmBlock[0] & 0x70) >> 4;
-
-        if (adpcmFilter > 4) {
-            adpcmFilter = 0;
-        }
-
-        if (sampleShift > 12) {
-            sampleShift = 9;
-        }
+        const std::byte* const pAdpcmBlock = pData + (size_t) sampleBlockIdx * ADPCM_BLOCK_SIZE;
+        const uint8_t adpcmFlags = (uint8_t) pAdpcmBlock[1];
 
         // Check for looping flags in the second ADPCM header byte
-        if (adpcmBlock[1] & ADPCM_FLAG_LOOP_START) {
+        if (adpcmFlags & ADPCM_FLAG_LOOP_START) {
             // Only use loop start if we haven't encountered a loop end yet.
             // Otherwise it will never be reached, unless the host software redirects the flow...
             if (!bFoundLoopEnd) {
@@ -247,38 +239,16 @@ void decodePsxAdpcmSamples(
             }
         }
 
-        if ((adpcmBlock[1] & ADPCM_FLAG_LOOP_END) && (adpcmBlock[1] & ADPCM_FLAG_REPEAT)) {
+        if ((adpcmFlags & ADPCM_FLAG_LOOP_END) && (adpcmFlags & ADPCM_FLAG_REPEAT)) {
             // Found the end of a sound that will loop.
             // Note that the loop end happens AFTER the end of the current block.
             bFoundLoopEnd = true;
             loopEndSampleIdx = (sampleBlockIdx + 1) * ADPCM_BLOCK_NUM_SAMPLES;
         }
 
-        // Get the ADPCM filter co-efficients, both positive and negative.
-        const int32_t filterCoefPos = ADPCM_PREDICT_COEF_POS[adpcmFilter];
-        const int32_t filterCoefNeg = ADPCM_PREDICT_COEF_NEG[adpcmFilter];
-
-        // Decode all of the samples in the block
-        for (int32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; sampleIdx++) {
-            // Read this samples 4-bit data
-            const uint16_t nibble = (sampleIdx % 2 == 0) ?
-                ((uint16_t) adpcmBlock[2 + sampleIdx / 2] & 0x0F) >> 0:
-                ((uint16_t) adpcmBlock[2 + sampleIdx / 2] & 0xF0) >> 4;
-
-            // The 4-bit sample gets extended to 16-bit by shifting and is sign extended to 32-bit.
-            // After that we scale by the sample shift, arithmetically.
-            int32_t sample = (int32_t)(int16_t)(nibble << 12);
-            sample >>= sampleShift;
-
-            // Mix in previous samples using the filter coefficients chosen and scale the result; also clamp to a 16-bit range
-            sample += (prevSamples[0] * filterCoefPos + prevSamples[1] * filterCoefNeg + 32) / 64;
-            sample = std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX);
-            samplesOut.push_back((int16_t) sample);
-
-            // Move previous samples forward
-            prevSamples[1] = prevSamples[0];
-            prevSamples[0] = (int16_t) sample;
-        }
+        // Decode all of the samples in the block directly into the output
+        int16_t* const pBlockSamplesOut = samplesOut.data() + (size_t) sampleBlockIdx * ADPCM_BLOCK_NUM_SAMPLES;
+        AdpcmDecoder::decodeBlock(pAdpcmBlock, prevSamples[0], prevSamples[1], pBlockSamplesOut);
     }
 
     // If we didn't find a loop end then ignore any loop starts encountered
@@ -379,64 +349,278 @@ bool writePcmSoundToVagFile(
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Encode the given sound to PSX adpcm
+// Which ADPCM blocks of a sound being encoded get the loop start and loop repeat flags
 //------------------------------------------------------------------------------------------------------------------------------------------
-void encodePcmSoundToPsxAdpcm(
-    const int16_t* const pSamples,
+struct SoundLoopBlocks {
+    uint32_t    loopStartBlock;
+    uint32_t    loopRepeatBlock;
+    bool        bIsSoundLooped;
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The last two samples encoded (newest first), which the encoding of the next ADPCM block depends on
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct PrevEncSamples {
+    int16_t     sample1;
+    int16_t     sample2;
+
+    inline bool operator == (const PrevEncSamples& other) const noexcept {
+        return ((sample1 == other.sample1) && (sample2 == other.sample2));
+    }
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Figure out which blocks the loop flags get applied to for the given sound
+//------------------------------------------------------------------------------------------------------------------------------------------
+static SoundLoopBlocks getSoundLoopBlocks(
     const uint32_t numSamples,
     const uint32_t loopStartSampleIdx,
-    const uint32_t loopEndSampleIdx,
-    std::vector<std::byte>& adpcmDataOut
+    const uint32_t loopEndSampleIdx
 ) noexcept {
-    // Figure out which blocks we apply these flags for
-    uint32_t loopStartBlock = UINT32_MAX;
-    uint32_t loopRepeatBlock = UINT32_MAX;
-    const bool bIsSoundLooped = (loopStartSampleIdx != loopEndSampleIdx);
+    SoundLoopBlocks loopBlocks = { UINT32_MAX, UINT32_MAX, (loopStartSampleIdx != loopEndSampleIdx) };
 
-    if (bIsSoundLooped) {
-        loopStartBlock = (std::min(loopStartSampleIdx, numSamples) + ADPCM_BLOCK_NUM_SAMPLES / 2) / ADPCM_BLOCK_NUM_SAMPLES;
-        loopRepeatBlock = (std::min(loopEndSampleIdx, numSamples) + ADPCM_BLOCK_NUM_SAMPLES / 2) / ADPCM_BLOCK_NUM_SAMPLES;
+    if (loopBlocks.bIsSoundLooped) {
+        loopBlocks.loopStartBlock = (std::min(loopStartSampleIdx, numSamples) + ADPCM_BLOCK_NUM_SAMPLES / 2) / ADPCM_BLOCK_NUM_SAMPLES;
+        loopBlocks.loopRepeatBlock = (std::min(loopEndSampleIdx, numSamples) + ADPCM_BLOCK_NUM_SAMPLES / 2) / ADPCM_BLOCK_NUM_SAMPLES;
 
         // Note: the flag means loop AFTER the end of this block, so we have to decrement by 1
-        if (loopRepeatBlock > 0) {
-            loopRepeatBlock--;
+        if (loopBlocks.loopRepeatBlock > 0) {
+            loopBlocks.loopRepeatBlock--;
         }
     }
 
-    // Store the previous two encoded samples here
-    int16_t prevEncSamples[2] = {};
+    return loopBlocks;
+}
 
-    // Encode all of the blocks of sound
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the samples for the specified ADPCM block of a sound, zero padding to 28 samples if required (at the end of the sound)
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void getPcmSoundBlockSamples(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const uint32_t blockIdx,
+    int16_t blockSamplesOut[ADPCM_BLOCK_NUM_SAMPLES]
+) noexcept {
+    const uint32_t startSampIdx = blockIdx * ADPCM_BLOCK_NUM_SAMPLES;
+    const uint32_t endSampIdx = std::min(startSampIdx + ADPCM_BLOCK_NUM_SAMPLES, numSamples);
+    const int32_t numSamplesToCopy = endSampIdx - startSampIdx;
+
+    std::memset(blockSamplesOut, 0, sizeof(int16_t) * ADPCM_BLOCK_NUM_SAMPLES);
+    std::memcpy(blockSamplesOut, pSamples + startSampIdx, numSamplesToCopy * sizeof(int16_t));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Encode the specified range of ADPCM blocks for a sound, starting with the given previous two encoded samples.
+// Optionally records the last two encoded samples after each block that is encoded.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static PrevEncSamples encodePcmSoundBlocks(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const SoundLoopBlocks& loopBlocks,
+    const EncodeOptions& options,
+    const uint32_t startBlockIdx,
+    const uint32_t endBlockIdx,
+    const PrevEncSamples startPrevEncSamples,
+    std::byte* const pAdpcmDataOut,
+    PrevEncSamples* const pBlockPrevEncSamplesOut
+) noexcept {
     const uint32_t numAdpcmBlocks = (numSamples + ADPCM_BLOCK_NUM_SAMPLES - 1) / ADPCM_BLOCK_NUM_SAMPLES;
-    adpcmDataOut.clear();
-    adpcmDataOut.resize((size_t) numAdpcmBlocks * ADPCM_BLOCK_SIZE);
+    PrevEncSamples prevEncSamples = startPrevEncSamples;
 
-    for (uint32_t blockIdx = 0; blockIdx < numAdpcmBlocks; ++blockIdx) {
-        // Grab all of the samples for this block, zero pad to 28 samples if required (if we are at the end of the sound)
+    for (uint32_t blockIdx = startBlockIdx; blockIdx < endBlockIdx; ++blockIdx) {
+        // Grab all of the samples for this block
         const bool bIsLastBlock = (blockIdx + 1 >= numAdpcmBlocks);
+        int16_t blockSamples[ADPCM_BLOCK_NUM_SAMPLES];
+        getPcmSoundBlockSamples(pSamples, numSamples, blockIdx, blockSamples);
+
+        // Figure out the flags for the block
+        const bool bLoopStartFlag = ((blockIdx == loopBlocks.loopStartBlock) && loopBlocks.bIsSoundLooped);
+        const bool bLoopEndFlag = ((blockIdx == loopBlocks.loopRepeatBlock) || bIsLastBlock);
+
+        // The old PlayStation VAG tools set the loop repeat flag for every single sample block except the first, if the sound was looped.
+        // I'm replicating the same behavior here...
+        const bool bRepeatFlag = ((blockIdx != 0) && loopBlocks.bIsSoundLooped);
+
+        // Encode the ADPCM block.
+        // The high quality encoder also gets to see the samples in the next block (if there is one) for lookahead.
+        std::byte* const pBlockAdpcmDataOut = pAdpcmDataOut + (size_t) blockIdx * ADPCM_BLOCK_SIZE;
+
+        if (options.quality == EncodeQuality::High) {
+            int16_t nextBlockSamples[ADPCM_BLOCK_NUM_SAMPLES];
+
+            if (!bIsLastBlock) {
+                getPcmSoundBlockSamples(pSamples, numSamples, blockIdx + 1, nextBlockSamples);
+            }
+
+            encodePcmToPsxAdpcmBlockHq(
+                blockSamples,
+                (!bIsLastBlock) ? nextBlockSamples : nullptr,
+                prevEncSamples.sample1,
+                prevEncSamples.sample2,
+                bLoopStartFlag,
+                bLoopEndFlag,
+                bRepeatFlag,
+                options.beamWidth,
+                pBlockAdpcmDataOut,
+                prevEncSamples.sample1,
+                prevEncSamples.sample2
+            );
+        } else {
+            encodePcmToPsxAdpcmBlock(
+                blockSamples,
+                prevEncSamples.sample1,
+                prevEncSamples.sample2,
+                bLoopStartFlag,
+                bLoopEndFlag,
+                bRepeatFlag,
+                pBlockAdpcmDataOut,
+                prevEncSamples.sample1,
+                prevEncSamples.sample2
+            );
+        }
+
+        if (pBlockPrevEncSamplesOut) {
+            pBlockPrevEncSamplesOut[blockIdx] = prevEncSamples;
+        }
+    }
+
+    return prevEncSamples;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Encode the ADPCM blocks for a sound using multiple threads, producing exactly the same output as encoding serially.
+//
+// The sound is split into segments which are encoded in parallel. Since each block depends on the last two samples encoded by the
+// previous block, segments after the first begin with a guess: the original PCM samples just before the segment.
+// Once all segments are done a serial 'seam' pass fixes up the start of each segment, re-encoding blocks with the correct previous
+// samples until the encoder state matches what the parallel pass saw. From that point on the parallel output is identical to what
+// serial encoding would have produced, since encoding is deterministic.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void encodePcmSoundBlocksParallel(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const SoundLoopBlocks& loopBlocks,
+    const EncodeOptions& options,
+    const uint32_t numSegments,
+    std::byte* const pAdpcmDataOut
+) noexcept {
+    ASSERT(numSegments > 1);
 
-        int16_t blockSamples[ADPCM_BLOCK_NUM_SAMPLES] = {};
-
-        const uint32_t startSampIdx = blockIdx * ADPCM_BLOCK_NUM_SAMPLES;
-        const uint32_t endSampIdx = std::min(startSampIdx + ADPCM_BLOCK_NUM_SAMPLES, numSamples);
-        const int32_t numSamplesToCopy = endSampIdx - startSampIdx;
-
-        std::memcpy(blockSamples, pSamples + startSampIdx, numSamplesToCopy * sizeof(int16_t));
-
-        // Encode the ADPCM block
-        encodePcmToPsxAdpcmBlock(
-            blockSamples,
-            prevEncSamples[0],
-            prevEncSamples[1],
-            ((blockIdx == loopStartBlock) && bIsSoundLooped),
-            ((blockIdx == loopRepeatBlock) || bIsLastBlock),
-            // The old PlayStation VAG tools set the loop repeat flag for every single sample block except the first, if the sound was looped.
-            // I'm replicating the same behavior here...
-            ((blockIdx != 0) && bIsSoundLooped),
-            adpcmDataOut.data() + (size_t) blockIdx * ADPCM_BLOCK_SIZE,
-            prevEncSamples[0],
-            prevEncSamples[1]
+    // Decide on the blocks for each segment and the guessed previous encoded samples for each one
+    const uint32_t numAdpcmBlocks = (numSamples + ADPCM_BLOCK_NUM_SAMPLES - 1) / ADPCM_BLOCK_NUM_SAMPLES;
+    const uint32_t numBlocksPerSegment = (numAdpcmBlocks + numSegments - 1) / numSegments;
+
+    const auto getSegmentStartBlock = [=](const uint32_t segmentIdx) noexcept {
+        return std::min(segmentIdx * numBlocksPerSegment, numAdpcmBlocks);
+    };
+
+    const auto getSegmentGuessPrevEncSamples = [=](const uint32_t segmentIdx) noexcept {
+        const uint32_t startSampIdx = getSegmentStartBlock(segmentIdx) * ADPCM_BLOCK_NUM_SAMPLES;
+        return (startSampIdx >= 2) ? PrevEncSamples{ pSamples[startSampIdx - 1], pSamples[startSampIdx - 2] } : PrevEncSamples{};
+    };
+
+    // Encode all the segments in parallel, with the current thread helping out.
+    // If for some reason threads can't be created then just encode the remaining segments on this thread.
+    std::vector<PrevEncSamples> blockPrevEncSamples(numAdpcmBlocks);
+
+    const auto encodeSegment = [&](const uint32_t segmentIdx) noexcept {
+        encodePcmSoundBlocks(
+            pSamples,
+            numSamples,
+            loopBlocks,
+            options,
+            getSegmentStartBlock(segmentIdx),
+            getSegmentStartBlock(segmentIdx + 1),
+            getSegmentGuessPrevEncSamples(segmentIdx),
+            pAdpcmDataOut,
+            blockPrevEncSamples.data()
         );
+    };
+
+    std::vector<std::thread> threads;
+
+    try {
+        threads.reserve(numSegments - 1);
+
+        for (uint32_t segmentIdx = 1; segmentIdx < numSegments; ++segmentIdx) {
+            threads.emplace_back(encodeSegment, segmentIdx);
+        }
+    } catch (...) {}
+
+    encodeSegment(0);
+
+    for (uint32_t segmentIdx = (uint32_t) threads.size() + 1; segmentIdx < numSegments; ++segmentIdx) {
+        encodeSegment(segmentIdx);
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // Seam pass: fix up the start of each segment after the first
+    for (uint32_t segmentIdx = 1; segmentIdx < numSegments; ++segmentIdx) {
+        const uint32_t startBlockIdx = getSegmentStartBlock(segmentIdx);
+        const uint32_t endBlockIdx = getSegmentStartBlock(segmentIdx + 1);
+
+        if (startBlockIdx >= endBlockIdx)
+            break;
+
+        PrevEncSamples prevEncSamples = blockPrevEncSamples[startBlockIdx - 1];
+        PrevEncSamples guessPrevEncSamples = getSegmentGuessPrevEncSamples(segmentIdx);
+
+        for (uint32_t blockIdx = startBlockIdx; blockIdx < endBlockIdx; ++blockIdx) {
+            // If the parallel pass encoded this block with the correct state then it and the rest of the segment are correct
+            if (prevEncSamples == guessPrevEncSamples)
+                break;
+
+            guessPrevEncSamples = blockPrevEncSamples[blockIdx];
+            prevEncSamples = encodePcmSoundBlocks(
+                pSamples, numSamples, loopBlocks, options, blockIdx, blockIdx + 1, prevEncSamples, pAdpcmDataOut, blockPrevEncSamples.data()
+            );
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Encode the given sound to PSX adpcm
+//------------------------------------------------------------------------------------------------------------------------------------------
+void encodePcmSoundToPsxAdpcm(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const uint32_t loopStartSampleIdx,
+    const uint32_t loopEndSampleIdx,
+    std::vector<std::byte>& adpcmDataOut
+) noexcept {
+    encodePcmSoundToPsxAdpcm(pSamples, numSamples, loopStartSampleIdx, loopEndSampleIdx, adpcmDataOut, EncodeOptions());
+}
+
+void encodePcmSoundToPsxAdpcm(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const uint32_t loopStartSampleIdx,
+    const uint32_t loopEndSampleIdx,
+    std::vector<std::byte>& adpcmDataOut,
+    const EncodeOptions& options
+) noexcept {
+    // Figure out which blocks we apply the loop flags for
+    const SoundLoopBlocks loopBlocks = getSoundLoopBlocks(numSamples, loopStartSampleIdx, loopEndSampleIdx);
+
+    // Allocate the output
+    const uint32_t numAdpcmBlocks = (numSamples + ADPCM_BLOCK_NUM_SAMPLES - 1) / ADPCM_BLOCK_NUM_SAMPLES;
+    adpcmDataOut.clear();
+    adpcmDataOut.resize((size_t) numAdpcmBlocks * ADPCM_BLOCK_SIZE);
+
+    // Decide how many segments to split the sound into for multi-threaded encoding.
+    // Don't bother splitting up short sounds, since the cost of starting threads and fixing up the seams would outweigh the gains.
+    constexpr uint32_t MIN_BLOCKS_PER_SEGMENT = 256;
+    const uint32_t maxThreads = (options.numThreads > 0) ? options.numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    const uint32_t numSegments = std::min(maxThreads, numAdpcmBlocks / MIN_BLOCKS_PER_SEGMENT);
+
+    // Encode all of the blocks of sound
+    if (numSegments > 1) {
+        encodePcmSoundBlocksParallel(pSamples, numSamples, loopBlocks, options, numSegments, adpcmDataOut.data());
+    } else {
+        encodePcmSoundBlocks(pSamples, numSamples, loopBlocks, options, 0, numAdpcmBlocks, PrevEncSamples{}, adpcmDataOut.data(), nullptr);
     }
 }
 
@@ -444,7 +628,7 @@ void encodePcmSoundToPsxAdpcm(
 // Evaluates a particular ADPCM encoding using the specified sample filter and sample shift.
 // Returns the encoded nibbles, previous 2 encoded samples and the error of this encoding.
 //------------------------------------------------------------------------------------------------------------------------------------------
-static void tryPsxAdpcmEncoding(
+void tryPsxAdpcmEncoding(
     const uint32_t sampleFilter,
     const int32_t sampleShift,
     const int16_t inSamples[ADPCM_BLOCK_NUM_SAMPLES],
@@ -494,62 +678,167 @@ static void tryPsxAdpcmEncoding(
     outPrevSample2 = prevSamples[1];
 }
 
+#if SIMD_SSE2
+
 //------------------------------------------------------------------------------------------------------------------------------------------
-// Encode the given samples in the PlayStation's ADPCM format
+// Per-lane constants for evaluating ADPCM encoding candidates 4 at a time with SSE2.
+// The final lanes are padding and just repeat the last candidate.
 //------------------------------------------------------------------------------------------------------------------------------------------
-void encodePcmToPsxAdpcmBlock(
-    const int16_t samples[ADPCM_BLOCK_NUM_SAMPLES],
-    const int16_t prevSample1,
-    const int16_t prevSample2,
-    const bool bLoopStartFlag,
-    const bool bLoopEndFlag,
-    const bool bRepeatFlag,
-    std::byte adpcmDataOut[ADPCM_BLOCK_SIZE],
-    int16_t& prevEncSampleOut1,
-    int16_t& prevEncSampleOut2
+static constexpr uint32_t NUM_CANDIDATE_VECS = (NUM_ENCODING_CANDIDATES + 3) / 4;
+
+struct EncodingCandidateLanes {
+    int32_t     predictCoefs[NUM_CANDIDATE_VECS * 4];       // Positive coefficient in the low 16-bits, negative in the high 16-bits
+    int32_t     adjustSteps[NUM_CANDIDATE_VECS * 4];        // Quantization step size for the candidate (1 << (12 - shift))
+    float       adjustStepsInv[NUM_CANDIDATE_VECS * 4];     // 1.0 / quantization step size: exact since the step is a power of two
+};
+
+static constexpr EncodingCandidateLanes buildEncodingCandidateLanes() noexcept {
+    EncodingCandidateLanes lanes = {};
+
+    for (uint32_t laneIdx = 0; laneIdx < NUM_CANDIDATE_VECS * 4; ++laneIdx) {
+        const uint32_t candidateIdx = std::min(laneIdx, NUM_ENCODING_CANDIDATES - 1);
+        const uint32_t sampleFilter = candidateIdx / 13;
+        const uint32_t sampleShift = candidateIdx % 13;
+
+        lanes.predictCoefs[laneIdx] = (int32_t)(
+            ((uint32_t) ADPCM_PREDICT_COEF_POS[sampleFilter] & 0xFFFFu) |
+            ((uint32_t) ADPCM_PREDICT_COEF_NEG[sampleFilter] << 16)
+        );
+
+        lanes.adjustSteps[laneIdx] = 1 << (12 - sampleShift);
+        lanes.adjustStepsInv[laneIdx] = 1.0f / (float)(1 << (12 - sampleShift));
+    }
+
+    return lanes;
+}
+
+alignas(16) static constexpr EncodingCandidateLanes ENCODING_CANDIDATE_LANES = buildEncodingCandidateLanes();
+
+#endif  // #if SIMD_SSE2
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Computes the error for every possible ADPCM encoding of the given samples, in the same way as 'tryPsxAdpcmEncoding'.
+// With SSE2 this evaluates 4 candidates at once, with all candidates advancing through the block together.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void getPsxAdpcmEncodingErrors(
+    const int16_t inSamples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t inPrevSample1,
+    const int16_t inPrevSample2,
+    uint64_t outErrors[NUM_ENCODING_CANDIDATES]
 ) noexcept {
-    // Try various combinations of ADPCM encoding and sample shift adjust to find the best one
-    uint64_t bestError = UINT64_MAX;
-    uint32_t bestSampleFilter = 0;
-    uint32_t bestSampleShift = 0;
-    uint8_t bestSampleNibbles[ADPCM_BLOCK_NUM_SAMPLES] = {};
-
-    for (uint32_t sampleFilter = 0; sampleFilter <= 4; ++sampleFilter) {
-        for (int32_t sampleShift = 0; sampleShift <= 12; ++sampleShift) {
-            // Evaluate this encoding
+    #if SIMD_SSE2
+        // The previous 2 encoded samples for each candidate, packed as 16-bit pairs so '_mm_madd_epi16' can apply the prediction filter.
+        // The newest sample is in the low 16-bits. Also the squared error for each candidate, split by even and odd lanes.
+        __m128i prevSamples[NUM_CANDIDATE_VECS];
+        __m128i errorsEven[NUM_CANDIDATE_VECS];
+        __m128i errorsOdd[NUM_CANDIDATE_VECS];
+
+        for (uint32_t vecIdx = 0; vecIdx < NUM_CANDIDATE_VECS; ++vecIdx) {
+            prevSamples[vecIdx] = _mm_set1_epi32((int32_t)((uint16_t) inPrevSample1 | ((uint32_t)(uint16_t) inPrevSample2 << 16)));
+            errorsEven[vecIdx] = _mm_setzero_si128();
+            errorsOdd[vecIdx] = _mm_setzero_si128();
+        }
+
+        const __m128i round = _mm_set1_epi32(32);
+        const __m128i divRoundMask = _mm_set1_epi32(63);
+        const __m128i low16Mask = _mm_set1_epi32(0xFFFF);
+        const __m128 minAdjustSteps = _mm_set1_ps(-8.0f);
+        const __m128 maxAdjustSteps = _mm_set1_ps(7.0f);
+
+        for (uint32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; ++sampleIdx) {
+            const __m128i realSample = _mm_set1_epi32(inSamples[sampleIdx]);
+
+            for (uint32_t vecIdx = 0; vecIdx < NUM_CANDIDATE_VECS; ++vecIdx) {
+                const __m128i predictCoefs = _mm_load_si128((const __m128i*) ENCODING_CANDIDATE_LANES.predictCoefs + vecIdx);
+                const __m128i adjustStep = _mm_load_si128((const __m128i*) ENCODING_CANDIDATE_LANES.adjustSteps + vecIdx);
+                const __m128 adjustStepInv = _mm_load_ps(ENCODING_CANDIDATE_LANES.adjustStepsInv + vecIdx * 4);
+
+                // Get the prediction according to the filter: note that the divide by 64 must round towards zero
+                const __m128i predictionX64 = _mm_add_epi32(_mm_madd_epi16(prevSamples[vecIdx], predictCoefs), round);
+                const __m128i predictionBias = _mm_and_si128(_mm_srai_epi32(predictionX64, 31), divRoundMask);
+                const __m128i predictedSample = _mm_srai_epi32(_mm_add_epi32(predictionX64, predictionBias), 6);
+                const __m128i predictionError = _mm_sub_epi32(realSample, predictedSample);
+
+                // Compute how many steps to adjust by and clamp to a 4-bit signed integer.
+                // Float math here is exact since the step is a power of two, and conversion rounds towards zero like integer division.
+                const __m128 adjustStepsF = _mm_mul_ps(_mm_cvtepi32_ps(predictionError), adjustStepInv);
+                const __m128i adjustSteps = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(adjustStepsF, minAdjustSteps), maxAdjustSteps));
+
+                // Get the encoded sample, clamped and unclamped, and save it as the newest previous sample.
+                // Note: 'adjustSteps' is a small signed number so the high 16-bits are just sign bits and are ignored by the multiply.
+                const __m128i encodedSampleUnclamped = _mm_add_epi32(predictedSample, _mm_madd_epi16(adjustSteps, adjustStep));
+                const __m128i encodedSample16 = _mm_packs_epi32(encodedSampleUnclamped, encodedSampleUnclamped);
+                const __m128i encodedSample = _mm_srai_epi32(_mm_unpacklo_epi16(encodedSample16, encodedSample16), 16);
+                prevSamples[vecIdx] = _mm_or_si128(_mm_and_si128(encodedSample, low16Mask), _mm_slli_epi32(prevSamples[vecIdx], 16));
+
+                // Update the error of this encoding: penalize heavily overflow.
+                // Squares are accumulated as 64-bit using the absolute values of the errors.
+                const __m128i encodingError = _mm_sub_epi32(encodedSample, realSample);
+                const __m128i overflowError = _mm_slli_epi32(_mm_sub_epi32(encodedSampleUnclamped, encodedSample), 6);
+                const __m128i encodingErrorSign = _mm_srai_epi32(encodingError, 31);
+                const __m128i overflowErrorSign = _mm_srai_epi32(overflowError, 31);
+                const __m128i encodingErrorAbs = _mm_sub_epi32(_mm_xor_si128(encodingError, encodingErrorSign), encodingErrorSign);
+                const __m128i overflowErrorAbs = _mm_sub_epi32(_mm_xor_si128(overflowError, overflowErrorSign), overflowErrorSign);
+
+                errorsEven[vecIdx] = _mm_add_epi64(errorsEven[vecIdx], _mm_add_epi64(
+                    _mm_mul_epu32(encodingErrorAbs, encodingErrorAbs),
+                    _mm_mul_epu32(overflowErrorAbs, overflowErrorAbs)
+                ));
+
+                const __m128i encodingErrorAbsOdd = _mm_srli_epi64(encodingErrorAbs, 32);
+                const __m128i overflowErrorAbsOdd = _mm_srli_epi64(overflowErrorAbs, 32);
+
+                errorsOdd[vecIdx] = _mm_add_epi64(errorsOdd[vecIdx], _mm_add_epi64(
+                    _mm_mul_epu32(encodingErrorAbsOdd, encodingErrorAbsOdd),
+                    _mm_mul_epu32(overflowErrorAbsOdd, overflowErrorAbsOdd)
+                ));
+            }
+        }
+
+        // Save the errors for all the candidates, ignoring the padding lanes
+        alignas(16) uint64_t laneErrors[NUM_CANDIDATE_VECS * 4];
+
+        for (uint32_t vecIdx = 0; vecIdx < NUM_CANDIDATE_VECS; ++vecIdx) {
+            _mm_store_si128((__m128i*)(laneErrors + vecIdx * 4 + 0), _mm_unpacklo_epi64(errorsEven[vecIdx], errorsOdd[vecIdx]));
+            _mm_store_si128((__m128i*)(laneErrors + vecIdx * 4 + 2), _mm_unpackhi_epi64(errorsEven[vecIdx], errorsOdd[vecIdx]));
+        }
+
+        std::memcpy(outErrors, laneErrors, sizeof(uint64_t) * NUM_ENCODING_CANDIDATES);
+    #else
+        for (uint32_t candidateIdx = 0; candidateIdx < NUM_ENCODING_CANDIDATES; ++candidateIdx) {
             uint8_t sampleNibbles[ADPCM_BLOCK_NUM_SAMPLES];
             int16_t lastEncSample1;
             int16_t lastEncSample2;
-            uint64_t error;
 
             tryPsxAdpcmEncoding(
-                sampleFilter,
-                sampleShift,
-                samples,
-                prevSample1,
-                prevSample2,
+                candidateIdx / 13,
+                (int32_t)(candidateIdx % 13),
+                inSamples,
+                inPrevSample1,
+                inPrevSample2,
                 sampleNibbles,
                 lastEncSample1,
                 lastEncSample2,
-                error
+                outErrors[candidateIdx]
             );
-
-            // Is this a better one? If so then remember it...
-            if (error < bestError) {
-                bestError = error;
-                bestSampleFilter = sampleFilter;
-                bestSampleShift = sampleShift;
-                std::memcpy(bestSampleNibbles, sampleNibbles, sizeof(sampleNibbles));
-
-                // Save this for the caller, so it knows the last two encoded samples for the best encoding
-                prevEncSampleOut1 = lastEncSample1;
-                prevEncSampleOut2 = lastEncSample2;
-            }
         }
-    }
+    #endif
+}
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Write out an encoded ADPCM block: header, flags and the sample nibbles
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void writePsxAdpcmBlock(
+    const uint32_t sampleFilter,
+    const uint32_t sampleShift,
+    const uint8_t sampleNibbles[ADPCM_BLOCK_NUM_SAMPLES],
+    const bool bLoopStartFlag,
+    const bool bLoopEndFlag,
+    const bool bRepeatFlag,
+    std::byte adpcmDataOut[ADPCM_BLOCK_SIZE]
+) noexcept {
     // Save the sample shift and the prediction filter
-    adpcmDataOut[0] = (std::byte)(bestSampleShift | (bestSampleFilter << 4));
+    adpcmDataOut[0] = (std::byte)(sampleShift | (sampleFilter << 4));
 
     // Save the ADPCM flags and the sample nibbles themselves
     adpcmDataOut[1] = (std::byte)(
@@ -559,9 +848,291 @@ void encodePcmToPsxAdpcmBlock(
     );
 
     for (uint32_t byteIdx = 0; byteIdx < ADPCM_BLOCK_NUM_SAMPLES / 2; ++byteIdx) {
-        adpcmDataOut[2 + byteIdx] = (std::byte)(bestSampleNibbles[byteIdx * 2] | (bestSampleNibbles[byteIdx * 2 + 1] << 4));
+        adpcmDataOut[2 + byteIdx] = (std::byte)(sampleNibbles[byteIdx * 2] | (sampleNibbles[byteIdx * 2 + 1] << 4));
     }
 }
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Encode the given samples in the PlayStation's ADPCM format
+//------------------------------------------------------------------------------------------------------------------------------------------
+void encodePcmToPsxAdpcmBlock(
+    const int16_t samples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t prevSample1,
+    const int16_t prevSample2,
+    const bool bLoopStartFlag,
+    const bool bLoopEndFlag,
+    const bool bRepeatFlag,
+    std::byte adpcmDataOut[ADPCM_BLOCK_SIZE],
+    int16_t& prevEncSampleOut1,
+    int16_t& prevEncSampleOut2
+) noexcept {
+    // Try all combinations of ADPCM encoding and sample shift adjust to find the best one.
+    // If there is a tie then the first candidate wins.
+    uint64_t errors[NUM_ENCODING_CANDIDATES];
+    getPsxAdpcmEncodingErrors(samples, prevSample1, prevSample2, errors);
+
+    const uint32_t bestCandidateIdx = (uint32_t)(std::min_element(errors, errors + NUM_ENCODING_CANDIDATES) - errors);
+    const uint32_t bestSampleFilter = bestCandidateIdx / 13;
+    const uint32_t bestSampleShift = bestCandidateIdx % 13;
+
+    // Redo the best encoding to get the sample nibbles, and also the last two encoded samples for the caller
+    uint8_t bestSampleNibbles[ADPCM_BLOCK_NUM_SAMPLES];
+    uint64_t bestError;
+
+    tryPsxAdpcmEncoding(
+        bestSampleFilter,
+        (int32_t) bestSampleShift,
+        samples,
+        prevSample1,
+        prevSample2,
+        bestSampleNibbles,
+        prevEncSampleOut1,
+        prevEncSampleOut2,
+        bestError
+    );
+
+    writePsxAdpcmBlock(
+        bestSampleFilter, bestSampleShift, bestSampleNibbles, bLoopStartFlag, bLoopEndFlag, bRepeatFlag, adpcmDataOut
+    );
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// High quality version of 'tryPsxAdpcmEncoding'.
+//
+// Quantizes by considering the adjust steps either side of the exact prediction error (i.e rounding down and up) rather than just
+// truncating. A beam search over these choices keeps the given number of lowest error encoder states after each sample, so a choice
+// that costs a little now but leaves a better prediction state for later samples can still win. The error measure is the same as
+// for 'tryPsxAdpcmEncoding'.
+//
+// Since the error only ever grows from one sample to the next, the search gives up as soon as every state has an error of at least the
+// given maximum. Returns 'false' in that case, leaving the outputs untouched.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool tryPsxAdpcmEncodingHq(
+    const uint32_t sampleFilter,
+    const int32_t sampleShift,
+    const int16_t inSamples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t inPrevSample1,
+    const int16_t inPrevSample2,
+    const uint32_t beamWidth,
+    const uint64_t maxError,
+    uint8_t outNibbles[ADPCM_BLOCK_NUM_SAMPLES],
+    int16_t& outPrevSample1,
+    int16_t& outPrevSample2,
+    uint64_t& outError
+) noexcept {
+    ASSERT((beamWidth >= 1) && (beamWidth <= MAX_ENCODE_BEAM_WIDTH));
+
+    // A state in the search and how it was reached: from which state in the previous step and with what sample nibble
+    struct BeamState {
+        PrevEncSamples  prevSamples;
+        uint64_t        error;
+    };
+
+    struct BeamStep {
+        uint8_t     parentIdx;
+        uint8_t     sampleNibble;
+    };
+
+    // Get the prediction filter co-efficients and the correction step based on the sample shift
+    const int32_t predictCoefPos = ADPCM_PREDICT_COEF_POS[sampleFilter];
+    const int32_t predictCoefNeg = ADPCM_PREDICT_COEF_NEG[sampleFilter];
+    const int32_t adjustStep = 1 << std::clamp(12 - sampleShift, 0, 12);
+
+    // Start off with just the input state and expand from there
+    BeamState beam[MAX_ENCODE_BEAM_WIDTH];
+    uint32_t beamSize = 1;
+    beam[0] = { { inPrevSample1, inPrevSample2 }, 0 };
+
+    BeamStep beamSteps[ADPCM_BLOCK_NUM_SAMPLES][MAX_ENCODE_BEAM_WIDTH];
+
+    for (uint32_t sampleIdx = 0; sampleIdx < ADPCM_BLOCK_NUM_SAMPLES; ++sampleIdx) {
+        const int32_t realSample = inSamples[sampleIdx];
+
+        // Expand each state with the nibbles either side of the prediction error
+        BeamState children[MAX_ENCODE_BEAM_WIDTH * 2];
+        BeamStep childSteps[MAX_ENCODE_BEAM_WIDTH * 2];
+        uint32_t numChildren = 0;
+
+        for (uint32_t stateIdx = 0; stateIdx < beamSize; ++stateIdx) {
+            const BeamState& state = beam[stateIdx];
+            const int32_t predictedSample = (state.prevSamples.sample1 * predictCoefPos + state.prevSamples.sample2 * predictCoefNeg + 32) / 64;
+            const int32_t predictionError = realSample - predictedSample;
+
+            // Round down and up, i.e use floor and ceil of the division, then clamp to within range for a 4-bit signed integer
+            const int32_t adjustStepsTrunc = predictionError / adjustStep;
+            const int32_t adjustStepsFloor = adjustStepsTrunc - (((predictionError % adjustStep) < 0) ? 1 : 0);
+            const int32_t adjustStepsLo = std::clamp(adjustStepsFloor, -8, 7);
+            const int32_t adjustStepsHi = std::clamp(adjustStepsFloor + 1, -8, 7);
+
+            for (int32_t adjustSteps = adjustStepsLo; adjustSteps <= adjustStepsHi; ++adjustSteps) {
+                // Get the encoded sample and the error for it: penalize heavily overflow
+                const uint8_t sampleNibble = ((uint8_t) adjustSteps) & 0x0Fu;
+                const int32_t encodedSampleUnclamped = predictedSample + (int32_t) SHIFT_NIBBLE_ENC_TABLE.values[sampleShift][sampleNibble];
+                const int16_t encodedSample = (int16_t) std::clamp<int32_t>(encodedSampleUnclamped, INT16_MIN, INT16_MAX);
+                const uint32_t encodingError = (uint32_t) std::abs(encodedSample - realSample);
+                const uint32_t overflowError = (uint32_t) std::abs(encodedSampleUnclamped - encodedSample) * 64;
+
+                BeamState& child = children[numChildren];
+                child.prevSamples = { encodedSample, state.prevSamples.sample1 };
+                child.error = state.error + (uint64_t) encodingError * encodingError + (uint64_t) overflowError * overflowError;
+                childSteps[numChildren] = { (uint8_t) stateIdx, sampleNibble };
+                numChildren++;
+            }
+        }
+
+        // Keep the lowest error states, ignoring any duplicates of a state already kept since they will encode identically from here.
+        // There are only ever a few children, so a stable insertion sort is quicker than 'std::stable_sort' (which can allocate).
+        uint8_t childOrder[MAX_ENCODE_BEAM_WIDTH * 2];
+
+        for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx) {
+            uint32_t orderIdx = childIdx;
+
+            for (; (orderIdx > 0) && (children[childOrder[orderIdx - 1]].error > children[childIdx].error); --orderIdx) {
+                childOrder[orderIdx] = childOrder[orderIdx - 1];
+            }
+
+            childOrder[orderIdx] = (uint8_t) childIdx;
+        }
+
+        beamSize = 0;
+
+        for (uint32_t orderIdx = 0; (orderIdx < numChildren) && (beamSize < beamWidth); ++orderIdx) {
+            const uint8_t childIdx = childOrder[orderIdx];
+            const BeamState& child = children[childIdx];
+
+            const bool bIsDuplicate = std::any_of(beam, beam + beamSize, [&](const BeamState& state) noexcept {
+                return (state.prevSamples == child.prevSamples);
+            });
+
+            if (!bIsDuplicate) {
+                beam[beamSize] = child;
+                beamSteps[sampleIdx][beamSize] = childSteps[childIdx];
+                beamSize++;
+            }
+        }
+
+        // The states are kept in order of error, so the first has the least
+        if (beam[0].error >= maxError)
+            return false;
+    }
+
+    // The best state is first: walk back through the steps that led to it to get the nibbles
+    uint32_t stateIdx = 0;
+
+    for (int32_t sampleIdx = ADPCM_BLOCK_NUM_SAMPLES - 1; sampleIdx >= 0; --sampleIdx) {
+        const BeamStep& step = beamSteps[sampleIdx][stateIdx];
+        outNibbles[sampleIdx] = step.sampleNibble;
+        stateIdx = step.parentIdx;
+    }
+
+    outPrevSample1 = beam[0].prevSamples.sample1;
+    outPrevSample2 = beam[0].prevSamples.sample2;
+    outError = beam[0].error;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Encode the given samples in the PlayStation's ADPCM format using the high quality encoder.
+// If the samples for the next block are given, then the best few candidates for this block are re-ranked by also considering how well
+// the next block can be encoded (with the fast encoder) from the prediction state they leave behind.
+//------------------------------------------------------------------------------------------------------------------------------------------
+void encodePcmToPsxAdpcmBlockHq(
+    const int16_t samples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t* const pNextSamples,
+    const int16_t prevSample1,
+    const int16_t prevSample2,
+    const bool bLoopStartFlag,
+    const bool bLoopEndFlag,
+    const bool bRepeatFlag,
+    const uint32_t beamWidth,
+    std::byte adpcmDataOut[ADPCM_BLOCK_SIZE],
+    int16_t& prevEncSampleOut1,
+    int16_t& prevEncSampleOut2
+) noexcept {
+    // Try all combinations of ADPCM encoding and sample shift adjust
+    struct Candidate {
+        uint8_t         sampleNibbles[ADPCM_BLOCK_NUM_SAMPLES];
+        PrevEncSamples  prevEncSamples;
+        uint64_t        error;
+    };
+
+    // Only the best few candidates are considered by the lookahead below, so give up on a candidate once it can't be one of them.
+    // The candidates are tried in order and the first wins any ties, so a candidate which can only tie with the current best few can't
+    // displace them either. This gives exactly the same result as trying every candidate in full.
+    constexpr uint32_t NUM_LOOKAHEAD_CANDIDATES = 4;
+    uint64_t bestErrors[NUM_LOOKAHEAD_CANDIDATES];
+    std::fill(bestErrors, bestErrors + NUM_LOOKAHEAD_CANDIDATES, UINT64_MAX);
+
+    const uint32_t clampedBeamWidth = std::clamp(beamWidth, 1u, MAX_ENCODE_BEAM_WIDTH);
+    Candidate candidates[NUM_ENCODING_CANDIDATES];
+
+    for (uint32_t candidateIdx = 0; candidateIdx < NUM_ENCODING_CANDIDATES; ++candidateIdx) {
+        Candidate& candidate = candidates[candidateIdx];
+        candidate.error = UINT64_MAX;
+
+        tryPsxAdpcmEncodingHq(
+            candidateIdx / 13,
+            (int32_t)(candidateIdx % 13),
+            samples,
+            prevSample1,
+            prevSample2,
+            clampedBeamWidth,
+            bestErrors[NUM_LOOKAHEAD_CANDIDATES - 1],
+            candidate.sampleNibbles,
+            candidate.prevEncSamples.sample1,
+            candidate.prevEncSamples.sample2,
+            candidate.error
+        );
+
+        // Keep track of the lowest errors so far, in order
+        uint64_t* const pInsertPos = std::upper_bound(bestErrors, bestErrors + NUM_LOOKAHEAD_CANDIDATES, candidate.error);
+
+        if (pInsertPos < bestErrors + NUM_LOOKAHEAD_CANDIDATES) {
+            std::copy_backward(pInsertPos, bestErrors + NUM_LOOKAHEAD_CANDIDATES - 1, bestErrors + NUM_LOOKAHEAD_CANDIDATES);
+            *pInsertPos = candidate.error;
+        }
+    }
+
+    // Rank the candidates by error, the first candidate winning any ties
+    uint8_t candidateOrder[NUM_ENCODING_CANDIDATES];
+
+    for (uint32_t candidateIdx = 0; candidateIdx < NUM_ENCODING_CANDIDATES; ++candidateIdx) {
+        candidateOrder[candidateIdx] = (uint8_t) candidateIdx;
+    }
+
+    std::stable_sort(candidateOrder, candidateOrder + NUM_ENCODING_CANDIDATES, [&](const uint8_t c1, const uint8_t c2) noexcept {
+        return (candidates[c1].error < candidates[c2].error);
+    });
+
+    // Lookahead: choose between the best few candidates based on their error plus the error for encoding the next block
+    uint32_t bestCandidateIdx = candidateOrder[0];
+
+    if (pNextSamples) {
+        uint64_t bestTotalError = UINT64_MAX;
+
+        for (uint32_t orderIdx = 0; orderIdx < NUM_LOOKAHEAD_CANDIDATES; ++orderIdx) {
+            const Candidate& candidate = candidates[candidateOrder[orderIdx]];
+
+            uint64_t nextErrors[NUM_ENCODING_CANDIDATES];
+            getPsxAdpcmEncodingErrors(pNextSamples, candidate.prevEncSamples.sample1, candidate.prevEncSamples.sample2, nextErrors);
+            const uint64_t totalError = candidate.error + *std::min_element(nextErrors, nextErrors + NUM_ENCODING_CANDIDATES);
+
+            if (totalError < bestTotalError) {
+                bestTotalError = totalError;
+                bestCandidateIdx = candidateOrder[orderIdx];
+            }
+        }
+    }
+
+    // Save the best encoding and the last two encoded samples for it
+    const Candidate& bestCandidate = candidates[bestCandidateIdx];
+    prevEncSampleOut1 = bestCandidate.prevEncSamples.sample1;
+    prevEncSampleOut2 = bestCandidate.prevEncSamples.sample2;
+
+    writePsxAdpcmBlock(
+        bestCandidateIdx / 13, bestCandidateIdx % 13, bestCandidate.sampleNibbles, bLoopStartFlag, bLoopEndFlag, bRepeatFlag, adpcmDataOut
+    );
+}
+
 END_NAMESPACE(VagUtils)
 END_NAMESPACE(AudioTools)
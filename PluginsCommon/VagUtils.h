@@ -24,6 +24,7 @@ static constexpr uint32_t VAG_FILE_VERSION  = 0x03;         // VAG file version
 //------------------------------------------------------------------------------------------------------------------------------------------
 static constexpr uint32_t   ADPCM_BLOCK_SIZE        = 16;       // The size in bytes of a PSX format ADPCM block
 static constexpr uint32_t   ADPCM_BLOCK_NUM_SAMPLES = 28;       // The number of samples in a PSX format ADPCM block
+static constexpr uint32_t   NUM_ENCODING_CANDIDATES = 5 * 13;   // How many filter and shift combinations are tried for each block: numbered 'filter * 13 + shift'
 
 //------------------------------------------------------------------------------------------------------------------------------------------
 // Flags read from the 2nd byte of a PSX ADPCM block.
@@ -58,6 +59,42 @@ struct VagFileHdr {
 
 static_assert(sizeof(VagFileHdr) == 64);
 
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Which method to use when encoding PCM sound to PSX ADPCM.
+//
+//  Fast:   For each block pick the filter and shift with the least error, quantizing each sample by truncation.
+//          This is the original encoder and the default.
+//  High:   Quantize with rounding and do a beam search over the nibble choices for each filter and shift, keeping several of the best
+//          encoder states at each sample. Also looks ahead to the next block when choosing between the best few candidates, since the
+//          choice affects the prediction state for that block. Gives better SNR for the same size, but is much slower.
+//------------------------------------------------------------------------------------------------------------------------------------------
+enum class EncodeQuality : uint8_t {
+    Fast,
+    High
+};
+
+// Maximum number of encoder states kept at each sample for the 'High' quality mode.
+// On the benchmark's test sounds (see 'Benchmarks/AdpcmEncoderBench.cpp') SNR rises with every step in width from 1 up to 4, but past
+// that it's flat to within a few hundredths of a dB either way while the cost keeps growing. Wider beams are not guaranteed to do better,
+// since each block is searched on it's own: a lower error block can leave a prediction state which makes the following blocks worse.
+static constexpr uint32_t MAX_ENCODE_BEAM_WIDTH = 4;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Options controlling how PCM sound is encoded to PSX ADPCM.
+// The defaults give the same behavior as not specifying any options.
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct EncodeOptions {
+    // How many threads to use for encoding, or '0' to use all hardware threads.
+    // The output is identical regardless of the number of threads; short sounds will always be encoded on a single thread.
+    uint32_t numThreads = 1;
+
+    // Which encoder to use, and for the 'High' quality encoder how many encoder states to keep at each sample.
+    // The beam width is clamped to between 1 and MAX_ENCODE_BEAM_WIDTH, and defaults to the maximum since that gave the best SNR in testing.
+    // A beam width of '1' means just rounding-aware quantization without any search.
+    EncodeQuality quality = EncodeQuality::Fast;
+    uint32_t beamWidth = 4;
+};
+
 bool readVagFile(
     InputStream& in,
     const size_t fileSize,
@@ -121,6 +158,15 @@ void encodePcmSoundToPsxAdpcm(
     std::vector<std::byte>& adpcmDataOut
 ) noexcept;
 
+void encodePcmSoundToPsxAdpcm(
+    const int16_t* const pSamples,
+    const uint32_t numSamples,
+    const uint32_t loopStartSampleIdx,
+    const uint32_t loopEndSampleIdx,
+    std::vector<std::byte>& adpcmDataOut,
+    const EncodeOptions& options
+) noexcept;
+
 void encodePcmToPsxAdpcmBlock(
     const int16_t samples[ADPCM_BLOCK_NUM_SAMPLES],
     const int16_t prevSample1,
@@ -133,5 +179,38 @@ void encodePcmToPsxAdpcmBlock(
     int16_t& prevEncSampleOut2
 ) noexcept;
 
+void encodePcmToPsxAdpcmBlockHq(
+    const int16_t samples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t* const pNextSamples,
+    const int16_t prevSample1,
+    const int16_t prevSample2,
+    const bool bLoopStartFlag,
+    const bool bLoopEndFlag,
+    const bool bRepeatFlag,
+    const uint32_t beamWidth,
+    std::byte adpcmDataOut[ADPCM_BLOCK_SIZE],
+    int16_t& prevEncSampleOut1,
+    int16_t& prevEncSampleOut2
+) noexcept;
+
+void tryPsxAdpcmEncoding(
+    const uint32_t sampleFilter,
+    const int32_t sampleShift,
+    const int16_t inSamples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t inPrevSample1,
+    const int16_t inPrevSample2,
+    uint8_t outNibbles[ADPCM_BLOCK_NUM_SAMPLES],
+    int16_t& outPrevSample1,
+    int16_t& outPrevSample2,
+    uint64_t& outError
+) noexcept;
+
+void getPsxAdpcmEncodingErrors(
+    const int16_t inSamples[ADPCM_BLOCK_NUM_SAMPLES],
+    const int16_t inPrevSample1,
+    const int16_t inPrevSample2,
+    uint64_t outErrors[NUM_ENCODING_CANDIDATES]
+) noexcept;
+
 END_NAMESPACE(VagUtils)
 END_NAMESPACE(AudioTools)
@@ -0,0 +1,222 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unit tests for the fast paths of the PSX ADPCM encoder.
+//
+// Usage: AdpcmEncoderTest
+//
+// The encoder must give byte-identical output to the plain serial encoder however it's sped up. Checks that the errors computed for all
+// filter and shift candidates at once (with SSE2 where available) match evaluating each candidate on it's own, for random blocks and for
+// blocks which clip. Also checks that sounds encoded on several threads come out exactly the same as on one thread, for looped and unlooped
+// sounds long enough to be split into segments, with both the fast and high quality encoders.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "VagUtils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <initializer_list>
+#include <iterator>
+#include <random>
+#include <vector>
+
+using namespace AudioTools;
+
+static constexpr uint32_t kMinBlocksPerSegment = 256;   // Shortest segment of a sound the encoder will split off for another thread
+
+static uint32_t gNumChecks = 0;
+static uint32_t gNumFailures = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Record the result of a check and report it if it failed
+//------------------------------------------------------------------------------------------------------------------------------------------
+#define CHECK(Condition)\
+    do {\
+        ++gNumChecks;\
+        if (!(Condition)) {\
+            ++gNumFailures;\
+            std::printf("FAIL: %s:%d: %s\n", __func__, __LINE__, #Condition);\
+        }\
+    } while (0)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that the errors for all the candidate encodings of a block match evaluating each candidate on it's own
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkCandidateErrors(const int16_t samples[VagUtils::ADPCM_BLOCK_NUM_SAMPLES], const int16_t prevSample1, const int16_t prevSample2) noexcept {
+    uint64_t errors[VagUtils::NUM_ENCODING_CANDIDATES];
+    VagUtils::getPsxAdpcmEncodingErrors(samples, prevSample1, prevSample2, errors);
+
+    for (uint32_t candidateIdx = 0; candidateIdx < VagUtils::NUM_ENCODING_CANDIDATES; ++candidateIdx) {
+        uint8_t nibbles[VagUtils::ADPCM_BLOCK_NUM_SAMPLES];
+        int16_t encSample1 = 0;
+        int16_t encSample2 = 0;
+        uint64_t error = 0;
+        VagUtils::tryPsxAdpcmEncoding(candidateIdx / 13, (int32_t)(candidateIdx % 13), samples, prevSample1, prevSample2, nibbles, encSample1, encSample2, error);
+        CHECK(errors[candidateIdx] == error);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check the candidate errors for random blocks, at full scale and at low levels where the smaller shifts matter
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testRandomBlockErrors() noexcept {
+    std::mt19937 random(2024);
+    int16_t samples[VagUtils::ADPCM_BLOCK_NUM_SAMPLES];
+
+    for (const int32_t amplitude : { 32768, 4096, 256, 16 }) {
+        std::uniform_int_distribution<int32_t> sampleDist(std::max(-amplitude, INT16_MIN), std::min(amplitude, (int32_t) INT16_MAX));
+
+        for (uint32_t blockIdx = 0; blockIdx < 2000; ++blockIdx) {
+            for (int16_t& sample : samples) {
+                sample = (int16_t) sampleDist(random);
+            }
+
+            checkCandidateErrors(samples, (int16_t) sampleDist(random), (int16_t) sampleDist(random));
+        }
+    }
+
+    // Smooth signals, which the prediction filters are actually good at
+    for (uint32_t blockIdx = 0; blockIdx < 2000; ++blockIdx) {
+        const double freq = std::uniform_real_distribution<double>(0.001, 0.5)(random);
+        const double amplitude = std::uniform_real_distribution<double>(1.0, 32767.0)(random);
+        const double phase = std::uniform_real_distribution<double>(0.0, 6.283)(random);
+
+        for (uint32_t sampleIdx = 0; sampleIdx < VagUtils::ADPCM_BLOCK_NUM_SAMPLES; ++sampleIdx) {
+            samples[sampleIdx] = (int16_t) std::lround(amplitude * std::sin(phase + freq * (sampleIdx + 2)));
+        }
+
+        checkCandidateErrors(samples, (int16_t) std::lround(amplitude * std::sin(phase + freq)), (int16_t) std::lround(amplitude * std::sin(phase)));
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check the candidate errors for blocks where the encoded samples clip, so the overflow penalty comes into play
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testClippingBlockErrors() noexcept {
+    std::mt19937 random(32767);
+    const int16_t extremes[] = { INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX };
+    int16_t samples[VagUtils::ADPCM_BLOCK_NUM_SAMPLES];
+
+    // Full scale square waves of various periods, starting from every combination of extreme previous samples
+    for (uint32_t period = 1; period <= 16; ++period) {
+        for (uint32_t sampleIdx = 0; sampleIdx < VagUtils::ADPCM_BLOCK_NUM_SAMPLES; ++sampleIdx) {
+            samples[sampleIdx] = ((sampleIdx / period) % 2 == 0) ? INT16_MAX : INT16_MIN;
+        }
+
+        for (const int16_t prevSample1 : extremes) {
+            for (const int16_t prevSample2 : extremes) {
+                checkCandidateErrors(samples, prevSample1, prevSample2);
+            }
+        }
+    }
+
+    // Constant full scale blocks and silence, after previous samples at the opposite extreme
+    for (const int16_t level : extremes) {
+        std::fill(samples, samples + VagUtils::ADPCM_BLOCK_NUM_SAMPLES, level);
+
+        for (const int16_t prevSample1 : extremes) {
+            for (const int16_t prevSample2 : extremes) {
+                checkCandidateErrors(samples, prevSample1, prevSample2);
+            }
+        }
+    }
+
+    // Random blocks made only of extreme values
+    std::uniform_int_distribution<uint32_t> extremeDist(0, (uint32_t) std::size(extremes) - 1);
+
+    for (uint32_t blockIdx = 0; blockIdx < 2000; ++blockIdx) {
+        for (int16_t& sample : samples) {
+            sample = extremes[extremeDist(random)];
+        }
+
+        checkCandidateErrors(samples, extremes[extremeDist(random)], extremes[extremeDist(random)]);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Make a test sound with the given number of samples: a mix of tones, noise, hard clipped sections and silence, so the encoder state at the
+// segment boundaries differs a lot between the guessed and actual previous samples.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<int16_t> makeSound(const uint32_t numSamples, const uint32_t seed) noexcept {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int32_t> noiseDist(-12000, 12000);
+    std::vector<int16_t> samples(numSamples);
+
+    for (uint32_t sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx) {
+        const double t = (double) sampleIdx;
+        const uint32_t section = (sampleIdx / 5000) % 4;
+        double value = 0.0;
+
+        if (section == 0) {
+            value = 20000.0 * std::sin(t * (0.01 + t * 1e-7)) + noiseDist(random) * 0.1;
+        } else if (section == 1) {
+            value = 50000.0 * std::sin(t * 0.03);
+        } else if (section == 2) {
+            value = noiseDist(random);
+        }
+
+        samples[sampleIdx] = (int16_t) std::clamp<double>(std::round(value), INT16_MIN, INT16_MAX);
+    }
+
+    return samples;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that the given sound encodes exactly the same with any number of threads as it does on a single thread
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkParallelEncoding(
+    const std::vector<int16_t>& samples,
+    const uint32_t loopStartSampleIdx,
+    const uint32_t loopEndSampleIdx,
+    const VagUtils::EncodeQuality quality,
+    const std::initializer_list<uint32_t> threadCounts
+) noexcept {
+    const uint32_t numSamples = (uint32_t) samples.size();
+    VagUtils::EncodeOptions options = {};
+    options.quality = quality;
+    options.numThreads = 1;
+
+    std::vector<std::byte> serialAdpcmData;
+    VagUtils::encodePcmSoundToPsxAdpcm(samples.data(), numSamples, loopStartSampleIdx, loopEndSampleIdx, serialAdpcmData, options);
+    CHECK(serialAdpcmData.size() == (size_t)((numSamples + VagUtils::ADPCM_BLOCK_NUM_SAMPLES - 1) / VagUtils::ADPCM_BLOCK_NUM_SAMPLES) * VagUtils::ADPCM_BLOCK_SIZE);
+
+    for (const uint32_t numThreads : threadCounts) {
+        // Make sure the sound is actually split into a segment for every thread
+        const uint32_t numBlocks = (uint32_t)(serialAdpcmData.size() / VagUtils::ADPCM_BLOCK_SIZE);
+        CHECK(numBlocks / kMinBlocksPerSegment >= numThreads);
+
+        options.numThreads = numThreads;
+        std::vector<std::byte> adpcmData;
+        VagUtils::encodePcmSoundToPsxAdpcm(samples.data(), numSamples, loopStartSampleIdx, loopEndSampleIdx, adpcmData, options);
+        CHECK(adpcmData == serialAdpcmData);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that multi-threaded encoding matches single-threaded encoding for looped and unlooped sounds
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testParallelEncoding() noexcept {
+    // Enough blocks for 8 segments of more than the minimum size, with a partial last block
+    const uint32_t numSamples = 9 * kMinBlocksPerSegment * VagUtils::ADPCM_BLOCK_NUM_SAMPLES + 13;
+    const std::vector<int16_t> samples = makeSound(numSamples, 1);
+
+    checkParallelEncoding(samples, 0, 0, VagUtils::EncodeQuality::Fast, { 2, 3, 8 });
+    checkParallelEncoding(samples, 1000, 60000, VagUtils::EncodeQuality::Fast, { 2, 3, 8 });
+    checkParallelEncoding(samples, 0, numSamples, VagUtils::EncodeQuality::Fast, { 2, 3, 8 });
+
+    // Loop points on segment boundaries
+    const uint32_t segmentSamples = (9 * kMinBlocksPerSegment + 1) / 2 * VagUtils::ADPCM_BLOCK_NUM_SAMPLES;
+    checkParallelEncoding(samples, segmentSamples, segmentSamples + 5 * VagUtils::ADPCM_BLOCK_NUM_SAMPLES, VagUtils::EncodeQuality::Fast, { 2 });
+
+    // The high quality encoder is much slower, so use a shorter sound which can only be split into a few segments
+    const std::vector<int16_t> shortSamples = makeSound(3 * kMinBlocksPerSegment * VagUtils::ADPCM_BLOCK_NUM_SAMPLES + 100, 2);
+    checkParallelEncoding(shortSamples, 0, 0, VagUtils::EncodeQuality::High, { 2, 3 });
+    checkParallelEncoding(shortSamples, 3000, 15000, VagUtils::EncodeQuality::High, { 2, 3 });
+}
+
+int main() {
+    testRandomBlockErrors();
+    testClippingBlockErrors();
+    testParallelEncoding();
+
+    std::printf("%u of %u checks passed.\n", gNumChecks - gNumFailures, gNumChecks);
+    return (gNumFailures == 0) ? 0 : 1;
+}
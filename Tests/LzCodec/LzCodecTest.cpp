@@ -0,0 +1,295 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unit tests for the LZ codec.
+//
+// Usage: LzCodecTest
+//
+// Checks that data of all kinds survives a round trip through the codec exactly, including empty, incompressible and highly repetitive data
+// and matches which overlap the bytes they produce. Since the decompressor reads plugin state handed over by the host, it's also checked
+// that it rejects truncated data and data with out of range lengths and offsets, and that it never writes outside the output it's given
+// even when the compressed data is corrupted at random.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "LzCodec.h"
+
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+static constexpr uint32_t kNumGuardBytes = 64;      // Bytes after the expected output that must never be written by decompression
+
+static uint32_t gNumChecks = 0;
+static uint32_t gNumFailures = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Record the result of a check and report it if it failed
+//------------------------------------------------------------------------------------------------------------------------------------------
+#define CHECK(Condition)\
+    do {\
+        ++gNumChecks;\
+        if (!(Condition)) {\
+            ++gNumFailures;\
+            std::printf("FAIL: %s:%d: %s\n", __func__, __LINE__, #Condition);\
+        }\
+    } while (0)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Make a buffer of bytes from the given values, for writing compressed data by hand
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::byte> makeBytes(const std::initializer_list<uint32_t> values) noexcept {
+    std::vector<std::byte> bytes;
+
+    for (const uint32_t value : values) {
+        bytes.push_back((std::byte) value);
+    }
+
+    return bytes;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Decompress the given data, expecting the given number of bytes out. The output is followed by guard bytes which must not be touched.
+// Returns whether decompression succeeded, and the output if it did.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool decompressGuarded(const std::vector<std::byte>& compressedData, const uint32_t size, std::vector<std::byte>& data) noexcept {
+    std::vector<std::byte> output(size + kNumGuardBytes, std::byte(0xA5));
+    const bool bDecompressed = LzCodec::decompress(compressedData.data(), (uint32_t) compressedData.size(), output.data(), size);
+
+    bool bGuardIntact = true;
+
+    for (uint32_t i = size; i < size + kNumGuardBytes; ++i) {
+        bGuardIntact &= (output[i] == std::byte(0xA5));
+    }
+
+    CHECK(bGuardIntact);
+    output.resize(size);
+    data = std::move(output);
+    return bDecompressed;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compress and decompress the given data and check that it comes back exactly as it was, returning the compressed data
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::byte> checkRoundTrip(const std::vector<std::byte>& data) noexcept {
+    const uint32_t size = (uint32_t) data.size();
+    std::vector<std::byte> compressedData;
+    LzCodec::compress(data.data(), size, compressedData);
+    CHECK(compressedData.size() <= LzCodec::getMaxCompressedSize(size));
+
+    std::vector<std::byte> decompressedData;
+    CHECK(decompressGuarded(compressedData, size, decompressedData));
+    CHECK(decompressedData == data);
+
+    // The data must decompress to exactly the size expected
+    std::vector<std::byte> wrongSizeData;
+    CHECK(!decompressGuarded(compressedData, size + 1, wrongSizeData));
+
+    if (size > 0) {
+        CHECK(!decompressGuarded(compressedData, size - 1, wrongSizeData));
+    }
+
+    return compressedData;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Round trips of empty data, data which doesn't compress and data with long and overlapping matches
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testRoundTrip() noexcept {
+    std::mt19937 random(12345);
+
+    // Empty data compresses to a single token with no literals
+    const std::vector<std::byte> emptyCompressed = checkRoundTrip({});
+    CHECK(emptyCompressed == makeBytes({ 0x00 }));
+
+    // Incompressible data, including literal runs either side of where the length spills out of the token's nibble
+    for (const uint32_t size : { 1u, 3u, 14u, 15u, 16u, 269u, 270u, 271u, 65536u, 300000u }) {
+        std::vector<std::byte> data(size);
+
+        for (std::byte& value : data) {
+            value = (std::byte) random();
+        }
+
+        checkRoundTrip(data);
+    }
+
+    // A long run of the same byte: encoded as a match overlapping the bytes it produces, with an offset of 1
+    {
+        const std::vector<std::byte> data(1000000, std::byte(0x42));
+        const std::vector<std::byte> compressedData = checkRoundTrip(data);
+        CHECK(compressedData.size() < data.size() / 200);
+    }
+
+    // A short repeating pattern: overlapping matches with offsets shorter than the match length
+    for (const uint32_t patternSize : { 2u, 3u, 5u, 7u }) {
+        std::vector<std::byte> data;
+
+        for (uint32_t i = 0; i < 10000; ++i) {
+            data.push_back((std::byte)(i % patternSize + 1));
+        }
+
+        const std::vector<std::byte> compressedData = checkRoundTrip(data);
+        CHECK(compressedData.size() < 100);
+    }
+
+    // A random block repeated many times: long matches reaching back as far as the maximum offset allows, and further
+    for (const uint32_t blockSize : { 1000u, LzCodec::MAX_MATCH_OFFSET, LzCodec::MAX_MATCH_OFFSET + 1 }) {
+        std::vector<std::byte> block(blockSize);
+
+        for (std::byte& value : block) {
+            value = (std::byte) random();
+        }
+
+        std::vector<std::byte> data;
+
+        for (uint32_t i = 0; i < 4; ++i) {
+            data.insert(data.end(), block.begin(), block.end());
+        }
+
+        checkRoundTrip(data);
+    }
+
+    // Mixed data: runs, repeats and random bytes of all lengths, including matches at the very end of the data
+    for (uint32_t testIdx = 0; testIdx < 200; ++testIdx) {
+        std::vector<std::byte> data;
+        const uint32_t numPieces = random() % 40;
+
+        for (uint32_t pieceIdx = 0; pieceIdx < numPieces; ++pieceIdx) {
+            const uint32_t pieceSize = random() % 600;
+
+            switch (random() % 3) {
+                case 0:
+                    data.insert(data.end(), pieceSize, (std::byte) random());
+                    break;
+
+                case 1:
+                    for (uint32_t i = 0; i < pieceSize; ++i) {
+                        data.push_back((std::byte) random());
+                    }
+                    break;
+
+                default:
+                    if (!data.empty()) {
+                        const size_t copyStart = random() % data.size();
+
+                        for (uint32_t i = 0; i < pieceSize; ++i) {
+                            data.push_back(data[copyStart + i]);
+                        }
+                    }
+                    break;
+            }
+        }
+
+        checkRoundTrip(data);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compressed data cut short anywhere must be rejected
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testTruncatedInput() noexcept {
+    std::mt19937 random(54321);
+    std::vector<std::byte> data;
+
+    // Literals long enough to need extra length bytes, then a long run to get a long match, then more literals
+    for (uint32_t i = 0; i < 300; ++i) {
+        data.push_back((std::byte) random());
+    }
+
+    data.insert(data.end(), 1000, std::byte(0));
+
+    for (uint32_t i = 0; i < 20; ++i) {
+        data.push_back((std::byte) random());
+    }
+
+    std::vector<std::byte> compressedData;
+    LzCodec::compress(data.data(), (uint32_t) data.size(), compressedData);
+
+    uint32_t numRejected = 0;
+
+    for (size_t truncatedSize = 0; truncatedSize < compressedData.size(); ++truncatedSize) {
+        const std::vector<std::byte> truncatedData(compressedData.begin(), compressedData.begin() + truncatedSize);
+        std::vector<std::byte> output;
+
+        if (!decompressGuarded(truncatedData, (uint32_t) data.size(), output)) {
+            ++numRejected;
+        }
+    }
+
+    CHECK(numRejected == compressedData.size());
+
+    // No data at all is not even an empty sequence
+    std::vector<std::byte> output;
+    CHECK(!decompressGuarded({}, 0, output));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Lengths and offsets which reach outside the input or output must be rejected
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testOutOfRange() noexcept {
+    std::vector<std::byte> output;
+
+    // A valid stream to start from: 1 literal, a match of 4 with an offset of 1, then an empty last sequence
+    CHECK(decompressGuarded(makeBytes({ 0x10, 'A', 0x01, 0x00, 0x00 }), 5, output));
+    CHECK(output == makeBytes({ 'A', 'A', 'A', 'A', 'A' }));
+
+    // Match offsets of 0 or reaching back before the start of the output
+    CHECK(!decompressGuarded(makeBytes({ 0x10, 'A', 0x00, 0x00, 0x00 }), 5, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x10, 'A', 0x02, 0x00, 0x00 }), 5, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x10, 'A', 0xFF, 0xFF, 0x00 }), 5, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x00, 0x01, 0x00, 0x00 }), 4, output));
+
+    // Match offset cut off
+    CHECK(!decompressGuarded(makeBytes({ 0x10, 'A', 0x01 }), 5, output));
+
+    // Match running past the end of the output, including through extra length bytes
+    CHECK(!decompressGuarded(makeBytes({ 0x10, 'A', 0x01, 0x00, 0x00 }), 4, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x1F, 'A', 0x01, 0x00, 0x10, 0x00 }), 20, output));
+    CHECK(decompressGuarded(makeBytes({ 0x1F, 'A', 0x01, 0x00, 0x10, 0x00 }), 36, output));
+
+    // Literals running past the end of the input or the output
+    CHECK(!decompressGuarded(makeBytes({ 0x50, 'A', 'B' }), 5, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x30, 'A', 'B', 'C' }), 2, output));
+    CHECK(!decompressGuarded(makeBytes({ 0xF0, 0x05, 'A', 'B' }), 20, output));
+
+    // Extra length bytes which run off the end of the input, or add up to more than could ever be valid
+    CHECK(!decompressGuarded(makeBytes({ 0xF0, 0xFF, 0xFF }), 1000, output));
+    CHECK(!decompressGuarded(makeBytes({ 0x1F, 'A', 0x01, 0x00, 0xFF }), 1000, output));
+
+    std::vector<std::byte> hugeLength = makeBytes({ 0xF0 });
+    hugeLength.insert(hugeLength.end(), 100000, std::byte(0xFF));
+    hugeLength.push_back(std::byte(0x00));
+    CHECK(!decompressGuarded(hugeLength, 1000, output));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Corrupting compressed data at random must never make decompression go outside the output, whether or not the corruption is noticed.
+// Note: the format has no checksum, so much of the corruption is not noticed; users of the codec need to check the data themselves.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testCorruptInput() noexcept {
+    std::mt19937 random(999);
+    std::vector<std::byte> data;
+
+    for (uint32_t i = 0; i < 4000; ++i) {
+        data.push_back((i % 100 < 50) ? (std::byte) random() : (std::byte)(i / 100));
+    }
+
+    std::vector<std::byte> compressedData;
+    LzCodec::compress(data.data(), (uint32_t) data.size(), compressedData);
+
+    for (uint32_t testIdx = 0; testIdx < 5000; ++testIdx) {
+        std::vector<std::byte> corruptData = compressedData;
+        corruptData[random() % corruptData.size()] = (std::byte) random();
+
+        std::vector<std::byte> output;
+        decompressGuarded(corruptData, (uint32_t) data.size(), output);
+    }
+}
+
+int main() {
+    testRoundTrip();
+    testTruncatedInput();
+    testOutOfRange();
+    testCorruptInput();
+
+    std::printf("%u of %u checks passed.\n", gNumChecks - gNumFailures, gNumChecks);
+    return (gNumFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unit tests for the resampler.
+//
+// Usage: ResamplerTest
+//
+// Checks that a stream with the same input and output rates passes samples through bit for bit, and that an impulse comes out of a stream
+// exactly as late as the lookahead it reports (which the plugins report to the host as latency). Checks the frame accounting both ways the
+// plugins use streams: pushing just the input needed for blocks of output (the SPU output), and pulling all the output available from blocks
+// of input (the reverb's host input). For random block sizes at 48 and 96 KHz the frames needed, available and held must match exactly what
+// is pushed and pulled. Also checks that a stream only reports being silent when it's sure to output nothing but silence.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static constexpr double     kSpuRate        = 44100.0;  // Rate of the SPU side of the streams
+static constexpr uint32_t   kMaxBlockFrames = 256;      // Most frames pushed or pulled at a time, like the plugins
+static constexpr double     kHostRates[]    = { 48000.0, 96000.0 };
+
+static uint32_t gNumChecks = 0;
+static uint32_t gNumFailures = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Record the result of a check and report it if it failed
+//------------------------------------------------------------------------------------------------------------------------------------------
+#define CHECK(Condition)\
+    do {\
+        ++gNumChecks;\
+        if (!(Condition)) {\
+            ++gNumFailures;\
+            std::printf("FAIL: %s:%d: %s\n", __func__, __LINE__, #Condition);\
+        }\
+    } while (0)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get how many frames of input a stream needs in total to output the given number of frames, from what's documented for the filter.
+// Each output frame is centered on its position in the input, and can't be made until the lookahead's worth of input after that is there.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static double getExpectedInputFrames(const Resampler::Stream& stream, const double rateRatio, const uint64_t numOutputFrames) noexcept {
+    if (numOutputFrames == 0)
+        return 0.0;
+
+    return std::floor((double)(numOutputFrames - 1) * rateRatio) + Resampler::getLookahead(stream) + 1.0;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that a stream with the same input and output rates outputs exactly what it's given, in blocks of any size, with no lookahead
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testPassthrough() noexcept {
+    std::mt19937 random(441);
+    std::uniform_real_distribution<float> sampleDist(-1.5f, 1.5f);
+
+    Resampler::Stream stream = {};
+    Resampler::initStream(stream, kSpuRate, kSpuRate, kMaxBlockFrames, kMaxBlockFrames);
+    CHECK(stream.bPassthrough);
+    CHECK(Resampler::getLookahead(stream) == 0.0);
+
+    std::vector<float> input[2];
+    std::vector<float> output[2];
+
+    for (uint32_t blockIdx = 0; blockIdx < 2000; ++blockIdx) {
+        const uint32_t numFrames = 1 + random() % kMaxBlockFrames;
+        CHECK(Resampler::getNumInputFramesNeeded(stream, numFrames) == numFrames);
+        CHECK(Resampler::getMaxInputFramesNeeded(stream, numFrames) == numFrames);
+
+        for (uint32_t chanIdx = 0; chanIdx < 2; ++chanIdx) {
+            input[chanIdx].resize(numFrames);
+            output[chanIdx].assign(numFrames, 0.0f);
+
+            for (float& sample : input[chanIdx]) {
+                sample = sampleDist(random);
+            }
+        }
+
+        // Include some values which would be easy to lose in arithmetic
+        input[0][0] = -0.0f;
+        input[1][numFrames - 1] = 1e-40f;
+
+        Resampler::pushInput(stream, input[0].data(), input[1].data(), numFrames);
+        CHECK(Resampler::getNumOutputFramesAvailable(stream) == numFrames);
+        CHECK(Resampler::getNumInputFramesNeeded(stream, numFrames) == 0);
+        Resampler::pullOutput(stream, output[0].data(), output[1].data(), numFrames);
+        CHECK(Resampler::getNumOutputFramesAvailable(stream) == 0);
+
+        CHECK(std::memcmp(output[0].data(), input[0].data(), numFrames * sizeof(float)) == 0);
+        CHECK(std::memcmp(output[1].data(), input[1].data(), numFrames * sizeof(float)) == 0);
+    }
+
+    Resampler::destroyStream(stream);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check where an impulse comes out of a stream, pushing just the input needed for each frame of output like the plugins do.
+// The peak must be where the impulse is in the output's timeline, but the input must be that far ahead of the output to make it: so relative
+// to the output frame being made when the impulse was pushed, it comes out delayed by the lookahead. This is the latency reported to hosts.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkImpulseDelay(const double inputRate, const double outputRate) noexcept {
+    constexpr uint32_t kImpulseFrame = 1000;
+
+    Resampler::Stream stream = {};
+    Resampler::initStream(stream, inputRate, outputRate, 0, 1);
+
+    const double rateRatio = inputRate / outputRate;
+    const uint32_t numOutputFrames = (uint32_t)(kImpulseFrame / rateRatio) + 200;
+    std::vector<float> output[2] = { std::vector<float>(numOutputFrames), std::vector<float>(numOutputFrames) };
+    uint32_t numInputFrames = 0;
+    uint32_t impulseOutputFrame = UINT32_MAX;
+
+    for (uint32_t outputFrameIdx = 0; outputFrameIdx < numOutputFrames; ++outputFrameIdx) {
+        const uint32_t numFramesNeeded = Resampler::getNumInputFramesNeeded(stream, 1);
+
+        for (uint32_t i = 0; i < numFramesNeeded; ++i, ++numInputFrames) {
+            const float sample = (numInputFrames == kImpulseFrame) ? 1.0f : 0.0f;
+            Resampler::pushInput(stream, &sample, &sample, 1);
+
+            if (numInputFrames == kImpulseFrame) {
+                impulseOutputFrame = outputFrameIdx;
+            }
+        }
+
+        Resampler::pullOutput(stream, &output[0][outputFrameIdx], &output[1][outputFrameIdx], 1);
+    }
+
+    const auto peakIter = std::max_element(output[0].begin(), output[0].end());
+    const uint32_t peakFrame = (uint32_t)(peakIter - output[0].begin());
+    CHECK(output[0] == output[1]);
+    CHECK(*peakIter > 0.5 * std::min(1.0 / rateRatio, 1.0));     // Going to a lower rate spreads the impulse out over more input frames
+    CHECK(std::abs((double) peakFrame - kImpulseFrame / rateRatio) <= 1.0);
+
+    // Same conversion of the lookahead to output frames as the plugins use for their latency
+    const int32_t latency = (int32_t) std::lround(Resampler::getLookahead(stream) / rateRatio);
+    CHECK(impulseOutputFrame != UINT32_MAX);
+    CHECK(std::abs((int32_t) peakFrame - (int32_t) impulseOutputFrame - latency) <= 1);
+
+    Resampler::destroyStream(stream);
+}
+
+static void testImpulseDelay() noexcept {
+    checkImpulseDelay(kSpuRate, kSpuRate);
+
+    for (const double hostRate : kHostRates) {
+        checkImpulseDelay(kSpuRate, hostRate);
+        checkImpulseDelay(hostRate, kSpuRate);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check the frame accounting when pushing just the input needed for random sized blocks of output, like the SPU output of the plugins.
+// The input needed must be no more than the most that could be needed, and exactly enough: one frame less must not be enough.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkPullDriven(const double inputRate, const double outputRate, const uint32_t seed) noexcept {
+    std::mt19937 random(seed);
+    Resampler::Stream stream = {};
+    Resampler::initStream(stream, inputRate, outputRate, 0, kMaxBlockFrames);
+
+    const double rateRatio = inputRate / outputRate;
+    const uint32_t maxInputFrames = Resampler::getMaxInputFramesNeeded(stream, kMaxBlockFrames);
+    std::vector<float> input(maxInputFrames, 0.25f);
+    std::vector<float> output(kMaxBlockFrames);
+    uint64_t numInputFrames = 0;
+    uint64_t numOutputFrames = 0;
+
+    for (uint32_t blockIdx = 0; blockIdx < 5000; ++blockIdx) {
+        const uint32_t numFrames = 1 + random() % kMaxBlockFrames;
+        const uint32_t numFramesNeeded = Resampler::getNumInputFramesNeeded(stream, numFrames);
+        CHECK(numFramesNeeded <= Resampler::getMaxInputFramesNeeded(stream, numFrames));
+        CHECK(numFramesNeeded <= maxInputFrames);
+
+        if (numFramesNeeded > 0) {
+            Resampler::pushInput(stream, input.data(), input.data(), numFramesNeeded - 1);
+            CHECK(Resampler::getNumOutputFramesAvailable(stream) < numFrames);
+            CHECK(Resampler::getNumInputFramesNeeded(stream, numFrames) == 1);
+            Resampler::pushInput(stream, input.data(), input.data(), 1);
+        }
+
+        CHECK(stream.numHistoryFrames <= stream.historyCapacity);
+        CHECK(Resampler::getNumOutputFramesAvailable(stream) >= numFrames);
+        CHECK(Resampler::getNumInputFramesNeeded(stream, numFrames) == 0);
+        Resampler::pullOutput(stream, output.data(), output.data(), numFrames);
+
+        numInputFrames += numFramesNeeded;
+        numOutputFrames += numFrames;
+        CHECK(std::abs((double) numInputFrames - getExpectedInputFrames(stream, rateRatio, numOutputFrames)) <= 1.0);
+    }
+
+    Resampler::destroyStream(stream);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check the frame accounting when pulling all the output available from random sized blocks of input, like the reverb's host input.
+// All of the output available must be makeable with no more input, and no more than that.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkPushDriven(const double inputRate, const double outputRate, const uint32_t seed) noexcept {
+    std::mt19937 random(seed);
+    Resampler::Stream stream = {};
+    Resampler::initStream(stream, inputRate, outputRate, kMaxBlockFrames, 0);
+
+    const double rateRatio = inputRate / outputRate;
+    std::vector<float> input(kMaxBlockFrames, -0.25f);
+    std::vector<float> output(Resampler::getMaxInputFramesNeeded(stream, 0) + (uint32_t) std::ceil(kMaxBlockFrames / rateRatio) + 1);
+    uint64_t numInputFrames = 0;
+    uint64_t numOutputFrames = 0;
+
+    for (uint32_t blockIdx = 0; blockIdx < 5000; ++blockIdx) {
+        const uint32_t numFrames = 1 + random() % kMaxBlockFrames;
+        CHECK(stream.numHistoryFrames + numFrames <= stream.historyCapacity);
+        Resampler::pushInput(stream, input.data(), input.data(), numFrames);
+
+        const uint32_t numFramesAvailable = Resampler::getNumOutputFramesAvailable(stream);
+        CHECK(numFramesAvailable <= output.size());
+        CHECK(Resampler::getNumInputFramesNeeded(stream, numFramesAvailable) == 0);
+        CHECK(Resampler::getNumInputFramesNeeded(stream, numFramesAvailable + 1) > 0);
+        Resampler::pullOutput(stream, output.data(), output.data(), numFramesAvailable);
+        CHECK(Resampler::getNumOutputFramesAvailable(stream) == 0);
+
+        numInputFrames += numFrames;
+        numOutputFrames += numFramesAvailable;
+        CHECK(numInputFrames >= getExpectedInputFrames(stream, rateRatio, numOutputFrames) - 1.0);
+        CHECK(numInputFrames < getExpectedInputFrames(stream, rateRatio, numOutputFrames + 1) + 1.0);
+    }
+
+    Resampler::destroyStream(stream);
+}
+
+static void testFrameAccounting() noexcept {
+    uint32_t seed = 96;
+
+    for (const double hostRate : kHostRates) {
+        checkPullDriven(kSpuRate, hostRate, ++seed);
+        checkPullDriven(hostRate, kSpuRate, ++seed);
+        checkPushDriven(kSpuRate, hostRate, ++seed);
+        checkPushDriven(hostRate, kSpuRate, ++seed);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that a stream says it's silent to begin with and once enough silence has followed a burst of noise, and that whenever it says so,
+// it outputs only silence for silent input. This is what lets the plugins skip rendering, so it must never be said while the filter still
+// has non-silent input in it's window.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkSilence(const double inputRate, const double outputRate, const uint32_t seed) noexcept {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> sampleDist(-1.0f, 1.0f);
+
+    Resampler::Stream stream = {};
+    Resampler::initStream(stream, inputRate, outputRate, 0, kMaxBlockFrames);
+    CHECK(Resampler::isSilent(stream));
+
+    std::vector<float> input(Resampler::getMaxInputFramesNeeded(stream, kMaxBlockFrames));
+    std::vector<float> output[2] = { std::vector<float>(kMaxBlockFrames), std::vector<float>(kMaxBlockFrames) };
+    const uint32_t numNoiseBlocks = 20;
+    uint32_t numSilentBlocks = 0;
+
+    // Small blocks, so the noise passes out of the filter window a few frames at a time
+    for (uint32_t blockIdx = 0; blockIdx < 500; ++blockIdx) {
+        const bool bNoise = (blockIdx >= 50) && (blockIdx < 50 + numNoiseBlocks);
+        const bool bWasSilent = Resampler::isSilent(stream);
+        const uint32_t numFrames = 1 + random() % 8;
+        const uint32_t numFramesNeeded = Resampler::getNumInputFramesNeeded(stream, numFrames);
+
+        for (uint32_t i = 0; i < numFramesNeeded; ++i) {
+            input[i] = (bNoise) ? sampleDist(random) : 0.0f;
+        }
+
+        Resampler::pushInput(stream, input.data(), input.data(), numFramesNeeded);
+        CHECK(Resampler::isSilent(stream) == (bWasSilent && ((!bNoise) || (numFramesNeeded == 0))));
+        Resampler::pullOutput(stream, output[0].data(), output[1].data(), numFrames);
+
+        if (bWasSilent && (!bNoise)) {
+            CHECK(std::all_of(output[0].begin(), output[0].begin() + numFrames, [](const float sample) { return sample == 0.0f; }));
+            CHECK(std::all_of(output[1].begin(), output[1].begin() + numFrames, [](const float sample) { return sample == 0.0f; }));
+        }
+
+        // Once the noise has gone it must be silent again, by the time the noise has passed out of the filter window
+        if ((blockIdx >= 50 + numNoiseBlocks) && Resampler::isSilent(stream)) {
+            ++numSilentBlocks;
+        }
+    }
+
+    CHECK(numSilentBlocks > 0);
+    CHECK(Resampler::isSilent(stream));
+    Resampler::destroyStream(stream);
+}
+
+static void testSilence() noexcept {
+    uint32_t seed = 7;
+    checkSilence(kSpuRate, kSpuRate, ++seed);
+
+    for (const double hostRate : kHostRates) {
+        checkSilence(kSpuRate, hostRate, ++seed);
+        checkSilence(hostRate, kSpuRate, ++seed);
+    }
+}
+
+int main() {
+    testPassthrough();
+    testImpulseDelay();
+    testFrameAccounting();
+    testSilence();
+
+    std::printf("%u of %u checks passed.\n", gNumChecks - gNumFailures, gNumChecks);
+    return (gNumFailures == 0) ? 0 : 1;
+}
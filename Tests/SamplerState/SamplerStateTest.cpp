@@ -0,0 +1,355 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unit tests for the versioned part of PsxSampler's saved state.
+//
+// Usage: SamplerStateTest
+//
+// Checks that the SPU settings, zones and samples survive a round trip through the state, wherever it starts in the data. Since the state
+// is handed over by the host and may be corrupt or malicious, it's also checked that states which are truncated, from newer versions, have
+// too many zones or more sample data than fits in SPU RAM, or whose samples don't match their hash are all rejected - and that a bad zone
+// table is rejected before any memory is allocated for the samples it claims to have.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "LzCodec.h"
+#include "PsxSampler/SamplerState.h"
+#include "SharedSampleStore.h"
+
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+static uint32_t gNumChecks = 0;
+static uint32_t gNumFailures = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Record the result of a check and report it if it failed
+//------------------------------------------------------------------------------------------------------------------------------------------
+#define CHECK(Condition)\
+    do {\
+        ++gNumChecks;\
+        if (!(Condition)) {\
+            ++gNumFailures;\
+            std::printf("FAIL: %s:%d: %s\n", __func__, __LINE__, #Condition);\
+        }\
+    } while (0)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Make a state with zones of the given sample sizes, and samples of ADPCM blocks with random data in some and repeated data in others.
+// Returns the samples of all zones, in zone order.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::byte> makeState(
+    const std::initializer_list<uint32_t> zoneSizes,
+    std::mt19937& random,
+    SamplerState::State& state
+) noexcept {
+    state = {};
+    state.sampleMode = 1;
+    state.spuHardware = 1;
+    state.selectedZoneIdx = (uint32_t)(zoneSizes.size() - 1);
+
+    std::vector<std::byte> adpcmData;
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds;
+
+    for (const uint32_t zoneSize : zoneSizes) {
+        const uint8_t zoneIdx = (uint8_t) state.zones.size();
+        state.zones.push_back(SamplerState::Zone{ zoneIdx, (uint8_t)(zoneIdx + 10), 0, 127, 60.0 + zoneIdx * 0.5, zoneSize });
+
+        for (uint32_t i = 0; i < zoneSize; ++i) {
+            adpcmData.push_back(((i / 16) % 4 == 0) ? (std::byte) random() : (std::byte)(i % 16));
+        }
+    }
+
+    const std::byte* pZoneAdpcmData = adpcmData.data();
+
+    for (const SamplerState::Zone& zone : state.zones) {
+        zoneSounds.push_back(SharedSampleStore::SoundPlacement{ 0, 0, pZoneAdpcmData, zone.adpcmSize });
+        pZoneAdpcmData += zone.adpcmSize;
+    }
+
+    state.soundDataHash = SharedSampleStore::hashSoundData(zoneSounds.data(), (uint32_t) zoneSounds.size());
+    return adpcmData;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Write the given state and samples after the given number of bytes of other data, returning the data
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<std::byte> writeState(
+    const SamplerState::State& state,
+    const std::vector<std::byte>& adpcmData,
+    const uint32_t startPos
+) noexcept {
+    std::vector<std::byte> compressedData;
+    LzCodec::compress(adpcmData.data(), (uint32_t) adpcmData.size(), compressedData);
+
+    std::vector<std::byte> data(startPos, std::byte(0x5A));
+    SamplerState::writeState(state, compressedData, data);
+    return data;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Read the state at the given position, expecting it to be rejected and nothing to be left over from it
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void checkRejected(const std::vector<std::byte>& data, const int startPos) noexcept {
+    SamplerState::State state = {};
+    std::vector<std::byte> adpcmData;
+    CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), startPos, state, adpcmData) < 0);
+    CHECK(state.zones.empty());
+    CHECK(adpcmData.empty());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Overwrite one of the 32-bit values in a written state
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void setValue(std::vector<std::byte>& data, const size_t pos, const uint32_t value) noexcept {
+    std::memcpy(data.data() + pos, &value, sizeof(value));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that states of various numbers and sizes of zones read back exactly as written, up to the most samples and zones allowed
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testRoundTrip() noexcept {
+    std::mt19937 random(1234);
+    const uint32_t halfRamSize = SamplerState::MAX_SAMPLES_SIZE / 2;
+
+    const auto checkRoundTrip = [&](const std::initializer_list<uint32_t> zoneSizes, const uint32_t startPos) noexcept {
+        SamplerState::State state = {};
+        const std::vector<std::byte> adpcmData = makeState(zoneSizes, random, state);
+        const std::vector<std::byte> data = writeState(state, adpcmData, startPos);
+        CHECK(SamplerState::hasStateTag(data.data(), (uint32_t) data.size(), (int) startPos));
+
+        SamplerState::State readState = {};
+        std::vector<std::byte> readAdpcmData;
+        CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), (int) startPos, readState, readAdpcmData) == (int) data.size());
+        CHECK(readState.sampleMode == state.sampleMode);
+        CHECK(readState.spuHardware == state.spuHardware);
+        CHECK(readState.selectedZoneIdx == state.selectedZoneIdx);
+        CHECK(readState.soundDataHash == state.soundDataHash);
+        CHECK(readState.zones.size() == state.zones.size());
+        CHECK(readAdpcmData == adpcmData);
+
+        for (size_t zoneIdx = 0; (zoneIdx < state.zones.size()) && (zoneIdx < readState.zones.size()); ++zoneIdx) {
+            const SamplerState::Zone& zone = state.zones[zoneIdx];
+            const SamplerState::Zone& readZone = readState.zones[zoneIdx];
+            CHECK(readZone.noteMin == zone.noteMin);
+            CHECK(readZone.noteMax == zone.noteMax);
+            CHECK(readZone.velocityMin == zone.velocityMin);
+            CHECK(readZone.velocityMax == zone.velocityMax);
+            CHECK(readZone.baseNote == zone.baseNote);
+            CHECK(readZone.adpcmSize == zone.adpcmSize);
+        }
+    };
+
+    checkRoundTrip({ 0 }, 0);
+    checkRoundTrip({ 16 }, 0);
+    checkRoundTrip({ 4096 }, 37);
+    checkRoundTrip({ 160, 0, 48, 1024 }, 5);
+    checkRoundTrip({ halfRamSize, halfRamSize }, 12);
+    checkRoundTrip({ SamplerState::MAX_SAMPLES_SIZE - 32, 16, 16 }, 0);
+
+    // The most zones there can be
+    SamplerState::State state = {};
+    std::vector<std::byte> adpcmData = makeState({ 32 }, random, state);
+    state.zones.assign(SamplerState::MAX_ZONES, state.zones[0]);
+    state.selectedZoneIdx = SamplerState::MAX_ZONES - 1;
+
+    for (uint32_t zoneIdx = 1; zoneIdx < SamplerState::MAX_ZONES; ++zoneIdx) {
+        adpcmData.insert(adpcmData.end(), adpcmData.begin(), adpcmData.begin() + 32);
+    }
+
+    std::vector<SharedSampleStore::SoundPlacement> zoneSounds;
+
+    for (uint32_t zoneIdx = 0; zoneIdx < SamplerState::MAX_ZONES; ++zoneIdx) {
+        zoneSounds.push_back(SharedSampleStore::SoundPlacement{ 0, 0, adpcmData.data() + zoneIdx * 32, 32 });
+    }
+
+    state.soundDataHash = SharedSampleStore::hashSoundData(zoneSounds.data(), SamplerState::MAX_ZONES);
+    const std::vector<std::byte> data = writeState(state, adpcmData, 0);
+
+    SamplerState::State readState = {};
+    std::vector<std::byte> readAdpcmData;
+    CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), 0, readState, readAdpcmData) == (int) data.size());
+    CHECK(readState.zones.size() == SamplerState::MAX_ZONES);
+    CHECK(readAdpcmData == adpcmData);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that note and velocity ranges out of the MIDI range are clamped to it
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testClampedRanges() noexcept {
+    std::mt19937 random(55);
+    SamplerState::State state = {};
+    const std::vector<std::byte> adpcmData = makeState({ 64 }, random, state);
+    std::vector<std::byte> data = writeState(state, adpcmData, 0);
+
+    // The zone table follows the 6 values at the start of the state
+    setValue(data, 24, 200);
+    setValue(data, 28, 0xFFFFFFFFu);
+    setValue(data, 32, 128);
+    setValue(data, 36, 1000);
+
+    SamplerState::State readState = {};
+    std::vector<std::byte> readAdpcmData;
+    CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), 0, readState, readAdpcmData) == (int) data.size());
+    CHECK(readState.zones.size() == 1);
+
+    if (readState.zones.size() == 1) {
+        CHECK(readState.zones[0].noteMin == 127);
+        CHECK(readState.zones[0].noteMax == 127);
+        CHECK(readState.zones[0].velocityMin == 127);
+        CHECK(readState.zones[0].velocityMax == 127);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that states which are not versioned, from newer versions or with bad zone counts are rejected
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testBadHeader() noexcept {
+    std::mt19937 random(77);
+    SamplerState::State state = {};
+    const std::vector<std::byte> adpcmData = makeState({ 64, 128 }, random, state);
+    const std::vector<std::byte> data = writeState(state, adpcmData, 0);
+
+    // Not a versioned state: older states have ADPCM data after the parameters
+    std::vector<std::byte> badData = data;
+    setValue(badData, 0, 0);
+    CHECK(!SamplerState::hasStateTag(badData.data(), (uint32_t) badData.size(), 0));
+    checkRejected(badData, 0);
+    CHECK(!SamplerState::hasStateTag(data.data(), 3, 0));
+    CHECK(!SamplerState::hasStateTag(data.data(), (uint32_t) data.size(), -1));
+
+    // Newer state version
+    badData = data;
+    setValue(badData, 4, SamplerState::STATE_VERSION + 1);
+    checkRejected(badData, 0);
+
+    // Too many zones, or no zones at all
+    badData = data;
+    setValue(badData, 16, SamplerState::MAX_ZONES + 1);
+    checkRejected(badData, 0);
+    setValue(badData, 16, 0xFFFFFFFFu);
+    checkRejected(badData, 0);
+    setValue(badData, 16, 0);
+    setValue(badData, 20, 0);
+    checkRejected(badData, 0);
+
+    // Selected zone out of range
+    badData = data;
+    setValue(badData, 20, 2);
+    checkRejected(badData, 0);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that zone tables claiming more sample data than fits in SPU RAM are rejected, before the samples are allocated.
+// No valid state can have more: each zone's sample is clipped to the SPU RAM allocated to it, and the most SPU RAM there is is 2 MiB.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testOversizedZones() noexcept {
+    const auto checkOversized = [&](const std::initializer_list<uint32_t> zoneSizes) noexcept {
+        SamplerState::State state = {};
+
+        for (const uint32_t zoneSize : zoneSizes) {
+            state.zones.push_back(SamplerState::Zone{ 0, 127, 0, 127, 60.0, zoneSize });
+        }
+
+        // The zone table is all that is checked: the compressed data is just a few bytes, which a reader allocating first would then fail on
+        const std::vector<std::byte> data = writeState(state, std::vector<std::byte>(256, std::byte(0)), 0);
+
+        SamplerState::State readState = {};
+        std::vector<std::byte> readAdpcmData;
+        CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), 0, readState, readAdpcmData) < 0);
+        CHECK(readState.zones.empty());
+        CHECK(readAdpcmData.capacity() == 0);
+    };
+
+    const uint32_t ramSize = SamplerState::MAX_SAMPLES_SIZE;
+    checkOversized({ ramSize + 16 });
+    checkOversized({ ramSize, 16 });
+    checkOversized({ ramSize / 2, ramSize / 2, 16 });
+    checkOversized({ 0xFFFFFFF0u });
+    checkOversized({ 0x80000000u, 0x80000000u });     // Wraps around to zero in 32-bits
+    checkOversized({ 0xFFFFFFFFu, 1 });               // Likewise
+
+    // Every zone at the limit, with the most zones there can be
+    SamplerState::State state = {};
+    state.zones.assign(SamplerState::MAX_ZONES, SamplerState::Zone{ 0, 127, 0, 127, 60.0, ramSize });
+
+    const std::vector<std::byte> data = writeState(state, std::vector<std::byte>(256, std::byte(0)), 0);
+    SamplerState::State readState = {};
+    std::vector<std::byte> readAdpcmData;
+    CHECK(SamplerState::readState(data.data(), (uint32_t) data.size(), 0, readState, readAdpcmData) < 0);
+    CHECK(readState.zones.empty());
+    CHECK(readAdpcmData.capacity() == 0);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that states cut short anywhere are rejected
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testTruncatedState() noexcept {
+    std::mt19937 random(31337);
+    SamplerState::State state = {};
+    const std::vector<std::byte> adpcmData = makeState({ 96, 32, 480 }, random, state);
+    const std::vector<std::byte> data = writeState(state, adpcmData, 9);
+
+    for (size_t size = 0; size < data.size(); ++size) {
+        const std::vector<std::byte> truncatedData(data.begin(), data.begin() + size);
+        checkRejected(truncatedData, 9);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Check that samples which don't match the hash saved with them are rejected, whether or not they still decompress.
+// A corrupted byte in the compressed data may still decompress to the same samples (e.g a match with another offset to the same bytes),
+// in which case the state must read back exactly as it was.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testHashMismatch() noexcept {
+    std::mt19937 random(8080);
+    SamplerState::State state = {};
+    const std::vector<std::byte> adpcmData = makeState({ 256, 1024 }, random, state);
+
+    // Wrong hash
+    SamplerState::State badState = state;
+    badState.soundDataHash ^= 1;
+    checkRejected(writeState(badState, adpcmData, 0), 0);
+
+    // Zone boundaries moved: the same data split differently hashes differently
+    badState = state;
+    badState.zones[0].adpcmSize += 16;
+    badState.zones[1].adpcmSize -= 16;
+    checkRejected(writeState(badState, adpcmData, 0), 0);
+
+    // Corrupted compressed data
+    const std::vector<std::byte> data = writeState(state, adpcmData, 0);
+    const size_t compressedDataPos = 24 + state.zones.size() * 28 + 12;
+
+    for (uint32_t testIdx = 0; testIdx < 200; ++testIdx) {
+        std::vector<std::byte> corruptData = data;
+        const size_t corruptPos = compressedDataPos + random() % (data.size() - compressedDataPos);
+        const std::byte corruptByte = (std::byte) random();
+
+        if (corruptData[corruptPos] == corruptByte)
+            continue;
+
+        corruptData[corruptPos] = corruptByte;
+
+        SamplerState::State readState = {};
+        std::vector<std::byte> readAdpcmData;
+
+        if (SamplerState::readState(corruptData.data(), (uint32_t) corruptData.size(), 0, readState, readAdpcmData) >= 0) {
+            CHECK(readAdpcmData == adpcmData);
+        } else {
+            CHECK(readState.zones.empty());
+            CHECK(readAdpcmData.empty());
+        }
+    }
+}
+
+int main() {
+    testRoundTrip();
+    testClampedRanges();
+    testBadHeader();
+    testOversizedZones();
+    testTruncatedState();
+    testHashMismatch();
+
+    std::printf("%u of %u checks passed.\n", gNumChecks - gNumFailures, gNumChecks);
+    return (gNumFailures == 0) ? 0 : 1;
+}
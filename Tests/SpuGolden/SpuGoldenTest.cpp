@@ -0,0 +1,740 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Golden output regression test for the SPU.
+//
+// Usage: SpuGoldenTest --mode float|16bit [--update] [--wav-dir dir] goldenFile.txt
+//
+// Renders a fixed corpus of scenarios through the SPU and checks the output against previously recorded results, so that optimizations to
+// voice stepping, interpolation, envelopes and reverb can be verified to not change the output. The corpus covers all 10 LIBSPU reverb
+// modes (with voices and with external input), extremes of every ADSR envelope setting, looping and one-shot sounds and pitches above
+// 'MAX_SAMPLE_RATE'. Rendering is split into irregular spans so that block rendering paths get exercised as well as single steps.
+//
+// Each sample mode of the SPU has it's own golden file, which stores a hash of each scenario's output. In 16-bit mode the hash must match
+// exactly. In floating point mode the
+// output only has to match within a declared tolerance (since the order of floating point operations may legitimately change),
+// so the golden file also stores the RMS level and mean of each block of output for comparison when the hash differs.
+//
+// Use '--update' to regenerate a golden file after an intentional change in output, and '--wav-dir' to write the output of each scenario
+// as a .wav file for listening to or diffing.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "Spu.h"
+#include "PsxReverb/SpuReverbPresets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr uint32_t   kSpuRamSize         = 512 * 1024;   // Same as the PsxSampler and PsxReverb plugins
+static constexpr uint32_t   kNumVoices          = 24;           // Hardware voice limit of the PS1
+static constexpr uint32_t   kSoundNumBlocks     = 256;          // Number of ADPCM blocks in each of the test sounds
+static constexpr uint32_t   kLoopedSoundAddr8   = 0;            // Where the looped test sound is in SPU RAM (8 byte units)
+static constexpr uint32_t   kOneShotSoundAddr8  = 0x1000;       // Where the one-shot test sound is in SPU RAM (8 byte units)
+static constexpr uint32_t   kSignatureBlockSize = 4096;         // Number of frames in each block of the float SPU output signature
+
+// Tolerance for comparing the float SPU output signatures: absolute (relative to full scale) plus relative to the expected value
+static constexpr double kFloatAbsTolerance = 1.0e-6;
+static constexpr double kFloatRelTolerance = 1.0e-4;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// An event in a test scenario which happens on a particular frame
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ScenarioEvent {
+    enum Type : uint8_t {
+        KeyOn,
+        KeyOff,
+        SetPitch
+    };
+
+    uint32_t            frame;          // Which frame the event happens on
+    Type                type;
+    uint8_t             voiceIdx;       // Which voice is affected
+    bool                bOneShot;       // Key on: play the one-shot test sound rather than the looped one
+    uint16_t            pitch;          // Key on and set pitch: voice sample rate
+    Spu::Volume         volume;         // Key on: voice volume
+    Spu::AdsrEnvelope   env;            // Key on: voice envelope
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A test scenario: a sequence of voice events rendered through the SPU with a particular setup
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct Scenario {
+    std::string                 name;
+    uint32_t                    numFrames;      // How many frames of output to render
+    int32_t                     reverbMode;     // Which of the LIBSPU reverb modes to use
+    bool                        bExtInput;      // Feed a test signal into the external input (like the PsxReverb plugin)
+    bool                        bBlockCache;    // Whether to enable the decoded ADPCM block cache
+    bool                        bPredecoded;    // Whether to use pre-decoded blocks for the test sounds
+    std::vector<ScenarioEvent>  events;         // Voice events, sorted by frame
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// The results of rendering a scenario and what gets saved in the golden file
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ScenarioResult {
+    uint64_t                hash;           // Hash of the exact output
+    std::vector<double>     signature;      // Float SPU only: RMS left, RMS right, mean left and mean right for each block of output
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Makes a test sound consisting of random ADPCM blocks, covering all filters and shifts (including the invalid shifts 13-15).
+// This is deliberately generated directly rather than with the encoder, so that changes to the encoder don't affect the test.
+// If looping then the sound loops back to it's middle when it ends, otherwise the voice is silenced when it reaches the end.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void writeTestSound(std::byte* const pDst, const uint32_t seed, const bool bLooped) noexcept {
+    std::mt19937 rng(seed);
+
+    for (uint32_t blockIdx = 0; blockIdx < kSoundNumBlocks; ++blockIdx) {
+        std::byte* const pBlock = pDst + blockIdx * Spu::ADPCM_BLOCK_SIZE;
+        const uint32_t filter = rng() % 5;
+        const uint32_t shift = (blockIdx % 32 == 31) ? 13 + rng() % 3 : 4 + rng() % 9;
+        uint8_t flags = 0;
+
+        if (bLooped && (blockIdx == kSoundNumBlocks / 2)) {
+            flags |= Spu::ADPCM_FLAG_LOOP_START;
+        }
+
+        if (blockIdx + 1 == kSoundNumBlocks) {
+            flags |= (bLooped) ? Spu::ADPCM_FLAG_LOOP_END | Spu::ADPCM_FLAG_REPEAT : Spu::ADPCM_FLAG_LOOP_END;
+        }
+
+        pBlock[0] = (std::byte)((filter << 4) | shift);
+        pBlock[1] = (std::byte) flags;
+
+        for (int32_t i = 2; i < Spu::ADPCM_BLOCK_SIZE; ++i) {
+            pBlock[i] = (std::byte)(rng() & 0xFF);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Helpers for making envelopes and events
+//------------------------------------------------------------------------------------------------------------------------------------------
+static Spu::AdsrEnvelope makeEnv(
+    const uint32_t attackShift,
+    const uint32_t attackStep,
+    const bool bAttackExp,
+    const uint32_t decayShift,
+    const uint32_t sustainLevel,
+    const uint32_t sustainShift,
+    const uint32_t sustainStep,
+    const bool bSustainDec,
+    const bool bSustainExp,
+    const uint32_t releaseShift,
+    const bool bReleaseExp
+) noexcept {
+    Spu::AdsrEnvelope env = {};
+    env.attackShift = attackShift;
+    env.attackStep = attackStep;
+    env.bAttackExp = bAttackExp;
+    env.decayShift = decayShift;
+    env.sustainLevel = sustainLevel;
+    env.sustainShift = sustainShift;
+    env.sustainStep = sustainStep;
+    env.bSustainDec = bSustainDec;
+    env.bSustainExp = bSustainExp;
+    env.releaseShift = releaseShift;
+    env.bReleaseExp = bReleaseExp;
+    return env;
+}
+
+// Same as the default envelope for the PsxSampler instrument
+static const Spu::AdsrEnvelope kDefaultEnv = makeEnv(10, 3, false, 6, 10, 20, 3, true, true, 12, true);
+
+static ScenarioEvent keyOnEvent(
+    const uint32_t frame,
+    const uint8_t voiceIdx,
+    const uint16_t pitch,
+    const Spu::AdsrEnvelope& env = kDefaultEnv,
+    const bool bOneShot = false,
+    const Spu::Volume volume = { 0x3FFF, 0x3FFF }
+) noexcept {
+    return ScenarioEvent{ frame, ScenarioEvent::KeyOn, voiceIdx, bOneShot, pitch, volume, env };
+}
+
+static ScenarioEvent keyOffEvent(const uint32_t frame, const uint8_t voiceIdx) noexcept {
+    return ScenarioEvent{ frame, ScenarioEvent::KeyOff, voiceIdx, false, 0, {}, {} };
+}
+
+static ScenarioEvent setPitchEvent(const uint32_t frame, const uint8_t voiceIdx, const uint16_t pitch) noexcept {
+    return ScenarioEvent{ frame, ScenarioEvent::SetPitch, voiceIdx, false, pitch, {}, {} };
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Makes the corpus of test scenarios
+//------------------------------------------------------------------------------------------------------------------------------------------
+static std::vector<Scenario> makeScenarios() noexcept {
+    std::vector<Scenario> scenarios;
+
+    const auto addScenario = [&](const std::string& name, const uint32_t numFrames, const int32_t reverbMode, std::vector<ScenarioEvent> events) {
+        std::stable_sort(events.begin(), events.end(), [](const ScenarioEvent& e1, const ScenarioEvent& e2) noexcept {
+            return e1.frame < e2.frame;
+        });
+
+        scenarios.push_back(Scenario{ name, numFrames, reverbMode, false, true, false, std::move(events) });
+        return &scenarios.back();
+    };
+
+    // All the reverb modes, with a chord played through voices and with the external input (as used by the PsxReverb effect)
+    for (int32_t mode = 0; mode < SpuReverbPresets::SPU_REV_MODE_MAX; ++mode) {
+        const std::string modeName = std::to_string(mode);
+
+        addScenario("reverb_voices_" + modeName, 66150, mode, {
+            keyOnEvent(0, 0, 0x1000),
+            keyOnEvent(0, 1, 0x1428),
+            keyOnEvent(0, 2, 0x1800, kDefaultEnv, true, { 0x2000, -0x3000 }),
+            keyOffEvent(8820, 0),
+            keyOffEvent(8820, 1),
+            keyOffEvent(8820, 2),
+        });
+
+        addScenario("reverb_ext_input_" + modeName, 66150, mode, {})->bExtInput = true;
+    }
+
+    // Extremes of each of the envelope phase settings.
+    // Each note is released halfway through, then retriggered during the release.
+    const auto addEnvScenario = [&](const std::string& name, const Spu::AdsrEnvelope& env) {
+        addScenario("adsr_" + name, 44100, 0, {
+            keyOnEvent(0, 0, 0x1000, env),
+            keyOffEvent(22050, 0),
+            keyOnEvent(33075, 0, 0x1000, env),
+        });
+    };
+
+    for (const uint32_t shift : { 0, 10, 31 }) {
+        for (const uint32_t step : { 0, 3 }) {
+            for (const bool bExp : { false, true }) {
+                const std::string suffix = "shift" + std::to_string(shift) + "_step" + std::to_string(step) + ((bExp) ? "_exp" : "_lin");
+                addEnvScenario("attack_" + suffix, makeEnv(shift, step, bExp, 0, 15, 31, 0, false, false, 0, false));
+            }
+        }
+    }
+
+    for (const uint32_t shift : { 0, 7, 15 }) {
+        for (const uint32_t level : { 0, 15 }) {
+            const std::string suffix = "shift" + std::to_string(shift) + "_level" + std::to_string(level);
+            addEnvScenario("decay_" + suffix, makeEnv(0, 0, false, shift, level, 31, 3, true, false, 0, false));
+        }
+    }
+
+    for (const uint32_t shift : { 0, 10, 31 }) {
+        for (const uint32_t step : { 0, 3 }) {
+            for (const bool bDec : { false, true }) {
+                for (const bool bExp : { false, true }) {
+                    const std::string suffix = (
+                        "shift" + std::to_string(shift) + "_step" + std::to_string(step) + ((bDec) ? "_dec" : "_inc") + ((bExp) ? "_exp" : "_lin")
+                    );
+
+                    addEnvScenario("sustain_" + suffix, makeEnv(0, 0, false, 0, (bDec) ? 15 : 0, shift, step, bDec, bExp, 31, false));
+                }
+            }
+        }
+    }
+
+    for (const uint32_t shift : { 0, 16, 31 }) {
+        for (const bool bExp : { false, true }) {
+            const std::string suffix = "shift" + std::to_string(shift) + ((bExp) ? "_exp" : "_lin");
+            addEnvScenario("release_" + suffix, makeEnv(0, 0, false, 4, 10, 31, 3, true, false, shift, bExp));
+        }
+    }
+
+    addScenario("adsr_keyoff_during_attack", 44100, 0, {
+        keyOnEvent(0, 0, 0x1000, makeEnv(20, 0, true, 0, 15, 31, 0, false, false, 10, false)),
+        keyOffEvent(1000, 0),
+    });
+
+    // Looping and one-shot sounds at various pitches
+    for (const bool bOneShot : { false, true }) {
+        for (const uint16_t pitch : { 0x0400, 0x1000, 0x2000, 0x3800 }) {
+            char name[64];
+            std::snprintf(name, sizeof(name), "%s_pitch_%04x", (bOneShot) ? "oneshot" : "loop", pitch);
+            addScenario(name, 44100, 0, { keyOnEvent(0, 0, pitch, kDefaultEnv, bOneShot) });
+        }
+    }
+
+    // Pitches around and above the maximum sample rate supported by the hardware
+    for (const uint16_t pitch : { 0x0001, 0x3FFF, 0x4000, 0x4001, 0x6000, 0x8000, 0xFFFF }) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "high_pitch_%04x", pitch);
+        addScenario(name, 22050, 0, { keyOnEvent(0, 0, pitch) });
+    }
+
+    addScenario("high_pitch_oneshot_ffff", 22050, 0, { keyOnEvent(0, 0, 0xFFFF, kDefaultEnv, true) });
+
+    // Pitch changes while a voice is playing
+    {
+        std::vector<ScenarioEvent> events = { keyOnEvent(0, 0, 0x0100) };
+
+        for (uint32_t i = 1; i < 64; ++i) {
+            events.push_back(setPitchEvent(i * 689, 0, (uint16_t)(0x0100 + i * 0x03F0)));
+        }
+
+        addScenario("pitch_sweep", 44100, 0, std::move(events));
+    }
+
+    // All voices at once with varied pitches and volumes, with reverb; also without the block cache which must not change anything
+    {
+        std::vector<ScenarioEvent> events;
+
+        for (uint8_t voiceIdx = 0; voiceIdx < kNumVoices; ++voiceIdx) {
+            const uint16_t pitch = (uint16_t)(0x0600 + voiceIdx * 0x01A3);
+            const Spu::Volume volume = { (int16_t)(0x3FFF - voiceIdx * 0x0400), (int16_t)(-0x1000 + voiceIdx * 0x0200) };
+            events.push_back(keyOnEvent(voiceIdx * 300, voiceIdx, pitch, kDefaultEnv, (voiceIdx % 3 == 0), volume));
+            events.push_back(keyOffEvent(22050 + voiceIdx * 500, voiceIdx));
+        }
+
+        events.push_back(keyOnEvent(30000, 5, 0x1000));     // Steal a voice that is releasing
+        addScenario("polyphony_all_voices", 66150, SpuReverbPresets::SPU_REV_MODE_HALL, events);
+        addScenario("polyphony_all_voices_no_cache", 66150, SpuReverbPresets::SPU_REV_MODE_HALL, events)->bBlockCache = false;
+        addScenario("polyphony_all_voices_predecoded", 66150, SpuReverbPresets::SPU_REV_MODE_HALL, events)->bPredecoded = true;
+
+        Scenario& noCachePredecoded = *addScenario("polyphony_all_voices_predecoded_no_cache", 66150, SpuReverbPresets::SPU_REV_MODE_HALL, events);
+        noCachePredecoded.bBlockCache = false;
+        noCachePredecoded.bPredecoded = true;
+    }
+
+    return scenarios;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// External input source for the external input scenarios: a short noisy burst followed by a decaying tone, then silence for the tail
+//------------------------------------------------------------------------------------------------------------------------------------------
+struct ExtInputSource {
+    std::mt19937    rng;
+    uint32_t        frameIdx;
+
+    static Spu::FloatStereoSample callback(void* const pUserData) noexcept {
+        ExtInputSource& src = *(ExtInputSource*) pUserData;
+        const uint32_t frameIdx = src.frameIdx++;
+        const uint32_t noise = src.rng();
+        int16_t left = 0;
+        int16_t right = 0;
+
+        if (frameIdx < 2205) {
+            left = (int16_t)(noise & 0xFFFF);
+            right = (int16_t)(noise >> 16);
+        } else if (frameIdx < 8820) {
+            const double t = (double)(frameIdx - 2205) / 44100.0;
+            const double tone = std::sin(t * 2.0 * 3.14159265358979323846 * 440.0) * std::exp(-t * 12.0) * 24000.0;
+            left = (int16_t) tone;
+            right = (int16_t)(-tone * 0.5);
+        }
+
+        return Spu::FloatStereoSample{ Spu::FloatSample(left), Spu::FloatSample(right) };
+    }
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Render a scenario and return the output
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static std::vector<Spu::BasicStereoSample<Sample>> renderScenario(const Scenario& scenario) noexcept {
+    Spu::Core spu = {};
+    Spu::initCore(spu, kSpuRamSize, kNumVoices, Sample::MODE);
+
+    if (scenario.bBlockCache) {
+        Spu::enableBlockCache(spu, 8192);
+    }
+
+    writeTestSound(spu.pRam + kLoopedSoundAddr8 * 8, 1, true);
+    writeTestSound(spu.pRam + kOneShotSoundAddr8 * 8, 2, false);
+    Spu::invalidateBlockCache(spu);
+
+    // Note: the pre-decoded sounds must be in address order
+    static_assert(kLoopedSoundAddr8 < kOneShotSoundAddr8);
+    Spu::PredecodedSound predecodedSounds[2] = {};
+
+    if (scenario.bPredecoded) {
+        Spu::initPredecodedSound(predecodedSounds[0], spu.pRam, spu.ramSize, kLoopedSoundAddr8, kSoundNumBlocks, Sample::MODE);
+        Spu::initPredecodedSound(predecodedSounds[1], spu.pRam, spu.ramSize, kOneShotSoundAddr8, kSoundNumBlocks, Sample::MODE);
+        spu.pPredecodedSounds = predecodedSounds;
+        spu.numPredecodedSounds = 2;
+    }
+
+    // Setup reverb and the external input in the same way as the plugins
+    static_assert(sizeof(Spu::ReverbRegs) == sizeof(SpuReverbPresets::SpuReverbDef));
+    std::memcpy(&spu.reverbRegs, &SpuReverbPresets::gReverbDefs[scenario.reverbMode], sizeof(Spu::ReverbRegs));
+
+    const bool bReverb = (scenario.reverbMode != SpuReverbPresets::SPU_REV_MODE_OFF);
+    spu.masterVol = { 0x3FFF, 0x3FFF };
+    spu.reverbVol = (bReverb) ? Spu::Volume{ 0x2FFF, 0x2FFF } : Spu::Volume{};
+    spu.reverbBaseAddr8 = SpuReverbPresets::gReverbWorkAreaBaseAddrs[scenario.reverbMode];
+    spu.bUnmute = true;
+    spu.bReverbWriteEnable = true;
+
+    ExtInputSource extInput = { std::mt19937(3), 0 };
+
+    if (scenario.bExtInput) {
+        spu.extInputVol = { 0x7FFF, 0x7FFF };
+        spu.bExtEnabled = true;
+        spu.bExtReverbEnable = true;
+        spu.pExtInputCallback = ExtInputSource::callback;
+        spu.pExtInputUserData = &extInput;
+    }
+
+    // Render the scenario, handling events as we go and splitting the rest of the rendering into irregular spans
+    constexpr uint32_t SPAN_SIZES[] = { 1, 3, 28, 64, 100, 441, 1024, 2000, 7 };
+
+    std::vector<Spu::BasicStereoSample<Sample>> output(scenario.numFrames);
+    size_t eventIdx = 0;
+    uint32_t spanIdx = 0;
+
+    for (uint32_t frameIdx = 0; frameIdx < scenario.numFrames;) {
+        while ((eventIdx < scenario.events.size()) && (scenario.events[eventIdx].frame <= frameIdx)) {
+            const ScenarioEvent& event = scenario.events[eventIdx++];
+            Spu::Voice& voice = spu.pVoices[event.voiceIdx];
+
+            if (event.type == ScenarioEvent::KeyOn) {
+                voice.adpcmStartAddr8 = (event.bOneShot) ? kOneShotSoundAddr8 : kLoopedSoundAddr8;
+                voice.sampleRate = event.pitch;
+                voice.volume = event.volume;
+                voice.env = event.env;
+                voice.bDisabled = false;
+                voice.bDoReverb = bReverb;
+                Spu::keyOn(voice);
+            }
+            else if (event.type == ScenarioEvent::KeyOff) {
+                Spu::keyOff(voice);
+            }
+            else {
+                voice.sampleRate = event.pitch;
+            }
+        }
+
+        uint32_t spanEndFrameIdx = std::min(frameIdx + SPAN_SIZES[spanIdx++ % std::size(SPAN_SIZES)], scenario.numFrames);
+
+        if (eventIdx < scenario.events.size()) {
+            spanEndFrameIdx = std::min(spanEndFrameIdx, scenario.events[eventIdx].frame);
+        }
+
+        Spu::renderCore(spu, output.data() + frameIdx, spanEndFrameIdx - frameIdx);
+        frameIdx = spanEndFrameIdx;
+    }
+
+    Spu::destroyCore(spu);
+
+    for (Spu::PredecodedSound& predecodedSound : predecodedSounds) {
+        Spu::destroyPredecodedSound(predecodedSound);
+    }
+    return output;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Get the results to check for rendered output: a hash (FNV-1a) of the exact output and for the float SPU, a signature of it
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static ScenarioResult getScenarioResult(const std::vector<Spu::BasicStereoSample<Sample>>& output) noexcept {
+    ScenarioResult result = { 0xCBF29CE484222325ull, {} };
+
+    const auto hashBytes = [&](const auto& value) noexcept {
+        const uint8_t* const pBytes = (const uint8_t*) &value;
+
+        for (size_t i = 0; i < sizeof(value); ++i) {
+            result.hash = (result.hash ^ pBytes[i]) * 0x100000001B3ull;
+        }
+    };
+
+    for (const Spu::BasicStereoSample<Sample>& sample : output) {
+        hashBytes(sample.left.value);
+        hashBytes(sample.right.value);
+    }
+
+    if constexpr (Sample::IS_FLOAT) {
+        for (size_t blockStart = 0; blockStart < output.size(); blockStart += kSignatureBlockSize) {
+            const size_t blockEnd = std::min(blockStart + kSignatureBlockSize, output.size());
+            double sumSqL = 0, sumSqR = 0, sumL = 0, sumR = 0;
+
+            for (size_t i = blockStart; i < blockEnd; ++i) {
+                const double left = output[i].left.value;
+                const double right = output[i].right.value;
+                sumSqL += left * left;
+                sumSqR += right * right;
+                sumL += left;
+                sumR += right;
+            }
+
+            const double numFrames = (double)(blockEnd - blockStart);
+            result.signature.push_back(std::sqrt(sumSqL / numFrames));
+            result.signature.push_back(std::sqrt(sumSqR / numFrames));
+            result.signature.push_back(sumL / numFrames);
+            result.signature.push_back(sumR / numFrames);
+        }
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Golden file reading and writing.
+// The file has one line per scenario: the scenario name, the output hash in hex and then any signature values.
+// Lines starting with '#' are comments.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static bool readGoldenFile(const char* const filePath, std::map<std::string, ScenarioResult>& resultsOut) noexcept {
+    std::FILE* const pFile = std::fopen(filePath, "r");
+
+    if (!pFile)
+        return false;
+
+    char line[8192];
+
+    while (std::fgets(line, sizeof(line), pFile)) {
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+
+        char name[256];
+        unsigned long long hash = 0;
+        int numChars = 0;
+
+        if (std::sscanf(line, "%255s %llx%n", name, &hash, &numChars) != 2)
+            continue;
+
+        ScenarioResult& result = resultsOut[name];
+        result.hash = hash;
+
+        const char* pValues = line + numChars;
+        double value = 0;
+
+        while (std::sscanf(pValues, "%lf%n", &value, &numChars) == 1) {
+            result.signature.push_back(value);
+            pValues += numChars;
+        }
+    }
+
+    std::fclose(pFile);
+    return true;
+}
+
+static bool writeGoldenFile(
+    const char* const filePath,
+    const char* const modeName,
+    const std::vector<Scenario>& scenarios,
+    const std::vector<ScenarioResult>& results
+) noexcept {
+    std::FILE* const pFile = std::fopen(filePath, "w");
+
+    if (!pFile)
+        return false;
+
+    std::fprintf(pFile, "# SPU golden output for %s mode: regenerate with 'SpuGoldenTest --mode %s --update <file>'.\n", modeName, modeName);
+    std::fprintf(pFile, "# Format: <scenario> <output hash> [<rms left> <rms right> <mean left> <mean right> for each %u frames]\n", kSignatureBlockSize);
+
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        std::fprintf(pFile, "%s %016llx", scenarios[i].name.c_str(), (unsigned long long) results[i].hash);
+
+        for (const double value : results[i].signature) {
+            std::fprintf(pFile, " %.9g", value);
+        }
+
+        std::fprintf(pFile, "\n");
+    }
+
+    std::fclose(pFile);
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compare the signatures of float SPU output within the declared tolerance.
+// Returns the index of the first value that differs by too much, or -1 if the signatures match.
+//------------------------------------------------------------------------------------------------------------------------------------------
+static int32_t compareSignatures(const std::vector<double>& actual, const std::vector<double>& expected) noexcept {
+    if (actual.size() != expected.size())
+        return 0;
+
+    for (size_t i = 0; i < actual.size(); ++i) {
+        const double maxDiff = kFloatAbsTolerance + kFloatRelTolerance * std::abs(expected[i]);
+
+        if (!(std::abs(actual[i] - expected[i]) <= maxDiff))
+            return (int32_t) i;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Write the output of a scenario to a .wav file: 16-bit PCM in 16-bit mode or 32-bit float in float mode
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static bool writeWavFile(const std::string& filePath, const std::vector<Spu::BasicStereoSample<Sample>>& output) noexcept {
+    std::FILE* const pFile = std::fopen(filePath.c_str(), "wb");
+
+    if (!pFile)
+        return false;
+
+    const auto writeU32 = [=](const uint32_t value) noexcept {
+        const uint8_t bytes[4] = { (uint8_t) value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        std::fwrite(bytes, 1, 4, pFile);
+    };
+
+    const auto writeU16 = [=](const uint16_t value) noexcept {
+        const uint8_t bytes[2] = { (uint8_t) value, (uint8_t)(value >> 8) };
+        std::fwrite(bytes, 1, 2, pFile);
+    };
+
+    const uint16_t sampleSize = (uint16_t) sizeof(Sample::value);
+    const uint32_t dataSize = (uint32_t) output.size() * sampleSize * 2;
+
+    std::fwrite("RIFF", 1, 4, pFile);
+    writeU32(36 + dataSize);
+    std::fwrite("WAVEfmt ", 1, 8, pFile);
+    writeU32(16);
+    writeU16((Sample::IS_FLOAT) ? 3 : 1);           // Format: IEEE float or PCM
+    writeU16(2);
+    writeU32(44100);
+    writeU32(44100 * sampleSize * 2);
+    writeU16(sampleSize * 2);
+    writeU16(sampleSize * 8);
+    std::fwrite("data", 1, 4, pFile);
+    writeU32(dataSize);
+
+    // Note: assumes a little endian host for the sample data
+    for (const Spu::BasicStereoSample<Sample>& sample : output) {
+        std::fwrite(&sample.left.value, sampleSize, 1, pFile);
+        std::fwrite(&sample.right.value, sampleSize, 1, pFile);
+    }
+
+    const bool bSuccess = (std::ferror(pFile) == 0);
+    std::fclose(pFile);
+    return bSuccess;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Render all of the scenarios in the sample mode for the given sample type, optionally writing .wav files of the output.
+// Returns 'false' on failure to write a .wav file.
+//------------------------------------------------------------------------------------------------------------------------------------------
+template <class Sample>
+static bool renderScenarios(const std::vector<Scenario>& scenarios, const char* const wavDir, std::vector<ScenarioResult>& resultsOut) noexcept {
+    for (const Scenario& scenario : scenarios) {
+        const std::vector<Spu::BasicStereoSample<Sample>> output = renderScenario<Sample>(scenario);
+        resultsOut.push_back(getScenarioResult(output));
+
+        if (wavDir && (!writeWavFile(std::string(wavDir) + "/" + scenario.name + ".wav", output))) {
+            std::printf("Failed to write a .wav file to '%s'!\n", wavDir);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse command line arguments
+    const char* modeName = nullptr;
+    bool bUpdate = false;
+    const char* wavDir = nullptr;
+    const char* goldenFilePath = nullptr;
+
+    for (int argIdx = 1; argIdx < argc; ++argIdx) {
+        const std::string arg = argv[argIdx];
+
+        if ((arg == "--mode") && (argIdx + 1 < argc)) {
+            modeName = argv[++argIdx];
+        } else if (arg == "--update") {
+            bUpdate = true;
+        } else if ((arg == "--wav-dir") && (argIdx + 1 < argc)) {
+            wavDir = argv[++argIdx];
+        } else if (arg[0] != '-') {
+            goldenFilePath = argv[argIdx];
+        } else {
+            goldenFilePath = nullptr;
+            break;
+        }
+    }
+
+    const bool bValidMode = modeName && ((std::strcmp(modeName, "float") == 0) || (std::strcmp(modeName, "16bit") == 0));
+
+    if ((!goldenFilePath) || (!bValidMode)) {
+        std::printf("Usage: SpuGoldenTest --mode float|16bit [--update] [--wav-dir dir] goldenFile.txt\n");
+        return 1;
+    }
+
+    const bool bFloatMode = (std::strcmp(modeName, "float") == 0);
+
+    // Render all of the scenarios
+    const std::vector<Scenario> scenarios = makeScenarios();
+    std::vector<ScenarioResult> results;
+
+    const bool bRendered = (bFloatMode) ?
+        renderScenarios<Spu::FloatSample>(scenarios, wavDir, results) :
+        renderScenarios<Spu::Int16Sample>(scenarios, wavDir, results);
+
+    if (!bRendered)
+        return 1;
+
+    if (bUpdate) {
+        if (!writeGoldenFile(goldenFilePath, modeName, scenarios, results)) {
+            std::printf("Failed to write golden file '%s'!\n", goldenFilePath);
+            return 1;
+        }
+
+        std::printf("Wrote results for %u scenarios to '%s'.\n", (unsigned) scenarios.size(), goldenFilePath);
+        return 0;
+    }
+
+    // Check against the golden file
+    std::map<std::string, ScenarioResult> goldenResults;
+
+    if (!readGoldenFile(goldenFilePath, goldenResults)) {
+        std::printf("Failed to read golden file '%s'!\n", goldenFilePath);
+        return 1;
+    }
+
+    uint32_t numFailed = 0;
+    uint32_t numWithinTolerance = 0;
+
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const std::string& name = scenarios[i].name;
+        const auto goldenIter = goldenResults.find(name);
+
+        if (goldenIter == goldenResults.end()) {
+            std::printf("FAIL: %s: no golden result\n", name.c_str());
+            numFailed++;
+            continue;
+        }
+
+        const ScenarioResult& expected = goldenIter->second;
+        const ScenarioResult& actual = results[i];
+
+        if (actual.hash == expected.hash)
+            continue;
+
+        if (bFloatMode) {
+            const int32_t diffIdx = compareSignatures(actual.signature, expected.signature);
+
+            if (diffIdx < 0) {
+                numWithinTolerance++;
+                continue;
+            }
+
+            if ((size_t) diffIdx < actual.signature.size() && (size_t) diffIdx < expected.signature.size()) {
+                std::printf(
+                    "FAIL: %s: output differs at frame %u: got %.9g, expected %.9g\n",
+                    name.c_str(),
+                    (unsigned)((diffIdx / 4) * kSignatureBlockSize),
+                    actual.signature[diffIdx],
+                    expected.signature[diffIdx]
+                );
+            } else {
+                std::printf("FAIL: %s: output length differs\n", name.c_str());
+            }
+        } else {
+            std::printf("FAIL: %s: output hash %016llx, expected %016llx\n", name.c_str(), (unsigned long long) actual.hash, (unsigned long long) expected.hash);
+        }
+
+        numFailed++;
+    }
+
+    std::printf(
+        "%u scenarios, %u failed, %u exact, %u within tolerance (%s mode)\n",
+        (unsigned) scenarios.size(),
+        numFailed,
+        (unsigned)(scenarios.size() - numFailed - numWithinTolerance),
+        numWithinTolerance,
+        modeName
+    );
+
+    return (numFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Unit tests for the SPU RAM allocator.
+//
+// Usage: SpuRamAllocTest
+//
+// Checks that allocations are rounded up to whole ADPCM blocks and placed first-fit from the heap's base address, that running out of room
+// gives 'INVALID_ADDR', that freed neighbouring ranges can be allocated again as one range, and that compacting a fragmented heap slides
+// the allocations down in order and reports exactly the ones which moved.
+//------------------------------------------------------------------------------------------------------------------------------------------
+#include "Spu.h"
+#include "SpuRamAlloc.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace SpuRamAlloc;
+
+static uint32_t gNumChecks = 0;
+static uint32_t gNumFailures = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Record the result of a check and report it if it failed
+//------------------------------------------------------------------------------------------------------------------------------------------
+#define CHECK(Condition)\
+    do {\
+        ++gNumChecks;\
+        if (!(Condition)) {\
+            ++gNumFailures;\
+            std::printf("FAIL: %s:%d: %s\n", __func__, __LINE__, #Condition);\
+        }\
+    } while (0)
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocation sizes are rounded up to whole ADPCM blocks, and the heap size is rounded down to them
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testAlignmentRounding() noexcept {
+    static_assert(Spu::ADPCM_BLOCK_SIZE == 16);
+
+    Heap heap = {};
+    initHeap(heap, 0, 1000);
+    CHECK(heap.size == 992);
+    CHECK(getNumFreeBytes(heap) == 992);
+
+    CHECK(allocate(heap, 1) == 0);
+    CHECK(allocate(heap, 17) == 16);
+    CHECK(allocate(heap, 16) == 48);
+    CHECK(allocate(heap, 15) == 64);
+
+    CHECK(heap.allocations.size() == 4);
+    CHECK(heap.allocations[0].size == 16);
+    CHECK(heap.allocations[1].size == 32);
+    CHECK(heap.allocations[2].size == 16);
+    CHECK(heap.allocations[3].size == 16);
+    CHECK(getNumFreeBytes(heap) == 992 - 80);
+
+    // Sizes which would overflow when rounded up still fail cleanly
+    CHECK(allocate(heap, UINT32_MAX) == INVALID_ADDR);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Allocations fail with 'INVALID_ADDR' (0xFFFFFFFF) when there is no free range big enough, or when nothing is asked for
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testExhaustion() noexcept {
+    CHECK(INVALID_ADDR == 0xFFFFFFFFu);
+
+    Heap heap = {};
+    initHeap(heap, 0, 256);
+    CHECK(allocate(heap, 0) == INVALID_ADDR);
+    CHECK(allocate(heap, 257) == INVALID_ADDR);
+    CHECK(heap.allocations.empty());
+
+    CHECK(allocate(heap, 240) == 0);
+    CHECK(allocate(heap, 32) == INVALID_ADDR);
+    CHECK(allocate(heap, 16) == 240);
+    CHECK(allocate(heap, 1) == INVALID_ADDR);
+    CHECK(getNumFreeBytes(heap) == 0);
+    CHECK(getLargestFreeRangeSize(heap) == 0);
+
+    // A failed allocation leaves the heap as it was
+    CHECK(heap.allocations.size() == 2);
+
+    // An empty heap can't allocate anything
+    Heap emptyHeap = {};
+    initHeap(emptyHeap, 0, 15);
+    CHECK(emptyHeap.size == 0);
+    CHECK(allocate(emptyHeap, 1) == INVALID_ADDR);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Freeing allocations: only exact allocation addresses can be freed, and neighbouring free ranges join up into one bigger range
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testDeallocate() noexcept {
+    Heap heap = {};
+    initHeap(heap, 0, 1024);
+    const uint32_t addrA = allocate(heap, 16);
+    const uint32_t addrB = allocate(heap, 16);
+    const uint32_t addrC = allocate(heap, 16);
+    CHECK((addrA == 0) && (addrB == 16) && (addrC == 32));
+
+    CHECK(!deallocate(heap, addrA + 8));
+    CHECK(!deallocate(heap, 512));
+    CHECK(!deallocate(heap, INVALID_ADDR));
+    CHECK(deallocate(heap, addrB));
+    CHECK(!deallocate(heap, addrB));
+    CHECK(deallocate(heap, addrA));
+    CHECK(heap.allocations.size() == 1);
+
+    // The two freed ranges are now one range at the start of the heap, which is the first fit
+    CHECK(getLargestFreeRangeSize(heap) == 1024 - 48);
+    CHECK(allocate(heap, 32) == 0);
+    CHECK(allocate(heap, 16) == 48);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// Compacting a fragmented heap slides allocations down in address order and reports the ones that moved
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testFragmentationAndCompact() noexcept {
+    Heap heap = {};
+    initHeap(heap, 0, 160);
+    const uint32_t addrA = allocate(heap, 32);
+    const uint32_t addrB = allocate(heap, 32);
+    const uint32_t addrC = allocate(heap, 16);
+    const uint32_t addrD = allocate(heap, 48);
+    const uint32_t addrE = allocate(heap, 32);
+    CHECK((addrA == 0) && (addrB == 32) && (addrC == 64) && (addrD == 80) && (addrE == 128));
+    CHECK(getNumFreeBytes(heap) == 0);
+
+    // Free space is split into a 32 byte range and a 16 byte range, so a 48 byte allocation doesn't fit until the heap is compacted
+    CHECK(deallocate(heap, addrA));
+    CHECK(deallocate(heap, addrC));
+    CHECK(getNumFreeBytes(heap) == 48);
+    CHECK(getLargestFreeRangeSize(heap) == 32);
+    CHECK(allocate(heap, 48) == INVALID_ADDR);
+
+    std::vector<Relocation> relocations;
+    compact(heap, relocations);
+    CHECK(relocations.size() == 3);
+
+    if (relocations.size() == 3) {
+        CHECK((relocations[0].oldAddr == addrB) && (relocations[0].newAddr == 0));
+        CHECK((relocations[1].oldAddr == addrD) && (relocations[1].newAddr == 32));
+        CHECK((relocations[2].oldAddr == addrE) && (relocations[2].newAddr == 80));
+    }
+
+    CHECK(heap.allocations.size() == 3);
+
+    if (heap.allocations.size() == 3) {
+        CHECK((heap.allocations[0].addr == 0) && (heap.allocations[0].size == 32));
+        CHECK((heap.allocations[1].addr == 32) && (heap.allocations[1].size == 48));
+        CHECK((heap.allocations[2].addr == 80) && (heap.allocations[2].size == 32));
+    }
+
+    CHECK(getLargestFreeRangeSize(heap) == 48);
+    CHECK(allocate(heap, 48) == 112);
+
+    // Compacting a heap with no gaps moves nothing, and the relocation list is cleared of any previous results
+    compact(heap, relocations);
+    CHECK(relocations.empty());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------
+// A heap which doesn't start at address 0 only hands out addresses in it's own range, and compacts down to it's base address
+//------------------------------------------------------------------------------------------------------------------------------------------
+static void testHeapBaseOffset() noexcept {
+    constexpr uint32_t baseAddr = 0x1010;
+
+    Heap heap = {};
+    initHeap(heap, baseAddr, 64);
+    CHECK(allocate(heap, 16) == baseAddr);
+    CHECK(allocate(heap, 32) == baseAddr + 16);
+    CHECK(allocate(heap, 16) == baseAddr + 48);
+    CHECK(allocate(heap, 16) == INVALID_ADDR);
+
+    // The freed range at the base address is the first fit again
+    CHECK(deallocate(heap, baseAddr));
+    CHECK(getLargestFreeRangeSize(heap) == 16);
+    CHECK(allocate(heap, 16) == baseAddr);
+
+    // Compacting moves allocations down to the base address, not to 0
+    CHECK(deallocate(heap, baseAddr));
+    std::vector<Relocation> relocations;
+    compact(heap, relocations);
+    CHECK(relocations.size() == 2);
+
+    if (relocations.size() == 2) {
+        CHECK((relocations[0].oldAddr == baseAddr + 16) && (relocations[0].newAddr == baseAddr));
+        CHECK((relocations[1].oldAddr == baseAddr + 48) && (relocations[1].newAddr == baseAddr + 32));
+    }
+
+    CHECK(allocate(heap, 16) == baseAddr + 48);
+}
+
+int main() {
+    testAlignmentRounding();
+    testExhaustion();
+    testDeallocate();
+    testFragmentationAndCompact();
+    testHeapBaseOffset();
+
+    std::printf("%u of %u checks passed.\n", gNumChecks - gNumFailures, gNumChecks);
+    return (gNumFailures == 0) ? 0 : 1;
+}